@@ -0,0 +1,70 @@
+// Copyright (c) 2018 The Monacoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <alert.h>
+#include <hash.h>
+#include <key.h>
+#include <pubkey.h>
+#include <streams.h>
+#include <timedata.h>
+#include <version.h>
+
+// The private keys matching the chain's alert keys are not available, so
+// alerts here are signed by a freshly generated key. ProcessAlert() then
+// runs the path every unsolicited alert from a peer takes: both signature
+// checks fail and the alert is dropped. CheckSignature() against the
+// signing key measures the verification and decoding of a valid alert.
+
+static CAlert MakeBenchAlert(const CKey& key)
+{
+    CUnsignedAlert alert;
+    alert.SetNull();
+    alert.nVersion = 1;
+    alert.nRelayUntil = GetAdjustedTime() + 24 * 60 * 60;
+    alert.nExpiration = GetAdjustedTime() + 24 * 60 * 60;
+    alert.nID = 1;
+    alert.nCancel = 0;
+    alert.nMinVer = 0;
+    alert.nMaxVer = 999999;
+    alert.nPriority = 1;
+    alert.strComment = "Benchmark alert";
+    alert.strStatusBar = "Benchmark alert";
+
+    CAlert signedAlert;
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << alert;
+    signedAlert.vchMsg.assign(ss.begin(), ss.end());
+    assert(key.Sign(Hash(signedAlert.vchMsg.begin(), signedAlert.vchMsg.end()), signedAlert.vchSig));
+    return signedAlert;
+}
+
+static void CAlert_ProcessAlert_Untrusted(benchmark::State& state)
+{
+    ECCVerifyHandle verifyHandle;
+    CKey key;
+    key.MakeNewKey(false);
+    const CAlert alert = MakeBenchAlert(key);
+    while (state.KeepRunning()) {
+        CAlert copy(alert);
+        assert(!copy.ProcessAlert(false));
+    }
+}
+
+static void CAlert_CheckSignature(benchmark::State& state)
+{
+    ECCVerifyHandle verifyHandle;
+    CKey key;
+    key.MakeNewKey(false);
+    const CPubKey pubkey = key.GetPubKey();
+    const std::vector<unsigned char> vchPubKey(pubkey.begin(), pubkey.end());
+    const CAlert alert = MakeBenchAlert(key);
+    while (state.KeepRunning()) {
+        CAlert copy(alert);
+        assert(copy.CheckSignature(vchPubKey));
+    }
+}
+
+BENCHMARK(CAlert_ProcessAlert_Untrusted, 6000);
+BENCHMARK(CAlert_CheckSignature, 12 * 1000);
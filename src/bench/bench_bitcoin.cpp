@@ -4,7 +4,9 @@
 
 #include <bench/bench.h>
 
+#include <chainparams.h>
 #include <crypto/sha256.h>
+#include <crypto/Lyra2RE/Lyra2RE.h>
 #include <key.h>
 #include <validation.h>
 #include <util.h>
@@ -43,10 +45,18 @@ main(int argc, char** argv)
     }
 
     SHA256AutoDetect();
+    lyra2re2_autodetect();
     RandomInit();
     ECC_Start();
     SetupEnvironment();
     fPrintToDebugLog = false; // don't want to write to debug.log file
+    SelectParams(CBaseChainParams::MAIN);
+
+    // Benchmarks that touch disk (block files, the user checkpoint database)
+    // work in a scratch data directory.
+    fs::path data_dir = fs::temp_directory_path() / strprintf("bench_monacoin_%lu_%i", (unsigned long)GetTime(), (int)GetRand(100000));
+    fs::create_directories(data_dir);
+    gArgs.ForceSetArg("-datadir", data_dir.string());
 
     int64_t evaluations = gArgs.GetArg("-evals", DEFAULT_BENCH_EVALUATIONS);
     std::string regex_filter = gArgs.GetArg("-filter", DEFAULT_BENCH_FILTER);
@@ -67,5 +77,7 @@ main(int argc, char** argv)
 
     benchmark::BenchRunner::RunAll(*printer, evaluations, scaling_factor, regex_filter, is_list_only);
 
+    fs::remove_all(data_dir);
+
     ECC_Stop();
 }
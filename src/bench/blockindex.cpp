@@ -0,0 +1,110 @@
+// Copyright (c) 2018 The Monacoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <chain.h>
+#include <chainparams.h>
+#include <random.h>
+#include <txdb.h>
+#include <validation.h>
+
+#include <memory>
+#include <vector>
+
+// Reading the block index at startup, from a synthetic chain of 50000
+// entries in an in-memory block tree database. This leaves out reading a
+// real index from disk, so it is no measure of startup time on mainnet.
+static const int BLOCK_INDEX_BENCH_ENTRIES = 50000;
+
+static std::unique_ptr<CBlockTreeDB> WriteBlockIndex()
+{
+    FastRandomContext rng(true);
+    std::vector<std::unique_ptr<CBlockIndex>> vIndex;
+    std::vector<std::unique_ptr<uint256>> vHashes;
+    std::vector<const CBlockIndex*> vBlocks;
+    CBlockIndex* pprev = nullptr;
+    for (int i = 0; i < BLOCK_INDEX_BENCH_ENTRIES; i++) {
+        vIndex.emplace_back(new CBlockIndex());
+        CBlockIndex* pindex = vIndex.back().get();
+        pindex->pprev = pprev;
+        pindex->nHeight = i;
+        pindex->nVersion = 0x20000000;
+        pindex->hashMerkleRoot = rng.rand256();
+        pindex->nTime = 1388880000 + i * 90;
+        pindex->nBits = 0x1e0ffff0;
+        pindex->nNonce = rng.rand32();
+        pindex->nStatus = BLOCK_VALID_TREE;
+        pindex->nTx = 1 + rng.randrange(1000);
+        vHashes.emplace_back(new uint256(pindex->GetBlockHeader().GetHash()));
+        pindex->phashBlock = vHashes.back().get();
+        vBlocks.push_back(pindex);
+        pprev = pindex;
+    }
+    std::unique_ptr<CBlockTreeDB> blocktree(new CBlockTreeDB(1 << 20, true, true));
+    bool fWritten = blocktree->WriteBatchSync({}, 0, vBlocks);
+    assert(fWritten);
+    return blocktree;
+}
+
+// The entries read into a CBlockIndexArena, as CChainState does, and into
+// entries allocated one by one, as they were before it. One thread, so that
+// the allocation is what differs.
+static void BlockIndexLoadGuts(benchmark::State& state, bool fArena)
+{
+    std::unique_ptr<CBlockTreeDB> blocktree = WriteBlockIndex();
+    const Consensus::Params& consensus = Params().GetConsensus();
+
+    while (state.KeepRunning()) {
+        BlockMap mapIndex;
+        CBlockIndexArena arena;
+        auto insert = [&](const uint256& hash) -> CBlockIndex* {
+            if (hash.IsNull())
+                return nullptr;
+            BlockMap::iterator mi = mapIndex.find(hash);
+            if (mi != mapIndex.end())
+                return mi->second;
+            CBlockIndex* pindexNew = fArena ? arena.Allocate() : new CBlockIndex();
+            mi = mapIndex.insert(std::make_pair(hash, pindexNew)).first;
+            pindexNew->phashBlock = &mi->first;
+            return pindexNew;
+        };
+        bool fLoaded = blocktree->LoadBlockIndexGuts(consensus, insert, 1);
+        assert(fLoaded && mapIndex.size() == (size_t)BLOCK_INDEX_BENCH_ENTRIES);
+        if (!fArena) {
+            for (const auto& entry : mapIndex) {
+                delete entry.second;
+            }
+        }
+    }
+}
+
+static void BlockIndexLoadArena(benchmark::State& state)
+{
+    BlockIndexLoadGuts(state, true);
+}
+
+static void BlockIndexLoadHeap(benchmark::State& state)
+{
+    BlockIndexLoadGuts(state, false);
+}
+
+// All of LoadBlockIndex(): reading the entries, then the chain work, the
+// skip pointers and the candidate tips.
+static void BlockIndexLoadStartup(benchmark::State& state)
+{
+    pblocktree = WriteBlockIndex();
+
+    while (state.KeepRunning()) {
+        UnloadBlockIndex();
+        LOCK(cs_main);
+        bool fLoaded = LoadBlockIndex(Params());
+        assert(fLoaded && mapBlockIndex.size() == (size_t)BLOCK_INDEX_BENCH_ENTRIES);
+    }
+    UnloadBlockIndex();
+    pblocktree.reset();
+}
+
+BENCHMARK(BlockIndexLoadArena, 1);
+BENCHMARK(BlockIndexLoadHeap, 1);
+BENCHMARK(BlockIndexLoadStartup, 1);
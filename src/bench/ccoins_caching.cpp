@@ -5,6 +5,7 @@
 #include <bench/bench.h>
 #include <coins.h>
 #include <policy/policy.h>
+#include <random.h>
 #include <wallet/crypter.h>
 
 #include <vector>
@@ -84,4 +85,54 @@ static void CCoinsCaching(benchmark::State& state)
     }
 }
 
+// Input lookups on a cache holding as many coins as a few hundred MiB of
+// -dbcache do, so that most of them miss the CPU caches like they do during
+// the initial block download.
+static void CCoinsCachingLarge(benchmark::State& state)
+{
+    static const size_t NUM_COINS = 1000 * 1000;
+    static const size_t NUM_TXS = 100 * 1000;
+    FastRandomContext rng(true);
+    CCoinsView coinsDummy;
+    CCoinsViewCache coins(&coinsDummy);
+
+    // Fill the cache the way a child cache is flushed into it, which leaves
+    // out the UTXO set commitment
+    std::vector<COutPoint> outpoints;
+    outpoints.reserve(NUM_COINS);
+    while (outpoints.size() < NUM_COINS) {
+        CCoinsMap map;
+        for (int i = 0; i < 1000; i++) {
+            outpoints.emplace_back(rng.rand256(), rng.randrange(4));
+            CScript script = CScript() << OP_DUP << OP_HASH160 << rng.randbytes(20) << OP_EQUALVERIFY << OP_CHECKSIG;
+            CCoinsCacheEntry& entry = map[outpoints.back()];
+            entry.coin = Coin(CTxOut(1 + rng.randrange(50 * COIN), script), 1 + rng.randrange(1000000), false);
+            entry.flags = CCoinsCacheEntry::DIRTY | CCoinsCacheEntry::FRESH;
+        }
+        coins.BatchWrite(map, uint256(), CUTXOCommitment());
+    }
+
+    // Transactions spending four random coins each
+    std::vector<CTransaction> txs;
+    txs.reserve(NUM_TXS);
+    for (size_t i = 0; i < NUM_TXS; i++) {
+        CMutableTransaction mtx;
+        mtx.vin.resize(4);
+        for (CTxIn& txin : mtx.vin) {
+            txin.prevout = outpoints[rng.randrange(NUM_COINS)];
+        }
+        txs.emplace_back(mtx);
+    }
+
+    size_t n = 0;
+    while (state.KeepRunning()) {
+        const CTransaction& tx = txs[n++ % NUM_TXS];
+        bool success = coins.HaveInputs(tx);
+        assert(success);
+        CAmount value = coins.GetValueIn(tx);
+        assert(value > 0);
+    }
+}
+
 BENCHMARK(CCoinsCaching, 170 * 1000);
+BENCHMARK(CCoinsCachingLarge, 2 * 1000 * 1000);
@@ -4,7 +4,11 @@
 
 #include <bench/bench.h>
 
+#include <arith_uint256.h>
+#include <chain.h>
 #include <chainparams.h>
+#include <clientversion.h>
+#include <pow.h>
 #include <validation.h>
 #include <streams.h>
 #include <consensus/validation.h>
@@ -55,5 +59,89 @@ static void DeserializeAndCheckBlockTest(benchmark::State& state)
     }
 }
 
+// Reading the block back from a block file, as done when connecting blocks
+// and serving them to peers.
+
+static const int BENCH_BLOCK_HEIGHT = 878439;
+
+/** Write the benchmark block to a block file in the data directory. */
+static CDiskBlockPos WriteBenchBlock(const CBlock& block)
+{
+    CDiskBlockPos pos(0, 0);
+    CAutoFile fileout(OpenBlockFile(pos), SER_DISK, CLIENT_VERSION);
+    assert(!fileout.IsNull());
+    unsigned int nSize = GetSerializeSize(fileout, block);
+    fileout << FLATDATA(Params().MessageStart()) << nSize;
+    pos.nPos = (unsigned int)ftell(fileout.Get());
+    fileout << block;
+    return pos;
+}
+
+/** The benchmark block, with its header re-mined against the Lyra2REv2 PoW
+ *  limit: it predates the switch from scrypt, so its own PoW does not pass
+ *  the checks for its height. */
+static CBlock ReadBenchBlock()
+{
+    CDataStream stream((const char*)block_bench::block413567,
+            (const char*)&block_bench::block413567[sizeof(block_bench::block413567)],
+            SER_NETWORK, PROTOCOL_VERSION);
+    CBlock block;
+    stream >> block;
+
+    const Consensus::Params& params = Params().GetConsensus();
+    block.nBits = UintToArith256(params.powLimit).GetCompact();
+    while (!CheckProofOfWork(block.GetPoWHash(true), block.nBits, BENCH_BLOCK_HEIGHT, params)) {
+        ++block.nNonce;
+    }
+    return block;
+}
+
+// Includes re-hashing the Lyra2REv2 proof of work of the header.
+static void ReadBlockFromDiskTest(benchmark::State& state)
+{
+    const CDiskBlockPos pos = WriteBenchBlock(ReadBenchBlock());
+
+    while (state.KeepRunning()) {
+        CBlock block;
+        assert(ReadBlockFromDisk(block, pos, BENCH_BLOCK_HEIGHT, Params().GetConsensus()));
+    }
+}
+
+// The same read through a block index entry for a validated header, which
+// only ties the data to the header hash.
+static void ReadBlockFromDiskIndexTest(benchmark::State& state)
+{
+    const CBlock benchBlock = ReadBenchBlock();
+    const CDiskBlockPos pos = WriteBenchBlock(benchBlock);
+    const uint256 hash = benchBlock.GetHash();
+
+    CBlockIndex index(benchBlock.GetBlockHeader());
+    index.phashBlock = &hash;
+    index.nHeight = BENCH_BLOCK_HEIGHT;
+    index.nFile = pos.nFile;
+    index.nDataPos = pos.nPos;
+    index.nStatus = BLOCK_VALID_TREE | BLOCK_HAVE_DATA;
+
+    while (state.KeepRunning()) {
+        CBlock block;
+        assert(ReadBlockFromDisk(block, &index, Params().GetConsensus()));
+    }
+}
+
+// The serialized bytes only, as served to peers that want witness data,
+// reusing one buffer.
+static void ReadRawBlockFromDiskTest(benchmark::State& state)
+{
+    const CDiskBlockPos pos = WriteBenchBlock(ReadBenchBlock());
+
+    std::vector<uint8_t> blockData;
+    while (state.KeepRunning()) {
+        assert(ReadRawBlockFromDisk(blockData, pos, Params().MessageStart()));
+    }
+}
+
 BENCHMARK(DeserializeBlockTest, 130);
 BENCHMARK(DeserializeAndCheckBlockTest, 160);
+BENCHMARK(ReadBlockFromDiskTest, 110);
+BENCHMARK(ReadBlockFromDiskIndexTest, 130);
+BENCHMARK(ReadRawBlockFromDiskTest, 1000);
@@ -0,0 +1,57 @@
+// Copyright (c) 2018 The Monacoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <coins.h>
+#include <random.h>
+#include <script/script.h>
+
+#include <unordered_map>
+#include <vector>
+
+// The coins cache's use of its map while connecting blocks: look up coins
+// that are mostly not there yet, add them, look them up again and erase
+// them as they are flushed. CCoinsMap is compared with the
+// std::unordered_map it replaced.
+template <typename Map>
+static void CoinsMapOperations(benchmark::State& state)
+{
+    FastRandomContext rng(true);
+    std::vector<COutPoint> vOutpoints;
+    for (int i = 0; i < 20000; i++) {
+        vOutpoints.emplace_back(rng.rand256(), rng.randrange(4));
+    }
+    CCoinsCacheEntry entry;
+    entry.coin = Coin(CTxOut(1000, CScript() << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, 1) << OP_EQUALVERIFY << OP_CHECKSIG), 1, false);
+    entry.flags = CCoinsCacheEntry::DIRTY | CCoinsCacheEntry::FRESH;
+
+    while (state.KeepRunning()) {
+        Map map;
+        size_t nFound = 0;
+        for (const COutPoint& outpoint : vOutpoints) {
+            nFound += map.count(outpoint);
+            map.emplace(outpoint, entry);
+        }
+        for (const COutPoint& outpoint : vOutpoints) {
+            nFound += map.find(outpoint) != map.end();
+        }
+        for (auto it = map.begin(); it != map.end();) {
+            it = map.erase(it);
+        }
+        assert(nFound == vOutpoints.size());
+    }
+}
+
+static void CoinsMapFlat(benchmark::State& state)
+{
+    CoinsMapOperations<CCoinsMap>(state);
+}
+
+static void CoinsMapUnordered(benchmark::State& state)
+{
+    CoinsMapOperations<std::unordered_map<COutPoint, CCoinsCacheEntry, SaltedOutpointHasher>>(state);
+}
+
+BENCHMARK(CoinsMapFlat, 50);
+BENCHMARK(CoinsMapUnordered, 50);
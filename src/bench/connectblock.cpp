@@ -0,0 +1,83 @@
+// Copyright (c) 2018 The Monacoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+
+#include <coins.h>
+#include <primitives/block.h>
+#include <script/script.h>
+#include <streams.h>
+#include <utxocommitment.h>
+#include <validation.h>
+#include <version.h>
+
+#include <set>
+
+namespace block_bench {
+#include <bench/data/block413567.raw.h>
+} // namespace block_bench
+
+/** A view of an empty UTXO set whose commitment is known. */
+class CCoinsViewEmptyCommitment : public CCoinsView
+{
+public:
+    bool GetCommitment(CUTXOCommitment& commitment) const override
+    {
+        commitment = CUTXOCommitment();
+        return true;
+    }
+};
+
+// The coin updates of connecting the benchmark block (3808 transactions) to a
+// cache on top of one with the coins it spends, as ConnectBlock() does when
+// connecting the tip (tracking the UTXO set commitment) and when checking a
+// block template or mempool transactions (not tracking it).
+static void ConnectBlockCoins(benchmark::State& state, bool fTrackCommitment)
+{
+    CDataStream stream((const char*)block_bench::block413567,
+            (const char*)&block_bench::block413567[sizeof(block_bench::block413567)],
+            SER_NETWORK, PROTOCOL_VERSION);
+    CBlock block;
+    stream >> block;
+
+    std::set<uint256> setBlockTxids;
+    for (const auto& tx : block.vtx) {
+        setBlockTxids.insert(tx->GetHash());
+    }
+    CCoinsViewEmptyCommitment viewEmpty;
+    CCoinsViewCache base(&viewEmpty, true);
+    for (const auto& tx : block.vtx) {
+        if (tx->IsCoinBase()) continue;
+        for (const CTxIn& txin : tx->vin) {
+            if (!setBlockTxids.count(txin.prevout.hash)) {
+                base.AddCoin(txin.prevout, Coin(CTxOut(1000, CScript() << OP_TRUE), 1, false), true);
+            }
+        }
+    }
+    CUTXOCommitment commitment;
+    bool fHaveCommitment = base.GetCommitment(commitment);
+    assert(fHaveCommitment);
+
+    while (state.KeepRunning()) {
+        CCoinsViewCache view(&base, fTrackCommitment);
+        for (const auto& tx : block.vtx) {
+            UpdateCoins(*tx, view, 2);
+        }
+        fHaveCommitment = view.GetCommitment(commitment);
+        assert(fHaveCommitment == fTrackCommitment);
+    }
+}
+
+static void ConnectBlockCoinsTracked(benchmark::State& state)
+{
+    ConnectBlockCoins(state, true);
+}
+
+static void ConnectBlockCoinsUntracked(benchmark::State& state)
+{
+    ConnectBlockCoins(state, false);
+}
+
+BENCHMARK(ConnectBlockCoinsTracked, 2);
+BENCHMARK(ConnectBlockCoinsUntracked, 100);
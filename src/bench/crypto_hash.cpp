@@ -52,6 +52,47 @@ static void SHA256_32b(benchmark::State& state)
     }
 }
 
+/* Run a benchmark with SHA256AutoDetect() restricted to the given
+ * implementations, falling back to whatever subset the CPU supports. */
+template<typename Fn>
+static void WithSHA256Implementation(benchmark::State& state, sha256_implementation::UseImplementation impl, Fn fn)
+{
+    SHA256AutoDetect(impl);
+    fn(state);
+    SHA256AutoDetect();
+}
+
+static void SHA256_32b_Impl(benchmark::State& state)
+{
+    std::vector<uint8_t> in(32,0);
+    while (state.KeepRunning()) {
+        CSHA256()
+            .Write(in.data(), in.size())
+            .Finalize(in.data());
+    }
+}
+
+static void SHA256D64_1024_Impl(benchmark::State& state)
+{
+    std::vector<uint8_t> in(64 * 1024, 0);
+    while (state.KeepRunning()) {
+        SHA256D64(in.data(), in.data(), 1024);
+    }
+}
+
+static const sha256_implementation::UseImplementation SHA256_AVX2 = sha256_implementation::UseImplementation(sha256_implementation::USE_SSE4 | sha256_implementation::USE_AVX2);
+static const sha256_implementation::UseImplementation SHA256_SHANI = sha256_implementation::UseImplementation(sha256_implementation::USE_SSE4 | sha256_implementation::USE_SHANI);
+
+static void SHA256_32b_STANDARD(benchmark::State& state) { WithSHA256Implementation(state, sha256_implementation::STANDARD, SHA256_32b_Impl); }
+static void SHA256_32b_SSE4(benchmark::State& state) { WithSHA256Implementation(state, sha256_implementation::USE_SSE4, SHA256_32b_Impl); }
+static void SHA256_32b_AVX2(benchmark::State& state) { WithSHA256Implementation(state, SHA256_AVX2, SHA256_32b_Impl); }
+static void SHA256_32b_SHANI(benchmark::State& state) { WithSHA256Implementation(state, SHA256_SHANI, SHA256_32b_Impl); }
+
+static void SHA256D64_1024_STANDARD(benchmark::State& state) { WithSHA256Implementation(state, sha256_implementation::STANDARD, SHA256D64_1024_Impl); }
+static void SHA256D64_1024_SSE4(benchmark::State& state) { WithSHA256Implementation(state, sha256_implementation::USE_SSE4, SHA256D64_1024_Impl); }
+static void SHA256D64_1024_AVX2(benchmark::State& state) { WithSHA256Implementation(state, SHA256_AVX2, SHA256D64_1024_Impl); }
+static void SHA256D64_1024_SHANI(benchmark::State& state) { WithSHA256Implementation(state, SHA256_SHANI, SHA256D64_1024_Impl); }
+
 static void SHA512(benchmark::State& state)
 {
     uint8_t hash[CSHA512::OUTPUT_SIZE];
@@ -93,6 +134,14 @@ BENCHMARK(SHA256, 340);
 BENCHMARK(SHA512, 330);
 
 BENCHMARK(SHA256_32b, 4700 * 1000);
+BENCHMARK(SHA256_32b_STANDARD, 4700 * 1000);
+BENCHMARK(SHA256_32b_SSE4, 4700 * 1000);
+BENCHMARK(SHA256_32b_AVX2, 4700 * 1000);
+BENCHMARK(SHA256_32b_SHANI, 4700 * 1000);
+BENCHMARK(SHA256D64_1024_STANDARD, 7400);
+BENCHMARK(SHA256D64_1024_SSE4, 7400);
+BENCHMARK(SHA256D64_1024_AVX2, 7400);
+BENCHMARK(SHA256D64_1024_SHANI, 7400);
 BENCHMARK(SipHash_32b, 40 * 1000 * 1000);
 BENCHMARK(FastRandom_32bit, 110 * 1000 * 1000);
 BENCHMARK(FastRandom_1bit, 440 * 1000 * 1000);
@@ -0,0 +1,36 @@
+// Copyright (c) 2018 The Monacoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <uint256.h>
+
+extern "C" {
+#include <crypto/Lyra2RE/Lyra2.h>
+}
+
+// Lyra2REv2 parameters: 32-byte key, password and salt, T=1, 4x4 matrix.
+// The two cases differ only in where the memory matrix lives, so their
+// difference is the per-hash cost of allocating it.
+
+static void LYRA2_Alloc(benchmark::State& state)
+{
+    uint256 in, out;
+    while (state.KeepRunning()) {
+        LYRA2(out.begin(), 32, in.begin(), 32, in.begin(), 32, 1, 4, 4);
+        in = out;
+    }
+}
+
+static void LYRA2_Scratchpad(benchmark::State& state)
+{
+    uint256 in, out;
+    char scratchpad[LYRA2_SCRATCHPAD_SIZE(4, 4)];
+    while (state.KeepRunning()) {
+        LYRA2_sp(out.begin(), 32, in.begin(), 32, in.begin(), 32, 1, 4, 4, scratchpad);
+        in = out;
+    }
+}
+
+BENCHMARK(LYRA2_Alloc, 470 * 1000);
+BENCHMARK(LYRA2_Scratchpad, 600 * 1000);
@@ -0,0 +1,87 @@
+// Copyright (c) 2018 The Monacoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <arith_uint256.h>
+#include <chain.h>
+#include <chainparams.h>
+#include <pow.h>
+#include <random.h>
+
+#include <vector>
+
+// Retargeting over a synthetic chain: one week of 90 second blocks (the
+// KGW PastBlocksMax window) plus headroom, with jittered timestamps and
+// targets scattered around a fixed difficulty.
+
+static const int CHAIN_LENGTH = 7 * 24 * 60 * 60 / 90 + 2000;
+
+namespace {
+struct BenchChain
+{
+    std::vector<CBlockIndex> blocks;
+    std::vector<uint256> hashes;
+
+    explicit BenchChain(int nLength) : blocks(nLength), hashes(nLength)
+    {
+        FastRandomContext rng(true);
+        arith_uint256 bnBase;
+        bnBase.SetCompact(0x1b0404cb);
+        int64_t nTime = 1500000000;
+        for (int i = 0; i < nLength; i++) {
+            hashes[i] = rng.rand256();
+            blocks[i].phashBlock = &hashes[i];
+            blocks[i].pprev = i ? &blocks[i - 1] : nullptr;
+            blocks[i].nHeight = i;
+            nTime += 30 + rng.randrange(120);
+            blocks[i].nTime = nTime;
+            arith_uint256 bnTarget = (bnBase >> 4) * (8 + rng.randrange(16));
+            blocks[i].nBits = bnTarget.GetCompact();
+        }
+    }
+};
+} // namespace
+
+static void Retarget_KGW(benchmark::State& state)
+{
+    const auto chainParams = CreateChainParams(CBaseChainParams::MAIN);
+    const Consensus::Params& params = chainParams->GetConsensus();
+    const uint64_t nSpacing = params.nPowTargetSpacing;
+    const uint64_t PastBlocksMin = 60 * 60 * 24 * 0.25 / nSpacing;
+    const uint64_t PastBlocksMax = 60 * 60 * 24 * 7 / nSpacing;
+    BenchChain chain(CHAIN_LENGTH);
+    int i = 0;
+    while (state.KeepRunning()) {
+        const CBlockIndex* pindex = &chain.blocks[PastBlocksMax + i];
+        KimotoGravityWell(pindex, nullptr, nSpacing, PastBlocksMin, PastBlocksMax, params);
+        i = (i + 1) % (CHAIN_LENGTH - PastBlocksMax);
+    }
+}
+
+static void Retarget_DGW(benchmark::State& state)
+{
+    const auto chainParams = CreateChainParams(CBaseChainParams::MAIN);
+    BenchChain chain(CHAIN_LENGTH);
+    int i = 0;
+    while (state.KeepRunning()) {
+        DarkGravityWave(&chain.blocks[100 + i], nullptr, chainParams->GetConsensus());
+        i = (i + 1) % (CHAIN_LENGTH - 100);
+    }
+}
+
+// The same DGW retarget through GetNextWorkRequired() with the active chain
+// parameters, as called during header and block validation.
+static void GetNextWorkRequired_DGW(benchmark::State& state)
+{
+    BenchChain chain(CHAIN_LENGTH);
+    int i = 0;
+    while (state.KeepRunning()) {
+        GetNextWorkRequired(&chain.blocks[100 + i % 1000], nullptr, Params().GetConsensus());
+        i++;
+    }
+}
+
+BENCHMARK(Retarget_KGW, 1000);
+BENCHMARK(Retarget_DGW, 300 * 1000);
+BENCHMARK(GetNextWorkRequired_DGW, 300 * 1000);
@@ -0,0 +1,100 @@
+// Copyright (c) 2018 The Monacoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <crypto/Lyra2RE/Lyra2RE.h>
+#include <crypto/scrypt.h>
+#include <primitives/block.h>
+#include <streams.h>
+#include <version.h>
+
+#include <assert.h>
+#include <string.h>
+#include <vector>
+
+// The proof-of-work functions are always applied to a serialized 80-byte
+// block header. Each iteration feeds the previous hash back into the
+// header so that successive calls cannot be folded together.
+
+static std::vector<char> BenchHeader()
+{
+    CBlockHeader header;
+    header.nVersion = 0x20000000;
+    header.nTime = 1514764800;
+    header.nBits = 0x1b0404cb;
+    header.nNonce = 0x12345678;
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << header;
+    assert(ss.size() == 80);
+    return std::vector<char>(ss.begin(), ss.end());
+}
+
+static void POW_Lyra2REv2(benchmark::State& state)
+{
+    std::vector<char> header = BenchHeader();
+    char hash[32];
+    while (state.KeepRunning()) {
+        lyra2re2_hash(header.data(), hash);
+        memcpy(header.data() + 4, hash, 32);
+    }
+}
+
+static void POW_Lyra2REv2_Batch(benchmark::State& state)
+{
+    // Hash 64 headers per iteration, using the vector lanes when available.
+    static const size_t HEADERS = 64;
+    std::vector<char> headers;
+    for (size_t i = 0; i < HEADERS; ++i) {
+        std::vector<char> header = BenchHeader();
+        header[76] = i;
+        headers.insert(headers.end(), header.begin(), header.end());
+    }
+    std::vector<char> hashes(32 * HEADERS);
+    while (state.KeepRunning()) {
+        lyra2re2_hash_batch(headers.data(), hashes.data(), HEADERS);
+        for (size_t i = 0; i < HEADERS; ++i) {
+            memcpy(headers.data() + 80 * i + 4, hashes.data() + 32 * i, 32);
+        }
+    }
+}
+
+static void POW_Lyra2REv2_Nonces(benchmark::State& state)
+{
+    // Hash 64 consecutive nonces of one header per iteration, as the
+    // generate RPCs do, sharing the Blake256 midstate.
+    static const size_t NONCES = 64;
+    std::vector<char> header = BenchHeader();
+    std::vector<char> hashes(32 * NONCES);
+    uint32_t nonce = 0;
+    while (state.KeepRunning()) {
+        lyra2re2_hash_nonces(header.data(), nonce, hashes.data(), NONCES);
+        nonce += NONCES;
+    }
+}
+
+static void POW_Lyra2RE(benchmark::State& state)
+{
+    std::vector<char> header = BenchHeader();
+    char hash[32];
+    while (state.KeepRunning()) {
+        lyra2re_hash(header.data(), hash);
+        memcpy(header.data() + 4, hash, 32);
+    }
+}
+
+static void POW_Scrypt(benchmark::State& state)
+{
+    std::vector<char> header = BenchHeader();
+    char hash[32];
+    while (state.KeepRunning()) {
+        scrypt_1024_1_1_256(header.data(), hash);
+        memcpy(header.data() + 4, hash, 32);
+    }
+}
+
+BENCHMARK(POW_Lyra2REv2, 100 * 1000);
+BENCHMARK(POW_Lyra2REv2_Batch, 1600);
+BENCHMARK(POW_Lyra2REv2_Nonces, 1600);
+BENCHMARK(POW_Lyra2RE, 20 * 1000);
+BENCHMARK(POW_Scrypt, 8000);
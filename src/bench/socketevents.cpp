@@ -0,0 +1,76 @@
+// Copyright (c) 2018 The Monacoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <random.h>
+#include <socketevents.h>
+#include <util.h>
+
+#include <assert.h>
+#include <vector>
+
+#ifndef WIN32
+
+// A few of many idle connections get a message each round, as on a node with
+// many peers. The cost of waiting should grow with the ready sockets, not
+// with all of them.
+static void SocketEvents(benchmark::State& state, CSocketEvents::Mode mode, int nPairs)
+{
+    static const int READY_PER_ROUND = 8;
+
+    if (RaiseFileDescriptorLimit(2 * nPairs + 64) < 2 * nPairs + 64) {
+        return;
+    }
+
+    CSocketEvents events(mode);
+    std::vector<int> vLocal(nPairs), vRemote(nPairs);
+    for (int i = 0; i < nPairs; i++) {
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) assert(false);
+        vLocal[i] = fds[0];
+        vRemote[i] = fds[1];
+        if (!events.Add(vLocal[i], &vLocal[i], CSocketEvents::EVENT_RECV)) assert(false);
+    }
+
+    FastRandomContext rng(true);
+    std::vector<CSocketEvents::Event> vEvents;
+    char ch = 0;
+    while (state.KeepRunning()) {
+        for (int i = 0; i < READY_PER_ROUND; i++) {
+            if (write(vRemote[rng.randrange(nPairs)], &ch, 1) != 1) assert(false);
+        }
+        size_t nRead = 0;
+        while (nRead < READY_PER_ROUND) {
+            events.Wait(vEvents, 0);
+            for (const CSocketEvents::Event& event : vEvents) {
+                char buf[READY_PER_ROUND];
+                ssize_t nBytes = read(*static_cast<int*>(event.context), buf, sizeof(buf));
+                if (nBytes > 0) nRead += nBytes;
+            }
+        }
+    }
+
+    for (int i = 0; i < nPairs; i++) {
+        close(vLocal[i]);
+        close(vRemote[i]);
+    }
+}
+
+static void SocketEventsSelect100(benchmark::State& state) { SocketEvents(state, CSocketEvents::MODE_SELECT, 100); }
+static void SocketEventsSelect400(benchmark::State& state) { SocketEvents(state, CSocketEvents::MODE_SELECT, 400); }
+
+BENCHMARK(SocketEventsSelect100, 2000);
+BENCHMARK(SocketEventsSelect400, 500);
+
+#ifdef USE_EPOLL
+static void SocketEventsEpoll100(benchmark::State& state) { SocketEvents(state, CSocketEvents::MODE_EPOLL, 100); }
+static void SocketEventsEpoll400(benchmark::State& state) { SocketEvents(state, CSocketEvents::MODE_EPOLL, 400); }
+static void SocketEventsEpoll2000(benchmark::State& state) { SocketEvents(state, CSocketEvents::MODE_EPOLL, 2000); }
+
+BENCHMARK(SocketEventsEpoll100, 2000);
+BENCHMARK(SocketEventsEpoll400, 2000);
+BENCHMARK(SocketEventsEpoll2000, 2000);
+#endif
+
+#endif // WIN32
@@ -0,0 +1,51 @@
+// Copyright (c) 2018 The Monacoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <chain.h>
+#include <random.h>
+#include <usercheckpoint.h>
+#include <validation.h>
+
+#include <memory>
+#include <vector>
+
+// GetLastCheckpoint() walks the checkpoints from the highest down until it
+// finds one whose block is known. Model a node that has 100 checkpoints and
+// has not yet seen the blocks of the newest 10.
+
+static void UserCheckpoint_GetLastCheckpoint(benchmark::State& state)
+{
+    static const int CHECKPOINTS = 100;
+    static const int UNKNOWN = 10;
+
+    FastRandomContext rng(true);
+    CUserCheckpoint& checkpoints = CUserCheckpoint::GetInstance();
+    std::vector<std::unique_ptr<CBlockIndex>> vIndex;
+
+    LOCK(cs_main);
+    for (int i = 1; i <= CHECKPOINTS; i++) {
+        const uint256 hash = rng.rand256();
+        assert(checkpoints.WriteCheckpoint(i * 1000, hash));
+        if (i <= CHECKPOINTS - UNKNOWN) {
+            vIndex.emplace_back(new CBlockIndex());
+            vIndex.back()->nHeight = i * 1000;
+            vIndex.back()->phashBlock = &mapBlockIndex.emplace(hash, vIndex.back().get()).first->first;
+        }
+    }
+
+    while (state.KeepRunning()) {
+        CBlockIndex* pindex = checkpoints.GetLastCheckpoint();
+        assert(pindex && pindex->nHeight == (CHECKPOINTS - UNKNOWN) * 1000);
+    }
+
+    for (const auto& pindex : vIndex) {
+        mapBlockIndex.erase(pindex->GetBlockHash());
+    }
+    for (int i = 1; i <= CHECKPOINTS; i++) {
+        checkpoints.DeleteCheckpoint(i * 1000, false);
+    }
+}
+
+BENCHMARK(UserCheckpoint_GetLastCheckpoint, 12 * 1000);
@@ -8,6 +8,7 @@
 
 #include "serialize.h"
 #include "arith_uint256.h"
+#include "uint256.h"
 #include "version.h"
 
 #include <stdexcept>
@@ -4,6 +4,7 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include <chain.h>
+#include <memusage.h>
 
 /**
  * CChain implementation
@@ -118,6 +119,13 @@ void CBlockIndex::BuildSkip()
         pskip = pprev->GetAncestor(GetSkipHeight(nHeight));
 }
 
+void CBlockIndex::BuildSkip(const CChain& chain)
+{
+    assert(chain.Contains(this));
+    if (pprev)
+        pskip = chain[GetSkipHeight(nHeight)];
+}
+
 arith_uint256 GetBlockProof(const CBlockIndex& block)
 {
     arith_uint256 bnTarget;
@@ -168,3 +176,8 @@ const CBlockIndex* LastCommonAncestor(const CBlockIndex* pa, const CBlockIndex*
     assert(pa == pb);
     return pa;
 }
+
+size_t CBlockIndexArena::DynamicMemoryUsage() const
+{
+    return vChunks.size() * memusage::MallocUsage(ENTRIES_PER_CHUNK * sizeof(CBlockIndex)) + memusage::MallocUsage(vChunks.capacity() * sizeof(vChunks[0]));
+}
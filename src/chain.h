@@ -12,6 +12,7 @@
 #include <tinyformat.h>
 #include <uint256.h>
 
+#include <memory>
 #include <vector>
 
 /**
@@ -162,6 +163,8 @@ enum BlockStatus: uint32_t {
     BLOCK_OPT_WITNESS       =   128, //!< block data in blk*.data was received with a witness-enforcing client
 };
 
+class CChain;
+
 /** The block chain is a tree shaped structure starting with the
  * genesis block at the root, with each block potentially having multiple
  * candidates to be the next block. A blockindex may have multiple pprev pointing
@@ -170,6 +173,11 @@ enum BlockStatus: uint32_t {
 class CBlockIndex
 {
 public:
+    // The fields used when walking the block tree and comparing chains come
+    // first and next to each other, ahead of the ones only read when loading
+    // a block or rebuilding its header. Entries are not cache line aligned,
+    // so these 64 bytes can still span two lines.
+
     //! pointer to the hash of the block, if any. Memory is owned by this CBlockIndex
     const uint256* phashBlock;
 
@@ -179,20 +187,21 @@ public:
     //! pointer to the index of some further predecessor of this block
     CBlockIndex* pskip;
 
+    //! (memory only) Total amount of work (expected number of hashes) in the chain up to and including this block
+    arith_uint256 nChainWork;
+
     //! height of the entry in the chain. The genesis block has height 0
     int nHeight;
 
-    //! Which # file this block is stored in (blk?????.dat)
-    int nFile;
-
-    //! Byte offset within blk?????.dat where this block's data is stored
-    unsigned int nDataPos;
+    //! header fields read by the difficulty retarget and the median time past
+    uint32_t nBits;
+    uint32_t nTime;
 
-    //! Byte offset within rev?????.dat where this block's undo data is stored
-    unsigned int nUndoPos;
+    //! (memory only) Maximum nTime in the chain up to and including this block.
+    unsigned int nTimeMax;
 
-    //! (memory only) Total amount of work (expected number of hashes) in the chain up to and including this block
-    arith_uint256 nChainWork;
+    //! Verification status of this block. See enum BlockStatus
+    uint32_t nStatus;
 
     //! Number of transactions in this block.
     //! Note: in a potential headers-first mode, this number cannot be relied upon
@@ -203,21 +212,24 @@ public:
     //! Change to 64-bit type when necessary; won't happen before 2030
     unsigned int nChainTx;
 
-    //! Verification status of this block. See enum BlockStatus
-    uint32_t nStatus;
+    //! (memory only) Sequential id assigned to distinguish order in which blocks are received.
+    int32_t nSequenceId;
+
+    // The rest is only needed to read the block from disk or to rebuild its header.
+
+    //! Which # file this block is stored in (blk?????.dat)
+    int nFile;
+
+    //! Byte offset within blk?????.dat where this block's data is stored
+    unsigned int nDataPos;
+
+    //! Byte offset within rev?????.dat where this block's undo data is stored
+    unsigned int nUndoPos;
 
     //! block header
     int32_t nVersion;
-    uint256 hashMerkleRoot;
-    uint32_t nTime;
-    uint32_t nBits;
     uint32_t nNonce;
-
-    //! (memory only) Sequential id assigned to distinguish order in which blocks are received.
-    int32_t nSequenceId;
-
-    //! (memory only) Maximum nTime in the chain up to and including this block.
-    unsigned int nTimeMax;
+    uint256 hashMerkleRoot;
 
     void SetNull()
     {
@@ -353,6 +365,8 @@ public:
 
     //! Build the skiplist pointer for this entry.
     void BuildSkip();
+    //! Build the skiplist pointer for this entry, which must be in chain, from the entries of chain.
+    void BuildSkip(const CChain& chain);
 
     //! Efficiently find an ancestor of this block.
     CBlockIndex* GetAncestor(int height);
@@ -365,6 +379,41 @@ int64_t GetBlockProofEquivalentTime(const CBlockIndex& to, const CBlockIndex& fr
 /** Find the forking point between two chain tips. */
 const CBlockIndex* LastCommonAncestor(const CBlockIndex* pa, const CBlockIndex* pb);
 
+/**
+ * Allocates block index entries in chunks of many entries, rather than one
+ * heap allocation per entry. Entries are never freed on their own: they all
+ * go away together with Clear() or the arena.
+ */
+class CBlockIndexArena
+{
+private:
+    static const size_t ENTRIES_PER_CHUNK = 4096;
+
+    std::vector<std::unique_ptr<CBlockIndex[]>> vChunks;
+    //! Entries handed out from the last chunk
+    size_t nUsed = ENTRIES_PER_CHUNK;
+
+public:
+    //! Return a new entry, as constructed by CBlockIndex()
+    CBlockIndex* Allocate()
+    {
+        if (nUsed == ENTRIES_PER_CHUNK) {
+            vChunks.emplace_back(new CBlockIndex[ENTRIES_PER_CHUNK]);
+            nUsed = 0;
+        }
+        return &vChunks.back()[nUsed++];
+    }
+
+    void Clear()
+    {
+        vChunks.clear();
+        vChunks.shrink_to_fit();
+        nUsed = ENTRIES_PER_CHUNK;
+    }
+
+    size_t DynamicMemoryUsage() const;
+};
+
 
 /** Used to marshal pointers into hashes for db storage. */
 class CDiskBlockIndex : public CBlockIndex
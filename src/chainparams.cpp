@@ -180,6 +180,12 @@ public:
                     //   (the tx=... number in the SetBestChain debug.log lines)
             0.01493686    // * estimated number of transactions per second after that timestamp
         };
+
+        // UTXO snapshots accepted by -loadutxosnapshot: the base_height,
+        // base_hash, ecmh, coins_written and chain_tx reported by dumptxoutset,
+        // once the snapshot has been reproduced independently. None have been
+        // yet, on this or any other network.
+        mapUTXOSnapshots = {};
     }
 };
 
@@ -25,6 +25,21 @@ struct CCheckpointData {
     MapCheckpoints mapCheckpoints;
 };
 
+/**
+ * A UTXO snapshot that -loadutxosnapshot accepts, as reported by dumptxoutset
+ * at the given height. The coins are trusted only because of this entry.
+ */
+struct UTXOSnapshotData {
+    uint256 hashBlock;
+    //! CUTXOCommitment::GetHash() of the coins
+    uint256 hashCommitment;
+    uint64_t nCoins;
+    //! Transactions in the chain up to and including the base block
+    uint64_t nChainTx;
+};
+
+typedef std::map<int, UTXOSnapshotData> MapUTXOSnapshots;
+
 struct ChainTxData {
     int64_t nTime;
     int64_t nTxCount;
@@ -83,6 +98,7 @@ public:
     const std::vector<SeedSpec6>& FixedSeeds() const { return vFixedSeeds; }
     const CCheckpointData& Checkpoints() const { return checkpointData; }
     const ChainTxData& TxData() const { return chainTxData; }
+    const MapUTXOSnapshots& UTXOSnapshots() const { return mapUTXOSnapshots; }
     void UpdateVersionBitsParameters(Consensus::DeploymentPos d, int64_t nStartTime, int64_t nTimeout);
 
     int SwitchKGWblock() const { return nSwitchKGWblock; }
@@ -108,6 +124,7 @@ protected:
     bool fMineBlocksOnDemand;
     CCheckpointData checkpointData;
     ChainTxData chainTxData;
+    MapUTXOSnapshots mapUTXOSnapshots;
 
     int nSwitchKGWblock;
     int nSwitchDIGIblock;
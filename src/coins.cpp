@@ -10,7 +10,8 @@
 bool CCoinsView::GetCoin(const COutPoint &outpoint, Coin &coin) const { return false; }
 uint256 CCoinsView::GetBestBlock() const { return uint256(); }
 std::vector<uint256> CCoinsView::GetHeadBlocks() const { return std::vector<uint256>(); }
-bool CCoinsView::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) { return false; }
+bool CCoinsView::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, const CUTXOCommitment &commitmentDelta) { return false; }
+bool CCoinsView::GetCommitment(CUTXOCommitment &commitment) const { return false; }
 CCoinsViewCursor *CCoinsView::Cursor() const { return nullptr; }
 
 bool CCoinsView::HaveCoin(const COutPoint &outpoint) const
@@ -25,20 +26,25 @@ bool CCoinsViewBacked::HaveCoin(const COutPoint &outpoint) const { return base->
 uint256 CCoinsViewBacked::GetBestBlock() const { return base->GetBestBlock(); }
 std::vector<uint256> CCoinsViewBacked::GetHeadBlocks() const { return base->GetHeadBlocks(); }
 void CCoinsViewBacked::SetBackend(CCoinsView &viewIn) { base = &viewIn; }
-bool CCoinsViewBacked::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) { return base->BatchWrite(mapCoins, hashBlock); }
+bool CCoinsViewBacked::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, const CUTXOCommitment &commitmentDelta) { return base->BatchWrite(mapCoins, hashBlock, commitmentDelta); }
+bool CCoinsViewBacked::GetCommitment(CUTXOCommitment &commitment) const { return base->GetCommitment(commitment); }
 CCoinsViewCursor *CCoinsViewBacked::Cursor() const { return base->Cursor(); }
 size_t CCoinsViewBacked::EstimateSize() const { return base->EstimateSize(); }
 
 SaltedOutpointHasher::SaltedOutpointHasher() : k0(GetRand(std::numeric_limits<uint64_t>::max())), k1(GetRand(std::numeric_limits<uint64_t>::max())) {}
 
-CCoinsViewCache::CCoinsViewCache(CCoinsView *baseIn) : CCoinsViewBacked(baseIn), cachedCoinsUsage(0) {}
+CCoinsViewCache::CCoinsViewCache(CCoinsView *baseIn, bool fTrackCommitmentIn) : CCoinsViewBacked(baseIn), cachedCoinsUsage(0), fTrackCommitment(fTrackCommitmentIn) {}
 
 size_t CCoinsViewCache::DynamicMemoryUsage() const {
     return memusage::DynamicUsage(cacheCoins) + cachedCoinsUsage;
 }
 
 CCoinsMap::iterator CCoinsViewCache::FetchCoin(const COutPoint &outpoint) const {
-    CCoinsMap::iterator it = cacheCoins.find(outpoint);
+    return FetchCoin(outpoint, cacheCoins.hash_function()(outpoint));
+}
+
+CCoinsMap::iterator CCoinsViewCache::FetchCoin(const COutPoint &outpoint, size_t hash) const {
+    CCoinsMap::iterator it = cacheCoins.find(outpoint, hash);
     if (it != cacheCoins.end())
         return it;
     Coin tmp;
@@ -79,6 +85,18 @@ void CCoinsViewCache::AddCoin(const COutPoint &outpoint, Coin&& coin, bool possi
         }
         fresh = !(it->second.flags & CCoinsCacheEntry::DIRTY);
     }
+    if (fTrackCommitment) {
+        if (!it->second.coin.IsSpent()) {
+            commitmentDelta.Remove(outpoint, it->second.coin);
+        } else if (inserted && possible_overwrite) {
+            // The coin being overwritten may only exist in the base view.
+            Coin overwritten;
+            if (base->GetCoin(outpoint, overwritten) && !overwritten.IsSpent()) {
+                commitmentDelta.Remove(outpoint, overwritten);
+            }
+        }
+        commitmentDelta.Add(outpoint, coin);
+    }
     it->second.coin = std::move(coin);
     it->second.flags |= CCoinsCacheEntry::DIRTY | (fresh ? CCoinsCacheEntry::FRESH : 0);
     cachedCoinsUsage += it->second.coin.DynamicMemoryUsage();
@@ -99,6 +117,9 @@ bool CCoinsViewCache::SpendCoin(const COutPoint &outpoint, Coin* moveout) {
     CCoinsMap::iterator it = FetchCoin(outpoint);
     if (it == cacheCoins.end()) return false;
     cachedCoinsUsage -= it->second.coin.DynamicMemoryUsage();
+    if (fTrackCommitment && !it->second.coin.IsSpent()) {
+        commitmentDelta.Remove(outpoint, it->second.coin);
+    }
     if (moveout) {
         *moveout = std::move(it->second.coin);
     }
@@ -142,7 +163,7 @@ void CCoinsViewCache::SetBestBlock(const uint256 &hashBlockIn) {
     hashBlock = hashBlockIn;
 }
 
-bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn) {
+bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn, const CUTXOCommitment &commitmentDeltaIn) {
     for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end(); it = mapCoins.erase(it)) {
         // Ignore non-dirty entries (optimization).
         if (!(it->second.flags & CCoinsCacheEntry::DIRTY)) {
@@ -197,16 +218,31 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn
         }
     }
     hashBlock = hashBlockIn;
+    if (fTrackCommitment)
+        commitmentDelta.Combine(commitmentDeltaIn);
     return true;
 }
 
 bool CCoinsViewCache::Flush() {
-    bool fOk = base->BatchWrite(cacheCoins, hashBlock);
+    CUTXOCommitment commitment;
+    if (!fTrackCommitment && base->GetCommitment(commitment)) {
+        throw std::logic_error("Flushing coins without their commitment into a view with one");
+    }
+    bool fOk = base->BatchWrite(cacheCoins, hashBlock, commitmentDelta);
     cacheCoins.clear();
     cachedCoinsUsage = 0;
+    commitmentDelta = CUTXOCommitment();
     return fOk;
 }
 
+bool CCoinsViewCache::GetCommitment(CUTXOCommitment &commitment) const {
+    if (!fTrackCommitment || !base->GetCommitment(commitment)) {
+        return false;
+    }
+    commitment.Combine(commitmentDelta);
+    return true;
+}
+
 void CCoinsViewCache::Uncache(const COutPoint& hash)
 {
     CCoinsMap::iterator it = cacheCoins.find(hash);
@@ -235,8 +271,17 @@ CAmount CCoinsViewCache::GetValueIn(const CTransaction& tx) const
 bool CCoinsViewCache::HaveInputs(const CTransaction& tx) const
 {
     if (!tx.IsCoinBase()) {
+        // Hash all prevouts and prefetch their places in the cache first, so
+        // that the cache misses of the lookups overlap rather than add up.
+        std::vector<size_t> vHash;
+        vHash.reserve(tx.vin.size());
+        for (const CTxIn& txin : tx.vin) {
+            vHash.push_back(cacheCoins.hash_function()(txin.prevout));
+            cacheCoins.prefetch(vHash.back());
+        }
         for (unsigned int i = 0; i < tx.vin.size(); i++) {
-            if (!HaveCoin(tx.vin[i].prevout)) {
+            CCoinsMap::const_iterator it = FetchCoin(tx.vin[i].prevout, vHash[i]);
+            if (it == cacheCoins.end() || it->second.coin.IsSpent()) {
                 return false;
             }
         }
@@ -9,15 +9,16 @@
 #include <primitives/transaction.h>
 #include <compressor.h>
 #include <core_memusage.h>
+#include <flatmap.h>
 #include <hash.h>
 #include <memusage.h>
 #include <serialize.h>
 #include <uint256.h>
+#include <utxocommitment.h>
 
 #include <assert.h>
 #include <stdint.h>
 
-#include <unordered_map>
 
 /**
  * A UTXO entry.
@@ -119,7 +120,7 @@ struct CCoinsCacheEntry
     explicit CCoinsCacheEntry(Coin&& coin_) : coin(std::move(coin_)), flags(0) {}
 };
 
-typedef std::unordered_map<COutPoint, CCoinsCacheEntry, SaltedOutpointHasher> CCoinsMap;
+typedef flatmap<COutPoint, CCoinsCacheEntry, SaltedOutpointHasher> CCoinsMap;
 
 /** Cursor for iterating over CoinsView state */
 class CCoinsViewCursor
@@ -164,8 +165,12 @@ public:
     virtual std::vector<uint256> GetHeadBlocks() const;
 
     //! Do a bulk modification (multiple Coin changes + BestBlock change).
-    //! The passed mapCoins can be modified.
-    virtual bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
+    //! The passed mapCoins can be modified. commitmentDelta is the change
+    //! of the UTXO set commitment that the modification amounts to.
+    virtual bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, const CUTXOCommitment &commitmentDelta);
+
+    //! Retrieve the commitment to the unspent outputs in this view, if it is known
+    virtual bool GetCommitment(CUTXOCommitment &commitment) const;
 
     //! Get a cursor to iterate over the whole state
     virtual CCoinsViewCursor *Cursor() const;
@@ -191,7 +196,8 @@ public:
     uint256 GetBestBlock() const override;
     std::vector<uint256> GetHeadBlocks() const override;
     void SetBackend(CCoinsView &viewIn);
-    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) override;
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, const CUTXOCommitment &commitmentDelta) override;
+    bool GetCommitment(CUTXOCommitment &commitment) const override;
     CCoinsViewCursor *Cursor() const override;
     size_t EstimateSize() const override;
 };
@@ -211,8 +217,21 @@ protected:
     /* Cached dynamic memory usage for the inner Coin objects. */
     mutable size_t cachedCoinsUsage;
 
+    /* Whether commitmentDelta is kept up to date. */
+    const bool fTrackCommitment;
+
+    /* Change of the UTXO set commitment not yet written to the base view. */
+    CUTXOCommitment commitmentDelta;
+
 public:
-    CCoinsViewCache(CCoinsView *baseIn);
+    /**
+     * Only caches that are flushed into the chain state (and the chain state
+     * cache itself) need to track the UTXO set commitment, which costs a
+     * point multiplication per added or spent coin. The others, such as those
+     * of the mempool and the miner, don't know the commitment, and can't be
+     * flushed into a view that does.
+     */
+    CCoinsViewCache(CCoinsView *baseIn, bool fTrackCommitmentIn = false);
 
     /**
      * By deleting the copy constructor, we prevent accidentally using it when one intends to create a cache on top of a base cache.
@@ -224,7 +243,8 @@ public:
     bool HaveCoin(const COutPoint &outpoint) const override;
     uint256 GetBestBlock() const override;
     void SetBestBlock(const uint256 &hashBlock);
-    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) override;
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, const CUTXOCommitment &commitmentDelta) override;
+    bool GetCommitment(CUTXOCommitment &commitment) const override;
     CCoinsViewCursor* Cursor() const override {
         throw std::logic_error("CCoinsViewCache cursor iteration not supported.");
     }
@@ -295,6 +315,8 @@ public:
 
 private:
     CCoinsMap::iterator FetchCoin(const COutPoint &outpoint) const;
+    //! FetchCoin with the outpoint's hash in cacheCoins already computed
+    CCoinsMap::iterator FetchCoin(const COutPoint &outpoint, size_t hash) const;
 };
 
 //! Utility function to add all of a transaction's outputs to a cache.
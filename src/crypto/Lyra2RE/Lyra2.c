@@ -40,10 +40,11 @@
  * @param timeCost Parameter to determine the processing time (T)
  * @param nRows Number or rows of the memory matrix (R)
  * @param nCols Number of columns of the memory matrix (C)
+ * @param scratchpad Caller-provided memory of at least LYRA2_SCRATCHPAD_SIZE(nRows, nCols) bytes
  *
- * @return 0 if the key is generated correctly; -1 if there is an error (usually due to lack of memory for allocation)
+ * @return 0 if the key is generated correctly
  */
-int LYRA2(void *K, uint64_t kLen, const void *pwd, uint64_t pwdlen, const void *salt, uint64_t saltlen, uint64_t timeCost, uint64_t nRows, uint64_t nCols) {
+int LYRA2_sp(void *K, uint64_t kLen, const void *pwd, uint64_t pwdlen, const void *salt, uint64_t saltlen, uint64_t timeCost, uint64_t nRows, uint64_t nCols, void *scratchpad) {
 
     //============================= Basic variables ============================//
     int64_t row = 2; //index of row to be processed
@@ -56,31 +57,12 @@ int LYRA2(void *K, uint64_t kLen, const void *pwd, uint64_t pwdlen, const void *
     int64_t i; //auxiliary iteration counter
     //==========================================================================/
 
-    //========== Initializing the Memory Matrix and pointers to it =============//
-    //Tries to allocate enough space for the whole memory matrix
-
-
+    //================ Placing the Memory Matrix in the scratchpad =============//
+    //Rows are addressed directly as wholeMatrix + row * ROW_LEN_INT64. The matrix is
+    //not cleared: every row is fully written by the Setup phase before it is read.
     const int64_t ROW_LEN_INT64 = BLOCK_LEN_INT64 * nCols;
-    const int64_t ROW_LEN_BYTES = ROW_LEN_INT64 * 8;
-
-    i = (int64_t) ((int64_t) nRows * (int64_t) ROW_LEN_BYTES);
-    uint64_t *wholeMatrix = malloc(i);
-    if (wholeMatrix == NULL) {
-      return -1;
-    }
-	memset(wholeMatrix, 0, i);
-
-    //Allocates pointers to each row of the matrix
-    uint64_t **memMatrix = malloc(nRows * sizeof (uint64_t*));
-    if (memMatrix == NULL) {
-      return -1;
-    }
-    //Places the pointers in the correct positions
-    uint64_t *ptrWord = wholeMatrix;
-    for (i = 0; i < nRows; i++) {
-      memMatrix[i] = ptrWord;
-      ptrWord += ROW_LEN_INT64;
-    }
+    uint64_t *wholeMatrix = (uint64_t *) (((uintptr_t) scratchpad + (LYRA2_SCRATCHPAD_ALIGN - 1)) & ~(uintptr_t) (LYRA2_SCRATCHPAD_ALIGN - 1));
+    uint64_t *ptrWord;
     //==========================================================================/
 
     //============= Getting the password + salt + basil padded with 10*1 ===============//
@@ -123,10 +105,7 @@ int LYRA2(void *K, uint64_t kLen, const void *pwd, uint64_t pwdlen, const void *
 
     //======================= Initializing the Sponge State ====================//
     //Sponge state: 16 uint64_t, BLOCK_LEN_INT64 words of them for the bitrate (b) and the remainder for the capacity (c)
-    uint64_t *state = malloc(16 * sizeof (uint64_t));
-    if (state == NULL) {
-      return -1;
-    }
+    uint64_t state[16];
     initState(state);
     //==========================================================================/
 
@@ -139,12 +118,12 @@ int LYRA2(void *K, uint64_t kLen, const void *pwd, uint64_t pwdlen, const void *
     }
 
     //Initializes M[0] and M[1]
-    reducedSqueezeRow0(state, memMatrix[0], nCols); //The locally copied password is most likely overwritten here
-    reducedDuplexRow1(state, memMatrix[0], memMatrix[1], nCols);
+    reducedSqueezeRow0(state, wholeMatrix + 0 * ROW_LEN_INT64, nCols); //The locally copied password is most likely overwritten here
+    reducedDuplexRow1(state, wholeMatrix + 0 * ROW_LEN_INT64, wholeMatrix + 1 * ROW_LEN_INT64, nCols);
 
     do {
       //M[row] = rand; //M[row*] = M[row*] XOR rotW(rand)
-      reducedDuplexRowSetup(state, memMatrix[prev], memMatrix[rowa], memMatrix[row], nCols);
+      reducedDuplexRowSetup(state, wholeMatrix + prev * ROW_LEN_INT64, wholeMatrix + rowa * ROW_LEN_INT64, wholeMatrix + row * ROW_LEN_INT64, nCols);
 
 
       //updates the value of row* (deterministically picked during Setup))
@@ -177,7 +156,7 @@ int LYRA2(void *K, uint64_t kLen, const void *pwd, uint64_t pwdlen, const void *
   	    //------------------------------------------------------------------------------------------
 
   	    //Performs a reduced-round duplexing operation over M[row*] XOR M[prev], updating both M[row*] and M[row]
-  	    reducedDuplexRow(state, memMatrix[prev], memMatrix[rowa], memMatrix[row], nCols);
+  	    reducedDuplexRow(state, wholeMatrix + prev * ROW_LEN_INT64, wholeMatrix + rowa * ROW_LEN_INT64, wholeMatrix + row * ROW_LEN_INT64, nCols);
 
   	    //update prev: it now points to the last row ever computed
   	    prev = row;
@@ -194,25 +173,24 @@ int LYRA2(void *K, uint64_t kLen, const void *pwd, uint64_t pwdlen, const void *
 
     //============================ Wrap-up Phase ===============================//
     //Absorbs the last block of the memory matrix
-    absorbBlock(state, memMatrix[rowa]);
+    absorbBlock(state, wholeMatrix + rowa * ROW_LEN_INT64);
 
     //Squeezes the key
     squeeze(state, K, kLen);
     //==========================================================================/
 
-    //========================= Freeing the memory =============================//
-    free(memMatrix);
-    free(wholeMatrix);
-
-    //Wiping out the sponge's internal state before freeing it
+    //Wiping out the sponge's internal state
     memset(state, 0, 16 * sizeof (uint64_t));
-    free(state);
     //==========================================================================/
 
     return 0;
 }
 
-int LYRA2_old(void *K, uint64_t kLen, const void *pwd, uint64_t pwdlen, const void *salt, uint64_t saltlen, uint64_t timeCost, uint64_t nRows, uint64_t nCols) {
+/**
+ * Same as LYRA2_sp(), but keeps the original Lyra2RE absorb step, which advances
+ * BLOCK_LEN_BLAKE2_SAFE_BYTES words per input block. Lyra2RE (v1) hashes depend on it.
+ */
+int LYRA2_old_sp(void *K, uint64_t kLen, const void *pwd, uint64_t pwdlen, const void *salt, uint64_t saltlen, uint64_t timeCost, uint64_t nRows, uint64_t nCols, void *scratchpad) {
 
     //============================= Basic variables ============================//
     int64_t row = 2; //index of row to be processed
@@ -225,31 +203,13 @@ int LYRA2_old(void *K, uint64_t kLen, const void *pwd, uint64_t pwdlen, const vo
     int64_t i; //auxiliary iteration counter
     //==========================================================================/
 
-    //========== Initializing the Memory Matrix and pointers to it =============//
-    //Tries to allocate enough space for the whole memory matrix
-
-
+    //================ Placing the Memory Matrix in the scratchpad =============//
+    //Rows are addressed directly as wholeMatrix + row * ROW_LEN_INT64. Unlike LYRA2_sp(),
+    //the matrix must be cleared: the absorb step below reads zeroed words past the input.
     const int64_t ROW_LEN_INT64 = BLOCK_LEN_INT64 * nCols;
-    const int64_t ROW_LEN_BYTES = ROW_LEN_INT64 * 8;
-
-    i = (int64_t) ((int64_t) nRows * (int64_t) ROW_LEN_BYTES);
-    uint64_t *wholeMatrix = malloc(i);
-    if (wholeMatrix == NULL) {
-      return -1;
-    }
-	memset(wholeMatrix, 0, i);
-
-    //Allocates pointers to each row of the matrix
-    uint64_t **memMatrix = malloc(nRows * sizeof (uint64_t*));
-    if (memMatrix == NULL) {
-      return -1;
-    }
-    //Places the pointers in the correct positions
-    uint64_t *ptrWord = wholeMatrix;
-    for (i = 0; i < nRows; i++) {
-      memMatrix[i] = ptrWord;
-      ptrWord += ROW_LEN_INT64;
-    }
+    uint64_t *wholeMatrix = (uint64_t *) (((uintptr_t) scratchpad + (LYRA2_SCRATCHPAD_ALIGN - 1)) & ~(uintptr_t) (LYRA2_SCRATCHPAD_ALIGN - 1));
+    uint64_t *ptrWord;
+    memset(wholeMatrix, 0, nRows * ROW_LEN_INT64 * sizeof (uint64_t));
     //==========================================================================/
 
     //============= Getting the password + salt + basil padded with 10*1 ===============//
@@ -292,10 +252,7 @@ int LYRA2_old(void *K, uint64_t kLen, const void *pwd, uint64_t pwdlen, const vo
 
     //======================= Initializing the Sponge State ====================//
     //Sponge state: 16 uint64_t, BLOCK_LEN_INT64 words of them for the bitrate (b) and the remainder for the capacity (c)
-    uint64_t *state = malloc(16 * sizeof (uint64_t));
-    if (state == NULL) {
-      return -1;
-    }
+    uint64_t state[16];
     initState(state);
     //==========================================================================/
 
@@ -308,12 +265,12 @@ int LYRA2_old(void *K, uint64_t kLen, const void *pwd, uint64_t pwdlen, const vo
     }
 
     //Initializes M[0] and M[1]
-    reducedSqueezeRow0(state, memMatrix[0], nCols); //The locally copied password is most likely overwritten here
-    reducedDuplexRow1(state, memMatrix[0], memMatrix[1], nCols);
+    reducedSqueezeRow0(state, wholeMatrix + 0 * ROW_LEN_INT64, nCols); //The locally copied password is most likely overwritten here
+    reducedDuplexRow1(state, wholeMatrix + 0 * ROW_LEN_INT64, wholeMatrix + 1 * ROW_LEN_INT64, nCols);
 
     do {
       //M[row] = rand; //M[row*] = M[row*] XOR rotW(rand)
-      reducedDuplexRowSetup(state, memMatrix[prev], memMatrix[rowa], memMatrix[row], nCols);
+      reducedDuplexRowSetup(state, wholeMatrix + prev * ROW_LEN_INT64, wholeMatrix + rowa * ROW_LEN_INT64, wholeMatrix + row * ROW_LEN_INT64, nCols);
 
 
       //updates the value of row* (deterministically picked during Setup))
@@ -346,7 +303,7 @@ int LYRA2_old(void *K, uint64_t kLen, const void *pwd, uint64_t pwdlen, const vo
   	    //------------------------------------------------------------------------------------------
 
   	    //Performs a reduced-round duplexing operation over M[row*] XOR M[prev], updating both M[row*] and M[row]
-  	    reducedDuplexRow(state, memMatrix[prev], memMatrix[rowa], memMatrix[row], nCols);
+  	    reducedDuplexRow(state, wholeMatrix + prev * ROW_LEN_INT64, wholeMatrix + rowa * ROW_LEN_INT64, wholeMatrix + row * ROW_LEN_INT64, nCols);
 
   	    //update prev: it now points to the last row ever computed
   	    prev = row;
@@ -363,20 +320,40 @@ int LYRA2_old(void *K, uint64_t kLen, const void *pwd, uint64_t pwdlen, const vo
 
     //============================ Wrap-up Phase ===============================//
     //Absorbs the last block of the memory matrix
-    absorbBlock(state, memMatrix[rowa]);
+    absorbBlock(state, wholeMatrix + rowa * ROW_LEN_INT64);
 
     //Squeezes the key
     squeeze(state, K, kLen);
     //==========================================================================/
 
-    //========================= Freeing the memory =============================//
-    free(memMatrix);
-    free(wholeMatrix);
-
-    //Wiping out the sponge's internal state before freeing it
+    //Wiping out the sponge's internal state
     memset(state, 0, 16 * sizeof (uint64_t));
-    free(state);
     //==========================================================================/
 
     return 0;
 }
+
+/**
+ * Executes Lyra2 with a freshly allocated memory matrix. See LYRA2_sp().
+ *
+ * @return 0 if the key is generated correctly; -1 if there is an error (usually due to lack of memory for allocation)
+ */
+int LYRA2(void *K, uint64_t kLen, const void *pwd, uint64_t pwdlen, const void *salt, uint64_t saltlen, uint64_t timeCost, uint64_t nRows, uint64_t nCols) {
+    void *scratchpad = malloc(LYRA2_SCRATCHPAD_SIZE(nRows, nCols));
+    if (scratchpad == NULL) {
+      return -1;
+    }
+    int result = LYRA2_sp(K, kLen, pwd, pwdlen, salt, saltlen, timeCost, nRows, nCols, scratchpad);
+    free(scratchpad);
+    return result;
+}
+
+int LYRA2_old(void *K, uint64_t kLen, const void *pwd, uint64_t pwdlen, const void *salt, uint64_t saltlen, uint64_t timeCost, uint64_t nRows, uint64_t nCols) {
+    void *scratchpad = malloc(LYRA2_SCRATCHPAD_SIZE(nRows, nCols));
+    if (scratchpad == NULL) {
+      return -1;
+    }
+    int result = LYRA2_old_sp(K, kLen, pwd, pwdlen, salt, saltlen, timeCost, nRows, nCols, scratchpad);
+    free(scratchpad);
+    return result;
+}
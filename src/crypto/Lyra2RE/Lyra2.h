@@ -37,6 +37,15 @@ typedef unsigned char byte;
         #define BLOCK_LEN_BYTES (BLOCK_LEN_INT64 * 8)    //Block length, in bytes
 #endif
 
+//Alignment of the memory matrix inside a LYRA2_sp()/LYRA2_old_sp() scratchpad (one cache line)
+#define LYRA2_SCRATCHPAD_ALIGN 64
+//Scratchpad size needed by LYRA2_sp()/LYRA2_old_sp() for an nRows x nCols matrix, including alignment slack
+#define LYRA2_SCRATCHPAD_SIZE(nRows, nCols) ((nRows) * (nCols) * BLOCK_LEN_BYTES + LYRA2_SCRATCHPAD_ALIGN - 1)
+
+int LYRA2_sp(void *K, uint64_t kLen, const void *pwd, uint64_t pwdlen, const void *salt, uint64_t saltlen, uint64_t timeCost, uint64_t nRows, uint64_t nCols, void *scratchpad);
+
+int LYRA2_old_sp(void *K, uint64_t kLen, const void *pwd, uint64_t pwdlen, const void *salt, uint64_t saltlen, uint64_t timeCost, uint64_t nRows, uint64_t nCols, void *scratchpad);
+
 int LYRA2(void *K, uint64_t kLen, const void *pwd, uint64_t pwdlen, const void *salt, uint64_t saltlen, uint64_t timeCost, uint64_t nRows, uint64_t nCols);
 
 int LYRA2_old(void *K, uint64_t kLen, const void *pwd, uint64_t pwdlen, const void *salt, uint64_t saltlen, uint64_t timeCost, uint64_t nRows, uint64_t nCols);
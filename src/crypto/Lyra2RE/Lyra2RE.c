@@ -27,7 +27,12 @@
  * online backup system.
  */
 
+#if defined(HAVE_CONFIG_H)
+#include "config/bitcoin-config.h"
+#endif
+
 #include "Lyra2RE.h"
+#include "Lyra2RE_4way.h"
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
@@ -40,6 +45,10 @@
 #include "sph_skein.h"
 #include "Lyra2.h"
 
+#if defined(LYRA2RE_HAVE_4WAY_AVX2)
+#include <cpuid.h>
+#endif
+
 void lyra2re_hash(const char* input, char* output)
 {
     sph_blake256_context     ctx_blake;
@@ -48,6 +57,7 @@ void lyra2re_hash(const char* input, char* output)
     sph_skein256_context     ctx_skein;
 
     uint32_t hashA[8], hashB[8];
+    char scratchpad[LYRA2_SCRATCHPAD_SIZE(8, 8)];
 
     sph_blake256_init(&ctx_blake);
     sph_blake256 (&ctx_blake, input, 80);
@@ -57,7 +67,7 @@ void lyra2re_hash(const char* input, char* output)
     sph_keccak256 (&ctx_keccak,hashA, 32); 
     sph_keccak256_close(&ctx_keccak, hashB);
 	
-	LYRA2_old(hashA, 32, hashB, 32, hashB, 32, 1, 8, 8);
+	LYRA2_old_sp(hashA, 32, hashB, 32, hashB, 32, 1, 8, 8, scratchpad);
 	
 	sph_skein256_init(&ctx_skein);
     sph_skein256 (&ctx_skein, hashA, 32); 
@@ -70,19 +80,22 @@ void lyra2re_hash(const char* input, char* output)
 	memcpy(output, hashA, 32);
 }
 
-void lyra2re2_hash(const char* input, char* output)
+/*
+ * Finishes lyra2re2_hash() of the 80-byte header in input, given a Blake256
+ * context that has already absorbed its first 64 bytes.
+ */
+static void lyra2re2_hash_tail(sph_blake256_context* ctx_blake, const char* input, char* output)
 {
-	sph_blake256_context ctx_blake;
 	sph_cubehash256_context ctx_cubehash;
 	sph_keccak256_context ctx_keccak;
 	sph_skein256_context ctx_skein;
 	sph_bmw256_context ctx_bmw;
 	
 	uint32_t hashA[8], hashB[8];
+	char scratchpad[LYRA2_SCRATCHPAD_SIZE(4, 4)];
 	
-	sph_blake256_init(&ctx_blake);
-    sph_blake256(&ctx_blake, input, 80);
-    sph_blake256_close (&ctx_blake, hashA);	
+    sph_blake256(ctx_blake, input + 64, 16);
+    sph_blake256_close (ctx_blake, hashA);	
 	
     sph_keccak256_init(&ctx_keccak);
     sph_keccak256(&ctx_keccak, hashA, 32); 
@@ -92,7 +105,7 @@ void lyra2re2_hash(const char* input, char* output)
     sph_cubehash256(&ctx_cubehash, hashB, 32);
     sph_cubehash256_close(&ctx_cubehash, hashA);
     
-    LYRA2(hashB, 32, hashA, 32, hashA, 32, 1, 4, 4);
+    LYRA2_sp(hashB, 32, hashA, 32, hashA, 32, 1, 4, 4, scratchpad);
     
    	sph_skein256_init(&ctx_skein);
     sph_skein256(&ctx_skein, hashB, 32); 
@@ -108,3 +121,142 @@ void lyra2re2_hash(const char* input, char* output)
     
    	memcpy(output, hashA, 32);
 }
+
+void lyra2re2_hash(const char* input, char* output)
+{
+	sph_blake256_context ctx_blake;
+
+	sph_blake256_init(&ctx_blake);
+	sph_blake256(&ctx_blake, input, 64);
+	lyra2re2_hash_tail(&ctx_blake, input, output);
+}
+
+/* Hashes four headers by running the scalar implementation once per header. */
+static void lyra2re2_hash_4way_generic(const char* input, char* output, const sph_blake256_context* midstate)
+{
+    sph_blake256_context ctx_blake;
+    int i;
+    for (i = 0; i < 4; i++) {
+        if (midstate) {
+            ctx_blake = *midstate;
+            lyra2re2_hash_tail(&ctx_blake, input + 80 * i, output + 32 * i);
+        } else {
+            lyra2re2_hash(input + 80 * i, output + 32 * i);
+        }
+    }
+}
+
+#if defined(LYRA2RE_HAVE_4WAY)
+static void (*lyra2re2_hash_4way)(const char* input, char* output, const sph_blake256_context* midstate) = lyra2re2_hash_4way_sse2;
+#else
+static void (*lyra2re2_hash_4way)(const char* input, char* output, const sph_blake256_context* midstate) = lyra2re2_hash_4way_generic;
+#endif
+
+#if defined(LYRA2RE_HAVE_4WAY_AVX2)
+/* AVX2 needs both the CPU feature and OS support for saving the YMM registers. */
+static int lyra2re2_have_avx2(void)
+{
+    uint32_t eax, ebx, ecx, edx, xcr0_lo, xcr0_hi;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !((ecx >> 27) & 1))
+        return 0;
+    __asm__ ("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+    if ((xcr0_lo & 6) != 6)
+        return 0;
+    if (__get_cpuid_max(0, NULL) < 7)
+        return 0;
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+    return (ebx >> 5) & 1;
+}
+#endif
+
+/*
+ * Checks a four-lane implementation against lyra2re2_hash() on distinct
+ * headers, and on headers that share a midstate.
+ */
+static int lyra2re2_selftest(void (*hash_4way)(const char*, char*, const sph_blake256_context*))
+{
+    char in[80 * 4], out[32 * 4], expected[32 * 4];
+    sph_blake256_context midstate;
+    int i;
+
+    for (i = 0; i < (int)sizeof(in); i++)
+        in[i] = (char)(i * 7 + 3);
+    lyra2re2_hash_4way_generic(in, expected, NULL);
+    hash_4way(in, out, NULL);
+    if (memcmp(out, expected, sizeof(out)) != 0)
+        return 0;
+
+    for (i = 1; i < 4; i++)
+        memcpy(in + 80 * i, in, 64);
+    sph_blake256_init(&midstate);
+    sph_blake256(&midstate, in, 64);
+    lyra2re2_hash_4way_generic(in, expected, NULL);
+    hash_4way(in, out, &midstate);
+    return memcmp(out, expected, sizeof(out)) == 0;
+}
+
+const char* lyra2re2_autodetect(void)
+{
+#if defined(LYRA2RE_HAVE_4WAY_AVX2)
+    if (lyra2re2_have_avx2() && lyra2re2_selftest(lyra2re2_hash_4way_avx2)) {
+        lyra2re2_hash_4way = lyra2re2_hash_4way_avx2;
+        return "avx2(4way)";
+    }
+#endif
+#if defined(LYRA2RE_HAVE_4WAY)
+    if (lyra2re2_selftest(lyra2re2_hash_4way_sse2)) {
+        lyra2re2_hash_4way = lyra2re2_hash_4way_sse2;
+        return "sse2(4way)";
+    }
+#endif
+    lyra2re2_hash_4way = lyra2re2_hash_4way_generic;
+    return "standard";
+}
+
+void lyra2re2_hash_batch(const char* input, char* output, size_t n)
+{
+    while (n >= 4) {
+        lyra2re2_hash_4way(input, output, NULL);
+        input += 80 * 4;
+        output += 32 * 4;
+        n -= 4;
+    }
+    while (n > 0) {
+        lyra2re2_hash(input, output);
+        input += 80;
+        output += 32;
+        n--;
+    }
+}
+
+void lyra2re2_hash_nonces(const char* input, uint32_t nonce, char* output, size_t n)
+{
+    sph_blake256_context midstate, ctx_blake;
+    char headers[80 * 4];
+    size_t i, lanes;
+
+    sph_blake256_init(&midstate);
+    sph_blake256(&midstate, input, 64);
+    for (i = 0; i < 4; i++)
+        memcpy(headers + 80 * i, input, 80);
+
+    while (n > 0) {
+        lanes = n < 4 ? n : 4;
+        for (i = 0; i < lanes; i++) {
+            uint32_t v = nonce + (uint32_t)i;
+            unsigned char* p = (unsigned char*)headers + 80 * i + 76;
+            p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+        }
+        if (lanes == 4) {
+            lyra2re2_hash_4way(headers, output, &midstate);
+        } else {
+            for (i = 0; i < lanes; i++) {
+                ctx_blake = midstate;
+                lyra2re2_hash_tail(&ctx_blake, headers + 80 * i, output + 32 * i);
+            }
+        }
+        nonce += (uint32_t)lanes;
+        output += 32 * lanes;
+        n -= lanes;
+    }
+}
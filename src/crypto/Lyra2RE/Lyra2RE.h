@@ -1,6 +1,9 @@
 #ifndef LYRA2RE_H
 #define LYRA2RE_H
 
+#include <stddef.h>
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -8,6 +11,24 @@ extern "C" {
 void lyra2re_hash(const char* input, char* output);
 void lyra2re2_hash(const char* input, char* output);
 
+/**
+ * Hash n consecutive 80-byte headers from input into n consecutive 32-byte
+ * outputs; equivalent to calling lyra2re2_hash() on each header. Groups of
+ * four headers are hashed in parallel vector lanes when available.
+ */
+void lyra2re2_hash_batch(const char* input, char* output, size_t n);
+
+/**
+ * Hash n copies of the 80-byte header in input that differ only in their
+ * nonce (the last four bytes, little endian), which runs from nonce upwards,
+ * into n consecutive 32-byte outputs. The Blake256 state over the constant
+ * first 64 bytes is computed once and shared by all of them.
+ */
+void lyra2re2_hash_nonces(const char* input, uint32_t nonce, char* output, size_t n);
+
+/** Select the fastest lyra2re2_hash_batch() implementation for this CPU. Returns its name. */
+const char* lyra2re2_autodetect(void);
+
 #ifdef __cplusplus
 }
 #endif
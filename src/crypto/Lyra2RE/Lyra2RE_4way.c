@@ -0,0 +1,375 @@
+/**
+ * Four-lane Lyra2REv2 implementation.
+ *
+ * Hashes four independent 80-byte block headers at once. The CubeHash256 and
+ * Lyra2 (Blake2b sponge) stages keep one header per vector lane; the short
+ * Blake256, Keccak256, Skein256 and BMW256 stages run per lane on the regular
+ * sph_* code. The vector code uses the GCC/Clang vector extensions, so the
+ * same source is lowered to SSE2 by default and to AVX2 for the variant that
+ * is compiled with that target enabled. Results are bit-identical to
+ * lyra2re2_hash().
+ */
+#if defined(HAVE_CONFIG_H)
+#include "config/bitcoin-config.h"
+#endif
+
+#include <stdint.h>
+#include <string.h>
+#include "Lyra2RE.h"
+#include "Lyra2RE_4way.h"
+#include "Lyra2.h"
+#include "Sponge.h"
+#include "sph_blake.h"
+#include "sph_bmw.h"
+#include "sph_keccak.h"
+#include "sph_skein.h"
+
+#if defined(LYRA2RE_HAVE_4WAY)
+
+#define LANES 4
+
+typedef uint32_t v4u32 __attribute__((vector_size(16)));
+typedef uint64_t v4u64 __attribute__((vector_size(32)));
+
+#define ALWAYS_INLINE static inline __attribute__((always_inline))
+
+/* Lyra2REv2 parameters: LYRA2(K, 32, pwd, 32, salt, 32, 1, 4, 4) */
+#define LYRA2RE2_KLEN       32
+#define LYRA2RE2_PWDLEN     32
+#define LYRA2RE2_TIMECOST   1
+#define LYRA2RE2_NROWS      4
+#define LYRA2RE2_NCOLS      4
+#define LYRA2RE2_NBLOCKS    (((LYRA2RE2_PWDLEN * 2 + 6 * 8) / BLOCK_LEN_BLAKE2_SAFE_BYTES) + 1)
+
+static const uint32_t cubehash256_IV[32] = {
+    0xEA2BD4B4, 0xCCD6F29F, 0x63117E71, 0x35481EAE,
+    0x22512D5B, 0xE5D94E63, 0x7E624131, 0xF4CC12BE,
+    0xC2D0B696, 0x42AF2070, 0xD0720C35, 0x3361DA8C,
+    0x28CCECA4, 0x8EF8AD83, 0x4680AC00, 0x40E5FBAB,
+    0xD89041C3, 0x6107FBD5, 0x6C859D41, 0xF0B26679,
+    0x09392549, 0x5FA25603, 0x65C892FD, 0x93CB6285,
+    0x2AF2B5AE, 0x9E4B4E60, 0x774ABFDD, 0x85254725,
+    0x15815AEB, 0x4AB6AAD6, 0x9CDAF8AF, 0xD6032C0A
+};
+
+static inline uint32_t dec32le(const unsigned char* p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline void enc32le(unsigned char* p, uint32_t v)
+{
+    p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+}
+
+//================================ CubeHash256 ================================//
+
+/* The hot loops are spelled out so that they are fully unrolled at -O2 as well. */
+#define REP4(M, i) M(i) M((i) + 1) M((i) + 2) M((i) + 3)
+#define REP8(M, i) REP4(M, i) REP4(M, (i) + 4)
+#define REP12(M) REP8(M, 0) REP4(M, 8)
+#define REP16(M) REP8(M, 0) REP8(M, 8)
+
+#define ROTL32X4(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+#define CH_SWAP(a, b) { t = x[a]; x[a] = x[b]; x[b] = t; }
+#define CH_ADD(i) x[16 + (i)] += x[i];
+#define CH_ROT7(i) x[i] = ROTL32X4(x[i], 7);
+#define CH_ROT11(i) x[i] = ROTL32X4(x[i], 11);
+#define CH_XOR(i) x[i] ^= x[16 + (i)];
+#define CH_SWAP_8(i) CH_SWAP(i, (i) + 8)
+
+/** One CubeHash round, written in the form of the specification (x[0..15] and x[16..31] halves). */
+ALWAYS_INLINE void cubehash_round_4way(v4u32* x)
+{
+    v4u32 t;
+    REP16(CH_ADD)
+    REP16(CH_ROT7)
+    REP8(CH_SWAP_8, 0)
+    REP16(CH_XOR)
+    CH_SWAP(16, 18) CH_SWAP(17, 19) CH_SWAP(20, 22) CH_SWAP(21, 23)
+    CH_SWAP(24, 26) CH_SWAP(25, 27) CH_SWAP(28, 30) CH_SWAP(29, 31)
+    REP16(CH_ADD)
+    REP16(CH_ROT11)
+    CH_SWAP(0, 4) CH_SWAP(1, 5) CH_SWAP(2, 6) CH_SWAP(3, 7)
+    CH_SWAP(8, 12) CH_SWAP(9, 13) CH_SWAP(10, 14) CH_SWAP(11, 15)
+    REP16(CH_XOR)
+    CH_SWAP(16, 17) CH_SWAP(18, 19) CH_SWAP(20, 21) CH_SWAP(22, 23)
+    CH_SWAP(24, 25) CH_SWAP(26, 27) CH_SWAP(28, 29) CH_SWAP(30, 31)
+}
+
+ALWAYS_INLINE void cubehash_sixteen_rounds_4way(v4u32* x)
+{
+    int r;
+    for (r = 0; r < 16; r++)
+        cubehash_round_4way(x);
+}
+
+/** CubeHash16/32-256 of one 32-byte message per lane, as sph_cubehash256() computes it. */
+ALWAYS_INLINE void cubehash256_32_4way(const uint32_t in[LANES][8], uint32_t out[LANES][8])
+{
+    v4u32 x[32];
+    int i, l, r;
+
+    for (i = 0; i < 32; i++)
+        for (l = 0; l < LANES; l++)
+            x[i][l] = cubehash256_IV[i];
+
+    /* The single full message block. */
+    for (i = 0; i < 8; i++)
+        for (l = 0; l < LANES; l++)
+            x[i][l] ^= dec32le((const unsigned char*)&in[l][i]);
+    cubehash_sixteen_rounds_4way(x);
+
+    /* Padding block (0x80 followed by zeros), then finalization. */
+    for (l = 0; l < LANES; l++)
+        x[0][l] ^= 0x80;
+    for (r = 0; r < 11; r++) {
+        cubehash_sixteen_rounds_4way(x);
+        if (r == 0)
+            for (l = 0; l < LANES; l++)
+                x[31][l] ^= 1;
+    }
+
+    for (i = 0; i < 8; i++)
+        for (l = 0; l < LANES; l++)
+            enc32le((unsigned char*)&out[l][i], x[i][l]);
+}
+
+//=================================== Lyra2 ===================================//
+
+#define ROTR64X4(w, c) (((w) >> (c)) | ((w) << (64 - (c))))
+
+#define G4(a, b, c, d) \
+    do { \
+        a += b; d = ROTR64X4(d ^ a, 32); \
+        c += d; b = ROTR64X4(b ^ c, 24); \
+        a += b; d = ROTR64X4(d ^ a, 16); \
+        c += d; b = ROTR64X4(b ^ c, 63); \
+    } while (0)
+
+ALWAYS_INLINE void blake2b_round_4way(v4u64* v)
+{
+    G4(v[ 0], v[ 4], v[ 8], v[12]);
+    G4(v[ 1], v[ 5], v[ 9], v[13]);
+    G4(v[ 2], v[ 6], v[10], v[14]);
+    G4(v[ 3], v[ 7], v[11], v[15]);
+    G4(v[ 0], v[ 5], v[10], v[15]);
+    G4(v[ 1], v[ 6], v[11], v[12]);
+    G4(v[ 2], v[ 7], v[ 8], v[13]);
+    G4(v[ 3], v[ 4], v[ 9], v[14]);
+}
+
+ALWAYS_INLINE void blake2b_4way(v4u64* v)
+{
+    int r;
+    for (r = 0; r < 12; r++)
+        blake2b_round_4way(v);
+}
+
+/** Column col of row row of the lane-interleaved memory matrix. */
+#define MCOL(M, row, col) ((M) + ((row) * LYRA2RE2_NCOLS + (col)) * BLOCK_LEN_INT64)
+
+/**
+ * Lyra2 with the Lyra2REv2 parameters (kLen = pwdlen = saltlen = 32, timeCost = 1,
+ * nRows = nCols = 4) and pwd == salt, one instance per lane. Mirrors LYRA2() step by
+ * step; the only lane-dependent control data is row* during the Wandering phase.
+ */
+ALWAYS_INLINE void lyra2re2_lyra2_4way(uint32_t K[LANES][8], const uint32_t pwd[LANES][8])
+{
+    v4u64 M[LYRA2RE2_NROWS * LYRA2RE2_NCOLS * BLOCK_LEN_INT64];
+    v4u64 state[16];
+    v4u64 rot[BLOCK_LEN_INT64];
+    unsigned char input[LANES][LYRA2RE2_NBLOCKS * BLOCK_LEN_BLAKE2_SAFE_BYTES];
+    const uint64_t params[6] = { LYRA2RE2_KLEN, LYRA2RE2_PWDLEN, LYRA2RE2_PWDLEN,
+                                 LYRA2RE2_TIMECOST, LYRA2RE2_NROWS, LYRA2RE2_NCOLS };
+    int64_t row = 2, prev = 1, rowa = 0, tau, step = 1, window = 2, gap = 1;
+    int64_t rowaLane[LANES];
+    v4u64 *in, *inout, *out;
+    int i, j, l;
+
+    //==== pwd || salt || basil, padded with 10*1 ====//
+    for (l = 0; l < LANES; l++) {
+        unsigned char* p = input[l];
+        memset(p, 0, sizeof(input[l]));
+        memcpy(p, pwd[l], LYRA2RE2_PWDLEN);
+        memcpy(p + LYRA2RE2_PWDLEN, pwd[l], LYRA2RE2_PWDLEN);
+        memcpy(p + 2 * LYRA2RE2_PWDLEN, params, sizeof(params));
+        p[2 * LYRA2RE2_PWDLEN + sizeof(params)] = 0x80;
+        p[sizeof(input[l]) - 1] ^= 0x01;
+    }
+
+    //==== Sponge initialization and absorption of the padded input ====//
+    memset(state, 0, 8 * sizeof(state[0]));
+    for (i = 0; i < 8; i++)
+        for (l = 0; l < LANES; l++)
+            state[8 + i][l] = blake2b_IV[i];
+    for (j = 0; j < LYRA2RE2_NBLOCKS; j++) {
+        for (i = 0; i < BLOCK_LEN_BLAKE2_SAFE_INT64; i++) {
+            for (l = 0; l < LANES; l++) {
+                uint64_t w;
+                memcpy(&w, input[l] + (j * BLOCK_LEN_BLAKE2_SAFE_INT64 + i) * 8, 8);
+                state[i][l] ^= w;
+            }
+        }
+        blake2b_4way(state);
+    }
+
+    //==== Setup phase ====//
+    /* reducedSqueezeRow0 */
+    for (i = LYRA2RE2_NCOLS - 1; i >= 0; i--) {
+        out = MCOL(M, 0, i);
+        for (j = 0; j < BLOCK_LEN_INT64; j++)
+            out[j] = state[j];
+        blake2b_round_4way(state);
+    }
+    /* reducedDuplexRow1 */
+    for (i = 0; i < LYRA2RE2_NCOLS; i++) {
+        in = MCOL(M, 0, i);
+        out = MCOL(M, 1, LYRA2RE2_NCOLS - 1 - i);
+        for (j = 0; j < BLOCK_LEN_INT64; j++)
+            state[j] ^= in[j];
+        blake2b_round_4way(state);
+        for (j = 0; j < BLOCK_LEN_INT64; j++)
+            out[j] = in[j] ^ state[j];
+    }
+    do {
+        /* reducedDuplexRowSetup; row* is the same for every lane here */
+        for (i = 0; i < LYRA2RE2_NCOLS; i++) {
+            in = MCOL(M, prev, i);
+            inout = MCOL(M, rowa, i);
+            out = MCOL(M, row, LYRA2RE2_NCOLS - 1 - i);
+            for (j = 0; j < BLOCK_LEN_INT64; j++)
+                state[j] ^= in[j] + inout[j];
+            blake2b_round_4way(state);
+            for (j = 0; j < BLOCK_LEN_INT64; j++)
+                out[j] = in[j] ^ state[j];
+            inout[0] ^= state[11];
+            for (j = 1; j < BLOCK_LEN_INT64; j++)
+                inout[j] ^= state[j - 1];
+        }
+
+        rowa = (rowa + step) & (window - 1);
+        prev = row;
+        row++;
+        if (rowa == 0) {
+            step = window + gap;
+            window *= 2;
+            gap = -gap;
+        }
+    } while (row < LYRA2RE2_NROWS);
+
+    //==== Wandering phase ====//
+    row = 0;
+    for (tau = 1; tau <= LYRA2RE2_TIMECOST; tau++) {
+        step = (tau % 2 == 0) ? -1 : LYRA2RE2_NROWS / 2 - 1;
+        do {
+            for (l = 0; l < LANES; l++)
+                rowaLane[l] = state[0][l] % LYRA2RE2_NROWS;
+
+            /* reducedDuplexRow; row* differs per lane, so it is gathered and scattered */
+            for (i = 0; i < LYRA2RE2_NCOLS; i++) {
+                in = MCOL(M, prev, i);
+                out = MCOL(M, row, i);
+                for (j = 0; j < BLOCK_LEN_INT64; j++) {
+                    v4u64 w;
+                    for (l = 0; l < LANES; l++)
+                        w[l] = MCOL(M, rowaLane[l], i)[j][l];
+                    state[j] ^= in[j] + w;
+                }
+                blake2b_round_4way(state);
+                for (j = 0; j < BLOCK_LEN_INT64; j++)
+                    out[j] ^= state[j];
+                /* M[row*] is updated after M[row], as row* may alias row */
+                rot[0] = state[11];
+                for (j = 1; j < BLOCK_LEN_INT64; j++)
+                    rot[j] = state[j - 1];
+                for (l = 0; l < LANES; l++) {
+                    v4u64* col = MCOL(M, rowaLane[l], i);
+                    for (j = 0; j < BLOCK_LEN_INT64; j++)
+                        col[j][l] ^= rot[j][l];
+                }
+            }
+
+            prev = row;
+            row = (row + step) % LYRA2RE2_NROWS;
+        } while (row != 0);
+    }
+
+    //==== Wrap-up phase ====//
+    for (i = 0; i < BLOCK_LEN_INT64; i++)
+        for (l = 0; l < LANES; l++)
+            state[i][l] ^= M[rowaLane[l] * LYRA2RE2_NCOLS * BLOCK_LEN_INT64 + i][l];
+    blake2b_4way(state);
+
+    for (l = 0; l < LANES; l++) {
+        uint64_t k[LYRA2RE2_KLEN / 8];
+        for (i = 0; i < LYRA2RE2_KLEN / 8; i++)
+            k[i] = state[i][l];
+        memcpy(K[l], k, LYRA2RE2_KLEN);
+    }
+}
+
+//================================ Lyra2REv2 ================================//
+
+ALWAYS_INLINE void lyra2re2_hash_4way_impl(const char* input, char* output, const sph_blake256_context* midstate)
+{
+    uint32_t hashA[LANES][8], hashB[LANES][8];
+    int l;
+
+    for (l = 0; l < LANES; l++) {
+        sph_blake256_context ctx_blake;
+        sph_keccak256_context ctx_keccak;
+
+        if (midstate) {
+            ctx_blake = *midstate;
+            sph_blake256(&ctx_blake, input + 80 * l + 64, 16);
+        } else {
+            sph_blake256_init(&ctx_blake);
+            sph_blake256(&ctx_blake, input + 80 * l, 80);
+        }
+        sph_blake256_close(&ctx_blake, hashA[l]);
+
+        sph_keccak256_init(&ctx_keccak);
+        sph_keccak256(&ctx_keccak, hashA[l], 32);
+        sph_keccak256_close(&ctx_keccak, hashB[l]);
+    }
+
+    cubehash256_32_4way(hashB, hashA);
+
+    lyra2re2_lyra2_4way(hashB, hashA);
+
+    for (l = 0; l < LANES; l++) {
+        sph_skein256_context ctx_skein;
+
+        sph_skein256_init(&ctx_skein);
+        sph_skein256(&ctx_skein, hashB[l], 32);
+        sph_skein256_close(&ctx_skein, hashA[l]);
+    }
+
+    cubehash256_32_4way(hashA, hashB);
+
+    for (l = 0; l < LANES; l++) {
+        sph_bmw256_context ctx_bmw;
+
+        sph_bmw256_init(&ctx_bmw);
+        sph_bmw256(&ctx_bmw, hashB[l], 32);
+        sph_bmw256_close(&ctx_bmw, hashA[l]);
+        memcpy(output + 32 * l, hashA[l], 32);
+    }
+}
+
+void lyra2re2_hash_4way_sse2(const char* input, char* output, const sph_blake256_context* midstate)
+{
+    lyra2re2_hash_4way_impl(input, output, midstate);
+}
+
+#if defined(LYRA2RE_HAVE_4WAY_AVX2)
+__attribute__((target("avx2")))
+void lyra2re2_hash_4way_avx2(const char* input, char* output, const sph_blake256_context* midstate)
+{
+    lyra2re2_hash_4way_impl(input, output, midstate);
+}
+#endif
+
+#endif // LYRA2RE_HAVE_4WAY
@@ -0,0 +1,36 @@
+#ifndef LYRA2RE_4WAY_H
+#define LYRA2RE_4WAY_H
+
+/*
+ * Internal interface of the four-lane Lyra2REv2 implementation, used by
+ * lyra2re2_hash_batch() and lyra2re2_hash_nonces(). Each function hashes
+ * four consecutive 80-byte headers from input into four consecutive 32-byte
+ * hashes in output. If midstate is not NULL, it is the Blake256 state after
+ * the first 64 bytes, which all four headers share.
+ */
+
+#include "sph_blake.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__amd64__))
+#define LYRA2RE_HAVE_4WAY 1
+#if defined(USE_ASM)
+#define LYRA2RE_HAVE_4WAY_AVX2 1
+#endif
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(LYRA2RE_HAVE_4WAY)
+void lyra2re2_hash_4way_sse2(const char* input, char* output, const sph_blake256_context* midstate);
+#endif
+#if defined(LYRA2RE_HAVE_4WAY_AVX2)
+void lyra2re2_hash_4way_avx2(const char* input, char* output, const sph_blake256_context* midstate);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
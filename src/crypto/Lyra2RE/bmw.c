@@ -690,8 +690,15 @@ bmw32_close(sph_bmw_small_context *sc, unsigned ub, unsigned n,
 	}
 	memset(buf + ptr, 0, (sizeof sc->buf) - 8 - ptr);
 #if SPH_64
-	sph_enc64le_aligned(buf + (sizeof sc->buf) - 8,
-		SPH_T64(sc->bit_count + n));
+	/*
+	 * compress_small() reads the block back as 32-bit words; storing
+	 * the bit count as a 64-bit word would break strict aliasing and
+	 * lets optimizing compilers read a stale block.
+	 */
+	sph_enc32le_aligned(buf + (sizeof sc->buf) - 8,
+		SPH_T32(sc->bit_count + n));
+	sph_enc32le_aligned(buf + (sizeof sc->buf) - 4,
+		SPH_T32((sc->bit_count + n) >> 32));
 #else
 	sph_enc32le_aligned(buf + (sizeof sc->buf) - 8,
 		sc->bit_count_low + n);
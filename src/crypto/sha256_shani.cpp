@@ -0,0 +1,193 @@
+// Copyright (c) 2018 The Monacoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// This file is compiled with -msse4 -msha and must only be entered after
+// SHA256AutoDetect() has verified that the CPU supports the SHA extensions.
+//
+// The SHA instructions keep the working state as two vectors, ABEF and CDGH,
+// and perform two rounds per sha256rnds2, so the code below is organized in
+// quad rounds over four-word message vectors.
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <immintrin.h>
+
+namespace {
+
+static const uint32_t K256[64] __attribute__((aligned(16))) = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static const uint32_t INIT[8] __attribute__((aligned(16))) = {0x6a09e667ul, 0xbb67ae85ul, 0x3c6ef372ul, 0xa54ff53aul, 0x510e527ful, 0x9b05688cul, 0x1f83d9abul, 0x5be0cd19ul};
+
+/** Byte-swaps every 32-bit word, turning big-endian message words into lanes. */
+__m128i inline Mask() { return _mm_set_epi64x(0x0c0d0e0f08090a0bull, 0x0405060700010203ull); }
+
+/** Four rounds with message words m (lanes 0..3) and round constants k[0..3]. */
+void inline __attribute__((always_inline)) QuadRound(__m128i& s0, __m128i& s1, __m128i m, const uint32_t* k)
+{
+    const __m128i msg = _mm_add_epi32(m, _mm_load_si128((const __m128i*)k));
+    s1 = _mm_sha256rnds2_epu32(s1, s0, msg);
+    s0 = _mm_sha256rnds2_epu32(s0, s1, _mm_shuffle_epi32(msg, 0x0e));
+}
+
+/** Start the schedule for m0's successor four blocks ahead. */
+void inline __attribute__((always_inline)) ShiftMessageA(__m128i& m0, __m128i m1)
+{
+    m0 = _mm_sha256msg1_epu32(m0, m1);
+}
+
+/** Finish the schedule for m2 from the two preceding message vectors. */
+void inline __attribute__((always_inline)) ShiftMessageC(__m128i m0, __m128i m1, __m128i& m2)
+{
+    m2 = _mm_sha256msg2_epu32(_mm_add_epi32(m2, _mm_alignr_epi8(m1, m0, 4)), m1);
+}
+
+void inline __attribute__((always_inline)) ShiftMessageB(__m128i& m0, __m128i m1, __m128i& m2)
+{
+    ShiftMessageC(m0, m1, m2);
+    ShiftMessageA(m0, m1);
+}
+
+/** Convert ABCD/EFGH words into the ABEF/CDGH layout the instructions use. */
+void inline Shuffle(__m128i& s0, __m128i& s1)
+{
+    const __m128i t1 = _mm_shuffle_epi32(s0, 0xB1);
+    const __m128i t2 = _mm_shuffle_epi32(s1, 0x1B);
+    s0 = _mm_alignr_epi8(t1, t2, 0x08);
+    s1 = _mm_blend_epi16(t2, t1, 0xF0);
+}
+
+/** Inverse of Shuffle. */
+void inline Unshuffle(__m128i& s0, __m128i& s1)
+{
+    const __m128i t1 = _mm_shuffle_epi32(s0, 0x1B);
+    const __m128i t2 = _mm_shuffle_epi32(s1, 0xB1);
+    s0 = _mm_blend_epi16(t1, t2, 0xF0);
+    s1 = _mm_alignr_epi8(t2, t1, 0x08);
+}
+
+/** Compress one block into each of N independent (shuffled) states. The
+ *  lanes are processed in lockstep so that their instructions interleave
+ *  and hide the latency of sha256rnds2. */
+template<int N>
+void inline __attribute__((always_inline)) Compress(__m128i* s0, __m128i* s1, __m128i* m0, __m128i* m1, __m128i* m2, __m128i* m3)
+{
+    __m128i so0[N], so1[N];
+    for (int n = 0; n < N; ++n) { so0[n] = s0[n]; so1[n] = s1[n]; }
+
+    for (int n = 0; n < N; ++n) QuadRound(s0[n], s1[n], m0[n], K256 + 0);
+    for (int n = 0; n < N; ++n) QuadRound(s0[n], s1[n], m1[n], K256 + 4);
+    for (int n = 0; n < N; ++n) ShiftMessageA(m0[n], m1[n]);
+    for (int n = 0; n < N; ++n) QuadRound(s0[n], s1[n], m2[n], K256 + 8);
+    for (int n = 0; n < N; ++n) ShiftMessageA(m1[n], m2[n]);
+    for (int n = 0; n < N; ++n) QuadRound(s0[n], s1[n], m3[n], K256 + 12);
+    for (int i = 0; i < 2; ++i) {
+        const uint32_t* k = K256 + 16 + 16 * i;
+        for (int n = 0; n < N; ++n) ShiftMessageB(m2[n], m3[n], m0[n]);
+        for (int n = 0; n < N; ++n) QuadRound(s0[n], s1[n], m0[n], k + 0);
+        for (int n = 0; n < N; ++n) ShiftMessageB(m3[n], m0[n], m1[n]);
+        for (int n = 0; n < N; ++n) QuadRound(s0[n], s1[n], m1[n], k + 4);
+        for (int n = 0; n < N; ++n) ShiftMessageB(m0[n], m1[n], m2[n]);
+        for (int n = 0; n < N; ++n) QuadRound(s0[n], s1[n], m2[n], k + 8);
+        for (int n = 0; n < N; ++n) ShiftMessageB(m1[n], m2[n], m3[n]);
+        for (int n = 0; n < N; ++n) QuadRound(s0[n], s1[n], m3[n], k + 12);
+    }
+    for (int n = 0; n < N; ++n) ShiftMessageB(m2[n], m3[n], m0[n]);
+    for (int n = 0; n < N; ++n) QuadRound(s0[n], s1[n], m0[n], K256 + 48);
+    for (int n = 0; n < N; ++n) ShiftMessageB(m3[n], m0[n], m1[n]);
+    for (int n = 0; n < N; ++n) QuadRound(s0[n], s1[n], m1[n], K256 + 52);
+    for (int n = 0; n < N; ++n) ShiftMessageC(m0[n], m1[n], m2[n]);
+    for (int n = 0; n < N; ++n) QuadRound(s0[n], s1[n], m2[n], K256 + 56);
+    for (int n = 0; n < N; ++n) ShiftMessageC(m1[n], m2[n], m3[n]);
+    for (int n = 0; n < N; ++n) QuadRound(s0[n], s1[n], m3[n], K256 + 60);
+
+    for (int n = 0; n < N; ++n) {
+        s0[n] = _mm_add_epi32(s0[n], so0[n]);
+        s1[n] = _mm_add_epi32(s1[n], so1[n]);
+    }
+}
+
+/** Load the initial state, already shuffled. */
+void inline InitState(__m128i& s0, __m128i& s1)
+{
+    s0 = _mm_load_si128((const __m128i*)INIT);
+    s1 = _mm_load_si128((const __m128i*)(INIT + 4));
+    Shuffle(s0, s1);
+}
+
+} // namespace
+
+namespace sha256_shani {
+void Transform(uint32_t* s, const unsigned char* chunk, size_t blocks)
+{
+    __m128i s0 = _mm_loadu_si128((const __m128i*)s);
+    __m128i s1 = _mm_loadu_si128((const __m128i*)(s + 4));
+    Shuffle(s0, s1);
+
+    while (blocks--) {
+        __m128i m0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)chunk), Mask());
+        __m128i m1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(chunk + 16)), Mask());
+        __m128i m2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(chunk + 32)), Mask());
+        __m128i m3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(chunk + 48)), Mask());
+        Compress<1>(&s0, &s1, &m0, &m1, &m2, &m3);
+        chunk += 64;
+    }
+
+    Unshuffle(s0, s1);
+    _mm_storeu_si128((__m128i*)s, s0);
+    _mm_storeu_si128((__m128i*)(s + 4), s1);
+}
+}
+
+namespace sha256d64_shani {
+/** Compute the double SHA256 of two 64-byte inputs at once. */
+void Transform_2way(unsigned char* out, const unsigned char* in)
+{
+    __m128i s0[2], s1[2], m0[2], m1[2], m2[2], m3[2];
+
+    // First hash, message block.
+    for (int n = 0; n < 2; ++n) {
+        InitState(s0[n], s1[n]);
+        m0[n] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(in + 64 * n)), Mask());
+        m1[n] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(in + 64 * n + 16)), Mask());
+        m2[n] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(in + 64 * n + 32)), Mask());
+        m3[n] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(in + 64 * n + 48)), Mask());
+    }
+    Compress<2>(s0, s1, m0, m1, m2, m3);
+
+    // First hash, padding block for a 512-bit message.
+    for (int n = 0; n < 2; ++n) {
+        m0[n] = _mm_set_epi32(0, 0, 0, 0x80000000);
+        m1[n] = _mm_setzero_si128();
+        m2[n] = _mm_setzero_si128();
+        m3[n] = _mm_set_epi32(0x200, 0, 0, 0);
+    }
+    Compress<2>(s0, s1, m0, m1, m2, m3);
+
+    // Second hash over the 256-bit digest, in a single padded block.
+    for (int n = 0; n < 2; ++n) {
+        m0[n] = s0[n];
+        m1[n] = s1[n];
+        Unshuffle(m0[n], m1[n]);
+        m2[n] = _mm_set_epi32(0, 0, 0, 0x80000000);
+        m3[n] = _mm_set_epi32(0x100, 0, 0, 0);
+        InitState(s0[n], s1[n]);
+    }
+    Compress<2>(s0, s1, m0, m1, m2, m3);
+
+    for (int n = 0; n < 2; ++n) {
+        Unshuffle(s0[n], s1[n]);
+        _mm_storeu_si128((__m128i*)(out + 32 * n), _mm_shuffle_epi8(s0[n], Mask()));
+        _mm_storeu_si128((__m128i*)(out + 32 * n + 16), _mm_shuffle_epi8(s1[n], Mask()));
+    }
+}
+}
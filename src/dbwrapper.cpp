@@ -12,13 +12,32 @@
 #include <leveldb/filter_policy.h>
 #include <memenv.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <string.h>
 #include <algorithm>
+#include <map>
+#include <mutex>
+#include <set>
+#include <sstream>
 
 class CBitcoinLevelDBLogger : public leveldb::Logger {
+private:
+    std::atomic<uint64_t>& nL0Stalls;
+    std::atomic<uint64_t>& nMemtableStalls;
+
 public:
+    CBitcoinLevelDBLogger(std::atomic<uint64_t>& nL0StallsIn, std::atomic<uint64_t>& nMemtableStallsIn) :
+        nL0Stalls(nL0StallsIn), nMemtableStalls(nMemtableStallsIn) {}
+
     // This code is adapted from posix_logger.h, which is why it is using vsprintf.
     // Please do not do this in normal code
     void Logv(const char * format, va_list ap) override {
+            // LevelDB only reports writes that have to wait for a compaction through its log
+            if (strcmp(format, "Too many L0 files; waiting...\n") == 0) {
+                nL0Stalls++;
+            } else if (strcmp(format, "Current memtable full; waiting...\n") == 0) {
+                nMemtableStalls++;
+            }
             if (!LogAcceptCategory(BCLog::LEVELDB)) {
                 return;
             }
@@ -72,15 +91,109 @@ public:
     }
 };
 
-static leveldb::Options GetOptions(size_t nCacheSize)
+/** Block cache that counts its hits and misses */
+class CCountingCache : public leveldb::Cache {
+private:
+    leveldb::Cache* base;
+    std::atomic<uint64_t>& nHits;
+    std::atomic<uint64_t>& nMisses;
+
+public:
+    CCountingCache(leveldb::Cache* baseIn, std::atomic<uint64_t>& nHitsIn, std::atomic<uint64_t>& nMissesIn) :
+        base(baseIn), nHits(nHitsIn), nMisses(nMissesIn) {}
+    ~CCountingCache() { delete base; }
+
+    Handle* Insert(const leveldb::Slice& key, void* value, size_t charge, void (*deleter)(const leveldb::Slice& key, void* value)) override
+    {
+        return base->Insert(key, value, charge, deleter);
+    }
+    Handle* Lookup(const leveldb::Slice& key) override
+    {
+        Handle* handle = base->Lookup(key);
+        (handle ? nHits : nMisses)++;
+        return handle;
+    }
+    void Release(Handle* handle) override { base->Release(handle); }
+    void* Value(Handle* handle) override { return base->Value(handle); }
+    void Erase(const leveldb::Slice& key) override { base->Erase(key); }
+    uint64_t NewId() override { return base->NewId(); }
+    void Prune() override { base->Prune(); }
+    size_t TotalCharge() const override { return base->TotalCharge(); }
+};
+
+//! The default profile is the one every database used before profiles existed
+static const CDBProfile DB_PROFILES[] = {
+    // name       block cache  write buffer  open files  file size
+    {"default",   4,           2,            64,         2 << 20},
+    // Most of the cache for reading, and more table files kept open
+    {"read",      6,           1,            256,        2 << 20},
+    // Bigger write buffers and table files, for fewer and larger compactions, e.g. during IBD
+    {"write",     2,           3,            64,         8 << 20},
+};
+
+static const char* const DB_NAMES[] = {"chainstate", "index", "checkpoint", "alertdb"};
+
+static std::map<std::string, const CDBProfile*> mapDBProfiles;
+
+const CDBProfile& GetDBProfile(const std::string& strDB)
+{
+    auto it = mapDBProfiles.find(strDB);
+    return it == mapDBProfiles.end() ? DB_PROFILES[0] : *it->second;
+}
+
+bool InitDBProfiles(std::string& strError)
+{
+    mapDBProfiles.clear();
+    for (const std::string& strArg : gArgs.GetArgs("-dbprofile")) {
+        size_t nSep = strArg.find(':');
+        const std::string strDB = strArg.substr(0, nSep);
+        const std::string strProfile = nSep == std::string::npos ? "" : strArg.substr(nSep + 1);
+        if (std::find(std::begin(DB_NAMES), std::end(DB_NAMES), strDB) == std::end(DB_NAMES)) {
+            strError = strprintf("Unknown database in -dbprofile=%s", strArg);
+            return false;
+        }
+        auto it = std::find_if(std::begin(DB_PROFILES), std::end(DB_PROFILES), [&](const CDBProfile& profile) { return profile.strName == strProfile; });
+        if (it == std::end(DB_PROFILES)) {
+            strError = strprintf("Unknown profile in -dbprofile=%s", strArg);
+            return false;
+        }
+        mapDBProfiles[strDB] = &*it;
+    }
+    return true;
+}
+
+int GetDBProfilesExtraOpenFiles()
+{
+    int nFiles = 0;
+    for (const auto& entry : mapDBProfiles) {
+        nFiles += std::max(0, entry.second->nMaxOpenFiles - DB_PROFILES[0].nMaxOpenFiles);
+    }
+    return nFiles;
+}
+
+static std::mutex csDBWrappers;
+//! Open databases, for GetDBStats()
+static std::set<const CDBWrapper*> setDBWrappers;
+
+std::vector<CDBStats> GetDBStats()
+{
+    std::vector<CDBStats> vStats;
+    std::lock_guard<std::mutex> lock(csDBWrappers);
+    for (const CDBWrapper* pdbwrapper : setDBWrappers) {
+        vStats.push_back(pdbwrapper->GetStats());
+    }
+    return vStats;
+}
+
+static leveldb::Options GetOptions(size_t nCacheSize, const CDBProfile& profile)
 {
     leveldb::Options options;
-    options.block_cache = leveldb::NewLRUCache(nCacheSize / 2);
-    options.write_buffer_size = nCacheSize / 4; // up to two write buffers may be held in memory simultaneously
+    options.block_cache = leveldb::NewLRUCache(nCacheSize * profile.nBlockCacheEighths / 8);
+    options.write_buffer_size = nCacheSize * profile.nWriteBufferEighths / 8; // up to two write buffers may be held in memory simultaneously
     options.filter_policy = leveldb::NewBloomFilterPolicy(10);
     options.compression = leveldb::kNoCompression;
-    options.max_open_files = 64;
-    options.info_log = new CBitcoinLevelDBLogger();
+    options.max_open_files = profile.nMaxOpenFiles;
+    options.max_file_size = profile.nMaxFileSize;
     if (leveldb::kMajorVersion > 1 || (leveldb::kMajorVersion == 1 && leveldb::kMinorVersion >= 16)) {
         // LevelDB versions before 1.16 consider short writes to be corruption. Only trigger error
         // on corruption in later versions.
@@ -89,14 +202,18 @@ static leveldb::Options GetOptions(size_t nCacheSize)
     return options;
 }
 
-CDBWrapper::CDBWrapper(const fs::path& path, size_t nCacheSize, bool fMemory, bool fWipe, bool obfuscate, leveldb::Comparator *pComparator)
+CDBWrapper::CDBWrapper(const fs::path& path, size_t nCacheSize, bool fMemory, bool fWipe, bool obfuscate, leveldb::Comparator *pComparator) :
+    name(path.filename().string()), profile(GetDBProfile(name)),
+    nCacheHits(0), nCacheMisses(0), nWriteBatches(0), nSyncWrites(0), nWriteMicros(0), nMaxWriteMicros(0), nL0Stalls(0), nMemtableStalls(0)
 {
     penv = nullptr;
     readoptions.verify_checksums = true;
     iteroptions.verify_checksums = true;
     iteroptions.fill_cache = false;
     syncoptions.sync = true;
-    options = GetOptions(nCacheSize);
+    options = GetOptions(nCacheSize, profile);
+    options.block_cache = new CCountingCache(options.block_cache, nCacheHits, nCacheMisses);
+    options.info_log = new CBitcoinLevelDBLogger(nL0Stalls, nMemtableStalls);
     options.create_if_missing = true;
     if(pComparator != NULL)
     {
@@ -114,6 +231,9 @@ CDBWrapper::CDBWrapper(const fs::path& path, size_t nCacheSize, bool fMemory, bo
         TryCreateDirectories(path);
         LogPrintf("Opening LevelDB in %s\n", path.string());
     }
+    if (&profile != &DB_PROFILES[0]) {
+        LogPrintf("Using the %s LevelDB profile for %s\n", profile.strName, name);
+    }
     leveldb::Status status = leveldb::DB::Open(options, path.string(), &pdb);
     dbwrapper_private::HandleError(status);
     LogPrintf("Opened LevelDB successfully\n");
@@ -142,10 +262,17 @@ CDBWrapper::CDBWrapper(const fs::path& path, size_t nCacheSize, bool fMemory, bo
     }
 
     LogPrintf("Using obfuscation key for %s: %s\n", path.string(), HexStr(obfuscate_key));
+
+    std::lock_guard<std::mutex> lock(csDBWrappers);
+    setDBWrappers.insert(this);
 }
 
 CDBWrapper::~CDBWrapper()
 {
+    {
+        std::lock_guard<std::mutex> lock(csDBWrappers);
+        setDBWrappers.erase(this);
+    }
     delete pdb;
     pdb = nullptr;
     delete options.filter_policy;
@@ -160,11 +287,53 @@ CDBWrapper::~CDBWrapper()
 
 bool CDBWrapper::WriteBatch(CDBBatch& batch, bool fSync)
 {
+    const int64_t nStart = GetTimeMicros();
     leveldb::Status status = pdb->Write(fSync ? syncoptions : writeoptions, &batch.batch);
+    const int64_t nTime = GetTimeMicros() - nStart;
+    nWriteBatches++;
+    if (fSync)
+        nSyncWrites++;
+    nWriteMicros += nTime;
+    int64_t nMax = nMaxWriteMicros.load();
+    while (nTime > nMax && !nMaxWriteMicros.compare_exchange_weak(nMax, nTime)) {}
     dbwrapper_private::HandleError(status);
     return true;
 }
 
+CDBStats CDBWrapper::GetStats() const
+{
+    CDBStats stats;
+    stats.strName = name;
+    stats.strProfile = profile.strName;
+    stats.nBlockCacheSize = options.block_cache->TotalCharge();
+    stats.nWriteBufferSize = options.write_buffer_size;
+    stats.nMaxOpenFiles = options.max_open_files;
+    stats.nCacheHits = nCacheHits;
+    stats.nCacheMisses = nCacheMisses;
+    stats.nWriteBatches = nWriteBatches;
+    stats.nSyncWrites = nSyncWrites;
+    stats.nWriteMicros = nWriteMicros;
+    stats.nMaxWriteMicros = nMaxWriteMicros;
+    stats.nL0Stalls = nL0Stalls;
+    stats.nMemtableStalls = nMemtableStalls;
+
+    std::string strValue;
+    stats.nMemoryUsage = pdb->GetProperty("leveldb.approximate-memory-usage", &strValue) ? atoi64(strValue) : 0;
+    if (pdb->GetProperty("leveldb.stats", &strValue)) {
+        // A line per level with files or compactions, after three header lines
+        std::istringstream stream(strValue);
+        std::string strLine;
+        while (std::getline(stream, strLine)) {
+            CDBLevelStats level;
+            if (sscanf(strLine.c_str(), "%d %d %lf %lf %lf %lf", &level.nLevel, &level.nFiles, &level.dSizeMiB,
+                       &level.dCompactionSeconds, &level.dReadMiB, &level.dWrittenMiB) == 6) {
+                stats.vLevels.push_back(level);
+            }
+        }
+    }
+    return stats;
+}
+
 // Prefixed with null character to avoid collisions with other keys
 //
 // We must use a string constructor which specifies length so that we copy
@@ -16,6 +16,10 @@
 #include <leveldb/db.h>
 #include <leveldb/write_batch.h>
 
+#include <atomic>
+#include <string>
+#include <vector>
+
 static const size_t DBWRAPPER_PREALLOC_KEY_SIZE = 64;
 static const size_t DBWRAPPER_PREALLOC_VALUE_SIZE = 1024;
 
@@ -27,6 +31,64 @@ public:
 
 class CDBWrapper;
 
+/**
+ * LevelDB tuning for one database, selected with -dbprofile=<db>:<profile>
+ * where <db> is the name of the database's directory.
+ */
+struct CDBProfile
+{
+    std::string strName;
+    //! Share of the database's cache used for the block cache, in eighths
+    int nBlockCacheEighths;
+    //! Share used for the write buffer, in eighths; up to two are held in memory
+    int nWriteBufferEighths;
+    int nMaxOpenFiles;
+    //! Size at which table files are split
+    size_t nMaxFileSize;
+};
+
+/** The profile -dbprofile selects for a database, or the default one */
+const CDBProfile& GetDBProfile(const std::string& strDB);
+/** Check and apply -dbprofile. Returns false with an error message for unknown profiles. */
+bool InitDBProfiles(std::string& strError);
+/** Number of files the selected profiles may keep open on top of the default ones */
+int GetDBProfilesExtraOpenFiles();
+
+/** Per-level compaction statistics of a database, as reported by LevelDB */
+struct CDBLevelStats
+{
+    int nLevel;
+    int nFiles;
+    double dSizeMiB;
+    double dCompactionSeconds;
+    double dReadMiB;
+    double dWrittenMiB;
+};
+
+/** Settings and activity of an open database since it was opened */
+struct CDBStats
+{
+    std::string strName;
+    std::string strProfile;
+    size_t nBlockCacheSize;
+    size_t nWriteBufferSize;
+    int nMaxOpenFiles;
+    uint64_t nMemoryUsage;
+    uint64_t nCacheHits;
+    uint64_t nCacheMisses;
+    uint64_t nWriteBatches;
+    uint64_t nSyncWrites;
+    int64_t nWriteMicros;
+    int64_t nMaxWriteMicros;
+    //! Writes that waited for a level 0 compaction or a memtable flush to finish
+    uint64_t nL0Stalls;
+    uint64_t nMemtableStalls;
+    std::vector<CDBLevelStats> vLevels;
+};
+
+/** Statistics of all open databases */
+std::vector<CDBStats> GetDBStats();
+
 /** These should be considered an implementation detail of the specific database.
  */
 namespace dbwrapper_private {
@@ -198,6 +260,21 @@ private:
     //! the database itself
     leveldb::DB* pdb;
 
+    //! name of the database's directory, which selects its profile
+    std::string name;
+
+    const CDBProfile& profile;
+
+    //! counters for GetStats()
+    std::atomic<uint64_t> nCacheHits;
+    std::atomic<uint64_t> nCacheMisses;
+    std::atomic<uint64_t> nWriteBatches;
+    std::atomic<uint64_t> nSyncWrites;
+    std::atomic<int64_t> nWriteMicros;
+    std::atomic<int64_t> nMaxWriteMicros;
+    std::atomic<uint64_t> nL0Stalls;
+    std::atomic<uint64_t> nMemtableStalls;
+
     //! a key used for optional XOR-obfuscation of the database
     std::vector<unsigned char> obfuscate_key;
 
@@ -306,6 +383,8 @@ public:
      */
     bool IsEmpty();
 
+    CDBStats GetStats() const;
+
     template<typename K>
     size_t EstimateSize(const K& key_begin, const K& key_end) const
     {
@@ -0,0 +1,386 @@
+// Copyright (c) 2018 The Monacoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_FLATMAP_H
+#define BITCOIN_FLATMAP_H
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <iterator>
+#include <limits>
+#include <new>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/** Hash map for many small entries, with the interface of std::unordered_map
+ *  as far as the coins cache uses it.
+ *
+ *  The entries live in a pool of chunks that grow geometrically up to
+ *  CHUNK_MAX slots each and are never moved, so that like with
+ *  std::unordered_map, pointers and references to entries (and iterators)
+ *  stay valid until the entry is erased. Erased slots are reused by later
+ *  insertions. Entries are found through an open addressing table (linear
+ *  probing, backward shift deletion) of 32-bit hashes and slot numbers, so
+ *  that a lookup touches one cache line of the table and the entry itself,
+ *  rather than a bucket and a chain of individually allocated nodes.
+ *
+ *  Erasing during iteration is supported as with std::unordered_map (erase
+ *  returns the next iterator); inserting during iteration may or may not
+ *  visit the new entry. At most 2^32 - 1 entries are supported.
+ */
+template <typename K, typename T, typename Hash>
+class flatmap
+{
+public:
+    typedef K key_type;
+    typedef T mapped_type;
+    typedef std::pair<const K, T> value_type;
+    typedef size_t size_type;
+    typedef Hash hasher;
+
+private:
+    typedef typename std::aligned_storage<sizeof(value_type), alignof(value_type)>::type Slot;
+
+    //! An entry of the table: the low 32 bits of the key's hash, and 1 + its slot number (0 for none)
+    struct Bucket {
+        uint32_t hash;
+        uint32_t pos;
+    };
+
+    static const uint32_t NO_POS = std::numeric_limits<uint32_t>::max();
+    //! The first chunk holds CHUNK_MIN slots, every next one twice as many up to CHUNK_MAX
+    static const uint32_t CHUNK_MIN_BITS = 4;
+    static const uint32_t CHUNK_MAX_BITS = 16;
+    static const uint32_t CHUNK_MIN = 1 << CHUNK_MIN_BITS;
+    static const uint32_t CHUNK_MAX = 1 << CHUNK_MAX_BITS;
+    //! Slots in the chunks that grow geometrically
+    static const uint32_t GROWING_SLOTS = CHUNK_MAX * 2 - CHUNK_MIN;
+    static const size_t MIN_BUCKETS = 16;
+    static_assert(sizeof(Slot) >= sizeof(uint32_t), "erased slots hold the next one in the free list");
+
+    Hash m_hash;
+    std::vector<Slot*> m_chunks;
+    //! Bit per slot, set if it holds an entry
+    std::vector<uint64_t> m_used;
+    //! Slots ever taken, the ones at and after it are free
+    uint32_t m_slots;
+    //! First of the erased slots, which hold the next one in the list
+    uint32_t m_free;
+    size_t m_size;
+    Bucket* m_buckets;
+    size_t m_mask;
+
+    static size_t ChunkSize(size_t chunk)
+    {
+        return chunk < CHUNK_MAX_BITS - CHUNK_MIN_BITS ? (size_t)CHUNK_MIN << chunk : CHUNK_MAX;
+    }
+
+    Slot* SlotAt(uint32_t pos) const
+    {
+        if (pos < GROWING_SLOTS) {
+            // Chunk c starts at slot CHUNK_MIN * (2^c - 1)
+            uint32_t n = (pos >> CHUNK_MIN_BITS) + 1;
+            int chunk = 31 - __builtin_clz(n);
+            return m_chunks[chunk] + (pos - ((CHUNK_MIN << chunk) - CHUNK_MIN));
+        }
+        pos -= GROWING_SLOTS;
+        return m_chunks[(CHUNK_MAX_BITS - CHUNK_MIN_BITS + 1) + (pos >> CHUNK_MAX_BITS)] + (pos & (CHUNK_MAX - 1));
+    }
+
+    value_type* ValueAt(uint32_t pos) const { return reinterpret_cast<value_type*>(SlotAt(pos)); }
+    uint32_t& NextFreeAt(uint32_t pos) const { return *reinterpret_cast<uint32_t*>(SlotAt(pos)); }
+
+    bool IsUsed(uint32_t pos) const { return (m_used[pos >> 6] >> (pos & 63)) & 1; }
+    void SetUsed(uint32_t pos) { m_used[pos >> 6] |= uint64_t{1} << (pos & 63); }
+    void SetFree(uint32_t pos) { m_used[pos >> 6] &= ~(uint64_t{1} << (pos & 63)); }
+
+    //! First slot holding an entry at or after pos, or NO_POS
+    uint32_t NextUsed(uint32_t pos) const
+    {
+        while (pos < m_slots) {
+            uint64_t word = m_used[pos >> 6] >> (pos & 63);
+            if (word) {
+                pos += __builtin_ctzll(word);
+                return pos < m_slots ? pos : NO_POS;
+            }
+            pos = (pos | 63) + 1;
+        }
+        return NO_POS;
+    }
+
+    //! A free slot, making room for one if needed. It is only taken by TakeSlot.
+    uint32_t ReserveSlot()
+    {
+        if (m_free != NO_POS) {
+            return m_free;
+        }
+        assert(m_slots < NO_POS);
+        if (m_slots == Capacity()) {
+            // Grow everything before adding the chunk, so that nothing is left half done if that throws
+            const size_t chunk_size = ChunkSize(m_chunks.size());
+            m_used.resize((Capacity() + chunk_size + 63) / 64);
+            m_chunks.reserve(m_chunks.size() + 1);
+            m_chunks.push_back(new Slot[chunk_size]);
+        }
+        return m_slots;
+    }
+
+    //! Take the slot returned by ReserveSlot, whose next free slot (if it was erased) is next_free
+    void TakeSlot(uint32_t pos, uint32_t next_free)
+    {
+        if (pos == m_free) {
+            m_free = next_free;
+        } else {
+            m_slots++;
+        }
+        SetUsed(pos);
+    }
+
+    void FreeSlot(uint32_t pos)
+    {
+        SetFree(pos);
+        NextFreeAt(pos) = m_free;
+        m_free = pos;
+    }
+
+    size_t Capacity() const
+    {
+        size_t capacity = 0;
+        if (!m_chunks.empty()) {
+            size_t last = m_chunks.size() - 1;
+            capacity = last < CHUNK_MAX_BITS - CHUNK_MIN_BITS + 1 ? (CHUNK_MIN << (last + 1)) - CHUNK_MIN : GROWING_SLOTS + (last - (CHUNK_MAX_BITS - CHUNK_MIN_BITS)) * CHUNK_MAX;
+        }
+        return capacity;
+    }
+
+    //! The bucket of key, or the empty one where it would go
+    Bucket* FindBucket(const K& key, size_t hash) const
+    {
+        const uint32_t hash32 = (uint32_t)hash;
+        for (size_t i = hash & m_mask; ; i = (i + 1) & m_mask) {
+            Bucket* bucket = m_buckets + i;
+            if (bucket->pos == 0 || (bucket->hash == hash32 && ValueAt(bucket->pos - 1)->first == key)) {
+                return bucket;
+            }
+        }
+    }
+
+    void Rehash(size_t buckets)
+    {
+        Bucket* old_buckets = m_buckets;
+        size_t old_count = m_buckets ? m_mask + 1 : 0;
+        m_buckets = new Bucket[buckets]();
+        m_mask = buckets - 1;
+        for (size_t i = 0; i < old_count; i++) {
+            if (old_buckets[i].pos) {
+                size_t j = old_buckets[i].hash & m_mask;
+                while (m_buckets[j].pos) {
+                    j = (j + 1) & m_mask;
+                }
+                m_buckets[j] = old_buckets[i];
+            }
+        }
+        delete[] old_buckets;
+    }
+
+    void EraseBucket(Bucket* bucket)
+    {
+        size_t i = bucket - m_buckets;
+        m_buckets[i].pos = 0;
+        // Move back the entries after it that would otherwise no longer be found
+        for (size_t j = (i + 1) & m_mask; m_buckets[j].pos; j = (j + 1) & m_mask) {
+            size_t ideal = m_buckets[j].hash & m_mask;
+            if (((j - ideal) & m_mask) >= ((j - i) & m_mask)) {
+                m_buckets[i] = m_buckets[j];
+                m_buckets[j].pos = 0;
+                i = j;
+            }
+        }
+    }
+
+    template <bool Const>
+    class iterator_base
+    {
+        friend class flatmap;
+        template <bool> friend class iterator_base;
+        typedef typename std::conditional<Const, const flatmap*, flatmap*>::type map_pointer;
+        map_pointer m_map;
+        uint32_t m_pos;
+
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef typename std::conditional<Const, const typename flatmap::value_type, typename flatmap::value_type>::type value_type;
+        typedef ptrdiff_t difference_type;
+        typedef value_type* pointer;
+        typedef value_type& reference;
+
+        iterator_base() : m_map(nullptr), m_pos(NO_POS) {}
+        iterator_base(map_pointer map, uint32_t pos) : m_map(map), m_pos(pos) {}
+        template <bool C = Const, typename std::enable_if<C, int>::type = 0>
+        iterator_base(const iterator_base<false>& it) : m_map(it.m_map), m_pos(it.m_pos) {}
+
+        reference operator*() const { return *m_map->ValueAt(m_pos); }
+        pointer operator->() const { return m_map->ValueAt(m_pos); }
+        iterator_base& operator++() { m_pos = m_map->NextUsed(m_pos + 1); return *this; }
+        iterator_base operator++(int) { iterator_base copy(*this); ++(*this); return copy; }
+        bool operator==(const iterator_base& other) const { return m_pos == other.m_pos; }
+        bool operator!=(const iterator_base& other) const { return m_pos != other.m_pos; }
+    };
+
+public:
+    typedef iterator_base<false> iterator;
+    typedef iterator_base<true> const_iterator;
+
+    flatmap() : m_slots(0), m_free(NO_POS), m_size(0), m_buckets(nullptr), m_mask(0) {}
+    flatmap(flatmap&& other) : m_hash(other.m_hash), m_chunks(std::move(other.m_chunks)), m_used(std::move(other.m_used)),
+        m_slots(other.m_slots), m_free(other.m_free), m_size(other.m_size), m_buckets(other.m_buckets), m_mask(other.m_mask)
+    {
+        other.m_chunks.clear();
+        other.m_used.clear();
+        other.m_slots = 0;
+        other.m_free = NO_POS;
+        other.m_size = 0;
+        other.m_buckets = nullptr;
+        other.m_mask = 0;
+    }
+    flatmap(const flatmap&) = delete;
+    flatmap& operator=(const flatmap&) = delete;
+    ~flatmap() { clear(); }
+
+    iterator begin() { return iterator(this, NextUsed(0)); }
+    const_iterator begin() const { return const_iterator(this, NextUsed(0)); }
+    iterator end() { return iterator(this, NO_POS); }
+    const_iterator end() const { return const_iterator(this, NO_POS); }
+
+    bool empty() const { return m_size == 0; }
+    size_type size() const { return m_size; }
+    const hasher& hash_function() const { return m_hash; }
+
+    //! Fetch the table entry for a key hashing to hash into the CPU caches, ahead of find(key, hash).
+    void prefetch(size_t hash) const
+    {
+        if (m_buckets) {
+            __builtin_prefetch(m_buckets + (hash & m_mask));
+        }
+    }
+
+    iterator find(const K& key, size_t hash)
+    {
+        if (!m_buckets) {
+            return end();
+        }
+        Bucket* bucket = FindBucket(key, hash);
+        return iterator(this, bucket->pos ? bucket->pos - 1 : NO_POS);
+    }
+    const_iterator find(const K& key, size_t hash) const { return const_cast<flatmap*>(this)->find(key, hash); }
+    iterator find(const K& key) { return find(key, m_hash(key)); }
+    const_iterator find(const K& key) const { return find(key, m_hash(key)); }
+    size_type count(const K& key) const { return find(key) != end(); }
+
+    template <typename... Args>
+    std::pair<iterator, bool> emplace(Args&&... args)
+    {
+        // Make room first, so that only the entry's constructor can throw
+        // once it is constructed in a slot
+        if (!m_buckets || (m_size + 1) * 4 > (m_mask + 1) * 3) {
+            Rehash(m_buckets ? (m_mask + 1) * 2 : MIN_BUCKETS);
+        }
+        const uint32_t pos = ReserveSlot();
+        // An erased slot holds the next free one, which the entry overwrites
+        const uint32_t next_free = pos == m_free ? NextFreeAt(pos) : NO_POS;
+        // Like std::unordered_map, construct the entry before looking for its key
+        value_type* value;
+        try {
+            value = new (SlotAt(pos)) value_type(std::forward<Args>(args)...);
+        } catch (...) {
+            if (pos == m_free) {
+                NextFreeAt(pos) = next_free;
+            }
+            throw;
+        }
+        const size_t hash = m_hash(value->first);
+        Bucket* bucket = FindBucket(value->first, hash);
+        if (bucket->pos) {
+            value->~value_type();
+            if (pos == m_free) {
+                NextFreeAt(pos) = next_free;
+            }
+            return std::make_pair(iterator(this, bucket->pos - 1), false);
+        }
+        TakeSlot(pos, next_free);
+        bucket->hash = (uint32_t)hash;
+        bucket->pos = pos + 1;
+        m_size++;
+        return std::make_pair(iterator(this, pos), true);
+    }
+
+    T& operator[](const K& key)
+    {
+        iterator it = find(key);
+        if (it == end()) {
+            it = emplace(std::piecewise_construct, std::forward_as_tuple(key), std::tuple<>()).first;
+        }
+        return it->second;
+    }
+
+    iterator erase(const_iterator it)
+    {
+        const uint32_t pos = it.m_pos;
+        value_type* value = ValueAt(pos);
+        EraseBucket(FindBucket(value->first, m_hash(value->first)));
+        value->~value_type();
+        FreeSlot(pos);
+        m_size--;
+        return iterator(this, NextUsed(pos + 1));
+    }
+    iterator erase(iterator it) { return erase(const_iterator(it)); }
+
+    size_type erase(const K& key)
+    {
+        const_iterator it = find(key);
+        if (it == end()) {
+            return 0;
+        }
+        erase(it);
+        return 1;
+    }
+
+    void clear()
+    {
+        for (uint32_t pos = NextUsed(0); pos != NO_POS; pos = NextUsed(pos + 1)) {
+            ValueAt(pos)->~value_type();
+        }
+        for (Slot* chunk : m_chunks) {
+            delete[] chunk;
+        }
+        m_chunks.clear();
+        m_chunks.shrink_to_fit();
+        m_used.clear();
+        m_used.shrink_to_fit();
+        m_slots = 0;
+        m_free = NO_POS;
+        m_size = 0;
+        delete[] m_buckets;
+        m_buckets = nullptr;
+        m_mask = 0;
+    }
+
+    //! The sizes of the map's allocations, to be passed through memusage::MallocUsage
+    template <typename F>
+    void ForEachAllocation(F f) const
+    {
+        for (size_t chunk = 0; chunk < m_chunks.size(); chunk++) {
+            f(ChunkSize(chunk) * sizeof(Slot));
+        }
+        if (m_chunks.capacity()) f(m_chunks.capacity() * sizeof(Slot*));
+        if (m_used.capacity()) f(m_used.capacity() * sizeof(uint64_t));
+        if (m_buckets) f((m_mask + 1) * sizeof(Bucket));
+    }
+};
+
+#endif // BITCOIN_FLATMAP_H
@@ -181,6 +181,31 @@ public:
     }
 };
 
+/** Writes data to an underlying stream, while hashing the written data. */
+template<typename Dest>
+class CHashingWriter : public CHashWriter
+{
+private:
+    Dest* dest;
+
+public:
+    explicit CHashingWriter(Dest* dest_) : CHashWriter(dest_->GetType(), dest_->GetVersion()), dest(dest_) {}
+
+    void write(const char* pch, size_t nSize)
+    {
+        dest->write(pch, nSize);
+        CHashWriter::write(pch, nSize);
+    }
+
+    template<typename T>
+    CHashingWriter<Dest>& operator<<(const T& obj)
+    {
+        // Serialize to this stream
+        ::Serialize(*this, obj);
+        return (*this);
+    }
+};
+
 /** Compute the 256-bit hash of an object's serialization. */
 template<typename T>
 uint256 SerializeHash(const T& obj, int nType=SER_GETHASH, int nVersion=PROTOCOL_VERSION)
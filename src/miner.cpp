@@ -15,6 +15,7 @@
 #include <consensus/validation.h>
 #include <hash.h>
 #include <crypto/scrypt.h>
+#include <crypto/Lyra2RE/Lyra2RE.h>
 #include <validation.h>
 #include <net.h>
 #include <policy/feerate.h>
@@ -25,11 +26,15 @@
 #include <timedata.h>
 #include <util.h>
 #include <utilmoneystr.h>
+#include <utilstrencodings.h>
 #include <validationinterface.h>
 
 #include <algorithm>
+#include <atomic>
 #include <memory>
 #include <queue>
+#include <string.h>
+#include <thread>
 #include <utility>
 
 //////////////////////////////////////////////////////////////////////////////
@@ -457,3 +462,56 @@ void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned
     pblock->vtx[0] = MakeTransactionRef(std::move(txCoinbase));
     pblock->hashMerkleRoot = BlockMerkleRoot(*pblock);
 }
+
+//! Number of nonces a ScanPoWNonces() thread takes at a time
+static const uint32_t SCAN_NONCE_CHUNK = 16;
+
+bool ScanPoWNonces(CBlock* pblock, uint32_t nNonceEnd, int nThreads, int nHeight, bool fLyra2REv2, const Consensus::Params& consensusParams)
+{
+    const CBlockHeader header = pblock->GetBlockHeader();
+    // Chunks are handed out in increasing order, and a thread only gives up
+    // once the next chunk lies above the best nonce found so far, so every
+    // nonce below the result has been checked.
+    std::atomic<uint64_t> nNextNonce(header.nNonce);
+    std::atomic<uint64_t> nBestNonce(std::max(nNonceEnd, header.nNonce));
+
+    auto scan = [&]() {
+        CBlockHeader work(header);
+        char hashes[32 * SCAN_NONCE_CHUNK];
+        while (true) {
+            const uint64_t nStart = nNextNonce.fetch_add(SCAN_NONCE_CHUNK);
+            if (nStart >= nBestNonce.load())
+                break;
+            const uint32_t nCount = std::min<uint64_t>(SCAN_NONCE_CHUNK, nNonceEnd - nStart);
+            if (fLyra2REv2) {
+                lyra2re2_hash_nonces(BEGIN(work.nVersion), nStart, hashes, nCount);
+            } else {
+                for (uint32_t i = 0; i < nCount; i++) {
+                    work.nNonce = nStart + i;
+                    scrypt_1024_1_1_256(BEGIN(work.nVersion), hashes + 32 * i);
+                }
+            }
+            for (uint32_t i = 0; i < nCount; i++) {
+                uint256 hash;
+                memcpy(hash.begin(), hashes + 32 * i, 32);
+                if (CheckProofOfWork(hash, header.nBits, nHeight, consensusParams)) {
+                    uint64_t nBest = nBestNonce.load();
+                    while (nStart + i < nBest && !nBestNonce.compare_exchange_weak(nBest, nStart + i)) {}
+                    break;
+                }
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int i = 1; i < nThreads; i++) {
+        threads.emplace_back(scan);
+    }
+    scan();
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+
+    pblock->nNonce = nBestNonce.load();
+    return pblock->nNonce < nNonceEnd;
+}
@@ -21,6 +21,8 @@ class CScript;
 namespace Consensus { struct Params; };
 
 static const bool DEFAULT_PRINTPRIORITY = false;
+/** Default for -genthreads, the number of threads the generate RPCs grind nonces on */
+static const int DEFAULT_GENERATE_THREADS = 1;
 
 struct CBlockTemplate
 {
@@ -195,5 +197,12 @@ private:
 /** Modify the extranonce in a block */
 void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce);
 int64_t UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParams, const CBlockIndex* pindexPrev);
+/**
+ * Search the nonces of pblock from pblock->nNonce up to nNonceEnd (exclusive)
+ * for the lowest one that satisfies the proof of work, on nThreads threads.
+ * Sets pblock->nNonce to that nonce, or to nNonceEnd if there is none. The
+ * result does not depend on nThreads.
+ */
+bool ScanPoWNonces(CBlock* pblock, uint32_t nNonceEnd, int nThreads, int nHeight, bool fLyra2REv2, const Consensus::Params& consensusParams);
 
 #endif // BITCOIN_MINER_H
@@ -25,6 +25,7 @@
 #include <string.h>
 #else
 #include <fcntl.h>
+#include <sys/uio.h>
 #endif
 
 #ifdef USE_UPNP
@@ -43,6 +44,9 @@
 // We add a random period time (0 to 1 seconds) to feeler connections to prevent synchronization.
 #define FEELER_SLEEP_WINDOW 1
 
+// Maximum number of buffers passed to one send call, well below IOV_MAX
+#define MAX_SEND_PARTS 64
+
 #if !defined(HAVE_MSG_NOSIGNAL)
 #define MSG_NOSIGNAL 0
 #endif
@@ -449,12 +453,22 @@ CNode* CConnman::ConnectNode(CAddress addrConnect, const char *pszDest, bool fCo
         CloseSocket(hSocket);
         return nullptr;
     }
+    if (!socketEvents->IsUsable(hSocket)) {
+        LogPrintf("Cannot create connection: non-selectable socket created (fd >= FD_SETSIZE ?)\n");
+        CloseSocket(hSocket);
+        return nullptr;
+    }
 
     // Add node
     NodeId id = GetNewNodeId();
     uint64_t nonce = GetDeterministicRandomizer(RANDOMIZER_ID_LOCALHOSTNONCE).Write(id).Finalize();
     CAddress addr_bind = GetBindAddress(hSocket);
     CNode* pnode = new CNode(id, nLocalServices, GetBestHeight(), hSocket, addrConnect, CalculateKeyedNetGroup(addrConnect), nonce, addr_bind, pszDest ? pszDest : "", false);
+    if (!AddSocketEvents(pnode)) {
+        LogPrintf("Cannot create connection: could not wait on socket\n");
+        delete pnode;
+        return nullptr;
+    }
     pnode->AddRef();
 
     return pnode;
@@ -487,6 +501,13 @@ void CNode::CloseSocketDisconnect()
     if (hSocket != INVALID_SOCKET)
     {
         LogPrint(BCLog::NET, "disconnecting peer=%d\n", id);
+        // Stop waiting on the socket while it is still open: epoll only
+        // forgets a socket when every copy of it is closed, so it would
+        // keep reporting events for this node
+        if (pSocketEvents) {
+            pSocketEvents->Remove(hSocket, this);
+            pSocketEvents = nullptr;
+        }
         CloseSocket(hSocket);
     }
 }
@@ -744,10 +765,20 @@ bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes, bool& complete
     nRecvBytes += nBytes;
     while (nBytes > 0) {
 
-        // get current incomplete message, or create a new one
+        // get current incomplete message, or reuse or create a new one
         if (vRecvMsg.empty() ||
-            vRecvMsg.back().complete())
-            vRecvMsg.push_back(CNetMessage(Params().MessageStart(), SER_NETWORK, INIT_PROTO_VERSION));
+            vRecvMsg.back().complete()) {
+            bool fReused = false;
+            {
+                LOCK(cs_vRecvPool);
+                if (!vRecvPool.empty()) {
+                    vRecvMsg.splice(vRecvMsg.end(), vRecvPool, vRecvPool.begin());
+                    fReused = true;
+                }
+            }
+            if (!fReused)
+                vRecvMsg.push_back(CNetMessage(Params().MessageStart(), SER_NETWORK, INIT_PROTO_VERSION));
+        }
 
         CNetMessage& msg = vRecvMsg.back();
 
@@ -787,6 +818,38 @@ bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes, bool& complete
     return true;
 }
 
+char* CNode::GetRecvBuffer(size_t nMinSize, size_t& nSize)
+{
+    LOCK(cs_vRecv);
+    if (vRecvMsg.empty() || !vRecvMsg.back().in_data || vRecvMsg.back().complete())
+        return nullptr;
+    CNetMessage& msg = vRecvMsg.back();
+    size_t nRemaining = msg.hdr.nMessageSize - msg.nDataPos;
+    if (nRemaining < nMinSize)
+        return nullptr;
+    // Allocate up to 256 KiB ahead, like readData
+    nSize = std::min<size_t>(nRemaining, 256 * 1024);
+    if (msg.vRecv.size() < msg.nDataPos + nSize)
+        msg.vRecv.resize(msg.nDataPos + nSize);
+    return &msg.vRecv[msg.nDataPos];
+}
+
+void CNode::RecycleRecvMessages(std::list<CNetMessage>& msgs)
+{
+    for (auto it = msgs.begin(); it != msgs.end(); ) {
+        // Don't hold on to the memory of the occasional large message
+        if (it->hdr.nMessageSize > MAX_RECV_POOL_MESSAGE_SIZE) {
+            it = msgs.erase(it);
+        } else {
+            it->Reset();
+            ++it;
+        }
+    }
+    LOCK(cs_vRecvPool);
+    while (!msgs.empty() && vRecvPool.size() < MAX_RECV_POOL_MESSAGES)
+        vRecvPool.splice(vRecvPool.end(), msgs, msgs.begin());
+}
+
 void CNode::SetSendVersion(int nVersionIn)
 {
     // Send version may only be changed in the version message, and
@@ -856,12 +919,29 @@ int CNetMessage::readData(const char *pch, unsigned int nBytes)
     }
 
     hasher.Write((const unsigned char*)pch, nCopy);
-    memcpy(&vRecv[nDataPos], pch, nCopy);
+    // The data may have been received in place, see CNode::GetRecvBuffer
+    if (pch != &vRecv[nDataPos])
+        memcpy(&vRecv[nDataPos], pch, nCopy);
     nDataPos += nCopy;
 
     return nCopy;
 }
 
+void CNetMessage::Reset()
+{
+    // hdr is overwritten when the next header is complete
+    in_data = false;
+    hdrbuf.clear();
+    hdrbuf.resize(24);
+    nHdrPos = 0;
+    vRecv.clear();
+    nDataPos = 0;
+    nTime = 0;
+    hasher.Reset();
+    data_hash.SetNull();
+    SetVersion(INIT_PROTO_VERSION);
+}
+
 const uint256& CNetMessage::GetMessageHash() const
 {
     assert(complete());
@@ -885,27 +965,64 @@ size_t CConnman::SocketSendData(CNode *pnode) const
     size_t nSentSize = 0;
 
     while (it != pnode->vSendMsg.end()) {
-        const auto &data = *it;
-        assert(data.size() > pnode->nSendOffset);
+        // Gather the unsent headers and payloads of as many queued messages
+        // as fit, so that a burst of small messages costs a single call
+        std::pair<const unsigned char*, size_t> vParts[MAX_SEND_PARTS];
+        int nParts = 0;
+        size_t nBatchSize = 0;
+        size_t nOffset = pnode->nSendOffset;
+        for (auto itBatch = it; itBatch != pnode->vSendMsg.end() && nParts + 2 <= MAX_SEND_PARTS; ++itBatch) {
+            for (const std::vector<unsigned char>* part : {&(*itBatch)->header, &(*itBatch)->data}) {
+                if (nOffset >= part->size()) {
+                    nOffset -= part->size();
+                    continue;
+                }
+                vParts[nParts++] = std::make_pair(part->data() + nOffset, part->size() - nOffset);
+                nBatchSize += part->size() - nOffset;
+                nOffset = 0;
+            }
+        }
+        assert(nParts > 0);
         int nBytes = 0;
         {
             LOCK(pnode->cs_hSocket);
             if (pnode->hSocket == INVALID_SOCKET)
                 break;
-            nBytes = send(pnode->hSocket, reinterpret_cast<const char*>(data.data()) + pnode->nSendOffset, data.size() - pnode->nSendOffset, MSG_NOSIGNAL | MSG_DONTWAIT);
+#ifdef WIN32
+            nBatchSize = vParts[0].second;
+            nBytes = send(pnode->hSocket, reinterpret_cast<const char*>(vParts[0].first), vParts[0].second, MSG_NOSIGNAL | MSG_DONTWAIT);
+#else
+            struct iovec iov[MAX_SEND_PARTS];
+            for (int i = 0; i < nParts; i++) {
+                iov[i].iov_base = const_cast<unsigned char*>(vParts[i].first);
+                iov[i].iov_len = vParts[i].second;
+            }
+            struct msghdr msg = {};
+            msg.msg_iov = iov;
+            msg.msg_iovlen = nParts;
+            nBytes = sendmsg(pnode->hSocket, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+#endif
         }
         if (nBytes > 0) {
             pnode->nLastSend = GetSystemTimeInSeconds();
             pnode->nSendBytes += nBytes;
-            pnode->nSendOffset += nBytes;
             nSentSize += nBytes;
-            if (pnode->nSendOffset == data.size()) {
+            // Drop the messages that went out completely
+            size_t nLeft = nBytes;
+            while (nLeft > 0) {
+                const size_t nMessageLeft = (*it)->size() - pnode->nSendOffset;
+                if (nLeft < nMessageLeft) {
+                    pnode->nSendOffset += nLeft;
+                    break;
+                }
+                nLeft -= nMessageLeft;
                 pnode->nSendOffset = 0;
-                pnode->nSendSize -= data.size();
-                pnode->fPauseSend = pnode->nSendSize > nSendBufferMaxSize;
+                pnode->nSendSize -= (*it)->size();
                 it++;
-            } else {
-                // could not send full message; stop sending more
+            }
+            pnode->fPauseSend = pnode->nSendSize > nSendBufferMaxSize;
+            if ((size_t)nBytes < nBatchSize) {
+                // could not send everything; stop sending more
                 break;
             }
         } else {
@@ -931,6 +1048,53 @@ size_t CConnman::SocketSendData(CNode *pnode) const
     return nSentSize;
 }
 
+// Implement the following logic:
+// * If there is data to send, wait for sending data. As this only happens
+//   when optimistic write failed, we choose to first drain the write buffer
+//   in this case before receiving more. This avoids needlessly queueing
+//   received data, if the remote peer is not themselves receiving data. This
+//   means properly utilizing TCP flow control signalling.
+// * Otherwise, if there is space left in the receive buffer, wait for
+//   receiving data.
+// * Hand off all complete messages to the processor, to be handled without
+//   blocking here.
+static uint32_t GetWantedSocketEvents(const CNode* pnode)
+{
+    if (!pnode->vSendMsg.empty())
+        return CSocketEvents::EVENT_SEND;
+    if (pnode->fPauseRecv)
+        return 0;
+    return CSocketEvents::EVENT_RECV;
+}
+
+bool CConnman::AddSocketEvents(CNode* pnode)
+{
+    LOCK(pnode->cs_vSend);
+    const uint32_t events = GetWantedSocketEvents(pnode);
+    LOCK(pnode->cs_hSocket);
+    if (!socketEvents->Add(pnode->hSocket, pnode, events))
+        return false;
+    pnode->pSocketEvents = socketEvents.get();
+    pnode->nSocketEvents = events;
+    return true;
+}
+
+// requires LOCK(cs_vSend)
+void CConnman::UpdateSocketEvents(CNode* pnode)
+{
+    if (!socketEvents)
+        return;
+    const uint32_t events = GetWantedSocketEvents(pnode);
+    if (events == pnode->nSocketEvents)
+        return;
+    LOCK(pnode->cs_hSocket);
+    // A closed socket is dropped from the wait set already
+    if (pnode->hSocket == INVALID_SOCKET)
+        return;
+    if (socketEvents->Modify(pnode->hSocket, pnode, events))
+        pnode->nSocketEvents = events;
+}
+
 struct NodeEvictionCandidate
 {
     NodeId id;
@@ -1071,7 +1235,7 @@ bool CConnman::AttemptToEvictConnection()
 void CConnman::AcceptConnection(const ListenSocket& hListenSocket) {
     struct sockaddr_storage sockaddr;
     socklen_t len = sizeof(sockaddr);
-    SOCKET hSocket = accept(hListenSocket.socket, (struct sockaddr*)&sockaddr, &len);
+    SOCKET hSocket = AcceptSocket(hListenSocket.socket, (struct sockaddr*)&sockaddr, &len);
     CAddress addr;
     int nInbound = 0;
     int nMaxInbound = nMaxConnections - (nMaxOutbound + nMaxFeeler);
@@ -1104,7 +1268,7 @@ void CConnman::AcceptConnection(const ListenSocket& hListenSocket) {
         return;
     }
 
-    if (!IsSelectableSocket(hSocket))
+    if (!socketEvents->IsUsable(hSocket))
     {
         LogPrintf("connection from %s dropped: non-selectable socket\n", addr.ToString());
         CloseSocket(hSocket);
@@ -1137,6 +1301,11 @@ void CConnman::AcceptConnection(const ListenSocket& hListenSocket) {
     CAddress addr_bind = GetBindAddress(hSocket);
 
     CNode* pnode = new CNode(id, nLocalServices, GetBestHeight(), hSocket, addr, CalculateKeyedNetGroup(addr), nonce, addr_bind, "", true);
+    if (!AddSocketEvents(pnode)) {
+        LogPrintf("connection from %s dropped: could not wait on socket\n", addr.ToString());
+        delete pnode;
+        return;
+    }
     pnode->AddRef();
     pnode->fWhitelisted = whitelisted;
     m_msgproc->InitializeNode(pnode);
@@ -1149,35 +1318,96 @@ void CConnman::AcceptConnection(const ListenSocket& hListenSocket) {
     }
 }
 
+void CConnman::InactivityCheck(CNode* pnode)
+{
+    int64_t nTime = GetSystemTimeInSeconds();
+    if (nTime - pnode->nTimeConnected > 60)
+    {
+        if (pnode->nLastRecv == 0 || pnode->nLastSend == 0)
+        {
+            LogPrint(BCLog::NET, "socket no message in first 60 seconds, %d %d from %d\n", pnode->nLastRecv != 0, pnode->nLastSend != 0, pnode->GetId());
+            pnode->fDisconnect = true;
+        }
+        else if (nTime - pnode->nLastSend > TIMEOUT_INTERVAL)
+        {
+            LogPrintf("socket sending timeout: %is\n", nTime - pnode->nLastSend);
+            pnode->fDisconnect = true;
+        }
+        else if (nTime - pnode->nLastRecv > (pnode->nVersion > BIP0031_VERSION ? TIMEOUT_INTERVAL : 90*60))
+        {
+            LogPrintf("socket receive timeout: %is\n", nTime - pnode->nLastRecv);
+            pnode->fDisconnect = true;
+        }
+        else if (pnode->nPingNonceSent && pnode->nPingUsecStart + TIMEOUT_INTERVAL * 1000000 < GetTimeMicros())
+        {
+            LogPrintf("ping timeout: %fs\n", 0.000001 * (GetTimeMicros() - pnode->nPingUsecStart));
+            pnode->fDisconnect = true;
+        }
+        else if (!pnode->fSuccessfullyConnected)
+        {
+            LogPrintf("version handshake timeout from %d\n", pnode->GetId());
+            pnode->fDisconnect = true;
+        }
+    }
+}
+
 void CConnman::ThreadSocketHandler()
 {
     unsigned int nPrevNodeCount = 0;
+    int64_t nLastInactivityCheck = 0;
+    // Nodes that stopped receiving because their process queue is full. The
+    // message handler drains it, and they are waited on for receiving again.
+    std::vector<CNode*> vNodesPaused;
+    std::vector<CSocketEvents::Event> vEvents;
     while (!interruptNet)
     {
+        //
+        // Resume receiving
+        //
+        for (auto it = vNodesPaused.begin(); it != vNodesPaused.end(); )
+        {
+            CNode* pnode = *it;
+            if (pnode->fPauseRecv && !pnode->fDisconnect) {
+                ++it;
+                continue;
+            }
+            {
+                LOCK(pnode->cs_vSend);
+                UpdateSocketEvents(pnode);
+            }
+            {
+                LOCK(cs_vNodes);
+                pnode->Release();
+            }
+            it = vNodesPaused.erase(it);
+        }
+
         //
         // Disconnect nodes
         //
         {
             LOCK(cs_vNodes);
             // Disconnect unused nodes
-            std::vector<CNode*> vNodesCopy = vNodes;
-            for (CNode* pnode : vNodesCopy)
+            for (auto it = vNodes.begin(); it != vNodes.end(); )
             {
-                if (pnode->fDisconnect)
-                {
-                    // remove from vNodes
-                    vNodes.erase(remove(vNodes.begin(), vNodes.end(), pnode), vNodes.end());
+                CNode* pnode = *it;
+                if (!pnode->fDisconnect) {
+                    ++it;
+                    continue;
+                }
 
-                    // release outbound grant (if any)
-                    pnode->grantOutbound.Release();
+                // remove from vNodes
+                it = vNodes.erase(it);
 
-                    // close socket and cleanup
-                    pnode->CloseSocketDisconnect();
+                // release outbound grant (if any)
+                pnode->grantOutbound.Release();
 
-                    // hold in disconnected pool until all refs are released
-                    pnode->Release();
-                    vNodesDisconnected.push_back(pnode);
-                }
+                // close socket and cleanup
+                pnode->CloseSocketDisconnect();
+
+                // hold in disconnected pool until all refs are released
+                pnode->Release();
+                vNodesDisconnected.push_back(pnode);
             }
         }
         {
@@ -1216,142 +1446,82 @@ void CConnman::ThreadSocketHandler()
         }
 
         //
-        // Find which sockets have data to receive
+        // Wait for sockets that are ready. Nodes stay registered between
+        // waits; their events are changed as their send queue fills and
+        // drains, or as their receiving pauses and resumes.
         //
-        struct timeval timeout;
-        timeout.tv_sec  = 0;
-        timeout.tv_usec = 50000; // frequency to poll pnode->vSend
-
-        fd_set fdsetRecv;
-        fd_set fdsetSend;
-        fd_set fdsetError;
-        FD_ZERO(&fdsetRecv);
-        FD_ZERO(&fdsetSend);
-        FD_ZERO(&fdsetError);
-        SOCKET hSocketMax = 0;
-        bool have_fds = false;
-
-        for (const ListenSocket& hListenSocket : vhListenSocket) {
-            FD_SET(hListenSocket.socket, &fdsetRecv);
-            hSocketMax = std::max(hSocketMax, hListenSocket.socket);
-            have_fds = true;
-        }
-
-        {
-            LOCK(cs_vNodes);
-            for (CNode* pnode : vNodes)
-            {
-                // Implement the following logic:
-                // * If there is data to send, select() for sending data. As this only
-                //   happens when optimistic write failed, we choose to first drain the
-                //   write buffer in this case before receiving more. This avoids
-                //   needlessly queueing received data, if the remote peer is not themselves
-                //   receiving data. This means properly utilizing TCP flow control signalling.
-                // * Otherwise, if there is space left in the receive buffer, select() for
-                //   receiving data.
-                // * Hand off all complete messages to the processor, to be handled without
-                //   blocking here.
-
-                bool select_recv = !pnode->fPauseRecv;
-                bool select_send;
-                {
-                    LOCK(pnode->cs_vSend);
-                    select_send = !pnode->vSendMsg.empty();
-                }
-
-                LOCK(pnode->cs_hSocket);
-                if (pnode->hSocket == INVALID_SOCKET)
-                    continue;
-
-                FD_SET(pnode->hSocket, &fdsetError);
-                hSocketMax = std::max(hSocketMax, pnode->hSocket);
-                have_fds = true;
-
-                if (select_send) {
-                    FD_SET(pnode->hSocket, &fdsetSend);
-                    continue;
-                }
-                if (select_recv) {
-                    FD_SET(pnode->hSocket, &fdsetRecv);
-                }
-            }
-        }
-
-        int nSelect = select(have_fds ? hSocketMax + 1 : 0,
-                             &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
+        const int nTimeout = 50; // frequency of the inactivity checks and pause polling
+        bool fWaited = socketEvents->Wait(vEvents, nTimeout);
         if (interruptNet)
             return;
-
-        if (nSelect == SOCKET_ERROR)
-        {
-            if (have_fds)
-            {
-                int nErr = WSAGetLastError();
-                LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
-                for (unsigned int i = 0; i <= hSocketMax; i++)
-                    FD_SET(i, &fdsetRecv);
-            }
-            FD_ZERO(&fdsetSend);
-            FD_ZERO(&fdsetError);
-            if (!interruptNet.sleep_for(std::chrono::milliseconds(timeout.tv_usec/1000)))
-                return;
-        }
+        if (!fWaited && !interruptNet.sleep_for(std::chrono::milliseconds(nTimeout)))
+            return;
 
         //
         // Accept new connections
         //
-        for (const ListenSocket& hListenSocket : vhListenSocket)
+        std::vector<std::pair<CNode*, uint32_t>> vNodeEvents;
+        vNodeEvents.reserve(vEvents.size());
+        for (const CSocketEvents::Event& event : vEvents)
         {
-            if (hListenSocket.socket != INVALID_SOCKET && FD_ISSET(hListenSocket.socket, &fdsetRecv))
+            bool fListenSocket = false;
+            for (const ListenSocket& hListenSocket : vhListenSocket)
             {
-                AcceptConnection(hListenSocket);
+                if (event.context == &hListenSocket) {
+                    fListenSocket = true;
+                    if (hListenSocket.socket != INVALID_SOCKET)
+                        AcceptConnection(hListenSocket);
+                    break;
+                }
             }
+            if (!fListenSocket)
+                vNodeEvents.emplace_back(static_cast<CNode*>(event.context), event.events);
         }
 
         //
-        // Service each socket
+        // Service each ready socket
         //
-        std::vector<CNode*> vNodesCopy;
         {
+            // Only this thread deletes nodes, and only ones that were
+            // disconnected before the wait. Disconnecting a node removes its
+            // socket from socketEvents, so the nodes with events are alive
             LOCK(cs_vNodes);
-            vNodesCopy = vNodes;
-            for (CNode* pnode : vNodesCopy)
-                pnode->AddRef();
+            for (const auto& nodeEvents : vNodeEvents)
+                nodeEvents.first->AddRef();
         }
-        for (CNode* pnode : vNodesCopy)
+        for (const auto& nodeEvents : vNodeEvents)
         {
             if (interruptNet)
                 return;
 
+            CNode* pnode = nodeEvents.first;
+            const uint32_t events = nodeEvents.second;
+
             //
             // Receive
             //
-            bool recvSet = false;
-            bool sendSet = false;
-            bool errorSet = false;
-            {
-                LOCK(pnode->cs_hSocket);
-                if (pnode->hSocket == INVALID_SOCKET)
-                    continue;
-                recvSet = FD_ISSET(pnode->hSocket, &fdsetRecv);
-                sendSet = FD_ISSET(pnode->hSocket, &fdsetSend);
-                errorSet = FD_ISSET(pnode->hSocket, &fdsetError);
-            }
-            if (recvSet || errorSet)
+            if (events & (CSocketEvents::EVENT_RECV | CSocketEvents::EVENT_ERROR))
             {
                 // typical socket buffer is 8K-64K
                 char pchBuf[0x10000];
+                // The rest of a large message goes straight into its buffer
+                size_t nBufSize = sizeof(pchBuf);
+                char* pchRecv = pnode->GetRecvBuffer(sizeof(pchBuf), nBufSize);
+                if (!pchRecv) {
+                    pchRecv = pchBuf;
+                    nBufSize = sizeof(pchBuf);
+                }
                 int nBytes = 0;
                 {
                     LOCK(pnode->cs_hSocket);
                     if (pnode->hSocket == INVALID_SOCKET)
                         continue;
-                    nBytes = recv(pnode->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
+                    nBytes = recv(pnode->hSocket, pchRecv, nBufSize, MSG_DONTWAIT);
                 }
                 if (nBytes > 0)
                 {
                     bool notify = false;
-                    if (!pnode->ReceiveMsgBytes(pchBuf, nBytes, notify))
+                    if (!pnode->ReceiveMsgBytes(pchRecv, nBytes, notify))
                         pnode->CloseSocketDisconnect();
                     RecordBytesRecv(nBytes);
                     if (notify) {
@@ -1362,13 +1532,23 @@ void CConnman::ThreadSocketHandler()
                                 break;
                             nSizeAdded += it->vRecv.size() + CMessageHeader::HEADER_SIZE;
                         }
+                        bool fPaused = false;
                         {
                             LOCK(pnode->cs_vProcessMsg);
                             pnode->vProcessMsg.splice(pnode->vProcessMsg.end(), pnode->vRecvMsg, pnode->vRecvMsg.begin(), it);
                             pnode->nProcessQueueSize += nSizeAdded;
+                            fPaused = !pnode->fPauseRecv && pnode->nProcessQueueSize > nReceiveFloodSize;
                             pnode->fPauseRecv = pnode->nProcessQueueSize > nReceiveFloodSize;
                         }
-                        WakeMessageHandler();
+                        if (fPaused) {
+                            {
+                                LOCK(pnode->cs_vSend);
+                                UpdateSocketEvents(pnode);
+                            }
+                            pnode->AddRef();
+                            vNodesPaused.push_back(pnode);
+                        }
+                        WakeMessageHandler(pnode);
                     }
                 }
                 else if (nBytes == 0)
@@ -1395,52 +1575,35 @@ void CConnman::ThreadSocketHandler()
             //
             // Send
             //
-            if (sendSet)
+            if (events & CSocketEvents::EVENT_SEND)
             {
                 LOCK(pnode->cs_vSend);
                 size_t nBytes = SocketSendData(pnode);
+                UpdateSocketEvents(pnode);
                 if (nBytes) {
                     RecordBytesSent(nBytes);
                 }
             }
-
-            //
-            // Inactivity checking
-            //
-            int64_t nTime = GetSystemTimeInSeconds();
-            if (nTime - pnode->nTimeConnected > 60)
-            {
-                if (pnode->nLastRecv == 0 || pnode->nLastSend == 0)
-                {
-                    LogPrint(BCLog::NET, "socket no message in first 60 seconds, %d %d from %d\n", pnode->nLastRecv != 0, pnode->nLastSend != 0, pnode->GetId());
-                    pnode->fDisconnect = true;
-                }
-                else if (nTime - pnode->nLastSend > TIMEOUT_INTERVAL)
-                {
-                    LogPrintf("socket sending timeout: %is\n", nTime - pnode->nLastSend);
-                    pnode->fDisconnect = true;
-                }
-                else if (nTime - pnode->nLastRecv > (pnode->nVersion > BIP0031_VERSION ? TIMEOUT_INTERVAL : 90*60))
-                {
-                    LogPrintf("socket receive timeout: %is\n", nTime - pnode->nLastRecv);
-                    pnode->fDisconnect = true;
-                }
-                else if (pnode->nPingNonceSent && pnode->nPingUsecStart + TIMEOUT_INTERVAL * 1000000 < GetTimeMicros())
-                {
-                    LogPrintf("ping timeout: %fs\n", 0.000001 * (GetTimeMicros() - pnode->nPingUsecStart));
-                    pnode->fDisconnect = true;
-                }
-                else if (!pnode->fSuccessfullyConnected)
-                {
-                    LogPrintf("version handshake timeout from %d\n", pnode->GetId());
-                    pnode->fDisconnect = true;
-                }
-            }
         }
         {
             LOCK(cs_vNodes);
-            for (CNode* pnode : vNodesCopy)
-                pnode->Release();
+            for (const auto& nodeEvents : vNodeEvents)
+                nodeEvents.first->Release();
+        }
+
+        //
+        // Inactivity checking
+        //
+        int64_t nTime = GetSystemTimeInSeconds();
+        if (nTime != nLastInactivityCheck)
+        {
+            nLastInactivityCheck = nTime;
+            LOCK(cs_vNodes);
+            for (CNode* pnode : vNodes)
+            {
+                if (!pnode->fDisconnect)
+                    InactivityCheck(pnode);
+            }
         }
     }
 }
@@ -1449,9 +1612,25 @@ void CConnman::WakeMessageHandler()
 {
     {
         std::lock_guard<std::mutex> lock(mutexMsgProc);
-        fMsgProcWake = true;
+        vMsgProcWake.assign(vMsgProcWake.size(), true);
     }
-    condMsgProc.notify_one();
+    condMsgProc.notify_all();
+}
+
+void CConnman::WakeMessageHandler(const CNode* pnode)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutexMsgProc);
+        vMsgProcWake[GetMessageHandlerThread(pnode)] = true;
+    }
+    condMsgProc.notify_all();
+}
+
+int CConnman::GetMessageHandlerThread(const CNode* pnode) const
+{
+    // Node ids are assigned in sequence, which spreads the nodes evenly, and
+    // a node stays with its thread, so its messages are processed in order
+    return pnode->GetId() % nMessageHandlerThreads;
 }
 
 
@@ -1993,16 +2172,19 @@ void CConnman::OpenNetworkConnection(const CAddress& addrConnect, bool fCountFai
     }
 }
 
-void CConnman::ThreadMessageHandler()
+void CConnman::ThreadMessageHandler(int nThread)
 {
     while (!flagInterruptMsgProc)
     {
         std::vector<CNode*> vNodesCopy;
         {
             LOCK(cs_vNodes);
-            vNodesCopy = vNodes;
-            for (CNode* pnode : vNodesCopy) {
-                pnode->AddRef();
+            vNodesCopy.reserve(vNodes.size() / nMessageHandlerThreads + 1);
+            for (CNode* pnode : vNodes) {
+                if (GetMessageHandlerThread(pnode) == nThread) {
+                    pnode->AddRef();
+                    vNodesCopy.push_back(pnode);
+                }
             }
         }
 
@@ -2036,9 +2218,9 @@ void CConnman::ThreadMessageHandler()
 
         std::unique_lock<std::mutex> lock(mutexMsgProc);
         if (!fMoreWork) {
-            condMsgProc.wait_until(lock, std::chrono::steady_clock::now() + std::chrono::milliseconds(100), [this] { return fMsgProcWake; });
+            condMsgProc.wait_until(lock, std::chrono::steady_clock::now() + std::chrono::milliseconds(100), [this, nThread] { return vMsgProcWake[nThread]; });
         }
-        fMsgProcWake = false;
+        vMsgProcWake[nThread] = false;
     }
 }
 
@@ -2203,6 +2385,8 @@ CConnman::CConnman(uint64_t nSeed0In, uint64_t nSeed1In) : nSeed0(nSeed0In), nSe
     nLastNodeId = 0;
     nSendBufferMaxSize = 0;
     nReceiveFloodSize = 0;
+    nMessageHandlerThreads = 1;
+    socketEventsMode = CSocketEvents::DEFAULT_MODE;
     flagInterruptMsgProc = false;
     SetTryNewOutboundPeer(false);
 
@@ -2250,6 +2434,19 @@ bool CConnman::Start(CScheduler& scheduler, const Options& connOptions)
 {
     Init(connOptions);
 
+    try {
+        socketEvents = MakeUnique<CSocketEvents>(socketEventsMode);
+    } catch (const std::runtime_error& e) {
+        LogPrintf("%s\n", e.what());
+        if (clientInterface) {
+            clientInterface->ThreadSafeMessageBox(
+                strprintf(_("Cannot wait for %s socket events."), CSocketEvents::GetModeName(socketEventsMode)),
+                "", CClientUIInterface::MSG_ERROR);
+        }
+        return false;
+    }
+    LogPrintf("Using %s for socket events\n", CSocketEvents::GetModeName(socketEventsMode));
+
     {
         LOCK(cs_totalBytesRecv);
         nTotalBytesRecv = 0;
@@ -2269,6 +2466,16 @@ bool CConnman::Start(CScheduler& scheduler, const Options& connOptions)
         }
         return false;
     }
+    for (ListenSocket& hListenSocket : vhListenSocket) {
+        if (!socketEvents->Add(hListenSocket.socket, &hListenSocket, CSocketEvents::EVENT_RECV)) {
+            if (clientInterface) {
+                clientInterface->ThreadSafeMessageBox(
+                    _("Cannot wait for incoming connections on a listening socket."),
+                    "", CClientUIInterface::MSG_ERROR);
+            }
+            return false;
+        }
+    }
 
     for (const auto& strDest : connOptions.vSeedNodes) {
         AddOneShot(strDest);
@@ -2331,7 +2538,7 @@ bool CConnman::Start(CScheduler& scheduler, const Options& connOptions)
 
     {
         std::unique_lock<std::mutex> lock(mutexMsgProc);
-        fMsgProcWake = false;
+        vMsgProcWake.assign(nMessageHandlerThreads, false);
     }
 
     // Send and receive from sockets, accept connections
@@ -2357,7 +2564,10 @@ bool CConnman::Start(CScheduler& scheduler, const Options& connOptions)
         threadOpenConnections = std::thread(&TraceThread<std::function<void()> >, "opencon", std::function<void()>(std::bind(&CConnman::ThreadOpenConnections, this, connOptions.m_specified_outgoing)));
 
     // Process messages
-    threadMessageHandler = std::thread(&TraceThread<std::function<void()> >, "msghand", std::function<void()>(std::bind(&CConnman::ThreadMessageHandler, this)));
+    for (int i = 0; i < nMessageHandlerThreads; i++) {
+        threadMessageHandlers.emplace_back(&TraceThread<std::function<void()> >, "msghand", std::function<void()>(std::bind(&CConnman::ThreadMessageHandler, this, i)));
+    }
+    LogPrintf("Processing messages on %d threads\n", nMessageHandlerThreads);
 
     // Dump network addresses
     scheduler.scheduleEvery(std::bind(&CConnman::DumpData, this), DUMP_ADDRESSES_INTERVAL * 1000);
@@ -2406,8 +2616,11 @@ void CConnman::Interrupt()
 
 void CConnman::Stop()
 {
-    if (threadMessageHandler.joinable())
-        threadMessageHandler.join();
+    for (std::thread& threadMessageHandler : threadMessageHandlers) {
+        if (threadMessageHandler.joinable())
+            threadMessageHandler.join();
+    }
+    threadMessageHandlers.clear();
     if (threadOpenConnections.joinable())
         threadOpenConnections.join();
     if (threadOpenAddedConnections.joinable())
@@ -2441,6 +2654,8 @@ void CConnman::Stop()
     vNodes.clear();
     vNodesDisconnected.clear();
     vhListenSocket.clear();
+    socketEvents.reset();
+    sharedMsgCache.Clear();
     semOutbound.reset();
     semAddnode.reset();
 }
@@ -2718,6 +2933,8 @@ CNode::CNode(NodeId idIn, ServiceFlags nLocalServicesIn, int nMyStartingHeightIn
     nRefCount = 0;
     nSendSize = 0;
     nSendOffset = 0;
+    nSocketEvents = 0;
+    pSocketEvents = nullptr;
     hashContinue = uint256();
     nStartingHeight = -1;
     filterInventoryKnown.reset();
@@ -2799,19 +3016,31 @@ bool CConnman::NodeFullyConnected(const CNode* pnode)
     return pnode && pnode->fSuccessfullyConnected && !pnode->fDisconnect;
 }
 
-void CConnman::PushMessage(CNode* pnode, CSerializedNetMsg&& msg)
+CSharedNetMsgRef CConnman::MakeSharedMessage(CSerializedNetMsg&& msg)
 {
-    size_t nMessageSize = msg.data.size();
-    size_t nTotalSize = nMessageSize + CMessageHeader::HEADER_SIZE;
-    LogPrint(BCLog::NET, "sending %s (%d bytes) peer=%d\n",  SanitizeString(msg.command.c_str()), nMessageSize, pnode->GetId());
+    std::shared_ptr<CSharedNetMsg> shared = std::make_shared<CSharedNetMsg>();
+    shared->command = std::move(msg.command);
+    shared->data = std::move(msg.data);
 
-    std::vector<unsigned char> serializedHeader;
-    serializedHeader.reserve(CMessageHeader::HEADER_SIZE);
-    uint256 hash = Hash(msg.data.data(), msg.data.data() + nMessageSize);
-    CMessageHeader hdr(Params().MessageStart(), msg.command.c_str(), nMessageSize);
+    uint256 hash = Hash(shared->data.data(), shared->data.data() + shared->data.size());
+    CMessageHeader hdr(Params().MessageStart(), shared->command.c_str(), shared->data.size());
     memcpy(hdr.pchChecksum, hash.begin(), CMessageHeader::CHECKSUM_SIZE);
 
-    CVectorWriter{SER_NETWORK, INIT_PROTO_VERSION, serializedHeader, 0, hdr};
+    shared->header.reserve(CMessageHeader::HEADER_SIZE);
+    CVectorWriter{SER_NETWORK, INIT_PROTO_VERSION, shared->header, 0, hdr};
+    return shared;
+}
+
+void CConnman::PushMessage(CNode* pnode, CSerializedNetMsg&& msg)
+{
+    PushMessage(pnode, MakeSharedMessage(std::move(msg)));
+}
+
+void CConnman::PushMessage(CNode* pnode, const CSharedNetMsgRef& msg)
+{
+    size_t nMessageSize = msg->data.size();
+    size_t nTotalSize = msg->size();
+    LogPrint(BCLog::NET, "sending %s (%d bytes) peer=%d\n",  SanitizeString(msg->command.c_str()), nMessageSize, pnode->GetId());
 
     size_t nBytesSent = 0;
     {
@@ -2819,23 +3048,70 @@ void CConnman::PushMessage(CNode* pnode, CSerializedNetMsg&& msg)
         bool optimisticSend(pnode->vSendMsg.empty());
 
         //log total amount of bytes per command
-        pnode->mapSendBytesPerMsgCmd[msg.command] += nTotalSize;
+        pnode->mapSendBytesPerMsgCmd[msg->command] += nTotalSize;
         pnode->nSendSize += nTotalSize;
 
         if (pnode->nSendSize > nSendBufferMaxSize)
             pnode->fPauseSend = true;
-        pnode->vSendMsg.push_back(std::move(serializedHeader));
-        if (nMessageSize)
-            pnode->vSendMsg.push_back(std::move(msg.data));
+        pnode->vSendMsg.push_back(msg);
 
         // If write queue empty, attempt "optimistic write"
-        if (optimisticSend == true)
+        if (optimisticSend == true) {
             nBytesSent = SocketSendData(pnode);
+            UpdateSocketEvents(pnode);
+        }
     }
     if (nBytesSent)
         RecordBytesSent(nBytesSent);
 }
 
+CSharedNetMsgRef CConnman::FindSharedMessage(const std::string& command, const uint256& hash, int nVersion)
+{
+    return sharedMsgCache.Find(command, hash, nVersion);
+}
+
+CSharedNetMsgRef CConnman::ShareMessage(const uint256& hash, int nVersion, CSerializedNetMsg&& msg)
+{
+    CSharedNetMsgRef shared = MakeSharedMessage(std::move(msg));
+    sharedMsgCache.Add(hash, nVersion, shared);
+    return shared;
+}
+
+CSharedNetMsgRef CSharedNetMsgCache::Find(const std::string& command, const uint256& hash, int nVersion)
+{
+    LOCK(cs);
+    auto it = mapMessages.find(Key(command, hash, nVersion));
+    if (it == mapMessages.end())
+        return nullptr;
+    return it->second;
+}
+
+void CSharedNetMsgCache::Add(const uint256& hash, int nVersion, const CSharedNetMsgRef& msg)
+{
+    if (msg->size() > nMaxSize)
+        return;
+    LOCK(cs);
+    Key key(msg->command, hash, nVersion);
+    if (!mapMessages.emplace(key, msg).second)
+        return;
+    nSize += msg->size();
+    vOrder.push_back(key);
+    while (nSize > nMaxSize) {
+        auto it = mapMessages.find(vOrder.front());
+        nSize -= it->second->size();
+        mapMessages.erase(it);
+        vOrder.pop_front();
+    }
+}
+
+void CSharedNetMsgCache::Clear()
+{
+    LOCK(cs);
+    mapMessages.clear();
+    vOrder.clear();
+    nSize = 0;
+}
+
 bool CConnman::ForNode(NodeId id, std::function<bool(CNode* pnode)> func)
 {
     CNode* found = nullptr;
@@ -17,6 +17,7 @@
 #include <policy/feerate.h>
 #include <protocol.h>
 #include <random.h>
+#include <socketevents.h>
 #include <streams.h>
 #include <sync.h>
 #include <uint256.h>
@@ -25,7 +26,9 @@
 #include <atomic>
 #include <deque>
 #include <stdint.h>
+#include <map>
 #include <thread>
+#include <tuple>
 #include <memory>
 #include <condition_variable>
 
@@ -83,6 +86,14 @@ static const bool DEFAULT_BLOCKSONLY = false;
 static const bool DEFAULT_FORCEDNSSEED = false;
 static const size_t DEFAULT_MAXRECEIVEBUFFER = 5 * 1000;
 static const size_t DEFAULT_MAXSENDBUFFER    = 1 * 1000;
+/** Maximum number of message handler threads */
+static const int MAX_MSGHANDLER_THREADS = 16;
+/** -msghandlerthreads default */
+static const int DEFAULT_MSGHANDLER_THREADS = 4;
+/** Maximum number of processed messages a node keeps for receiving new ones into */
+static const size_t MAX_RECV_POOL_MESSAGES = 16;
+/** Processed messages larger than this are freed rather than kept for reuse */
+static const size_t MAX_RECV_POOL_MESSAGE_SIZE = 16 * 1024;
 
 // NOTE: When adjusting this, update rpcnet:setban's help ("24h")
 static const unsigned int DEFAULT_MISBEHAVING_BANTIME = 60 * 60 * 24;  // Default 24-hour ban
@@ -113,6 +124,49 @@ struct CSerializedNetMsg
     std::string command;
 };
 
+/**
+ * A message with its header, as queued for sending. It is immutable, so the
+ * same one can be queued to many nodes, and is only serialized once.
+ */
+struct CSharedNetMsg
+{
+    std::string command;
+    std::vector<unsigned char> header;
+    std::vector<unsigned char> data;
+
+    size_t size() const { return header.size() + data.size(); }
+};
+typedef std::shared_ptr<const CSharedNetMsg> CSharedNetMsgRef;
+
+/** Maximum total size of the messages kept for sending to more nodes */
+static const size_t MAX_SHARED_MSG_CACHE_SIZE = 32 * 1000 * 1000;
+
+/**
+ * Recently sent blocks and transactions, so that relaying one to many nodes
+ * serializes it once. Entries are keyed by the command, the hash of the
+ * object and the serialization version, including its flags. Evicting an
+ * entry does not free the message while it is still queued to a node.
+ */
+class CSharedNetMsgCache
+{
+public:
+    explicit CSharedNetMsgCache(size_t nMaxSizeIn = MAX_SHARED_MSG_CACHE_SIZE) : nMaxSize(nMaxSizeIn), nSize(0) {}
+
+    CSharedNetMsgRef Find(const std::string& command, const uint256& hash, int nVersion);
+    void Add(const uint256& hash, int nVersion, const CSharedNetMsgRef& msg);
+    void Clear();
+
+private:
+    typedef std::tuple<std::string, uint256, int> Key;
+
+    CCriticalSection cs;
+    const size_t nMaxSize;
+    size_t nSize;
+    std::map<Key, CSharedNetMsgRef> mapMessages;
+    //! Keys in the order they were added, oldest first
+    std::deque<Key> vOrder;
+};
+
 class NetEventsInterface;
 class CConnman
 {
@@ -137,6 +191,7 @@ public:
         NetEventsInterface* m_msgproc = nullptr;
         unsigned int nSendBufferMaxSize = 0;
         unsigned int nReceiveFloodSize = 0;
+        int nMessageHandlerThreads = 1;
         uint64_t nMaxOutboundTimeframe = 0;
         uint64_t nMaxOutboundLimit = 0;
         std::vector<std::string> vSeedNodes;
@@ -145,6 +200,7 @@ public:
         bool m_use_addrman_outgoing = true;
         std::vector<std::string> m_specified_outgoing;
         std::vector<std::string> m_added_nodes;
+        CSocketEvents::Mode socketEventsMode = CSocketEvents::DEFAULT_MODE;
     };
 
     void Init(const Options& connOptions) {
@@ -158,12 +214,14 @@ public:
         m_msgproc = connOptions.m_msgproc;
         nSendBufferMaxSize = connOptions.nSendBufferMaxSize;
         nReceiveFloodSize = connOptions.nReceiveFloodSize;
+        nMessageHandlerThreads = std::max(1, std::min(connOptions.nMessageHandlerThreads, MAX_MSGHANDLER_THREADS));
         {
             LOCK(cs_totalBytesSent);
             nMaxOutboundTimeframe = connOptions.nMaxOutboundTimeframe;
             nMaxOutboundLimit = connOptions.nMaxOutboundLimit;
         }
         vWhitelistedRange = connOptions.vWhitelistedRange;
+        socketEventsMode = connOptions.socketEventsMode;
         {
             LOCK(cs_vAddedNodes);
             vAddedNodes = connOptions.m_added_nodes;
@@ -183,6 +241,17 @@ public:
     bool ForNode(NodeId id, std::function<bool(CNode* pnode)> func);
 
     void PushMessage(CNode* pnode, CSerializedNetMsg&& msg);
+    void PushMessage(CNode* pnode, const CSharedNetMsgRef& msg);
+
+    /** Add the header to a message, so that it can be pushed to several nodes. */
+    static CSharedNetMsgRef MakeSharedMessage(CSerializedNetMsg&& msg);
+    /**
+     * Make a message for the object with the given hash, serialized with
+     * nVersion, and keep it for FindSharedMessage.
+     */
+    CSharedNetMsgRef ShareMessage(const uint256& hash, int nVersion, CSerializedNetMsg&& msg);
+    /** The message from a recent ShareMessage call with the same arguments, if any. */
+    CSharedNetMsgRef FindSharedMessage(const std::string& command, const uint256& hash, int nVersion);
 
     template<typename Callable>
     void ForEachNode(Callable&& func)
@@ -329,9 +398,17 @@ private:
     void AddOneShot(const std::string& strDest);
     void ProcessOneShot();
     void ThreadOpenConnections(std::vector<std::string> connect);
-    void ThreadMessageHandler();
+    void ThreadMessageHandler(int nThread);
+    /** The message handler thread that processes all messages of a node */
+    int GetMessageHandlerThread(const CNode* pnode) const;
+    void WakeMessageHandler(const CNode* pnode);
     void AcceptConnection(const ListenSocket& hListenSocket);
     void ThreadSocketHandler();
+    void InactivityCheck(CNode* pnode);
+    /** Register a new node's socket, before anything is pushed to it */
+    bool AddSocketEvents(CNode* pnode);
+    /** Wait for the events the node's queues call for now. Requires cs_vSend. */
+    void UpdateSocketEvents(CNode* pnode);
     void ThreadDNSAddressSeed();
 
     uint64_t CalculateKeyedNetGroup(const CAddress& ad) const;
@@ -386,7 +463,11 @@ private:
     unsigned int nSendBufferMaxSize;
     unsigned int nReceiveFloodSize;
 
+    CSharedNetMsgCache sharedMsgCache;
+
     std::vector<ListenSocket> vhListenSocket;
+    CSocketEvents::Mode socketEventsMode;
+    std::unique_ptr<CSocketEvents> socketEvents;
     std::atomic<bool> fNetworkActive;
     banmap_t setBanned;
     CCriticalSection cs_setBanned;
@@ -418,8 +499,10 @@ private:
     /** SipHasher seeds for deterministic randomness */
     const uint64_t nSeed0, nSeed1;
 
-    /** flag for waking the message processor. */
-    bool fMsgProcWake;
+    /** Number of message handler threads, each of which handles a fixed share of the nodes */
+    int nMessageHandlerThreads;
+    /** flags for waking the message processor threads. */
+    std::vector<bool> vMsgProcWake;
 
     std::condition_variable condMsgProc;
     std::mutex mutexMsgProc;
@@ -431,7 +514,7 @@ private:
     std::thread threadSocketHandler;
     std::thread threadOpenAddedConnections;
     std::thread threadOpenConnections;
-    std::thread threadMessageHandler;
+    std::vector<std::thread> threadMessageHandlers;
 
     /** flag for deciding to connect to an extra outbound peer,
      *  in excess of nMaxOutbound
@@ -594,6 +677,9 @@ public:
 
     int readHeader(const char *pch, unsigned int nBytes);
     int readData(const char *pch, unsigned int nBytes);
+
+    /** Prepare for receiving another message, keeping the allocated buffers */
+    void Reset();
 };
 
 
@@ -608,7 +694,11 @@ public:
     size_t nSendSize; // total size of all vSendMsg entries
     size_t nSendOffset; // offset inside the first vSendMsg already sent
     uint64_t nSendBytes;
-    std::deque<std::vector<unsigned char>> vSendMsg;
+    std::deque<CSharedNetMsgRef> vSendMsg;
+    //! CSocketEvents events the socket is waited on for, guarded by cs_vSend
+    uint32_t nSocketEvents;
+    //! Where the socket is waited on, if anywhere, guarded by cs_hSocket
+    CSocketEvents* pSocketEvents;
     CCriticalSection cs_vSend;
     CCriticalSection cs_hSocket;
     CCriticalSection cs_vRecv;
@@ -670,9 +760,13 @@ public:
     std::atomic<int> nStartingHeight;
 
     // flood relay
+    // Other nodes' message handler threads relay addresses to this one, so
+    // vAddrToSend and addrKnown are guarded by cs_addrSend.
+    CCriticalSection cs_addrSend;
     std::vector<CAddress> vAddrToSend;
     CRollingBloomFilter addrKnown;
     bool fGetAddr;
+    // Guarded by cs_mapAlerts
     std::set<uint256> setKnown;
     int64_t nNextAddrSend;
     int64_t nNextLocalAddrSend;
@@ -733,6 +827,9 @@ private:
     const int nMyStartingHeight;
     int nSendVersion;
     std::list<CNetMessage> vRecvMsg;  // Used only by SocketHandler thread
+    CCriticalSection cs_vRecvPool;
+    //! Processed messages that are reset for receiving, so that it needn't allocate
+    std::list<CNetMessage> vRecvPool;
 
     mutable CCriticalSection cs_addrName;
     std::string addrName;
@@ -761,6 +858,14 @@ public:
     }
 
     bool ReceiveMsgBytes(const char *pch, unsigned int nBytes, bool& complete);
+    /**
+     * If at least nMinSize bytes of the message being received are missing,
+     * the place in its buffer where nSize more of them go. Receiving into it
+     * and passing it to ReceiveMsgBytes saves copying them.
+     */
+    char* GetRecvBuffer(size_t nMinSize, size_t& nSize);
+    /** Keep processed messages for receiving later ones into */
+    void RecycleRecvMessages(std::list<CNetMessage>& msgs);
 
     void SetRecvVersion(int nVersionIn)
     {
@@ -792,6 +897,7 @@ public:
 
     void AddAddressKnown(const CAddress& _addr)
     {
+        LOCK(cs_addrSend);
         addrKnown.insert(_addr.GetKey());
     }
 
@@ -800,6 +906,7 @@ public:
         // Known checking here is only to save space from duplicates.
         // SendMessages will filter it again for knowns that were added
         // after addresses were pushed.
+        LOCK(cs_addrSend);
         if (_addr.IsValid() && !addrKnown.contains(_addr.GetKey())) {
             if (vAddrToSend.size() >= MAX_ADDR_TO_SEND) {
                 vAddrToSend[insecure_rand.randrange(vAddrToSend.size())] = _addr;
@@ -114,6 +114,7 @@ namespace {
         uint256 hash;
         const CBlockIndex* pindex;                               //!< Optional.
         bool fValidatedHeaders;                                  //!< Whether this block has validated headers at the time of request.
+        int64_t nTimeRequested;                                  //!< When the block was requested (in microseconds).
         std::unique_ptr<PartiallyDownloadedBlock> partialBlock;  //!< Optional, used for CMPCTBLOCK downloads
     };
     std::map<uint256, std::pair<NodeId, std::list<QueuedBlock>::iterator> > mapBlocksInFlight;
@@ -133,13 +134,43 @@ namespace {
     /** When our tip was last updated. */
     std::atomic<int64_t> g_last_tip_update(0);
 
-    /** Relay map, protected by cs_main. */
+    /** Relay map, protected by cs_relay. */
+    CCriticalSection cs_relay;
     typedef std::map<uint256, CTransactionRef> MapRelay;
     MapRelay mapRelay;
-    /** Expiration-time ordered list of (expire time, relay map entry) pairs, protected by cs_main). */
+    /** Expiration-time ordered list of (expire time, relay map entry) pairs, protected by cs_relay). */
     std::deque<std::pair<int64_t, MapRelay::iterator>> vRelayExpiration;
 } // namespace
 
+/**
+ * How many blocks to keep in flight from a peer that sends one every
+ * nAvgBlockInterval microseconds (0 if not known yet). This is twice what it
+ * sends during a round trip of nPingUsec, so that it never waits for our
+ * requests and can show that it got faster.
+ */
+int GetMaxBlocksInTransit(int64_t nAvgBlockInterval, int64_t nPingUsec) {
+    if (nAvgBlockInterval == 0 || nPingUsec <= 0 || nPingUsec == std::numeric_limits<int64_t>::max())
+        return MAX_BLOCKS_IN_TRANSIT_PER_PEER;
+    int64_t nBlocks = 2 * (nPingUsec / nAvgBlockInterval + 1);
+    return std::max<int64_t>(MIN_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER, std::min<int64_t>(nBlocks, MAX_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER));
+}
+
+/**
+ * Whether a block in flight from another peer should rather be downloaded
+ * from one that sends blocks every nAvgBlockInterval microseconds: that is
+ * faster than the other peer, and the other peer is overdue with the block by
+ * its own pace, with nQueuedBefore blocks ahead of it every
+ * nAvgBlockIntervalFrom (0 if not known yet) since nWaitingSince.
+ */
+bool IsBlockDownloadLate(int64_t nAvgBlockInterval, int64_t nAvgBlockIntervalFrom, int nQueuedBefore, int64_t nWaitingSince, int64_t nNow) {
+    if (nAvgBlockInterval == 0)
+        return false;
+    if (nAvgBlockIntervalFrom != 0 && nAvgBlockIntervalFrom <= nAvgBlockInterval)
+        return false;
+    int64_t nExpected = nAvgBlockIntervalFrom == 0 ? 1000000 * BLOCK_STALLING_TIMEOUT : 2 * (nQueuedBefore + 1) * nAvgBlockIntervalFrom;
+    return nNow - nWaitingSince > nExpected;
+}
+
 namespace {
 
 struct CBlockReject {
@@ -186,6 +217,10 @@ struct CNodeState {
     std::list<QueuedBlock> vBlocksInFlight;
     //! When the first entry in vBlocksInFlight started downloading. Don't care when vBlocksInFlight is empty.
     int64_t nDownloadingSince;
+    //! When the last block we asked this peer for arrived (in microseconds), or 0.
+    int64_t nLastBlockReceived;
+    //! Moving average of the time between blocks arriving while more were in flight (in microseconds), or 0 if unknown.
+    int64_t nAvgBlockInterval;
     int nBlocksInFlight;
     int nBlocksInFlightValidHeaders;
     //! Whether we consider this a preferred download peer.
@@ -253,6 +288,8 @@ struct CNodeState {
         nHeadersSyncTimeout = 0;
         nStallingSince = 0;
         nDownloadingSince = 0;
+        nLastBlockReceived = 0;
+        nAvgBlockInterval = 0;
         nBlocksInFlight = 0;
         nBlocksInFlightValidHeaders = 0;
         fPreferredDownload = false;
@@ -272,6 +309,7 @@ std::map<NodeId, CNodeState> mapNodeState;
 
 // Requires cs_main.
 CNodeState *State(NodeId pnode) {
+    AssertLockHeld(cs_main);
     std::map<NodeId, CNodeState>::iterator it = mapNodeState.find(pnode);
     if (it == mapNodeState.end())
         return nullptr;
@@ -339,6 +377,7 @@ bool MarkBlockAsReceived(const uint256& hash) {
 // returns false, still setting pit, if the block was already in flight from the same peer
 // pit will only be valid as long as the same cs_main lock is being held
 bool MarkBlockAsInFlight(NodeId nodeid, const uint256& hash, const CBlockIndex* pindex = nullptr, std::list<QueuedBlock>::iterator** pit = nullptr) {
+    AssertLockHeld(cs_main);
     CNodeState *state = State(nodeid);
     assert(state != nullptr);
 
@@ -355,7 +394,7 @@ bool MarkBlockAsInFlight(NodeId nodeid, const uint256& hash, const CBlockIndex*
     MarkBlockAsReceived(hash);
 
     std::list<QueuedBlock>::iterator it = state->vBlocksInFlight.insert(state->vBlocksInFlight.end(),
-            {hash, pindex, pindex != nullptr, std::unique_ptr<PartiallyDownloadedBlock>(pit ? new PartiallyDownloadedBlock(&mempool) : nullptr)});
+            {hash, pindex, pindex != nullptr, GetTimeMicros(), std::unique_ptr<PartiallyDownloadedBlock>(pit ? new PartiallyDownloadedBlock(&mempool) : nullptr)});
     state->nBlocksInFlight++;
     state->nBlocksInFlightValidHeaders += it->fValidatedHeaders;
     if (state->nBlocksInFlight == 1) {
@@ -371,6 +410,46 @@ bool MarkBlockAsInFlight(NodeId nodeid, const uint256& hash, const CBlockIndex*
     return true;
 }
 
+// Requires cs_main.
+/** Update a peer's block download speed with the arrival of a block we asked it for. */
+void UpdateBlockDownloadSpeed(NodeId nodeid, const uint256& hash, int64_t nTimeReceived) {
+    AssertLockHeld(cs_main);
+    std::map<uint256, std::pair<NodeId, std::list<QueuedBlock>::iterator> >::iterator itInFlight = mapBlocksInFlight.find(hash);
+    if (itInFlight == mapBlocksInFlight.end() || itInFlight->second.first != nodeid)
+        return;
+    CNodeState *state = State(nodeid);
+    assert(state != nullptr);
+    // Only count blocks that were already requested when the previous one
+    // arrived, as otherwise the time includes waiting for our request.
+    if (state->nLastBlockReceived != 0 && itInFlight->second.second->nTimeRequested <= state->nLastBlockReceived) {
+        int64_t nInterval = std::max<int64_t>(nTimeReceived - state->nLastBlockReceived, 1);
+        state->nAvgBlockInterval = state->nAvgBlockInterval == 0 ? nInterval : (7 * state->nAvgBlockInterval + nInterval) / 8;
+    }
+    state->nLastBlockReceived = std::max(state->nLastBlockReceived, nTimeReceived);
+}
+
+// Requires cs_main.
+/** Whether a block in flight from another peer should rather be downloaded from nodeid. */
+bool IsBlockInFlightLate(NodeId nodeid, const uint256& hash, int64_t nNow) {
+    AssertLockHeld(cs_main);
+    std::map<uint256, std::pair<NodeId, std::list<QueuedBlock>::iterator> >::iterator itInFlight = mapBlocksInFlight.find(hash);
+    if (itInFlight == mapBlocksInFlight.end() || itInFlight->second.first == nodeid)
+        return false;
+    const CNodeState *state = State(nodeid);
+    const CNodeState *stateFrom = State(itInFlight->second.first);
+    assert(state != nullptr && stateFrom != nullptr);
+
+    // The peer sends its blocks in the order we asked for them
+    int nQueuedBefore = 0;
+    for (const QueuedBlock& queuedBlock : stateFrom->vBlocksInFlight) {
+        if (queuedBlock.hash == hash)
+            break;
+        nQueuedBefore++;
+    }
+    int64_t nWaitingSince = std::max(stateFrom->nLastBlockReceived, itInFlight->second.second->nTimeRequested);
+    return IsBlockDownloadLate(state->nAvgBlockInterval, stateFrom->nAvgBlockInterval, nQueuedBefore, nWaitingSince, nNow);
+}
+
 /** Check whether the last unknown block a peer advertised is not yet known. */
 void ProcessBlockAvailability(NodeId nodeid) {
     CNodeState *state = State(nodeid);
@@ -463,8 +542,11 @@ bool PeerHasHeader(CNodeState *state, const CBlockIndex *pindex)
 }
 
 /** Update pindexLastCommonBlock and add not-in-flight missing successors to vBlocks, until it has
- *  at most count entries. */
-void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<const CBlockIndex*>& vBlocks, NodeId& nodeStaller, const Consensus::Params& consensusParams) {
+ *  at most count entries. If set, ppindexWaitingFor is set to the first block before those that is
+ *  in flight, which holds back the download window. */
+void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<const CBlockIndex*>& vBlocks, NodeId& nodeStaller, const Consensus::Params& consensusParams, const CBlockIndex** ppindexWaitingFor = nullptr) {
+    if (ppindexWaitingFor)
+        *ppindexWaitingFor = nullptr;
     if (count == 0)
         return;
 
@@ -545,6 +627,8 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<con
             } else if (waitingfor == -1) {
                 // This is the first already-in-flight block.
                 waitingfor = mapBlocksInFlight[pindex->GetBlockHash()].first;
+                if (ppindexWaitingFor)
+                    *ppindexWaitingFor = pindex;
             }
         }
     }
@@ -755,6 +839,7 @@ unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans)
 // Requires cs_main.
 void Misbehaving(NodeId pnode, int howmuch)
 {
+    AssertLockHeld(cs_main);
     if (howmuch == 0)
         return;
 
@@ -842,6 +927,20 @@ void PeerLogicValidation::BlockConnected(const std::shared_ptr<const CBlock>& pb
     g_last_tip_update = GetTime();
 }
 
+/**
+ * Push a block or transaction message that is sent to many peers. It is only
+ * serialized, with make(), if no peer was sent it with the same version and
+ * flags recently.
+ */
+template <typename Make>
+static void PushSharedMessage(CConnman* connman, CNode* pnode, const std::string& command, const uint256& hash, int nVersion, Make make)
+{
+    CSharedNetMsgRef msg = connman->FindSharedMessage(command, hash, nVersion);
+    if (!msg)
+        msg = connman->ShareMessage(hash, nVersion, make());
+    connman->PushMessage(pnode, msg);
+}
+
 // All of the following cache a recent block, and are protected by cs_most_recent_block
 static CCriticalSection cs_most_recent_block;
 static std::shared_ptr<const CBlock> most_recent_block;
@@ -871,8 +970,9 @@ void PeerLogicValidation::NewPoWValidBlock(const CBlockIndex *pindex, const std:
         fWitnessesPresentInMostRecentCompactBlock = fWitnessEnabled;
     }
 
-    connman->ForEachNode([this, &pcmpctblock, pindex, &msgMaker, fWitnessEnabled, &hashBlock](CNode* pnode) {
-        // TODO: Avoid the repeated-serialization here
+    // Serialized once, when the first peer needs it
+    CSharedNetMsgRef msgCmpctBlock;
+    connman->ForEachNode([this, &pcmpctblock, &msgCmpctBlock, pindex, &msgMaker, fWitnessEnabled, &hashBlock](CNode* pnode) {
         if (pnode->nVersion < INVALID_CB_NO_BAN_VERSION || pnode->fDisconnect)
             return;
         ProcessBlockAvailability(pnode->GetId());
@@ -884,7 +984,9 @@ void PeerLogicValidation::NewPoWValidBlock(const CBlockIndex *pindex, const std:
 
             LogPrint(BCLog::NET, "%s sending header-and-ids %s to peer=%d\n", "PeerLogicValidation::NewPoWValidBlock",
                     hashBlock.ToString(), pnode->GetId());
-            connman->PushMessage(pnode, msgMaker.Make(NetMsgType::CMPCTBLOCK, *pcmpctblock));
+            if (!msgCmpctBlock)
+                msgCmpctBlock = connman->ShareMessage(hashBlock, PROTOCOL_VERSION, msgMaker.Make(NetMsgType::CMPCTBLOCK, *pcmpctblock));
+            connman->PushMessage(pnode, msgCmpctBlock);
             state.pindexBestHeaderSent = pindex;
         }
     });
@@ -1076,6 +1178,12 @@ void static ProcessGetBlockData(CNode* pfrom, const Consensus::Params& consensus
         ActivateBestChain(dummy, Params(), a_recent_block);
     }
 
+    const CNetMsgMaker msgMaker(pfrom->GetSendVersion());
+    const CBlockIndex* pindex = nullptr;
+    bool fPeerWantsWitness = false;
+    bool fSendCompact = false;
+    uint256 hashTip;
+    {
     LOCK(cs_main);
     BlockMap::iterator mi = mapBlockIndex.find(inv.hash);
     if (mi != mapBlockIndex.end()) {
@@ -1084,7 +1192,6 @@ void static ProcessGetBlockData(CNode* pfrom, const Consensus::Params& consensus
             LogPrint(BCLog::NET, "%s: ignoring request from peer=%i for old block that isn't in the main chain\n", __func__, pfrom->GetId());
         }
     }
-    const CNetMsgMaker msgMaker(pfrom->GetSendVersion());
     // disconnect node in case we have reached the outbound limit for serving historical blocks
     // never disconnect whitelisted nodes
     if (send && connman->OutboundTargetReached(true) && ( ((pindexBestHeader != nullptr) && (pindexBestHeader->GetBlockTime() - mi->second->GetBlockTime() > HISTORICAL_BLOCK_AGE)) || inv.type == MSG_FILTERED_BLOCK) && !pfrom->fWhitelisted)
@@ -1107,79 +1214,112 @@ void static ProcessGetBlockData(CNode* pfrom, const Consensus::Params& consensus
     }
     // Pruned nodes may have deleted the block, so check whether
     // it's available before trying to send.
-    if (send && (mi->second->nStatus & BLOCK_HAVE_DATA))
+    if (!send || !(mi->second->nStatus & BLOCK_HAVE_DATA))
+        return;
+    pindex = mi->second;
+    fPeerWantsWitness = State(pfrom->GetId())->fWantsCmpctWitness;
+    fSendCompact = CanDirectFetch(consensusParams) && pindex->nHeight >= chainActive.Height() - MAX_CMPCTBLOCK_DEPTH;
+    hashTip = chainActive.Tip()->GetBlockHash();
+    } // release cs_main, so that blocks are read and sent to several peers at once
+
+    // A new block is requested by many peers at once, so reuse the message
+    // of an earlier request rather than reading and serializing it again
+    const uint256 hashBlock = pindex->GetBlockHash();
+    const int nBlockVersion = pfrom->GetSendVersion() | (inv.type == MSG_BLOCK ? SERIALIZE_TRANSACTION_NO_WITNESS : 0);
+    CSharedNetMsgRef msgBlock;
+    if (inv.type == MSG_BLOCK || inv.type == MSG_WITNESS_BLOCK)
+        msgBlock = connman->FindSharedMessage(NetMsgType::BLOCK, hashBlock, nBlockVersion);
+
+    std::shared_ptr<const CBlock> pblock;
+    if (msgBlock) {
+        connman->PushMessage(pfrom, msgBlock);
+        // pblock stays unset, as the block has been sent
+    } else if (a_recent_block && a_recent_block->GetHash() == hashBlock) {
+        pblock = a_recent_block;
+    } else if (inv.type == MSG_WITNESS_BLOCK) {
+        // Fast path: the network serialization with witness data is what
+        // is stored on disk, so the block can be sent without deserializing it
+        std::vector<uint8_t> blockData;
+        if (!ReadRawBlockFromDisk(blockData, pindex, Params().MessageStart())) {
+            LOCK(cs_main);
+            if (!(pindex->nStatus & BLOCK_HAVE_DATA))
+                return; // pruned since the check above
+            assert(!"cannot load block from disk");
+        }
+        connman->PushMessage(pfrom, connman->ShareMessage(hashBlock, nBlockVersion, msgMaker.Make(NetMsgType::BLOCK, CFlatData(blockData))));
+        // pblock stays unset, as the block has been sent
+    } else {
+        // Send block from disk
+        std::shared_ptr<CBlock> pblockRead = std::make_shared<CBlock>();
+        if (!ReadBlockFromDisk(*pblockRead, pindex, consensusParams)) {
+            LOCK(cs_main);
+            if (!(pindex->nStatus & BLOCK_HAVE_DATA))
+                return; // pruned since the check above
+            assert(!"cannot load block from disk");
+        }
+        pblock = pblockRead;
+    }
+    if (!pblock) {
+        // Already sent above
+    } else if (inv.type == MSG_BLOCK)
+        connman->PushMessage(pfrom, connman->ShareMessage(hashBlock, nBlockVersion, msgMaker.Make(SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::BLOCK, *pblock)));
+    else if (inv.type == MSG_WITNESS_BLOCK)
+        connman->PushMessage(pfrom, connman->ShareMessage(hashBlock, nBlockVersion, msgMaker.Make(NetMsgType::BLOCK, *pblock)));
+    else if (inv.type == MSG_FILTERED_BLOCK)
     {
-        std::shared_ptr<const CBlock> pblock;
-        if (a_recent_block && a_recent_block->GetHash() == (*mi).second->GetBlockHash()) {
-            pblock = a_recent_block;
-        } else {
-            // Send block from disk
-            std::shared_ptr<CBlock> pblockRead = std::make_shared<CBlock>();
-            if (!ReadBlockFromDisk(*pblockRead, (*mi).second, consensusParams))
-                assert(!"cannot load block from disk");
-            pblock = pblockRead;
-        }
-        if (inv.type == MSG_BLOCK)
-            connman->PushMessage(pfrom, msgMaker.Make(SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::BLOCK, *pblock));
-        else if (inv.type == MSG_WITNESS_BLOCK)
-            connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::BLOCK, *pblock));
-        else if (inv.type == MSG_FILTERED_BLOCK)
+        bool sendMerkleBlock = false;
+        CMerkleBlock merkleBlock;
         {
-            bool sendMerkleBlock = false;
-            CMerkleBlock merkleBlock;
-            {
-                LOCK(pfrom->cs_filter);
-                if (pfrom->pfilter) {
-                    sendMerkleBlock = true;
-                    merkleBlock = CMerkleBlock(*pblock, *pfrom->pfilter);
-                }
-            }
-            if (sendMerkleBlock) {
-                connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::MERKLEBLOCK, merkleBlock));
-                // CMerkleBlock just contains hashes, so also push any transactions in the block the client did not see
-                // This avoids hurting performance by pointlessly requiring a round-trip
-                // Note that there is currently no way for a node to request any single transactions we didn't send here -
-                // they must either disconnect and retry or request the full block.
-                // Thus, the protocol spec specified allows for us to provide duplicate txn here,
-                // however we MUST always provide at least what the remote peer needs
-                typedef std::pair<unsigned int, uint256> PairType;
-                for (PairType& pair : merkleBlock.vMatchedTxn)
-                    connman->PushMessage(pfrom, msgMaker.Make(SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::TX, *pblock->vtx[pair.first]));
-            }
-            // else
-                // no response
-        }
-        else if (inv.type == MSG_CMPCT_BLOCK)
-        {
-            // If a peer is asking for old blocks, we're almost guaranteed
-            // they won't have a useful mempool to match against a compact block,
-            // and we don't feel like constructing the object for them, so
-            // instead we respond with the full, non-compact block.
-            bool fPeerWantsWitness = State(pfrom->GetId())->fWantsCmpctWitness;
-            int nSendFlags = fPeerWantsWitness ? 0 : SERIALIZE_TRANSACTION_NO_WITNESS;
-            if (CanDirectFetch(consensusParams) && mi->second->nHeight >= chainActive.Height() - MAX_CMPCTBLOCK_DEPTH) {
-                if ((fPeerWantsWitness || !fWitnessesPresentInARecentCompactBlock) && a_recent_compact_block && a_recent_compact_block->header.GetHash() == mi->second->GetBlockHash()) {
-                    connman->PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, *a_recent_compact_block));
-                } else {
-                    CBlockHeaderAndShortTxIDs cmpctblock(*pblock, fPeerWantsWitness);
-                    connman->PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, cmpctblock));
-                }
-            } else {
-                connman->PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::BLOCK, *pblock));
-            }
+            LOCK(pfrom->cs_filter);
+            if (pfrom->pfilter) {
+                sendMerkleBlock = true;
+                merkleBlock = CMerkleBlock(*pblock, *pfrom->pfilter);
+            }
+        }
+        if (sendMerkleBlock) {
+            connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::MERKLEBLOCK, merkleBlock));
+            // CMerkleBlock just contains hashes, so also push any transactions in the block the client did not see
+            // This avoids hurting performance by pointlessly requiring a round-trip
+            // Note that there is currently no way for a node to request any single transactions we didn't send here -
+            // they must either disconnect and retry or request the full block.
+            // Thus, the protocol spec specified allows for us to provide duplicate txn here,
+            // however we MUST always provide at least what the remote peer needs
+            typedef std::pair<unsigned int, uint256> PairType;
+            for (PairType& pair : merkleBlock.vMatchedTxn)
+                connman->PushMessage(pfrom, msgMaker.Make(SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::TX, *pblock->vtx[pair.first]));
+        }
+        // else
+            // no response
+    }
+    else if (inv.type == MSG_CMPCT_BLOCK)
+    {
+        // If a peer is asking for old blocks, we're almost guaranteed
+        // they won't have a useful mempool to match against a compact block,
+        // and we don't feel like constructing the object for them, so
+        // instead we respond with the full, non-compact block.
+        int nSendFlags = fPeerWantsWitness ? 0 : SERIALIZE_TRANSACTION_NO_WITNESS;
+        if (fSendCompact) {
+            PushSharedMessage(connman, pfrom, NetMsgType::CMPCTBLOCK, hashBlock, pfrom->GetSendVersion() | nSendFlags, [&] {
+                if ((fPeerWantsWitness || !fWitnessesPresentInARecentCompactBlock) && a_recent_compact_block && a_recent_compact_block->header.GetHash() == hashBlock)
+                    return msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, *a_recent_compact_block);
+                CBlockHeaderAndShortTxIDs cmpctblock(*pblock, fPeerWantsWitness);
+                return msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, cmpctblock);
+            });
+        } else {
+            connman->PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::BLOCK, *pblock));
         }
+    }
 
-        // Trigger the peer node to send a getblocks request for the next batch of inventory
-        if (inv.hash == pfrom->hashContinue)
-        {
-            // Bypass PushInventory, this must send even if redundant,
-            // and we want it right after the last block so they don't
-            // wait for other stuff first.
-            std::vector<CInv> vInv;
-            vInv.push_back(CInv(MSG_BLOCK, chainActive.Tip()->GetBlockHash()));
-            connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::INV, vInv));
-            pfrom->hashContinue.SetNull();
-        }
+    // Trigger the peer node to send a getblocks request for the next batch of inventory
+    if (inv.hash == pfrom->hashContinue)
+    {
+        // Bypass PushInventory, this must send even if redundant,
+        // and we want it right after the last block so they don't
+        // wait for other stuff first.
+        std::vector<CInv> vInv;
+        vInv.push_back(CInv(MSG_BLOCK, hashTip));
+        connman->PushMessage(pfrom, msgMaker.Make(NetMsgType::INV, vInv));
+        pfrom->hashContinue.SetNull();
     }
 }
 
@@ -1191,8 +1331,6 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
     std::vector<CInv> vNotFound;
     const CNetMsgMaker msgMaker(pfrom->GetSendVersion());
     {
-        LOCK(cs_main);
-
         while (it != pfrom->vRecvGetData.end() && (it->type == MSG_TX || it->type == MSG_WITNESS_TX)) {
             if (interruptMsgProc)
                 return;
@@ -1205,10 +1343,19 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
 
             // Send stream from relay memory
             bool push = false;
-            auto mi = mapRelay.find(inv.hash);
+            CTransactionRef txRelay;
+            {
+                LOCK(cs_relay);
+                auto mi = mapRelay.find(inv.hash);
+                if (mi != mapRelay.end()) txRelay = mi->second;
+            }
             int nSendFlags = (inv.type == MSG_TX ? SERIALIZE_TRANSACTION_NO_WITNESS : 0);
-            if (mi != mapRelay.end()) {
-                connman->PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::TX, *mi->second));
+            if (txRelay) {
+                // Without witnesses, transactions with the same txid serialize the same
+                const uint256& hashTx = nSendFlags ? txRelay->GetHash() : txRelay->GetWitnessHash();
+                PushSharedMessage(connman, pfrom, NetMsgType::TX, hashTx, pfrom->GetSendVersion() | nSendFlags, [&] {
+                    return msgMaker.Make(nSendFlags, NetMsgType::TX, *txRelay);
+                });
                 push = true;
             } else if (pfrom->timeLastMempoolReq) {
                 auto txinfo = mempool.info(inv.hash);
@@ -1223,7 +1370,7 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
                 vNotFound.push_back(inv);
             }
         }
-    } // release cs_main
+    }
 
     if (it != pfrom->vRecvGetData.end() && !pfrom->fPauseSend) {
         const CInv &inv = *it;
@@ -1284,6 +1431,9 @@ bool static ProcessHeadersMessage(CNode *pfrom, CConnman *connman, const std::ve
 
     bool received_new_header = false;
     const CBlockIndex *pindexLast = nullptr;
+    // First header not yet in mapBlockIndex and its height, if the headers connect
+    size_t nFirstNew = nCount;
+    int nFirstNewHeight = -1;
     {
         LOCK(cs_main);
         CNodeState *nodestate = State(pfrom->GetId());
@@ -1316,12 +1466,21 @@ bool static ProcessHeadersMessage(CNode *pfrom, CConnman *connman, const std::ve
         }
 
         uint256 hashLastBlock;
-        for (const CBlockHeader& header : headers) {
+        for (size_t i = 0; i < nCount; i++) {
+            const CBlockHeader& header = headers[i];
             if (!hashLastBlock.IsNull() && header.hashPrevBlock != hashLastBlock) {
                 Misbehaving(pfrom->GetId(), 20);
                 return error("non-continuous headers sequence");
             }
             hashLastBlock = header.GetHash();
+            // Headers we already have form a prefix, as the parent of a known header is known too
+            if (nFirstNew == nCount && mapBlockIndex.find(hashLastBlock) == mapBlockIndex.end()) {
+                nFirstNew = i;
+                BlockMap::const_iterator mi = mapBlockIndex.find(header.hashPrevBlock);
+                if (mi != mapBlockIndex.end()) {
+                    nFirstNewHeight = mi->second->nHeight + 1;
+                }
+            }
         }
 
         // If we don't have the last header, then they'll have given us
@@ -1331,9 +1490,18 @@ bool static ProcessHeadersMessage(CNode *pfrom, CConnman *connman, const std::ve
         }
     }
 
+    // Check the proof of work of the new headers in parallel before taking
+    // cs_main, leaving only the contextual checks to ProcessNewBlockHeaders().
+    // If any of them fails, fall back to checking them one by one there, so
+    // that the first invalid header and the DoS score are found as before.
+    bool fCheckPOW = true;
+    if (nScriptCheckThreads && nFirstNewHeight >= 0) {
+        fCheckPOW = !CheckBlockHeadersPoW(headers, nFirstNew, nFirstNewHeight, chainparams.GetConsensus());
+    }
+
     CValidationState state;
     CBlockHeader first_invalid_header;
-    if (!ProcessNewBlockHeaders(headers, state, chainparams, &pindexLast, &first_invalid_header)) {
+    if (!ProcessNewBlockHeaders(headers, state, chainparams, &pindexLast, &first_invalid_header, fCheckPOW)) {
         int nDoS;
         if (state.IsInvalid(nDoS)) {
             LOCK(cs_main);
@@ -2345,6 +2513,7 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
         // Keep a CBlock for "optimistic" compactblock reconstructions (see
         // below)
         std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
+        bool fTryReconstruct = false;
         bool fBlockReconstructed = false;
 
         {
@@ -2440,18 +2609,9 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
                 // peer, or this peer has too many blocks outstanding to
                 // download from.
                 // Optimistically try to reconstruct anyway since we might be
-                // able to without any round trips.
-                PartiallyDownloadedBlock tempBlock(&mempool);
-                ReadStatus status = tempBlock.InitData(cmpctblock, vExtraTxnForCompact);
-                if (status != READ_STATUS_OK) {
-                    // TODO: don't ignore failures
-                    return true;
-                }
-                std::vector<CTransactionRef> dummy;
-                status = tempBlock.FillBlock(*pblock, dummy);
-                if (status == READ_STATUS_OK) {
-                    fBlockReconstructed = true;
-                }
+                // able to without any round trips. This only needs the
+                // mempool, so it is done below, after releasing cs_main.
+                fTryReconstruct = true;
             }
         } else {
             if (fAlreadyInFlight) {
@@ -2468,6 +2628,21 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
         }
         } // cs_main
 
+        if (fTryReconstruct) {
+            LOCK(g_cs_orphans);
+            PartiallyDownloadedBlock tempBlock(&mempool);
+            ReadStatus status = tempBlock.InitData(cmpctblock, vExtraTxnForCompact);
+            if (status != READ_STATUS_OK) {
+                // TODO: don't ignore failures
+                return true;
+            }
+            std::vector<CTransactionRef> dummy;
+            status = tempBlock.FillBlock(*pblock, dummy);
+            if (status == READ_STATUS_OK) {
+                fBlockReconstructed = true;
+            }
+        }
+
         if (fProcessBLOCKTXN)
             return ProcessMessage(pfrom, NetMsgType::BLOCKTXN, blockTxnMsg, nTimeReceived, chainparams, connman, interruptMsgProc);
 
@@ -2628,6 +2803,7 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
         const uint256 hash(pblock->GetHash());
         {
             LOCK(cs_main);
+            UpdateBlockDownloadSpeed(pfrom->GetId(), hash, nTimeReceived);
             // Also always process if we requested the block explicitly, as we may
             // need it even though it is not a candidate for a new best tip.
             forceProcessing |= MarkBlockAsReceived(hash);
@@ -2666,9 +2842,10 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
         }
         pfrom->fSentAddr = true;
 
-        pfrom->vAddrToSend.clear();
         std::vector<CAddress> vAddr = connman->GetAddresses();
         FastRandomContext insecure_rand;
+        LOCK(pfrom->cs_addrSend);
+        pfrom->vAddrToSend.clear();
         for (const CAddress &addr : vAddr)
             pfrom->PushAddress(addr, insecure_rand);
     }
@@ -2779,11 +2956,17 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
         vRecv >> alert;
 
         uint256 alertHash = alert.GetHash();
-        if (pfrom->setKnown.count(alertHash) == 0)
+        bool fKnown;
+        {
+            LOCK(cs_mapAlerts);
+            fKnown = pfrom->setKnown.count(alertHash) != 0;
+        }
+        if (!fKnown)
         {
             if (alert.ProcessAlert())
             {
                 // Relay
+                LOCK(cs_mapAlerts);
                 pfrom->setKnown.insert(alertHash);
                 {
                       connman->ForEachNode([&alert, &connman](CNode* pnode) {
@@ -2798,6 +2981,7 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
                 // This isn't a Misbehaving(100) (immediate ban) because the
                 // peer might be an older or different implementation with
                 // a different signature key, etc.
+                LOCK(cs_main);
                 Misbehaving(pfrom->GetId(), 10);
             }
         }
@@ -3025,6 +3209,9 @@ bool PeerLogicValidation::ProcessMessages(CNode* pfrom, std::atomic<bool>& inter
         PrintExceptionContinue(nullptr, "ProcessMessages()");
     }
 
+    // Done with the message, so receive another one into its buffers
+    pfrom->RecycleRecvMessages(msgs);
+
     if (!fRet) {
         LogPrint(BCLog::NET, "%s(%s, %u bytes) FAILED peer=%d\n", __func__, SanitizeString(strCommand), nMessageSize, pfrom->GetId());
     }
@@ -3230,9 +3417,10 @@ bool PeerLogicValidation::SendMessages(CNode* pto, std::atomic<bool>& interruptM
             return true;
         CNodeState &state = *State(pto->GetId());
 
-        // Address refresh broadcast
         int64_t nNow = GetTimeMicros();
-        if (!IsInitialBlockDownload() && pto->nNextLocalAddrSend < nNow) {
+
+        // Address refresh broadcast
+        if (pto->nNextLocalAddrSend < nNow && !IsInitialBlockDownload()) {
             AdvertiseLocal(pto);
             pto->nNextLocalAddrSend = PoissonNextSend(nNow, AVG_LOCAL_ADDRESS_BROADCAST_INTERVAL);
         }
@@ -3242,6 +3430,7 @@ bool PeerLogicValidation::SendMessages(CNode* pto, std::atomic<bool>& interruptM
         //
         if (pto->nNextAddrSend < nNow) {
             pto->nNextAddrSend = PoissonNextSend(nNow, AVG_ADDRESS_BROADCAST_INTERVAL);
+            LOCK(pto->cs_addrSend);
             std::vector<CAddress> vAddr;
             vAddr.reserve(pto->vAddrToSend.size());
             for (const CAddress& addr : pto->vAddrToSend)
@@ -3379,12 +3568,12 @@ bool PeerLogicValidation::SendMessages(CNode* pto, std::atomic<bool>& interruptM
                     {
                         LOCK(cs_most_recent_block);
                         if (most_recent_block_hash == pBestIndex->GetBlockHash()) {
-                            if (state.fWantsCmpctWitness || !fWitnessesPresentInMostRecentCompactBlock)
-                                connman->PushMessage(pto, msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, *most_recent_compact_block));
-                            else {
+                            PushSharedMessage(connman, pto, NetMsgType::CMPCTBLOCK, most_recent_block_hash, pto->GetSendVersion() | nSendFlags, [&] {
+                                if (state.fWantsCmpctWitness || !fWitnessesPresentInMostRecentCompactBlock)
+                                    return msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, *most_recent_compact_block);
                                 CBlockHeaderAndShortTxIDs cmpctblock(*most_recent_block, state.fWantsCmpctWitness);
-                                connman->PushMessage(pto, msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, cmpctblock));
-                            }
+                                return msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, cmpctblock);
+                            });
                             fGotBlockFromCache = true;
                         }
                     }
@@ -3551,6 +3740,7 @@ bool PeerLogicValidation::SendMessages(CNode* pto, std::atomic<bool>& interruptM
                     vInv.push_back(CInv(MSG_TX, hash));
                     nRelayedTransactions++;
                     {
+                        LOCK(cs_relay);
                         // Expire old relay messages
                         while (!vRelayExpiration.empty() && vRelayExpiration.front().first < nNow)
                         {
@@ -3639,10 +3829,22 @@ bool PeerLogicValidation::SendMessages(CNode* pto, std::atomic<bool>& interruptM
         // Message: getdata (blocks)
         //
         std::vector<CInv> vGetData;
-        if (!pto->fClient && (fFetch || !IsInitialBlockDownload()) && state.nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
+        const int nMaxBlocksInTransit = GetMaxBlocksInTransit(state.nAvgBlockInterval, pto->nMinPingUsecTime);
+        if (!pto->fClient && (fFetch || !IsInitialBlockDownload()) && state.nBlocksInFlight < nMaxBlocksInTransit) {
             std::vector<const CBlockIndex*> vToDownload;
             NodeId staller = -1;
-            FindNextBlocksToDownload(pto->GetId(), MAX_BLOCKS_IN_TRANSIT_PER_PEER - state.nBlocksInFlight, vToDownload, staller, consensusParams);
+            const CBlockIndex* pindexWaitingFor = nullptr;
+            FindNextBlocksToDownload(pto->GetId(), nMaxBlocksInTransit - state.nBlocksInFlight, vToDownload, staller, consensusParams, &pindexWaitingFor);
+            // Rather than letting a slow peer stall the download window,
+            // take over the block holding it back if this peer is faster.
+            if (pindexWaitingFor && IsInitialBlockDownload() && IsBlockInFlightLate(pto->GetId(), pindexWaitingFor->GetBlockHash(), nNow)) {
+                LogPrint(BCLog::NET, "Block %s (%d) is late from peer=%d, requesting it from peer=%d\n", pindexWaitingFor->GetBlockHash().ToString(),
+                    pindexWaitingFor->nHeight, mapBlocksInFlight.find(pindexWaitingFor->GetBlockHash())->second.first, pto->GetId());
+                if (vToDownload.size() == (size_t)(nMaxBlocksInTransit - state.nBlocksInFlight))
+                    vToDownload.pop_back();
+                vToDownload.insert(vToDownload.begin(), pindexWaitingFor);
+                staller = -1;
+            }
             for (const CBlockIndex *pindex : vToDownload) {
                 uint32_t nFetchFlags = GetFetchFlags(pto);
                 vGetData.push_back(CInv(MSG_BLOCK | nFetchFlags, pindex->GetBlockHash()));
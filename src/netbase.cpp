@@ -18,6 +18,10 @@
 #include <fcntl.h>
 #endif
 
+#ifdef USE_POLL
+#include <poll.h>
+#endif
+
 #include <boost/algorithm/string/case_conv.hpp> // for to_lower()
 #include <boost/algorithm/string/predicate.hpp> // for startswith() and endswith()
 
@@ -258,6 +262,12 @@ static IntrRecvError InterruptibleRecv(uint8_t* data, size_t len, int timeout, c
         } else { // Other error or blocking
             int nErr = WSAGetLastError();
             if (nErr == WSAEINPROGRESS || nErr == WSAEWOULDBLOCK || nErr == WSAEINVAL) {
+#ifdef USE_POLL
+                struct pollfd pollfd = {};
+                pollfd.fd = hSocket;
+                pollfd.events = POLLIN;
+                int nRet = poll(&pollfd, 1, std::min(endTime - curTime, maxWait));
+#else
                 if (!IsSelectableSocket(hSocket)) {
                     return IntrRecvError::NetworkError;
                 }
@@ -266,6 +276,7 @@ static IntrRecvError InterruptibleRecv(uint8_t* data, size_t len, int timeout, c
                 FD_ZERO(&fdset);
                 FD_SET(hSocket, &fdset);
                 int nRet = select(hSocket + 1, &fdset, nullptr, nullptr, &tval);
+#endif
                 if (nRet == SOCKET_ERROR) {
                     return IntrRecvError::NetworkError;
                 }
@@ -441,15 +452,24 @@ SOCKET CreateSocket(const CService &addrConnect)
         return INVALID_SOCKET;
     }
 
-    SOCKET hSocket = socket(((struct sockaddr*)&sockaddr)->sa_family, SOCK_STREAM, IPPROTO_TCP);
+    int nType = SOCK_STREAM;
+#ifdef SOCK_CLOEXEC
+    nType |= SOCK_CLOEXEC;
+#endif
+    SOCKET hSocket = socket(((struct sockaddr*)&sockaddr)->sa_family, nType, IPPROTO_TCP);
     if (hSocket == INVALID_SOCKET)
         return INVALID_SOCKET;
+#ifndef SOCK_CLOEXEC
+    SetSocketCloseOnExec(hSocket);
+#endif
 
+#ifndef USE_POLL
     if (!IsSelectableSocket(hSocket)) {
         CloseSocket(hSocket);
         LogPrintf("Cannot create connection: non-selectable socket created (fd >= FD_SETSIZE ?)\n");
         return INVALID_SOCKET;
     }
+#endif
 
 #ifdef SO_NOSIGPIPE
     int set = 1;
@@ -468,6 +488,18 @@ SOCKET CreateSocket(const CService &addrConnect)
     return hSocket;
 }
 
+SOCKET AcceptSocket(const SOCKET& hListenSocket, struct sockaddr* addr, socklen_t* addrlen)
+{
+#ifdef SOCK_CLOEXEC
+    return accept4(hListenSocket, addr, addrlen, SOCK_CLOEXEC);
+#else
+    SOCKET hSocket = accept(hListenSocket, addr, addrlen);
+    if (hSocket != INVALID_SOCKET)
+        SetSocketCloseOnExec(hSocket);
+    return hSocket;
+#endif
+}
+
 bool ConnectSocketDirectly(const CService &addrConnect, const SOCKET& hSocket, int nTimeout)
 {
     struct sockaddr_storage sockaddr;
@@ -486,11 +518,18 @@ bool ConnectSocketDirectly(const CService &addrConnect, const SOCKET& hSocket, i
         // WSAEINVAL is here because some legacy version of winsock uses it
         if (nErr == WSAEINPROGRESS || nErr == WSAEWOULDBLOCK || nErr == WSAEINVAL)
         {
+#ifdef USE_POLL
+            struct pollfd pollfd = {};
+            pollfd.fd = hSocket;
+            pollfd.events = POLLOUT;
+            int nRet = poll(&pollfd, 1, nTimeout);
+#else
             struct timeval timeout = MillisToTimeval(nTimeout);
             fd_set fdset;
             FD_ZERO(&fdset);
             FD_SET(hSocket, &fdset);
             int nRet = select(hSocket + 1, nullptr, &fdset, nullptr, &timeout);
+#endif
             if (nRet == 0)
             {
                 LogPrint(BCLog::NET, "connection to %s timeout\n", addrConnect.ToString());
@@ -716,6 +755,16 @@ bool SetSocketNonBlocking(const SOCKET& hSocket, bool fNonBlocking)
     return true;
 }
 
+bool SetSocketCloseOnExec(const SOCKET& hSocket)
+{
+#ifdef WIN32
+    return SetHandleInformation((HANDLE)hSocket, HANDLE_FLAG_INHERIT, 0) != 0;
+#else
+    int fFlags = fcntl(hSocket, F_GETFD, 0);
+    return fFlags != -1 && fcntl(hSocket, F_SETFD, fFlags | FD_CLOEXEC) != -1;
+#endif
+}
+
 bool SetSocketNoDelay(const SOCKET& hSocket)
 {
     int set = 1;
@@ -10,32 +10,91 @@
 #include <pow.h>
 
 #include <arith_uint256.h>
-#include <bignum.h>
 #include <chain.h>
+#include <crypto/common.h>
 #include <primitives/block.h>
+#include <sync.h>
 #include <uint256.h>
 #include <util.h>
 #include <version.h>
 #include <chainparams.h>
 
+#include <cmath>
+#include <limits>
 #include <stdexcept>
 #include <vector>
-#include <openssl/bn.h>
-#include <cmath>
 
-unsigned int static KimotoGravityWell(const CBlockIndex* pindexLast, const CBlockHeader *pblock, uint64_t TargetBlocksSpacingSeconds, uint64_t PastBlocksMin, uint64_t PastBlocksMax, const Consensus::Params& params) {
+/** Divide a by nDiv, rounding down, and store the remainder in nRem */
+static arith_uint256 DivMod(const arith_uint256& a, uint32_t nDiv, uint32_t& nRem)
+{
+    // Schoolbook division one 32-bit word at a time, which is much cheaper
+    // than the bit-by-bit long division of arith_uint256::operator/=
+    uint256 num = ArithToUint256(a);
+    uint256 quot;
+    uint64_t rem = 0;
+    for (int i = num.size() - 4; i >= 0; i -= 4) {
+        rem = (rem << 32) | ReadLE32(num.begin() + i);
+        WriteLE32(quot.begin() + i, rem / nDiv);
+        rem %= nDiv;
+    }
+    nRem = rem;
+    return UintToArith256(quot);
+}
+
+/**
+ * Compute (a * nMul + b) / nDiv rounded down, without limiting the
+ * intermediate values to 256 bits, as the CBigNum arithmetic this replaces
+ * did. Returns false if the result itself does not fit in 256 bits.
+ */
+static bool MulAddDiv(arith_uint256& result, const arith_uint256& a, uint64_t nMul, const arith_uint256& b, uint32_t nDiv)
+{
+    // With a = qa * nDiv + ra and b = qb * nDiv + rb, the result is
+    // qa * nMul + qb + (ra * nMul + rb) / nDiv, where the last term is small
+    uint32_t ra, rb;
+    const arith_uint256 qa = DivMod(a, nDiv, ra);
+    const arith_uint256 qb = DivMod(b, nDiv, rb);
+    if (nMul != 0 && qa.bits() + arith_uint256(nMul).bits() > 256 && qa > ~arith_uint256() / arith_uint256(nMul)) {
+        return false;
+    }
+    uint32_t nRem;
+    const arith_uint256 tail = DivMod(arith_uint256(ra) * arith_uint256(nMul) + rb, nDiv, nRem);
+
+    result = qa * arith_uint256(nMul);
+    result += qb;
+    if (result < qb) return false;
+    result += tail;
+    if (result < tail) return false;
+    return true;
+}
+
+/** Number of past block counts for which the KGW event horizon is precomputed */
+static const uint64_t KGW_EVENT_HORIZON_CACHE_SIZE = 10080;
+
+/** KGW event horizon deviation after PastBlocksMass blocks */
+static double KimotoEventHorizonDeviation(uint64_t PastBlocksMass)
+{
+    static const std::vector<double> vDeviation = [] {
+        std::vector<double> v(KGW_EVENT_HORIZON_CACHE_SIZE);
+        for (uint64_t n = 1; n < v.size(); n++) {
+            v[n] = 1 + (0.7084 * std::pow((double(n)/double(144)), -1.228));
+        }
+        return v;
+    }();
+    if (PastBlocksMass < vDeviation.size()) {
+        return vDeviation[PastBlocksMass];
+    }
+    return 1 + (0.7084 * std::pow((double(PastBlocksMass)/double(144)), -1.228));
+}
+
+unsigned int KimotoGravityWell(const CBlockIndex* pindexLast, const CBlockHeader *pblock, uint64_t TargetBlocksSpacingSeconds, uint64_t PastBlocksMin, uint64_t PastBlocksMax, const Consensus::Params& params) {
 	/* current difficulty formula, megacoin - kimoto gravity well */
 	const CBlockIndex  *BlockLastSolved				= pindexLast;
 	const CBlockIndex  *BlockReading				= pindexLast;
-	const CBlockHeader *BlockCreating				= pblock;
-						BlockCreating				= BlockCreating;
 	uint64_t			PastBlocksMass				= 0;
 	int64_t				PastRateActualSeconds		= 0;
 	int64_t				PastRateTargetSeconds		= 0;
 	double				PastRateAdjustmentRatio		= double(1);
-	CBigNum				PastDifficultyAverage;
-	CBigNum				PastDifficultyAveragePrev;
-	double				EventHorizonDeviation;
+	arith_uint256		PastDifficultyAverage;
 	double				EventHorizonDeviationFast;
 	double				EventHorizonDeviationSlow;
 
@@ -45,9 +104,12 @@ unsigned int static KimotoGravityWell(const CBlockIndex* pindexLast, const CBloc
 		if (PastBlocksMax > 0 && i > PastBlocksMax) { break; }
 		PastBlocksMass++;
 
-		if (i == 1)	{ PastDifficultyAverage.SetCompact(BlockReading->nBits); }
-		else		{ PastDifficultyAverage = ((CBigNum().SetCompact(BlockReading->nBits) - PastDifficultyAveragePrev) / i) + PastDifficultyAveragePrev; }
-		PastDifficultyAveragePrev = PastDifficultyAverage;
+		// Moving average, with the division rounding towards zero
+		arith_uint256 BlockDifficulty = arith_uint256().SetCompact(BlockReading->nBits);
+		uint32_t nRem;
+		if (i == 1)											{ PastDifficultyAverage = BlockDifficulty; }
+		else if (BlockDifficulty >= PastDifficultyAverage)	{ PastDifficultyAverage += DivMod(BlockDifficulty - PastDifficultyAverage, i, nRem); }
+		else												{ PastDifficultyAverage -= DivMod(PastDifficultyAverage - BlockDifficulty, i, nRem); }
 
 		PastRateActualSeconds			= BlockLastSolved->GetBlockTime() - BlockReading->GetBlockTime();
 		PastRateTargetSeconds			= TargetBlocksSpacingSeconds * PastBlocksMass;
@@ -56,29 +118,29 @@ unsigned int static KimotoGravityWell(const CBlockIndex* pindexLast, const CBloc
 		if (PastRateActualSeconds != 0 && PastRateTargetSeconds != 0) {
 		PastRateAdjustmentRatio			= double(PastRateTargetSeconds) / double(PastRateActualSeconds);
 		}
-		EventHorizonDeviation			= 1 + (0.7084 * std::pow((double(PastBlocksMass)/double(144)), -1.228));
-		EventHorizonDeviationFast		= EventHorizonDeviation;
-		EventHorizonDeviationSlow		= 1 / EventHorizonDeviation;
 
 		if (PastBlocksMass >= PastBlocksMin) {
+			EventHorizonDeviationFast		= KimotoEventHorizonDeviation(PastBlocksMass);
+			EventHorizonDeviationSlow		= 1 / EventHorizonDeviationFast;
 			if ((PastRateAdjustmentRatio <= EventHorizonDeviationSlow) || (PastRateAdjustmentRatio >= EventHorizonDeviationFast)) { assert(BlockReading); break; }
 		}
 		if (BlockReading->pprev == NULL) { assert(BlockReading); break; }
 		BlockReading = BlockReading->pprev;
 	}
 
-	CBigNum bnNew(PastDifficultyAverage);
+	const arith_uint256 bnPowLimit = UintToArith256(params.powLimit);
+	arith_uint256 bnNew(PastDifficultyAverage);
 	if (PastRateActualSeconds != 0 && PastRateTargetSeconds != 0) {
-		bnNew *= PastRateActualSeconds;
-		bnNew /= PastRateTargetSeconds;
+		assert(PastRateTargetSeconds <= std::numeric_limits<uint32_t>::max());
+		if (!MulAddDiv(bnNew, PastDifficultyAverage, PastRateActualSeconds, arith_uint256(), PastRateTargetSeconds)) { bnNew = bnPowLimit; }
 	}
-    if (bnNew > CBigNum(params.powLimit)) { bnNew = CBigNum(params.powLimit); }
+    if (bnNew > bnPowLimit) { bnNew = bnPowLimit; }
 
 	return bnNew.GetCompact();
 }
 
 
-unsigned int static DarkGravityWave(const CBlockIndex* pindexLast, const CBlockHeader *pblock, const Consensus::Params& params) {
+unsigned int DarkGravityWave(const CBlockIndex* pindexLast, const CBlockHeader *pblock, const Consensus::Params& params) {
     /* current difficulty formula, dash - DarkGravity v3, written by Evan Duffield - evan@dashpay.io */
     const CBlockIndex *BlockLastSolved = pindexLast;
     const CBlockIndex *BlockReading = pindexLast;
@@ -87,8 +149,7 @@ unsigned int static DarkGravityWave(const CBlockIndex* pindexLast, const CBlockH
     int64_t PastBlocksMin = 24;
     int64_t PastBlocksMax = 24;
     int64_t CountBlocks = 0;
-    CBigNum PastDifficultyAverage;
-    CBigNum PastDifficultyAveragePrev;
+    arith_uint256 PastDifficultyAverage;
 
     if (BlockLastSolved == NULL || BlockLastSolved->nHeight < Params().SwitchLyra2REv2_DGWblock() + PastBlocksMin) {
         return UintToArith256(params.powLimit).GetCompact();
@@ -99,9 +160,13 @@ unsigned int static DarkGravityWave(const CBlockIndex* pindexLast, const CBlockH
         CountBlocks++;
 
         if(CountBlocks <= PastBlocksMin) {
-            if (CountBlocks == 1) { PastDifficultyAverage.SetCompact(BlockReading->nBits); }
-            else { PastDifficultyAverage = ((PastDifficultyAveragePrev * CountBlocks)+(CBigNum().SetCompact(BlockReading->nBits))) / (CountBlocks+1); }
-            PastDifficultyAveragePrev = PastDifficultyAverage;
+            arith_uint256 BlockDifficulty = arith_uint256().SetCompact(BlockReading->nBits);
+            if (CountBlocks == 1) { PastDifficultyAverage = BlockDifficulty; }
+            else {
+                // An average of values below 2^256 always fits
+                bool fFits = MulAddDiv(PastDifficultyAverage, PastDifficultyAverage, CountBlocks, BlockDifficulty, CountBlocks + 1);
+                assert(fFits);
+            }
         }
 
         if(LastBlockTime > 0){
@@ -114,7 +179,8 @@ unsigned int static DarkGravityWave(const CBlockIndex* pindexLast, const CBlockH
         BlockReading = BlockReading->pprev;
     }
 
-    CBigNum bnNew(PastDifficultyAverage);
+    const arith_uint256 bnPowLimit = UintToArith256(params.powLimit);
+    arith_uint256 bnNew(PastDifficultyAverage);
 
     int64_t _nTargetTimespan = CountBlocks*params.nPowTargetSpacing;
 
@@ -124,16 +190,80 @@ unsigned int static DarkGravityWave(const CBlockIndex* pindexLast, const CBlockH
         nActualTimespan = _nTargetTimespan*3;
 
     // Retarget
-    bnNew *= nActualTimespan;
-    bnNew /= _nTargetTimespan;
+    assert(_nTargetTimespan > 0 && _nTargetTimespan <= std::numeric_limits<uint32_t>::max());
+    if (!MulAddDiv(bnNew, PastDifficultyAverage, nActualTimespan, arith_uint256(), _nTargetTimespan)) {
+        bnNew = bnPowLimit;
+    }
 
-    if (bnNew > CBigNum(params.powLimit)){
-        bnNew = CBigNum(params.powLimit);
+    if (bnNew > bnPowLimit){
+        bnNew = bnPowLimit;
     }
 
     return bnNew.GetCompact();
 }
 
+/**
+ * Results of the gravity well retargets, keyed by the block they build on.
+ *
+ * KGW and DGW only depend on pindexLast and its ancestors, so a result stays
+ * valid for as long as that block exists; after a reorg the other branch
+ * simply misses and takes the slow path. The moving averages round at every
+ * step from the newest block back, so they cannot be updated incrementally
+ * without changing results, and each block's result is memoized instead.
+ * This makes repeated retargets for the same tip, as done by
+ * getblocktemplate and mining, O(1).
+ *
+ * Entries are direct-mapped by height, so the cache holds the most recent
+ * result for each of the last NEXT_WORK_CACHE_SIZE heights.
+ */
+class CNextWorkCache
+{
+private:
+    static const size_t NEXT_WORK_CACHE_SIZE = 1024;
+
+    struct Entry {
+        uint256 hashBlock;
+        unsigned int nBits;
+    };
+
+    CCriticalSection cs;
+    std::vector<Entry> vEntries;
+
+    static bool Cacheable(const CBlockIndex* pindexLast, const Consensus::Params& params)
+    {
+        // Only cache for the active chain's parameters, and for real block index
+        // entries, whose hash identifies them even if their memory is reused
+        return &params == &Params().GetConsensus() && pindexLast->phashBlock != nullptr;
+    }
+
+public:
+    CNextWorkCache() : vEntries(NEXT_WORK_CACHE_SIZE) {}
+
+    bool Lookup(const CBlockIndex* pindexLast, const Consensus::Params& params, unsigned int& nBits)
+    {
+        if (!Cacheable(pindexLast, params))
+            return false;
+        LOCK(cs);
+        const Entry& entry = vEntries[pindexLast->nHeight % NEXT_WORK_CACHE_SIZE];
+        if (entry.hashBlock != pindexLast->GetBlockHash())
+            return false;
+        nBits = entry.nBits;
+        return true;
+    }
+
+    void Insert(const CBlockIndex* pindexLast, const Consensus::Params& params, unsigned int nBits)
+    {
+        if (!Cacheable(pindexLast, params))
+            return;
+        LOCK(cs);
+        Entry& entry = vEntries[pindexLast->nHeight % NEXT_WORK_CACHE_SIZE];
+        entry.hashBlock = pindexLast->GetBlockHash();
+        entry.nBits = nBits;
+    }
+};
+
+static CNextWorkCache nextWorkCache;
+
 unsigned int static GetNextWorkRequired_V2(const CBlockIndex* pindexLast, const CBlockHeader *pblock, const Consensus::Params& params)
 {
 	static const int64_t	BlocksTargetSpacing			= params.nPowTargetSpacing;
@@ -161,14 +291,23 @@ unsigned int GetNextWorkRequired(const CBlockIndex* pindexLast, const CBlockHead
     if (params.fPowNoRetargeting)
         return pindexLast->nBits;
 
+    unsigned int nBits;
     if(pindexLast->nHeight+1 >= Params().SwitchLyra2REv2_DGWblock())
     {
         // DGWv3
-        return DarkGravityWave(pindexLast, pblock, params);
+        if (!nextWorkCache.Lookup(pindexLast, params, nBits)) {
+            nBits = DarkGravityWave(pindexLast, pblock, params);
+            nextWorkCache.Insert(pindexLast, params, nBits);
+        }
+        return nBits;
     }
     else if(pindexLast->nHeight+1 >= Params().SwitchKGWblock() && pindexLast->nHeight+1 < Params().SwitchDIGIblock()){
         // KGW
-        return GetNextWorkRequired_V2(pindexLast, pblock, params);
+        if (!nextWorkCache.Lookup(pindexLast, params, nBits)) {
+            nBits = GetNextWorkRequired_V2(pindexLast, pblock, params);
+            nextWorkCache.Insert(pindexLast, params, nBits);
+        }
+        return nBits;
     }
 
     int64_t adjustmentInterval = params.DifficultyAdjustmentInterval();
@@ -81,6 +81,7 @@ public:
 
     // memory only
     mutable bool fChecked;
+    mutable bool fCheckedPoW; // header proof of work already verified for its height
 
     CBlock()
     {
@@ -106,6 +107,7 @@ public:
         CBlockHeader::SetNull();
         vtx.clear();
         fChecked = false;
+        fCheckedPoW = false;
     }
 
     CBlockHeader GetBlockHeader() const
@@ -24,6 +24,7 @@
 #include <usercheckpoint.h>
 #include <util.h>
 #include <utilstrencodings.h>
+#include <utxosnapshot.h>
 #include <hash.h>
 #include <validationinterface.h>
 #include <volatilecheckpoint.h>
@@ -933,29 +934,66 @@ UniValue pruneblockchain(const JSONRPCRequest& request)
 
 UniValue gettxoutsetinfo(const JSONRPCRequest& request)
 {
-    if (request.fHelp || request.params.size() != 0)
+    if (request.fHelp || request.params.size() > 2)
         throw std::runtime_error(
-            "gettxoutsetinfo\n"
+            "gettxoutsetinfo ( \"hash_type\" height )\n"
             "\nReturns statistics about the unspent transaction output set.\n"
-            "Note this call may take some time.\n"
+            "Note this call may take some time, unless hash_type is \"ecmh\".\n"
+            "\nArguments:\n"
+            "1. \"hash_type\"    (string, optional, default=\"hash_serialized_2\") \"hash_serialized_2\" scans the whole set;\n"
+            "                   \"ecmh\" reports the incrementally maintained set commitment instead\n"
+            "2. height         (numeric, optional) With \"ecmh\", the active chain height to report on (default: the tip),\n"
+            "                   within " + strprintf("%d", UTXO_COMMITMENT_BLOCKS_TO_KEEP) + " blocks of the tip or at a checkpoint\n"
             "\nResult:\n"
             "{\n"
             "  \"height\":n,     (numeric) The current block height (index)\n"
             "  \"bestblock\": \"hex\",   (string) The hash of the block at the tip of the chain\n"
-            "  \"transactions\": n,      (numeric) The number of transactions with unspent outputs\n"
+            "  \"transactions\": n,      (numeric) The number of transactions with unspent outputs (hash_serialized_2 only)\n"
             "  \"txouts\": n,            (numeric) The number of unspent transaction outputs\n"
             "  \"bogosize\": n,          (numeric) A meaningless metric for UTXO set size\n"
-            "  \"hash_serialized_2\": \"hash\", (string) The serialized hash\n"
-            "  \"disk_size\": n,         (numeric) The estimated size of the chainstate on disk\n"
+            "  \"hash_serialized_2\": \"hash\", (string) The serialized hash (hash_serialized_2 only)\n"
+            "  \"ecmh\": \"hash\",        (string) The order-independent set commitment (ecmh only)\n"
+            "  \"disk_size\": n,         (numeric) The estimated size of the chainstate on disk (hash_serialized_2 only)\n"
             "  \"total_amount\": x.xxx          (numeric) The total amount\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("gettxoutsetinfo", "")
+            + HelpExampleCli("gettxoutsetinfo", "\"ecmh\" 1000")
             + HelpExampleRpc("gettxoutsetinfo", "")
         );
 
+    std::string strHashType = "hash_serialized_2";
+    if (!request.params[0].isNull())
+        strHashType = request.params[0].get_str();
+
     UniValue ret(UniValue::VOBJ);
 
+    if (strHashType == "ecmh") {
+        LOCK(cs_main);
+        const CBlockIndex* pindex = chainActive.Tip();
+        if (!request.params[1].isNull()) {
+            int nHeight = request.params[1].get_int();
+            if (nHeight < 0 || nHeight > chainActive.Height())
+                throw JSONRPCError(RPC_INVALID_PARAMETER, "Block height out of range");
+            pindex = chainActive[nHeight];
+        }
+        CUTXOCommitment commitment;
+        if (!pcoinsdbview->ReadBlockCommitment(pindex->GetBlockHash(), commitment) &&
+            !(pindex == chainActive.Tip() && pcoinsTip->GetCommitment(commitment)))
+            throw JSONRPCError(RPC_MISC_ERROR, "No UTXO set commitment stored for this block");
+        ret.push_back(Pair("height", (int64_t)pindex->nHeight));
+        ret.push_back(Pair("bestblock", pindex->GetBlockHash().GetHex()));
+        ret.push_back(Pair("txouts", commitment.nTransactionOutputs));
+        ret.push_back(Pair("bogosize", commitment.nBogoSize));
+        ret.push_back(Pair("ecmh", commitment.GetHash().GetHex()));
+        ret.push_back(Pair("total_amount", ValueFromAmount(commitment.nTotalAmount)));
+        return ret;
+    }
+    if (strHashType != "hash_serialized_2")
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Unknown hash_type");
+    if (!request.params[1].isNull())
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "height is only supported with hash_type \"ecmh\"");
+
     CCoinsStats stats;
     FlushStateToDisk();
     if (GetUTXOStats(pcoinsdbview.get(), stats)) {
@@ -973,6 +1011,80 @@ UniValue gettxoutsetinfo(const JSONRPCRequest& request)
     return ret;
 }
 
+UniValue getdbstats(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 0)
+        throw std::runtime_error(
+            "getdbstats\n"
+            "\nReturns the settings and activity of each open LevelDB database since it was opened.\n"
+            "\nResult:\n"
+            "[\n"
+            "  {\n"
+            "    \"name\": \"xxxx\",           (string) The database, e.g. chainstate or index\n"
+            "    \"profile\": \"xxxx\",        (string) The -dbprofile in use\n"
+            "    \"block_cache\": n,         (numeric) Bytes used by the block cache\n"
+            "    \"write_buffer\": n,        (numeric) Size of the write buffer in bytes\n"
+            "    \"max_open_files\": n,      (numeric) Table files kept open at most\n"
+            "    \"memory_usage\": n,        (numeric) Approximate memory used by LevelDB in bytes\n"
+            "    \"cache_hits\": n,          (numeric) Block cache lookups that hit\n"
+            "    \"cache_misses\": n,        (numeric) Block cache lookups that missed\n"
+            "    \"write_batches\": n,       (numeric) Batches written\n"
+            "    \"sync_writes\": n,         (numeric) Batches written synchronously\n"
+            "    \"write_time\": n,          (numeric) Total time spent writing batches in microseconds\n"
+            "    \"max_write_time\": n,      (numeric) Longest batch write in microseconds\n"
+            "    \"l0_stalls\": n,           (numeric) Writes that waited for level 0 files to be compacted\n"
+            "    \"memtable_stalls\": n,     (numeric) Writes that waited for the memtable to be flushed\n"
+            "    \"levels\": [               (array) Levels with files or compactions\n"
+            "      {\n"
+            "        \"level\": n,           (numeric) The level\n"
+            "        \"files\": n,           (numeric) Number of table files\n"
+            "        \"size_mib\": x.xx,     (numeric) Size of the table files in MiB\n"
+            "        \"compaction_time\": x.xx, (numeric) Time spent compacting into the level in seconds\n"
+            "        \"read_mib\": x.xx,     (numeric) MiB read by these compactions\n"
+            "        \"written_mib\": x.xx   (numeric) MiB written by these compactions\n"
+            "      }, ...\n"
+            "    ]\n"
+            "  }, ...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getdbstats", "")
+            + HelpExampleRpc("getdbstats", "")
+        );
+
+    UniValue ret(UniValue::VARR);
+    for (const CDBStats& stats : GetDBStats()) {
+        UniValue db(UniValue::VOBJ);
+        db.push_back(Pair("name", stats.strName));
+        db.push_back(Pair("profile", stats.strProfile));
+        db.push_back(Pair("block_cache", (uint64_t)stats.nBlockCacheSize));
+        db.push_back(Pair("write_buffer", (uint64_t)stats.nWriteBufferSize));
+        db.push_back(Pair("max_open_files", stats.nMaxOpenFiles));
+        db.push_back(Pair("memory_usage", stats.nMemoryUsage));
+        db.push_back(Pair("cache_hits", stats.nCacheHits));
+        db.push_back(Pair("cache_misses", stats.nCacheMisses));
+        db.push_back(Pair("write_batches", stats.nWriteBatches));
+        db.push_back(Pair("sync_writes", stats.nSyncWrites));
+        db.push_back(Pair("write_time", stats.nWriteMicros));
+        db.push_back(Pair("max_write_time", stats.nMaxWriteMicros));
+        db.push_back(Pair("l0_stalls", stats.nL0Stalls));
+        db.push_back(Pair("memtable_stalls", stats.nMemtableStalls));
+        UniValue levels(UniValue::VARR);
+        for (const CDBLevelStats& level : stats.vLevels) {
+            UniValue obj(UniValue::VOBJ);
+            obj.push_back(Pair("level", level.nLevel));
+            obj.push_back(Pair("files", level.nFiles));
+            obj.push_back(Pair("size_mib", level.dSizeMiB));
+            obj.push_back(Pair("compaction_time", level.dCompactionSeconds));
+            obj.push_back(Pair("read_mib", level.dReadMiB));
+            obj.push_back(Pair("written_mib", level.dWrittenMiB));
+            levels.push_back(obj);
+        }
+        db.push_back(Pair("levels", levels));
+        ret.push_back(db);
+    }
+    return ret;
+}
+
 UniValue gettxout(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() < 2 || request.params.size() > 3)
@@ -1789,6 +1901,51 @@ UniValue savemempool(const JSONRPCRequest& request)
     return NullUniValue;
 }
 
+UniValue dumptxoutset(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() != 1) {
+        throw std::runtime_error(
+            "dumptxoutset \"path\"\n"
+            "\nWrite the UTXO set as of the chain tip, with the block headers leading up to it, to a snapshot file.\n"
+            "A new node can start from it with -loadutxosnapshot once the result is added to the chain parameters.\n"
+            "\nArguments:\n"
+            "1. \"path\"    (string, required) The file to write. A relative path is taken relative to the data directory.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"path\": \"xxxx\",         (string) The absolute path of the snapshot\n"
+            "  \"base_hash\": \"hash\",    (string) The block the coins are the unspent outputs as of\n"
+            "  \"base_height\": n,       (numeric) The height of that block\n"
+            "  \"coins_written\": n,     (numeric) The number of coins in the snapshot\n"
+            "  \"ecmh\": \"hash\",         (string) The set commitment, as reported by gettxoutsetinfo \"ecmh\"\n"
+            "  \"chain_tx\": n,          (numeric) The number of transactions in the chain up to and including the base block\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("dumptxoutset", "\"utxo.dat\"")
+            + HelpExampleRpc("dumptxoutset", "\"utxo.dat\"")
+        );
+    }
+
+    fs::path path = fs::absolute(request.params[0].get_str(), GetDataDir());
+    if (fs::exists(path))
+        throw JSONRPCError(RPC_INVALID_PARAMETER, path.string() + " already exists");
+
+    CUTXOSnapshotHeader header;
+    if (!DumpUTXOSnapshot(path, header))
+        throw JSONRPCError(RPC_MISC_ERROR, "Unable to write UTXO snapshot, see debug.log for details");
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("path", path.string()));
+    ret.push_back(Pair("base_hash", header.hashBlock.GetHex()));
+    ret.push_back(Pair("base_height", header.nHeight));
+    ret.push_back(Pair("coins_written", (int64_t)header.nCoins));
+    ret.push_back(Pair("ecmh", header.hashCommitment.GetHex()));
+    {
+        LOCK(cs_main);
+        ret.push_back(Pair("chain_tx", (uint64_t)mapBlockIndex.at(header.hashBlock)->nChainTx));
+    }
+    return ret;
+}
+
 static const CRPCCommand commands[] =
 { //  category              name                      actor (function)         argNames
   //  --------------------- ------------------------  -----------------------  ----------
@@ -1800,6 +1957,7 @@ static const CRPCCommand commands[] =
     { "blockchain",         "getblockhash",           &getblockhash,           {"height"} },
     { "blockchain",         "getblockheader",         &getblockheader,         {"blockhash","verbose"} },
     { "blockchain",         "getchaintips",           &getchaintips,           {} },
+    { "blockchain",         "getdbstats",             &getdbstats,             {} },
     { "blockchain",         "getdifficulty",          &getdifficulty,          {} },
     { "blockchain",         "getmempoolancestors",    &getmempoolancestors,    {"txid","verbose"} },
     { "blockchain",         "getmempooldescendants",  &getmempooldescendants,  {"txid","verbose"} },
@@ -1807,7 +1965,8 @@ static const CRPCCommand commands[] =
     { "blockchain",         "getmempoolinfo",         &getmempoolinfo,         {} },
     { "blockchain",         "getrawmempool",          &getrawmempool,          {"verbose"} },
     { "blockchain",         "gettxout",               &gettxout,               {"txid","n","include_mempool"} },
-    { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        {} },
+    { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        {"hash_type","height"} },
+    { "blockchain",         "dumptxoutset",           &dumptxoutset,           {"path"} },
     { "blockchain",         "pruneblockchain",        &pruneblockchain,        {"height"} },
     { "blockchain",         "savemempool",            &savemempool,            {} },
     { "blockchain",         "verifychain",            &verifychain,            {"checklevel","nblocks"} },
@@ -114,6 +114,9 @@ UniValue generateBlocks(std::shared_ptr<CReserveScript> coinbaseScript, int nGen
         nHeight = chainActive.Height();
         nHeightEnd = nHeight+nGenerate;
     }
+    int nThreads = gArgs.GetArg("-genthreads", DEFAULT_GENERATE_THREADS);
+    if (nThreads <= 0)
+        nThreads = GetNumCores();
     unsigned int nExtraNonce = 0;
     UniValue blockHashes(UniValue::VARR);
     while (nHeight < nHeightEnd)
@@ -126,14 +129,14 @@ UniValue generateBlocks(std::shared_ptr<CReserveScript> coinbaseScript, int nGen
             LOCK(cs_main);
             IncrementExtraNonce(pblock, chainActive.Tip(), nExtraNonce);
         }
-        while (nMaxTries > 0 && pblock->nNonce < nInnerLoopCount && !CheckProofOfWork(pblock->GetPoWHash(nHeight+1 >= Params().SwitchLyra2REv2_DGWblock()), pblock->nBits, nHeight, Params().GetConsensus())) {
-            ++pblock->nNonce;
-            --nMaxTries;
-        }
+        const uint32_t nNonceBegin = pblock->nNonce;
+        const uint32_t nNonceEnd = std::min<uint64_t>(nInnerLoopCount, nNonceBegin + nMaxTries);
+        bool fFound = ScanPoWNonces(pblock, nNonceEnd, nThreads, nHeight, nHeight+1 >= Params().SwitchLyra2REv2_DGWblock(), Params().GetConsensus());
+        nMaxTries -= pblock->nNonce - nNonceBegin;
         if (nMaxTries == 0) {
             break;
         }
-        if (pblock->nNonce == nInnerLoopCount) {
+        if (!fFound) {
             continue;
         }
         std::shared_ptr<const CBlock> shared_pblock = std::make_shared<const CBlock>(*pblock);
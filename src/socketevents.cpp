@@ -0,0 +1,227 @@
+// Copyright (c) 2018 The Monacoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <socketevents.h>
+
+#include <netbase.h>
+#include <util.h>
+
+#include <algorithm>
+#include <stdexcept>
+
+#ifdef USE_EPOLL
+#include <sys/epoll.h>
+#include <unistd.h>
+#endif
+
+#ifdef USE_EPOLL
+const CSocketEvents::Mode CSocketEvents::DEFAULT_MODE = CSocketEvents::MODE_EPOLL;
+#else
+const CSocketEvents::Mode CSocketEvents::DEFAULT_MODE = CSocketEvents::MODE_SELECT;
+#endif
+
+bool CSocketEvents::ParseMode(const std::string& strMode, Mode& mode)
+{
+    if (strMode == "select") {
+        mode = MODE_SELECT;
+        return true;
+    }
+#ifdef USE_EPOLL
+    if (strMode == "epoll") {
+        mode = MODE_EPOLL;
+        return true;
+    }
+#endif
+    return false;
+}
+
+std::string CSocketEvents::GetModeName(Mode mode)
+{
+    switch (mode) {
+    case MODE_SELECT: return "select";
+    case MODE_EPOLL: return "epoll";
+    }
+    return "";
+}
+
+CSocketEvents::CSocketEvents(Mode modeIn) : mode(modeIn)
+{
+#ifdef USE_EPOLL
+    epollfd = -1;
+    if (mode == MODE_EPOLL) {
+        epollfd = epoll_create1(EPOLL_CLOEXEC);
+        if (epollfd == -1) {
+            throw std::runtime_error(strprintf("epoll_create1 failed: %s", NetworkErrorString(errno)));
+        }
+    }
+#else
+    if (mode != MODE_SELECT) {
+        throw std::runtime_error("socket events mode not supported");
+    }
+#endif
+}
+
+CSocketEvents::~CSocketEvents()
+{
+#ifdef USE_EPOLL
+    if (epollfd != -1) {
+        close(epollfd);
+    }
+#endif
+}
+
+bool CSocketEvents::IsUsable(SOCKET hSocket) const
+{
+    if (hSocket == INVALID_SOCKET) return false;
+    if (mode == MODE_SELECT) return IsSelectableSocket(hSocket);
+    return true;
+}
+
+#ifdef USE_EPOLL
+static uint32_t ToEpollEvents(uint32_t events)
+{
+    // Level-triggered, so a reader that stops early is woken again
+    uint32_t result = 0;
+    if (events & CSocketEvents::EVENT_RECV) result |= EPOLLIN;
+    if (events & CSocketEvents::EVENT_SEND) result |= EPOLLOUT;
+    return result;
+}
+#endif
+
+bool CSocketEvents::Add(SOCKET hSocket, void* context, uint32_t events)
+{
+    if (!IsUsable(hSocket)) return false;
+#ifdef USE_EPOLL
+    if (mode == MODE_EPOLL) {
+        struct epoll_event ev = {};
+        ev.events = ToEpollEvents(events);
+        ev.data.ptr = context;
+        if (epoll_ctl(epollfd, EPOLL_CTL_ADD, hSocket, &ev) == -1) {
+            LogPrintf("epoll_ctl add failed: %s\n", NetworkErrorString(errno));
+            return false;
+        }
+        return true;
+    }
+#endif
+    LOCK(cs);
+    return mapSockets.emplace(context, std::make_pair(hSocket, events)).second;
+}
+
+bool CSocketEvents::Modify(SOCKET hSocket, void* context, uint32_t events)
+{
+#ifdef USE_EPOLL
+    if (mode == MODE_EPOLL) {
+        struct epoll_event ev = {};
+        ev.events = ToEpollEvents(events);
+        ev.data.ptr = context;
+        if (epoll_ctl(epollfd, EPOLL_CTL_MOD, hSocket, &ev) == -1) {
+            LogPrintf("epoll_ctl modify failed: %s\n", NetworkErrorString(errno));
+            return false;
+        }
+        return true;
+    }
+#endif
+    LOCK(cs);
+    auto it = mapSockets.find(context);
+    if (it == mapSockets.end() || it->second.first != hSocket) return false;
+    it->second.second = events;
+    return true;
+}
+
+void CSocketEvents::Remove(SOCKET hSocket, void* context)
+{
+#ifdef USE_EPOLL
+    if (mode == MODE_EPOLL) {
+        // Kernels before 2.6.9 want an event even though it is ignored
+        struct epoll_event ev = {};
+        if (epoll_ctl(epollfd, EPOLL_CTL_DEL, hSocket, &ev) == -1) {
+            LogPrintf("epoll_ctl delete failed: %s\n", NetworkErrorString(errno));
+        }
+        return;
+    }
+#endif
+    LOCK(cs);
+    mapSockets.erase(context);
+}
+
+bool CSocketEvents::Wait(std::vector<Event>& vEvents, int nTimeout)
+{
+    vEvents.clear();
+#ifdef USE_EPOLL
+    if (mode == MODE_EPOLL) return WaitEpoll(vEvents, nTimeout);
+#endif
+    return WaitSelect(vEvents, nTimeout);
+}
+
+bool CSocketEvents::WaitSelect(std::vector<Event>& vEvents, int nTimeout)
+{
+    fd_set fdsetRecv;
+    fd_set fdsetSend;
+    fd_set fdsetError;
+    FD_ZERO(&fdsetRecv);
+    FD_ZERO(&fdsetSend);
+    FD_ZERO(&fdsetError);
+    SOCKET hSocketMax = 0;
+    bool fHaveSockets = false;
+
+    std::vector<std::pair<void*, SOCKET>> vSockets;
+    {
+        LOCK(cs);
+        vSockets.reserve(mapSockets.size());
+        for (const auto& entry : mapSockets) {
+            const SOCKET hSocket = entry.second.first;
+            const uint32_t events = entry.second.second;
+            vSockets.emplace_back(entry.first, hSocket);
+            FD_SET(hSocket, &fdsetError);
+            if (events & EVENT_RECV) FD_SET(hSocket, &fdsetRecv);
+            if (events & EVENT_SEND) FD_SET(hSocket, &fdsetSend);
+            hSocketMax = std::max(hSocketMax, hSocket);
+            fHaveSockets = true;
+        }
+    }
+
+    struct timeval timeout = MillisToTimeval(nTimeout);
+    int nSelect = select(fHaveSockets ? hSocketMax + 1 : 0, &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
+    if (nSelect == SOCKET_ERROR) {
+        if (fHaveSockets) {
+            int nErr = WSAGetLastError();
+            LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
+        }
+        return false;
+    }
+
+    for (const auto& entry : vSockets) {
+        uint32_t events = 0;
+        if (FD_ISSET(entry.second, &fdsetRecv)) events |= EVENT_RECV;
+        if (FD_ISSET(entry.second, &fdsetSend)) events |= EVENT_SEND;
+        if (FD_ISSET(entry.second, &fdsetError)) events |= EVENT_ERROR;
+        if (events) vEvents.push_back(Event{entry.first, events});
+    }
+    return true;
+}
+
+#ifdef USE_EPOLL
+bool CSocketEvents::WaitEpoll(std::vector<Event>& vEvents, int nTimeout)
+{
+    static const int MAX_EVENTS = 1024;
+    struct epoll_event events[MAX_EVENTS];
+
+    int nEvents = epoll_wait(epollfd, events, MAX_EVENTS, nTimeout);
+    if (nEvents == -1) {
+        if (errno == EINTR) return true;
+        LogPrintf("epoll_wait error %s\n", NetworkErrorString(errno));
+        return false;
+    }
+
+    vEvents.reserve(nEvents);
+    for (int i = 0; i < nEvents; i++) {
+        uint32_t result = 0;
+        if (events[i].events & EPOLLIN) result |= EVENT_RECV;
+        if (events[i].events & EPOLLOUT) result |= EVENT_SEND;
+        if (events[i].events & (EPOLLERR | EPOLLHUP)) result |= EVENT_ERROR;
+        vEvents.push_back(Event{events[i].data.ptr, result});
+    }
+    return true;
+}
+#endif
@@ -0,0 +1,107 @@
+// Copyright (c) 2018 The Monacoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_SOCKETEVENTS_H
+#define BITCOIN_SOCKETEVENTS_H
+
+#if defined(HAVE_CONFIG_H)
+#include <config/bitcoin-config.h>
+#endif
+
+#include <compat.h>
+#include <sync.h>
+
+#include <map>
+#include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifdef HAVE_SYS_EPOLL_H
+#define USE_EPOLL
+#endif
+
+/**
+ * Waits for sockets to become ready for receiving or sending.
+ *
+ * With epoll the sockets stay registered with the kernel between waits, and a
+ * wait costs time in the number of ready sockets only. select() is portable,
+ * but every wait passes all sockets, and it cannot wait for sockets numbered
+ * FD_SETSIZE or higher.
+ */
+class CSocketEvents
+{
+public:
+    enum Mode {
+        MODE_SELECT,
+        MODE_EPOLL,
+    };
+
+    enum : uint32_t {
+        EVENT_RECV = (1U << 0),
+        EVENT_SEND = (1U << 1),
+        //! Errors and hang-ups are always reported
+        EVENT_ERROR = (1U << 2),
+    };
+
+    struct Event {
+        void* context;
+        uint32_t events;
+    };
+
+    /** The best mode this platform supports */
+    static const Mode DEFAULT_MODE;
+
+    static bool ParseMode(const std::string& strMode, Mode& mode);
+    static std::string GetModeName(Mode mode);
+
+    /** Throws std::runtime_error if the mode can't be used. */
+    explicit CSocketEvents(Mode modeIn);
+    ~CSocketEvents();
+
+    CSocketEvents(const CSocketEvents&) = delete;
+    CSocketEvents& operator=(const CSocketEvents&) = delete;
+
+    Mode GetMode() const { return mode; }
+
+    /** Whether Add() can take the socket */
+    bool IsUsable(SOCKET hSocket) const;
+
+    /**
+     * Start waiting for events on a socket. context identifies the socket in
+     * the results of Wait(), and has to be unique among the sockets added.
+     */
+    bool Add(SOCKET hSocket, void* context, uint32_t events);
+    /** Change the events waited for on a socket that was added and is open. */
+    bool Modify(SOCKET hSocket, void* context, uint32_t events);
+    /**
+     * Stop waiting on a socket. Call this before closing the socket: epoll
+     * only drops it once every copy of it is closed, including copies in
+     * child processes.
+     */
+    void Remove(SOCKET hSocket, void* context);
+
+    /**
+     * Wait up to nTimeout milliseconds for events. Returns false on errors,
+     * which can return at once, so callers should sleep before retrying.
+     */
+    bool Wait(std::vector<Event>& vEvents, int nTimeout);
+
+private:
+    const Mode mode;
+#ifdef USE_EPOLL
+    int epollfd;
+#endif
+
+    //! With select(), the sockets added and the events to wait for
+    CCriticalSection cs;
+    std::map<void*, std::pair<SOCKET, uint32_t>> mapSockets;
+
+    bool WaitSelect(std::vector<Event>& vEvents, int nTimeout);
+#ifdef USE_EPOLL
+    bool WaitEpoll(std::vector<Event>& vEvents, int nTimeout);
+#endif
+};
+
+#endif // BITCOIN_SOCKETEVENTS_H
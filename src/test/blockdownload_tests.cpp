@@ -0,0 +1,67 @@
+// Copyright (c) 2018 The Monacoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// Unit tests for sizing and taking over block downloads by peer speed
+
+#include <validation.h>
+
+#include <test/test_bitcoin.h>
+
+#include <limits>
+#include <stdint.h>
+
+#include <boost/test/unit_test.hpp>
+
+// Tests these internal-to-net_processing.cpp methods:
+extern int GetMaxBlocksInTransit(int64_t nAvgBlockInterval, int64_t nPingUsec);
+extern bool IsBlockDownloadLate(int64_t nAvgBlockInterval, int64_t nAvgBlockIntervalFrom, int nQueuedBefore, int64_t nWaitingSince, int64_t nNow);
+
+BOOST_FIXTURE_TEST_SUITE(blockdownload_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(max_blocks_in_transit)
+{
+    const int nDefault = MAX_BLOCKS_IN_TRANSIT_PER_PEER;
+    const int nMin = MIN_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER;
+    const int nMax = MAX_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER;
+
+    // Without a known speed or round trip time, the fixed window
+    BOOST_CHECK_EQUAL(GetMaxBlocksInTransit(0, 1000000), nDefault);
+    BOOST_CHECK_EQUAL(GetMaxBlocksInTransit(100000, 0), nDefault);
+    BOOST_CHECK_EQUAL(GetMaxBlocksInTransit(100000, std::numeric_limits<int64_t>::max()), nDefault);
+
+    // Twice the blocks sent during a round trip: 10 per second for a second
+    BOOST_CHECK_EQUAL(GetMaxBlocksInTransit(100000, 1000000), 22);
+
+    // Clamped for peers that are very slow or very fast for their ping
+    BOOST_CHECK_EQUAL(GetMaxBlocksInTransit(60 * 1000000, 1000), nMin);
+    BOOST_CHECK_EQUAL(GetMaxBlocksInTransit(1, 1000000), nMax);
+    BOOST_CHECK_EQUAL(GetMaxBlocksInTransit(1000, 1000000), nMax);
+}
+
+BOOST_AUTO_TEST_CASE(block_download_late)
+{
+    const int64_t nNow = 1000 * 1000000LL;
+
+    // Only a peer whose speed is known takes over
+    BOOST_CHECK(!IsBlockDownloadLate(0, 1000000, 0, 0, nNow));
+    BOOST_CHECK(!IsBlockDownloadLate(0, 0, 0, 0, nNow));
+
+    // And only from a slower one, however late it is
+    BOOST_CHECK(!IsBlockDownloadLate(100000, 100000, 0, 0, nNow));
+    BOOST_CHECK(!IsBlockDownloadLate(200000, 100000, 0, 0, nNow));
+
+    // A peer sending a block a second is late with the third block in line
+    // after twice the time the three take
+    const int64_t nExpected = 2 * 3 * 1000000;
+    BOOST_CHECK(!IsBlockDownloadLate(100000, 1000000, 2, nNow - nExpected, nNow));
+    BOOST_CHECK(IsBlockDownloadLate(100000, 1000000, 2, nNow - nExpected - 1, nNow));
+    BOOST_CHECK(!IsBlockDownloadLate(100000, 1000000, 3, nNow - nExpected - 1, nNow));
+
+    // A peer of unknown speed is late after the stalling timeout
+    const int64_t nStalling = BLOCK_STALLING_TIMEOUT * 1000000LL;
+    BOOST_CHECK(!IsBlockDownloadLate(100000, 0, 10, nNow - nStalling, nNow));
+    BOOST_CHECK(IsBlockDownloadLate(100000, 0, 10, nNow - nStalling - 1, nNow));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
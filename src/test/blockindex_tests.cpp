@@ -0,0 +1,154 @@
+// Copyright (c) 2018 The Monacoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <chain.h>
+#include <chainparams.h>
+#include <txdb.h>
+#include <validation.h>
+#include <test/test_bitcoin.h>
+
+#include <map>
+#include <memory>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+namespace {
+/** A block tree with a long chain and some forks off it, in memory. */
+struct BlockTreeTestingSetup : public TestingSetup {
+    std::vector<std::unique_ptr<uint256>> vHashes;
+    std::vector<std::unique_ptr<CBlockIndex>> vIndex;
+
+    /** Add a block after pprev, or a chain root at nHeightRoot. */
+    CBlockIndex* AddBlock(CBlockIndex* pprev, int nHeightRoot = 0)
+    {
+        vIndex.emplace_back(new CBlockIndex());
+        CBlockIndex* pindex = vIndex.back().get();
+        pindex->pprev = pprev;
+        pindex->nHeight = pprev ? pprev->nHeight + 1 : nHeightRoot;
+        pindex->nFile = InsecureRandRange(100);
+        pindex->nDataPos = InsecureRand32();
+        pindex->nUndoPos = InsecureRand32();
+        pindex->nVersion = InsecureRand32();
+        pindex->hashMerkleRoot = InsecureRand256();
+        pindex->nTime = InsecureRand32();
+        pindex->nBits = 0x1e0ffff0;
+        pindex->nNonce = InsecureRand32();
+        pindex->nStatus = BLOCK_VALID_TREE;
+        pindex->nTx = 1 + InsecureRandRange(1000);
+        // Entries are stored by the hash of their header
+        vHashes.emplace_back(new uint256(pindex->GetBlockHeader().GetHash()));
+        pindex->phashBlock = vHashes.back().get();
+        return pindex;
+    }
+
+    void MakeTree(CBlockIndex* pindexRoot, int nHeight, int nForks)
+    {
+        CBlockIndex* pindex = pindexRoot;
+        for (int i = 0; i < nHeight; i++) {
+            pindex = AddBlock(pindex);
+        }
+        for (int i = 0; i < nForks; i++) {
+            pindex = vIndex[InsecureRandRange(vIndex.size())].get();
+            for (int j = InsecureRandRange(10); j >= 0; j--) {
+                pindex = AddBlock(pindex);
+            }
+        }
+    }
+
+    std::unique_ptr<CBlockTreeDB> WriteTree() const
+    {
+        std::unique_ptr<CBlockTreeDB> blocktree(new CBlockTreeDB(1 << 20, true, true));
+        std::vector<const CBlockIndex*> vBlocks;
+        for (const auto& pindex : vIndex) {
+            vBlocks.push_back(pindex.get());
+        }
+        BOOST_REQUIRE(blocktree->WriteBatchSync({}, 0, vBlocks));
+        return blocktree;
+    }
+};
+
+/** The entries loaded by LoadBlockIndexGuts, outside of mapBlockIndex. */
+struct LoadedIndex {
+    std::map<uint256, std::unique_ptr<CBlockIndex>> mapIndex;
+
+    CBlockIndex* Insert(const uint256& hash)
+    {
+        if (hash.IsNull())
+            return nullptr;
+        std::unique_ptr<CBlockIndex>& pindex = mapIndex[hash];
+        if (!pindex) {
+            pindex.reset(new CBlockIndex());
+            pindex->phashBlock = &mapIndex.find(hash)->first;
+        }
+        return pindex.get();
+    }
+};
+} // namespace
+
+BOOST_FIXTURE_TEST_SUITE(blockindex_tests, BlockTreeTestingSetup)
+
+BOOST_AUTO_TEST_CASE(load_guts_sharded)
+{
+    MakeTree(AddBlock(nullptr), 2000, 100);
+    for (const auto& pindex : vIndex) {
+        pindex->nStatus |= BLOCK_HAVE_DATA | BLOCK_HAVE_UNDO;
+    }
+    std::unique_ptr<CBlockTreeDB> blocktree = WriteTree();
+
+    // Reading the shards on one thread and on several gives every entry as written
+    for (int nThreads : {1, 3, 8}) {
+        LoadedIndex loaded;
+        BOOST_REQUIRE(blocktree->LoadBlockIndexGuts(Params().GetConsensus(), [&loaded](const uint256& hash) { return loaded.Insert(hash); }, nThreads));
+        BOOST_CHECK_EQUAL(loaded.mapIndex.size(), vIndex.size());
+        for (const auto& pindex : vIndex) {
+            auto it = loaded.mapIndex.find(pindex->GetBlockHash());
+            BOOST_REQUIRE(it != loaded.mapIndex.end());
+            const CBlockIndex& index = *it->second;
+            BOOST_CHECK(index.GetBlockHash() == pindex->GetBlockHash());
+            BOOST_CHECK(pindex->pprev ? index.pprev && index.pprev->GetBlockHash() == pindex->pprev->GetBlockHash() : !index.pprev);
+            BOOST_CHECK_EQUAL(index.nHeight, pindex->nHeight);
+            BOOST_CHECK_EQUAL(index.nFile, pindex->nFile);
+            BOOST_CHECK_EQUAL(index.nDataPos, pindex->nDataPos);
+            BOOST_CHECK_EQUAL(index.nUndoPos, pindex->nUndoPos);
+            BOOST_CHECK_EQUAL(index.nVersion, pindex->nVersion);
+            BOOST_CHECK(index.hashMerkleRoot == pindex->hashMerkleRoot);
+            BOOST_CHECK_EQUAL(index.nTime, pindex->nTime);
+            BOOST_CHECK_EQUAL(index.nBits, pindex->nBits);
+            BOOST_CHECK_EQUAL(index.nNonce, pindex->nNonce);
+            BOOST_CHECK_EQUAL(index.nStatus, pindex->nStatus);
+            BOOST_CHECK_EQUAL(index.nTx, pindex->nTx);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(load_skip_pointers)
+{
+    MakeTree(AddBlock(nullptr), 2000, 100);
+    pblocktree = WriteTree();
+    UnloadBlockIndex();
+    BOOST_REQUIRE(LoadBlockIndex(Params()));
+
+    // The skip pointers built in parallel along the longest chain match the
+    // ones built one by one
+    BOOST_CHECK_EQUAL(mapBlockIndex.size(), vIndex.size());
+    for (const auto& pindex : vIndex) {
+        pindex->BuildSkip();
+        const CBlockIndex* pindexLoaded = mapBlockIndex.at(pindex->GetBlockHash());
+        BOOST_CHECK(pindex->pskip ? pindexLoaded->pskip && pindexLoaded->pskip->GetBlockHash() == pindex->pskip->GetBlockHash() : !pindexLoaded->pskip);
+    }
+    UnloadBlockIndex();
+}
+
+BOOST_AUTO_TEST_CASE(load_orphaned_chain)
+{
+    // A chain that does not start from a block at height 0 is refused
+    MakeTree(AddBlock(nullptr, 1), 100, 0);
+    pblocktree = WriteTree();
+    UnloadBlockIndex();
+    BOOST_CHECK(!LoadBlockIndex(Params()));
+    UnloadBlockIndex();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -8,6 +8,7 @@
 #include <undo.h>
 #include <utilstrencodings.h>
 #include <test/test_bitcoin.h>
+#include <txdb.h>
 #include <validation.h>
 #include <consensus/validation.h>
 
@@ -34,6 +35,7 @@ class CCoinsViewTest : public CCoinsView
 {
     uint256 hashBestBlock_;
     std::map<COutPoint, Coin> map_;
+    CUTXOCommitment commitment_;
 
 public:
     bool GetCoin(const COutPoint& outpoint, Coin& coin) const override
@@ -52,7 +54,13 @@ public:
 
     uint256 GetBestBlock() const override { return hashBestBlock_; }
 
-    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock) override
+    bool GetCommitment(CUTXOCommitment& commitment) const override
+    {
+        commitment = commitment_;
+        return true;
+    }
+
+    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock, const CUTXOCommitment& commitmentDelta) override
     {
         for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end(); ) {
             if (it->second.flags & CCoinsCacheEntry::DIRTY) {
@@ -67,6 +75,7 @@ public:
         }
         if (!hashBlock.IsNull())
             hashBestBlock_ = hashBlock;
+        commitment_.Combine(commitmentDelta);
         return true;
     }
 };
@@ -74,7 +83,7 @@ public:
 class CCoinsViewCacheTest : public CCoinsViewCache
 {
 public:
-    explicit CCoinsViewCacheTest(CCoinsView* _base) : CCoinsViewCache(_base) {}
+    explicit CCoinsViewCacheTest(CCoinsView* _base) : CCoinsViewCache(_base, true) {}
 
     void SelfTest() const
     {
@@ -204,6 +213,16 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
             for (const CCoinsViewCacheTest *test : stack) {
                 test->SelfTest();
             }
+
+            // The incrementally maintained commitment must match one computed from scratch.
+            CUTXOCommitment expected, commitment;
+            for (const auto& entry : result) {
+                if (!entry.second.IsSpent()) expected.Add(entry.first, entry.second);
+            }
+            BOOST_CHECK(stack.back()->GetCommitment(commitment));
+            BOOST_CHECK(commitment.GetHash() == expected.GetHash());
+            BOOST_CHECK_EQUAL(commitment.nTransactionOutputs, expected.nTransactionOutputs);
+            BOOST_CHECK_EQUAL(commitment.nTotalAmount, expected.nTotalAmount);
         }
 
         if (InsecureRandRange(100) == 0) {
@@ -588,7 +607,7 @@ void WriteCoinsViewEntry(CCoinsView& view, CAmount value, char flags)
 {
     CCoinsMap map;
     InsertCoinsMapEntry(map, value, flags);
-    view.BatchWrite(map, {});
+    view.BatchWrite(map, {}, {});
 }
 
 class SingleEntryCacheTest
@@ -855,4 +874,132 @@ BOOST_AUTO_TEST_CASE(ccoins_write)
                     CheckWriteCoins(parent_value, child_value, parent_value, parent_flags, child_flags, parent_flags);
 }
 
+BOOST_AUTO_TEST_CASE(untracked_commitment)
+{
+    CCoinsViewTest base;
+    CCoinsViewCache tracked(&base, true);
+    CCoinsViewCache untracked(&tracked, false);
+    CCoinsViewCache scratch(&untracked, false);
+
+    Coin coin;
+    coin.out.nValue = 1;
+    coin.nHeight = 1;
+    const COutPoint outpoint(InsecureRand256(), 0);
+    scratch.AddCoin(outpoint, Coin(coin), false);
+    CUTXOCommitment commitment;
+    BOOST_CHECK(!scratch.GetCommitment(commitment));
+    BOOST_CHECK(!untracked.GetCommitment(commitment));
+
+    // Coins can move between views without a commitment, but not into one that has it
+    BOOST_CHECK(scratch.Flush());
+    BOOST_CHECK(untracked.HaveCoinInCache(outpoint));
+    BOOST_CHECK_THROW(untracked.Flush(), std::logic_error);
+
+    tracked.AddCoin(outpoint, Coin(coin), false);
+    CUTXOCommitment expected;
+    expected.Add(outpoint, coin);
+    BOOST_CHECK(tracked.GetCommitment(commitment));
+    BOOST_CHECK(commitment.GetHash() == expected.GetHash());
+}
+
+BOOST_AUTO_TEST_CASE(block_commitments)
+{
+    CCoinsViewDB db(1 << 20, true, true);
+    CUTXOCommitment commitment, read;
+    commitment.Add(COutPoint(InsecureRand256(), 0), Coin(CTxOut(1, CScript()), 1, false));
+    const uint256 hashKept = InsecureRand256();
+    const uint256 hashErased = InsecureRand256();
+    BOOST_CHECK(db.WriteBlockCommitment(hashErased, commitment));
+
+    // Queued changes are visible right away, but only written with the coins
+    db.QueueBlockCommitment(hashKept, commitment);
+    db.QueueEraseBlockCommitment(hashErased);
+    BOOST_CHECK(db.ReadBlockCommitment(hashKept, read));
+    BOOST_CHECK(read.GetHash() == commitment.GetHash());
+    BOOST_CHECK(!db.ReadBlockCommitment(hashErased, read));
+
+    CCoinsMap mapCoins;
+    BOOST_CHECK(db.BatchWrite(mapCoins, InsecureRand256(), CUTXOCommitment()));
+    BOOST_CHECK(db.ReadBlockCommitment(hashKept, read));
+    BOOST_CHECK(read.GetHash() == commitment.GetHash());
+    BOOST_CHECK(!db.ReadBlockCommitment(hashErased, read));
+
+    // Forgetting one and recording it again leaves it recorded
+    db.QueueEraseBlockCommitment(hashKept);
+    BOOST_CHECK(!db.ReadBlockCommitment(hashKept, read));
+    db.QueueBlockCommitment(hashKept, commitment);
+    BOOST_CHECK(db.BatchWrite(mapCoins, InsecureRand256(), CUTXOCommitment()));
+    BOOST_CHECK(db.ReadBlockCommitment(hashKept, read));
+}
+
+BOOST_AUTO_TEST_CASE(background_flush)
+{
+    ClearDatadirCache();
+    fs::path path = fs::temp_directory_path() / fs::unique_path();
+    fs::create_directories(path);
+    gArgs.ForceSetArg("-datadir", path.string());
+    {
+        CCoinsViewDB db(1 << 20, true);
+        BOOST_CHECK(db.InitCommitment());
+        CCoinsViewDBFlusher flusher(&db, true);
+        CCoinsViewCache cache(&flusher, true);
+
+        std::map<COutPoint, Coin> result;
+        uint256 hashBlock;
+        for (int i = 0; i < 20; i++) {
+            // Spend some of the coins, possibly ones that are still being written
+            for (auto it = result.begin(); it != result.end();) {
+                if (InsecureRandBool()) {
+                    BOOST_CHECK(cache.SpendCoin(it->first));
+                    it = result.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+            for (int j = 0; j < 100; j++) {
+                COutPoint outpoint(InsecureRand256(), 0);
+                Coin coin;
+                coin.out.nValue = InsecureRand32();
+                coin.out.scriptPubKey.assign(InsecureRandBits(6), 0);
+                coin.nHeight = i + 1;
+                result[outpoint] = coin;
+                cache.AddCoin(outpoint, std::move(coin), false);
+            }
+            hashBlock = InsecureRand256();
+            cache.SetBestBlock(hashBlock);
+            BOOST_CHECK(cache.Flush());
+
+            // Whether or not the write is done, the flushed state is what is read back
+            BOOST_CHECK(flusher.GetBestBlock() == hashBlock);
+            for (const auto& entry : result) {
+                Coin coin;
+                BOOST_CHECK(flusher.GetCoin(entry.first, coin));
+                BOOST_CHECK(coin == entry.second);
+            }
+        }
+        BOOST_CHECK(flusher.Sync());
+
+        CUTXOCommitment expected;
+        for (const auto& entry : result) {
+            expected.Add(entry.first, entry.second);
+        }
+        CUTXOCommitment commitment;
+        BOOST_CHECK(db.GetCommitment(commitment));
+        BOOST_CHECK(commitment.GetHash() == expected.GetHash());
+        BOOST_CHECK(db.GetBestBlock() == hashBlock);
+        BOOST_CHECK(db.GetHeadBlocks().empty());
+        std::unique_ptr<CCoinsViewCursor> pcursor(db.Cursor());
+        size_t nCoins = 0;
+        for (; pcursor->Valid(); pcursor->Next()) {
+            COutPoint key;
+            Coin coin;
+            BOOST_CHECK(pcursor->GetKey(key) && pcursor->GetValue(coin));
+            BOOST_CHECK(result.count(key) && coin == result[key]);
+            nCoins++;
+        }
+        BOOST_CHECK_EQUAL(nCoins, result.size());
+    }
+    fs::remove_all(path);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
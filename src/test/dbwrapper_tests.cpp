@@ -319,4 +319,47 @@ BOOST_AUTO_TEST_CASE(iterator_string_ordering)
 
 
 
+BOOST_AUTO_TEST_CASE(dbwrapper_profiles_and_stats)
+{
+    std::string strError;
+    gArgs.ForceSetArg("-dbprofile", "chainstate:nonsense");
+    BOOST_CHECK(!InitDBProfiles(strError));
+    gArgs.ForceSetArg("-dbprofile", "blocks:read");
+    BOOST_CHECK(!InitDBProfiles(strError));
+    gArgs.ForceSetArg("-dbprofile", "chainstate:write");
+    BOOST_CHECK(InitDBProfiles(strError));
+    BOOST_CHECK_EQUAL(GetDBProfile("chainstate").strName, "write");
+    BOOST_CHECK_EQUAL(GetDBProfile("index").strName, "default");
+    BOOST_CHECK_EQUAL(GetDBProfilesExtraOpenFiles(), 0);
+
+    fs::path ph = fs::temp_directory_path() / fs::unique_path() / "chainstate";
+    {
+        CDBWrapper dbw(ph, (1 << 20), true, false, false);
+        for (int i = 0; i < 10; i++) {
+            CDBBatch batch(dbw);
+            batch.Write(i, InsecureRand256());
+            BOOST_CHECK(dbw.WriteBatch(batch, i % 2 == 0));
+        }
+        CDBStats stats = dbw.GetStats();
+        BOOST_CHECK_EQUAL(stats.strName, "chainstate");
+        BOOST_CHECK_EQUAL(stats.strProfile, "write");
+        BOOST_CHECK_EQUAL(stats.nWriteBufferSize, (1 << 20) * 3 / 8);
+        BOOST_CHECK_EQUAL(stats.nWriteBatches, 10U);
+        BOOST_CHECK_EQUAL(stats.nSyncWrites, 5U);
+        BOOST_CHECK(stats.nMaxWriteMicros <= stats.nWriteMicros);
+
+        std::vector<CDBStats> vStats = GetDBStats();
+        BOOST_CHECK(std::any_of(vStats.begin(), vStats.end(), [](const CDBStats& s) { return s.strName == "chainstate"; }));
+    }
+    std::vector<CDBStats> vStats = GetDBStats();
+    BOOST_CHECK(std::none_of(vStats.begin(), vStats.end(), [](const CDBStats& s) { return s.strName == "chainstate"; }));
+
+    gArgs.ForceSetArg("-dbprofile", "index:read");
+    BOOST_CHECK(InitDBProfiles(strError));
+    BOOST_CHECK_EQUAL(GetDBProfile("chainstate").strName, "default");
+    BOOST_CHECK(GetDBProfilesExtraOpenFiles() > 0);
+    gArgs.ForceSetArg("-dbprofile", "chainstate:default");
+    BOOST_CHECK(InitDBProfiles(strError));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,182 @@
+// Copyright (c) 2018 The Monacoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <flatmap.h>
+#include <memusage.h>
+#include <random.h>
+
+#include <test/test_bitcoin.h>
+
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(flatmap_tests, BasicTestingSetup)
+
+//! Only a few distinct hashes, so that the table sees long runs of collisions
+struct WeakHasher {
+    size_t operator()(uint32_t key) const { return key % 61; }
+};
+
+template <typename Hash>
+static void CheckRandomOperations(int nRounds)
+{
+    flatmap<uint32_t, std::string, Hash> map;
+    std::unordered_map<uint32_t, std::string> real;
+    std::map<uint32_t, const std::string*> addresses;
+
+    auto check = [&]() {
+        BOOST_CHECK_EQUAL(map.size(), real.size());
+        size_t n = 0;
+        for (const auto& entry : map) {
+            auto it = real.find(entry.first);
+            BOOST_CHECK(it != real.end() && it->second == entry.second);
+            // Entries never move
+            BOOST_CHECK(addresses[entry.first] == &entry.second);
+            n++;
+        }
+        BOOST_CHECK_EQUAL(n, real.size());
+    };
+
+    for (int i = 0; i < nRounds; i++) {
+        const uint32_t key = InsecureRandRange(2000);
+        switch (InsecureRandRange(6)) {
+        case 0:
+        case 1: {
+            // Long enough values for prevector-like heap allocations
+            std::string value(InsecureRandRange(40), 'a' + InsecureRandRange(26));
+            auto inserted = map.emplace(key, value);
+            auto real_inserted = real.emplace(key, value);
+            BOOST_CHECK_EQUAL(inserted.second, real_inserted.second);
+            BOOST_CHECK(inserted.first->second == real_inserted.first->second);
+            if (inserted.second) addresses[key] = &inserted.first->second;
+            break;
+        }
+        case 2: {
+            auto it = map.find(key);
+            auto real_it = real.find(key);
+            BOOST_CHECK_EQUAL(it == map.end(), real_it == real.end());
+            if (it != map.end()) BOOST_CHECK(it->second == real_it->second);
+            break;
+        }
+        case 3:
+            BOOST_CHECK_EQUAL(map.erase(key), real.erase(key));
+            break;
+        case 4: {
+            std::string& value = map[key];
+            if (!real.count(key)) addresses[key] = &value;
+            value += 'x';
+            real[key] += 'x';
+            break;
+        }
+        case 5:
+            // Erase some entries while iterating
+            for (auto it = map.begin(); it != map.end();) {
+                if (InsecureRandRange(8) == 0) {
+                    real.erase(it->first);
+                    it = map.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+            break;
+        }
+        if (InsecureRandRange(1000) == 0) {
+            check();
+        }
+        if (InsecureRandRange(20000) == 0) {
+            map.clear();
+            real.clear();
+            BOOST_CHECK_EQUAL(memusage::DynamicUsage(map), 0U);
+        }
+    }
+    check();
+    BOOST_CHECK(map.empty() || memusage::DynamicUsage(map) > map.size() * sizeof(std::pair<const uint32_t, std::string>));
+}
+
+BOOST_AUTO_TEST_CASE(flatmap_random)
+{
+    CheckRandomOperations<std::hash<uint32_t>>(100000);
+    CheckRandomOperations<WeakHasher>(20000);
+}
+
+BOOST_AUTO_TEST_CASE(flatmap_large)
+{
+    // Beyond the chunks that grow geometrically
+    flatmap<uint32_t, uint64_t, std::hash<uint32_t>> map;
+    const uint32_t nCount = 300000;
+    for (uint32_t i = 0; i < nCount; i++) {
+        BOOST_CHECK(map.emplace(i * 7919, i).second);
+    }
+    for (uint32_t i = 0; i < nCount; i += 2) {
+        BOOST_CHECK_EQUAL(map.erase(i * 7919), 1U);
+    }
+    // Erased slots are reused before new ones are taken
+    const size_t nUsage = memusage::DynamicUsage(map);
+    for (uint32_t i = 0; i < nCount; i += 2) {
+        BOOST_CHECK(map.emplace(i * 7919, i).second);
+    }
+    BOOST_CHECK_EQUAL(memusage::DynamicUsage(map), nUsage);
+    BOOST_CHECK_EQUAL(map.size(), nCount);
+    uint64_t nSum = 0;
+    for (const auto& entry : map) {
+        BOOST_CHECK_EQUAL(entry.first, entry.second * 7919);
+        nSum += entry.second;
+    }
+    BOOST_CHECK_EQUAL(nSum, (uint64_t)nCount * (nCount - 1) / 2);
+    BOOST_CHECK_EQUAL(map.find(7919)->second, 1U);
+    BOOST_CHECK(map.find(1) == map.end());
+
+    flatmap<uint32_t, uint64_t, std::hash<uint32_t>> moved(std::move(map));
+    BOOST_CHECK(map.empty() && map.begin() == map.end());
+    BOOST_CHECK_EQUAL(moved.size(), nCount);
+    BOOST_CHECK_EQUAL(moved.find(7919 * 3)->second, 3U);
+}
+
+//! A value that fails to construct from a negative number
+struct Throwing {
+    int n;
+    explicit Throwing(int nIn) : n(nIn)
+    {
+        if (n < 0) throw std::runtime_error("negative");
+    }
+};
+
+BOOST_AUTO_TEST_CASE(flatmap_throwing_constructor)
+{
+    flatmap<uint32_t, Throwing, std::hash<uint32_t>> map;
+    // Failing insertions, into new slots and erased ones, leave no trace
+    for (uint32_t i = 0; i < 100; i++) {
+        map.emplace(std::piecewise_construct, std::forward_as_tuple(i), std::forward_as_tuple(i));
+        BOOST_CHECK_THROW(map.emplace(std::piecewise_construct, std::forward_as_tuple(1000 + i), std::forward_as_tuple(-1)), std::runtime_error);
+    }
+    for (uint32_t i = 0; i < 100; i += 3) {
+        map.erase(i);
+    }
+    for (uint32_t i = 0; i < 100; i++) {
+        BOOST_CHECK_THROW(map.emplace(std::piecewise_construct, std::forward_as_tuple(1000 + i), std::forward_as_tuple(-1)), std::runtime_error);
+    }
+    BOOST_CHECK_EQUAL(map.size(), 66U);
+    size_t n = 0;
+    for (const auto& entry : map) {
+        BOOST_CHECK(entry.first % 3 != 0 && (int)entry.first == entry.second.n);
+        n++;
+    }
+    BOOST_CHECK_EQUAL(n, 66U);
+    BOOST_CHECK(map.find(1000) == map.end());
+
+    // And the erased slots are still there to be reused
+    const size_t nUsage = memusage::DynamicUsage(map);
+    for (uint32_t i = 0; i < 100; i += 3) {
+        BOOST_CHECK(map.emplace(std::piecewise_construct, std::forward_as_tuple(i), std::forward_as_tuple(i)).second);
+    }
+    BOOST_CHECK_EQUAL(memusage::DynamicUsage(map), nUsage);
+    BOOST_CHECK_EQUAL(map.size(), 100U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,75 @@
+// Copyright (c) 2018 The Monacoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "crypto/common.h"
+#include "crypto/Lyra2RE/Lyra2RE.h"
+#include "uint256.h"
+#include "utilstrencodings.h"
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(lyra2re_tests, BasicTestingSetup)
+
+#define HASHCOUNT 5
+static const char* inputhex[HASHCOUNT] = { "020000004c1271c211717198227392b029a64a7971931d351b387bb80db027f270411e398a07046f7d4a08dd815412a8712f874a7ebf0507e3878bd24e20a3b73fd750a667d2f451eac7471b00de6659", "0200000011503ee6a855e900c00cfdd98f5f55fffeaee9b6bf55bea9b852d9de2ce35828e204eef76acfd36949ae56d1fbe81c1ac9c0209e6331ad56414f9072506a77f8c6faf551eac7471b00389d01", "02000000a72c8a177f523946f42f22c3e86b8023221b4105e8007e59e81f6beb013e29aaf635295cb9ac966213fb56e046dc71df5b3f7f67ceaeab24038e743f883aff1aaafaf551eac7471b0166249b", "010000007824bc3a8a1b4628485eee3024abd8626721f7f870f8ad4d2f33a27155167f6a4009d1285049603888fe85a84b6c803a53305a8d497965a5e896e1a00568359589faf551eac7471b0065434e", "0200000050bfd4e4a307a8cb6ef4aef69abc5c0f2d579648bd80d7733e1ccc3fbc90ed664a7f74006cb11bde87785f229ecd366c2d4e44432832580e0608c579e4cb76f383f7f551eac7471b00c36982" };
+static const char* expected_lyra2re[HASHCOUNT] = { "3f31a9b6e0ed3555bc0e4bfb4c693f30a1bde614929fe07f444c0f99646fbfe5", "b4cf8928d6bba0b2442895eea96b9e602bad96ebbeba923402dae5dc03a6ff22", "e5382b6c7e31d98694aa0a4ada12c144ed561c25c0b9c4a3fc405416b3b735d4", "c9fc628c6ddfdfb947c2d1b18dc1aa05fc94da62c811d386a9230b596f217d67", "b738d681cee84cc7eb3002594a2e4ac8ca3e6b1768dca82d2888a67b4be12fba" };
+static const char* expected_lyra2re2[HASHCOUNT] = { "ae16465df6994b673150f3020df485df79c9049d29a0d5ea39ffde6da5e44538", "bc036832eb70eb55e57a4084f0fdc1df735424684cb5afb835bab564e53247fb", "76d05e30d0a1f63a9e4ed56579c5cefb41d5703754b3f07069c01723d66446d8", "6bab27b41ce1e6dcfd09b634ef6ab8cc478091d4acd2618a573a31b30a412446", "04c51502cdc78390f456afd4ef7429eb9ae1f2bf7a447b382c178d20ea4047e9" };
+
+BOOST_AUTO_TEST_CASE(lyra2re_hashtest)
+{
+    uint256 hash;
+    for (int i = 0; i < HASHCOUNT; i++) {
+        std::vector<unsigned char> inputbytes = ParseHex(inputhex[i]);
+        lyra2re_hash((const char*)&inputbytes[0], BEGIN(hash));
+        BOOST_CHECK_EQUAL(hash.ToString(), expected_lyra2re[i]);
+        lyra2re2_hash((const char*)&inputbytes[0], BEGIN(hash));
+        BOOST_CHECK_EQUAL(hash.ToString(), expected_lyra2re2[i]);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(lyra2re2_batch)
+{
+    // Two full groups of four lanes plus a remainder, mixing the known vectors
+    // with headers that differ only in the nonce.
+    const size_t count = 11;
+    std::vector<unsigned char> headers;
+    for (size_t i = 0; i < count; i++) {
+        std::vector<unsigned char> header = ParseHex(inputhex[i % HASHCOUNT]);
+        if (i >= HASHCOUNT) header[79] ^= i;
+        headers.insert(headers.end(), header.begin(), header.end());
+    }
+
+    std::vector<uint256> expected(count);
+    for (size_t i = 0; i < count; i++) {
+        lyra2re2_hash((const char*)&headers[80 * i], BEGIN(expected[i]));
+    }
+
+    std::vector<uint256> hashes(count);
+    lyra2re2_hash_batch((const char*)headers.data(), BEGIN(hashes[0]), count);
+    for (size_t i = 0; i < count; i++) {
+        BOOST_CHECK_EQUAL(hashes[i], expected[i]);
+        if (i < HASHCOUNT) BOOST_CHECK_EQUAL(hashes[i].ToString(), expected_lyra2re2[i]);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(lyra2re2_nonces)
+{
+    // A full group of four lanes plus a remainder, counting across a byte
+    // boundary of the nonce.
+    const size_t count = 7;
+    const uint32_t nonce = 0x1fe;
+    std::vector<unsigned char> header = ParseHex(inputhex[0]);
+
+    std::vector<uint256> hashes(count);
+    lyra2re2_hash_nonces((const char*)header.data(), nonce, BEGIN(hashes[0]), count);
+    for (size_t i = 0; i < count; i++) {
+        WriteLE32(&header[76], nonce + i);
+        uint256 expected;
+        lyra2re2_hash((const char*)header.data(), BEGIN(expected));
+        BOOST_CHECK_EQUAL(hashes[i], expected);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -2,6 +2,7 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include <arith_uint256.h>
 #include <chainparams.h>
 #include <coins.h>
 #include <consensus/consensus.h>
@@ -11,6 +12,7 @@
 #include <validation.h>
 #include <miner.h>
 #include <policy/policy.h>
+#include <pow.h>
 #include <pubkey.h>
 #include <script/standard.h>
 #include <txmempool.h>
@@ -520,4 +522,33 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
     fCheckpointsEnabled = true;
 }
 
+BOOST_AUTO_TEST_CASE(ScanPoWNonces_lowest)
+{
+    const Consensus::Params& params = Params().GetConsensus();
+    CBlock block;
+    block.nVersion = 0x20000000;
+    block.nTime = 1514764800;
+    block.nBits = UintToArith256(params.powLimit).GetCompact();
+    block.nNonce = 0;
+
+    // The lowest valid nonce is found regardless of the thread count, and
+    // every nonce below it fails.
+    BOOST_CHECK(ScanPoWNonces(&block, 0x10000, 1, 1, true, params));
+    const uint32_t nNonce = block.nNonce;
+    for (uint32_t nThreads = 2; nThreads <= 4; nThreads++) {
+        block.nNonce = 0;
+        BOOST_CHECK(ScanPoWNonces(&block, 0x10000, nThreads, 1, true, params));
+        BOOST_CHECK_EQUAL(block.nNonce, nNonce);
+    }
+    BOOST_CHECK(CheckProofOfWork(block.GetPoWHash(true), block.nBits, 1, params));
+    for (block.nNonce = 0; block.nNonce < nNonce; block.nNonce++) {
+        BOOST_CHECK(!CheckProofOfWork(block.GetPoWHash(true), block.nBits, 1, params));
+    }
+
+    // Scanning stops at the end of the range.
+    block.nNonce = 0;
+    BOOST_CHECK(!ScanPoWNonces(&block, nNonce, 3, 1, true, params));
+    BOOST_CHECK_EQUAL(block.nNonce, nNonce);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -187,4 +187,87 @@ BOOST_AUTO_TEST_CASE(cnode_simple_test)
     BOOST_CHECK(pnode2->fFeeler == false);
 }
 
+static CSharedNetMsgRef MakeTestMessage(const std::string& command, size_t nSize)
+{
+    CSerializedNetMsg msg;
+    msg.command = command;
+    msg.data.resize(nSize);
+    return CConnman::MakeSharedMessage(std::move(msg));
+}
+
+BOOST_AUTO_TEST_CASE(shared_msg_cache)
+{
+    CSerializedNetMsg msg;
+    msg.command = "tx";
+    msg.data = {1, 2, 3};
+    CSharedNetMsgRef shared = CConnman::MakeSharedMessage(std::move(msg));
+    const size_t nHeaderSize = CMessageHeader::HEADER_SIZE;
+    BOOST_CHECK_EQUAL(shared->header.size(), nHeaderSize);
+    BOOST_CHECK_EQUAL(shared->size(), nHeaderSize + 3);
+
+    const uint256 hash1 = uint256S("01");
+    const uint256 hash2 = uint256S("02");
+    CSharedNetMsgCache cache(3 * (nHeaderSize + 100));
+    CSharedNetMsgRef msg1 = MakeTestMessage("block", 100);
+    cache.Add(hash1, PROTOCOL_VERSION, msg1);
+    BOOST_CHECK(cache.Find("block", hash1, PROTOCOL_VERSION) == msg1);
+    // The command, hash and version all have to match
+    BOOST_CHECK(!cache.Find("cmpctblock", hash1, PROTOCOL_VERSION));
+    BOOST_CHECK(!cache.Find("block", hash2, PROTOCOL_VERSION));
+    BOOST_CHECK(!cache.Find("block", hash1, PROTOCOL_VERSION | SERIALIZE_TRANSACTION_NO_WITNESS));
+
+    // The oldest messages are evicted once the cache is full
+    cache.Add(hash1, PROTOCOL_VERSION | SERIALIZE_TRANSACTION_NO_WITNESS, MakeTestMessage("block", 100));
+    cache.Add(hash2, PROTOCOL_VERSION, MakeTestMessage("block", 100));
+    BOOST_CHECK(cache.Find("block", hash1, PROTOCOL_VERSION) == msg1);
+    cache.Add(hash1, PROTOCOL_VERSION, MakeTestMessage("cmpctblock", 100));
+    BOOST_CHECK(!cache.Find("block", hash1, PROTOCOL_VERSION));
+    BOOST_CHECK(cache.Find("block", hash2, PROTOCOL_VERSION));
+    BOOST_CHECK(cache.Find("cmpctblock", hash1, PROTOCOL_VERSION));
+    // An evicted message stays valid while it is still referenced
+    BOOST_CHECK_EQUAL(msg1->data.size(), 100U);
+
+    // Messages larger than the cache are not kept
+    cache.Add(hash2, PROTOCOL_VERSION, MakeTestMessage("tx", 1000));
+    BOOST_CHECK(!cache.Find("tx", hash2, PROTOCOL_VERSION));
+    BOOST_CHECK(cache.Find("block", hash2, PROTOCOL_VERSION));
+}
+
+static void ReceiveTestMessage(CNetMessage& msg, const std::vector<unsigned char>& payload, bool fInPlace)
+{
+    CDataStream ssHeader(SER_NETWORK, PROTOCOL_VERSION);
+    CMessageHeader hdr(Params().MessageStart(), "ping", payload.size());
+    uint256 hash = Hash(payload.begin(), payload.end());
+    memcpy(hdr.pchChecksum, hash.begin(), CMessageHeader::CHECKSUM_SIZE);
+    ssHeader << hdr;
+    BOOST_CHECK_EQUAL(msg.readHeader(ssHeader.data(), ssHeader.size()), (int)ssHeader.size());
+    BOOST_CHECK(msg.in_data);
+    if (fInPlace) {
+        // As CNode::GetRecvBuffer does
+        msg.vRecv.resize(payload.size());
+        memcpy(&msg.vRecv[0], payload.data(), payload.size());
+        BOOST_CHECK_EQUAL(msg.readData(&msg.vRecv[0], payload.size()), (int)payload.size());
+    } else {
+        BOOST_CHECK_EQUAL(msg.readData((const char*)payload.data(), payload.size()), (int)payload.size());
+    }
+    BOOST_CHECK(msg.complete());
+    BOOST_CHECK(memcmp(msg.GetMessageHash().begin(), hdr.pchChecksum, CMessageHeader::CHECKSUM_SIZE) == 0);
+    BOOST_CHECK(std::equal(msg.vRecv.begin(), msg.vRecv.end(), payload.begin()));
+}
+
+BOOST_AUTO_TEST_CASE(cnetmessage_reuse)
+{
+    CNetMessage msg(Params().MessageStart(), SER_NETWORK, INIT_PROTO_VERSION);
+    ReceiveTestMessage(msg, std::vector<unsigned char>(100, 1), false);
+
+    // A reset message receives the next one like a new one
+    msg.Reset();
+    BOOST_CHECK(!msg.in_data);
+    BOOST_CHECK(!msg.complete());
+    ReceiveTestMessage(msg, std::vector<unsigned char>(10, 2), false);
+
+    msg.Reset();
+    ReceiveTestMessage(msg, std::vector<unsigned char>(1000, 3), true);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -8,6 +8,10 @@
 
 #include <string>
 
+#ifndef WIN32
+#include <fcntl.h>
+#endif
+
 #include <boost/test/unit_test.hpp>
 
 BOOST_FIXTURE_TEST_SUITE(netbase_tests, BasicTestingSetup)
@@ -302,4 +306,48 @@ BOOST_AUTO_TEST_CASE(netbase_getgroup)
     BOOST_CHECK(CreateInternal("baz.net").GetGroup() == internal_group);
 }
 
+#ifndef WIN32
+static bool IsCloseOnExec(SOCKET hSocket)
+{
+    int fFlags = fcntl(hSocket, F_GETFD, 0);
+    return fFlags != -1 && (fFlags & FD_CLOEXEC);
+}
+
+BOOST_AUTO_TEST_CASE(sockets_not_inherited)
+{
+    CService addrBind = LookupNumeric("127.0.0.1", 0);
+    SOCKET hListenSocket = CreateSocket(addrBind);
+    BOOST_REQUIRE(hListenSocket != INVALID_SOCKET);
+    BOOST_CHECK(IsCloseOnExec(hListenSocket));
+
+    struct sockaddr_storage sockaddr;
+    socklen_t len = sizeof(sockaddr);
+    BOOST_REQUIRE(addrBind.GetSockAddr((struct sockaddr*)&sockaddr, &len));
+    BOOST_REQUIRE(bind(hListenSocket, (struct sockaddr*)&sockaddr, len) != SOCKET_ERROR);
+    BOOST_REQUIRE(listen(hListenSocket, 1) != SOCKET_ERROR);
+    len = sizeof(sockaddr);
+    BOOST_REQUIRE(getsockname(hListenSocket, (struct sockaddr*)&sockaddr, &len) != SOCKET_ERROR);
+    CService addrListen;
+    BOOST_REQUIRE(addrListen.SetSockAddr((struct sockaddr*)&sockaddr));
+
+    SOCKET hSocket = CreateSocket(addrListen);
+    BOOST_REQUIRE(hSocket != INVALID_SOCKET);
+    BOOST_CHECK(ConnectSocketDirectly(addrListen, hSocket, 1000));
+
+    // The listening socket is non-blocking
+    SOCKET hAccepted = INVALID_SOCKET;
+    for (int i = 0; i < 100 && hAccepted == INVALID_SOCKET; i++) {
+        len = sizeof(sockaddr);
+        hAccepted = AcceptSocket(hListenSocket, (struct sockaddr*)&sockaddr, &len);
+        if (hAccepted == INVALID_SOCKET) MilliSleep(10);
+    }
+    BOOST_REQUIRE(hAccepted != INVALID_SOCKET);
+    BOOST_CHECK(IsCloseOnExec(hAccepted));
+
+    CloseSocket(hAccepted);
+    CloseSocket(hSocket);
+    CloseSocket(hListenSocket);
+}
+#endif
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -2,13 +2,17 @@
 // Distributed under the MIT/X11 software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include <bignum.h>
 #include <chain.h>
 #include <chainparams.h>
 #include <pow.h>
 #include <random.h>
 #include <util.h>
+#include <validation.h>
 #include <test/test_bitcoin.h>
 
+#include <cmath>
+
 #include <boost/test/unit_test.hpp>
 
 BOOST_FIXTURE_TEST_SUITE(pow_tests, BasicTestingSetup)
@@ -83,4 +87,239 @@ BOOST_AUTO_TEST_CASE(GetBlockProofEquivalentTime_test)
     }
 }
 
+/* The original OpenSSL CBigNum implementation of KimotoGravityWell, as reference */
+static unsigned int KimotoGravityWellBigNum(const CBlockIndex* pindexLast, uint64_t TargetBlocksSpacingSeconds, uint64_t PastBlocksMin, uint64_t PastBlocksMax, const Consensus::Params& params)
+{
+    const CBlockIndex *BlockLastSolved = pindexLast;
+    const CBlockIndex *BlockReading = pindexLast;
+    uint64_t PastBlocksMass = 0;
+    int64_t PastRateActualSeconds = 0;
+    int64_t PastRateTargetSeconds = 0;
+    double PastRateAdjustmentRatio = double(1);
+    CBigNum PastDifficultyAverage;
+    CBigNum PastDifficultyAveragePrev;
+    double EventHorizonDeviation;
+    double EventHorizonDeviationFast;
+    double EventHorizonDeviationSlow;
+
+    if (BlockLastSolved == NULL || BlockLastSolved->nHeight == 0 || (uint64_t)BlockLastSolved->nHeight < PastBlocksMin) { return UintToArith256(params.powLimit).GetCompact(); }
+
+    for (unsigned int i = 1; BlockReading && BlockReading->nHeight > 0; i++) {
+        if (PastBlocksMax > 0 && i > PastBlocksMax) { break; }
+        PastBlocksMass++;
+
+        if (i == 1) { PastDifficultyAverage.SetCompact(BlockReading->nBits); }
+        else { PastDifficultyAverage = ((CBigNum().SetCompact(BlockReading->nBits) - PastDifficultyAveragePrev) / i) + PastDifficultyAveragePrev; }
+        PastDifficultyAveragePrev = PastDifficultyAverage;
+
+        PastRateActualSeconds = BlockLastSolved->GetBlockTime() - BlockReading->GetBlockTime();
+        PastRateTargetSeconds = TargetBlocksSpacingSeconds * PastBlocksMass;
+        PastRateAdjustmentRatio = double(1);
+        if (PastRateActualSeconds < 0) { PastRateActualSeconds = 0; }
+        if (PastRateActualSeconds != 0 && PastRateTargetSeconds != 0) {
+            PastRateAdjustmentRatio = double(PastRateTargetSeconds) / double(PastRateActualSeconds);
+        }
+        EventHorizonDeviation = 1 + (0.7084 * std::pow((double(PastBlocksMass)/double(144)), -1.228));
+        EventHorizonDeviationFast = EventHorizonDeviation;
+        EventHorizonDeviationSlow = 1 / EventHorizonDeviation;
+
+        if (PastBlocksMass >= PastBlocksMin) {
+            if ((PastRateAdjustmentRatio <= EventHorizonDeviationSlow) || (PastRateAdjustmentRatio >= EventHorizonDeviationFast)) { break; }
+        }
+        if (BlockReading->pprev == NULL) { break; }
+        BlockReading = BlockReading->pprev;
+    }
+
+    CBigNum bnNew(PastDifficultyAverage);
+    if (PastRateActualSeconds != 0 && PastRateTargetSeconds != 0) {
+        bnNew *= PastRateActualSeconds;
+        bnNew /= PastRateTargetSeconds;
+    }
+    if (bnNew > CBigNum(params.powLimit)) { bnNew = CBigNum(params.powLimit); }
+
+    return bnNew.GetCompact();
+}
+
+/* The original OpenSSL CBigNum implementation of DarkGravityWave, as reference */
+static unsigned int DarkGravityWaveBigNum(const CBlockIndex* pindexLast, const Consensus::Params& params)
+{
+    const CBlockIndex *BlockLastSolved = pindexLast;
+    const CBlockIndex *BlockReading = pindexLast;
+    int64_t nActualTimespan = 0;
+    int64_t LastBlockTime = 0;
+    int64_t PastBlocksMin = 24;
+    int64_t PastBlocksMax = 24;
+    int64_t CountBlocks = 0;
+    CBigNum PastDifficultyAverage;
+    CBigNum PastDifficultyAveragePrev;
+
+    if (BlockLastSolved == NULL || BlockLastSolved->nHeight < Params().SwitchLyra2REv2_DGWblock() + PastBlocksMin) {
+        return UintToArith256(params.powLimit).GetCompact();
+    }
+
+    for (unsigned int i = 1; BlockReading && BlockReading->nHeight >= Params().SwitchLyra2REv2_DGWblock(); i++) {
+        if (PastBlocksMax > 0 && i > PastBlocksMax) { break; }
+        CountBlocks++;
+
+        if(CountBlocks <= PastBlocksMin) {
+            if (CountBlocks == 1) { PastDifficultyAverage.SetCompact(BlockReading->nBits); }
+            else { PastDifficultyAverage = ((PastDifficultyAveragePrev * CountBlocks)+(CBigNum().SetCompact(BlockReading->nBits))) / (CountBlocks+1); }
+            PastDifficultyAveragePrev = PastDifficultyAverage;
+        }
+
+        if(LastBlockTime > 0){
+            int64_t Diff = (LastBlockTime - BlockReading->GetBlockTime());
+            nActualTimespan += Diff;
+        }
+        LastBlockTime = BlockReading->GetBlockTime();
+
+        if (BlockReading->pprev == NULL) { break; }
+        BlockReading = BlockReading->pprev;
+    }
+
+    CBigNum bnNew(PastDifficultyAverage);
+
+    int64_t _nTargetTimespan = CountBlocks*params.nPowTargetSpacing;
+
+    if (nActualTimespan < _nTargetTimespan/3)
+        nActualTimespan = _nTargetTimespan/3;
+    if (nActualTimespan > _nTargetTimespan*3)
+        nActualTimespan = _nTargetTimespan*3;
+
+    bnNew *= nActualTimespan;
+    bnNew /= _nTargetTimespan;
+
+    if (bnNew > CBigNum(params.powLimit)){
+        bnNew = CBigNum(params.powLimit);
+    }
+
+    return bnNew.GetCompact();
+}
+
+/* Build a chain with random targets below the PoW limit and erratic block times */
+static void BuildGravityTestChain(std::vector<CBlockIndex>& blocks, const Consensus::Params& params)
+{
+    const arith_uint256 bnPowLimit = UintToArith256(params.powLimit);
+    int64_t nTime = 1500000000;
+    for (size_t i = 0; i < blocks.size(); i++) {
+        blocks[i].pprev = i ? &blocks[i - 1] : nullptr;
+        blocks[i].nHeight = i;
+
+        switch (InsecureRandRange(10)) {
+        case 0: nTime += InsecureRandRange(6 * 60 * 60); break; // long gap
+        case 1: nTime -= InsecureRandRange(60 * 60); break; // timestamp going backwards
+        default: nTime += params.nPowTargetSpacing / 2 + InsecureRandRange(params.nPowTargetSpacing); break;
+        }
+        blocks[i].nTime = nTime;
+
+        arith_uint256 bnTarget = UintToArith256(InsecureRand256()) >> (256 - bnPowLimit.bits() + InsecureRandRange(24));
+        if (bnTarget == 0) bnTarget = 1;
+        blocks[i].nBits = bnTarget.GetCompact();
+    }
+}
+
+/* Test that the arith_uint256 KGW and DGW are bit-identical to the CBigNum ones */
+BOOST_AUTO_TEST_CASE(gravity_well_matches_bignum)
+{
+    const auto chainParams = CreateChainParams(CBaseChainParams::MAIN);
+    // Also use a PoW limit close to 2^256, so that intermediate values overflow 256 bits
+    Consensus::Params paramsHighLimit = chainParams->GetConsensus();
+    paramsHighLimit.powLimit = uint256S("7fffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff");
+
+    for (const Consensus::Params& params : {chainParams->GetConsensus(), paramsHighLimit}) {
+        const uint64_t nSpacing = params.nPowTargetSpacing;
+        const uint64_t PastBlocksMin = 60 * 60 * 24 * 0.25 / nSpacing;
+        const uint64_t PastBlocksMax = 60 * 60 * 24 * 7 / nSpacing;
+
+        std::vector<CBlockIndex> blocks(PastBlocksMax + 1000);
+        BuildGravityTestChain(blocks, params);
+
+        // Count results below the limit, to make sure the comparison is not vacuous
+        const unsigned int nProofOfWorkLimit = UintToArith256(params.powLimit).GetCompact();
+        int nKGWBelowLimit = 0, nDGWBelowLimit = 0;
+        for (int j = 0; j < 50; j++) {
+            const CBlockIndex* pindex = &blocks[InsecureRandRange(blocks.size())];
+            unsigned int nBits = KimotoGravityWell(pindex, nullptr, nSpacing, PastBlocksMin, PastBlocksMax, params);
+            BOOST_CHECK_EQUAL(nBits, KimotoGravityWellBigNum(pindex, nSpacing, PastBlocksMin, PastBlocksMax, params));
+            nKGWBelowLimit += nBits != nProofOfWorkLimit;
+        }
+        for (int j = 0; j < 1000; j++) {
+            const CBlockIndex* pindex = &blocks[InsecureRandRange(blocks.size())];
+            unsigned int nBits = DarkGravityWave(pindex, nullptr, params);
+            BOOST_CHECK_EQUAL(nBits, DarkGravityWaveBigNum(pindex, params));
+            nDGWBelowLimit += nBits != nProofOfWorkLimit;
+        }
+        BOOST_CHECK(nKGWBelowLimit > 0);
+        BOOST_CHECK(nDGWBelowLimit > 0);
+    }
+}
+
+/* Test that memoized retargets match fresh ones, also after switching to a competing branch */
+BOOST_AUTO_TEST_CASE(next_work_cache)
+{
+    const Consensus::Params& params = Params().GetConsensus();
+    std::vector<CBlockIndex> blocks(300);
+    std::vector<CBlockIndex> fork(200);
+    BuildGravityTestChain(blocks, params);
+    BuildGravityTestChain(fork, params);
+    fork[0].pprev = &blocks[99];
+    for (CBlockIndex& block : fork) {
+        block.nHeight += 100;
+    }
+
+    std::vector<uint256> hashes(blocks.size() + fork.size());
+    for (size_t i = 0; i < hashes.size(); i++) {
+        hashes[i] = InsecureRand256();
+        CBlockIndex& block = i < blocks.size() ? blocks[i] : fork[i - blocks.size()];
+        block.phashBlock = &hashes[i];
+    }
+
+    for (int round = 0; round < 2; round++) {
+        for (size_t i = 1; i < blocks.size(); i++) {
+            BOOST_CHECK_EQUAL(GetNextWorkRequired(&blocks[i], nullptr, params), DarkGravityWave(&blocks[i], nullptr, params));
+        }
+        for (size_t i = 0; i < fork.size(); i++) {
+            BOOST_CHECK_EQUAL(GetNextWorkRequired(&fork[i], nullptr, params), DarkGravityWave(&fork[i], nullptr, params));
+        }
+    }
+}
+
+/* Test that the header PoW pre-check used by ProcessHeadersMessage catches bad headers */
+BOOST_FIXTURE_TEST_CASE(check_block_headers_pow, TestingSetup)
+{
+    // Use a trivial PoW limit, so that the headers below can be mined quickly
+    Consensus::Params consensusParams = Params().GetConsensus();
+    consensusParams.powLimit = uint256S("7fffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff");
+    const CBlock& genesis = Params().GenesisBlock();
+
+    std::vector<CBlockHeader> headers;
+    uint256 prev_hash = genesis.GetHash();
+    for (int height = 1; height <= 100; height++) {
+        CBlockHeader header;
+        header.nVersion = genesis.nVersion;
+        header.hashPrevBlock = prev_hash;
+        header.nTime = genesis.nTime + height;
+        header.nBits = 0x207fffff;
+        while (!CheckProofOfWork(header.GetPoWHash(height >= Params().SwitchLyra2REv2_DGWblock()), header.nBits, height, consensusParams)) {
+            ++header.nNonce;
+        }
+        headers.push_back(header);
+        prev_hash = header.GetHash();
+    }
+
+    BOOST_CHECK(CheckBlockHeadersPoW(headers, 0, 1, consensusParams));
+    BOOST_CHECK(CheckBlockHeadersPoW(headers, 10, 11, consensusParams));
+    BOOST_CHECK(CheckBlockHeadersPoW(headers, headers.size(), headers.size() + 1, consensusParams));
+
+    // Claiming more work than the hash provides fails the whole batch, but not a batch that skips it
+    headers[30].nBits = 0x1d00ffff;
+    BOOST_CHECK(!CheckBlockHeadersPoW(headers, 0, 1, consensusParams));
+    BOOST_CHECK(CheckBlockHeadersPoW(headers, 31, 32, consensusParams));
+
+    // Also when the bad header is in the last, partial group of a batch
+    headers.back().nBits = 0x1d00ffff;
+    BOOST_CHECK(!CheckBlockHeadersPoW(headers, 31, 32, consensusParams));
+    BOOST_CHECK(CheckBlockHeadersPoW(std::vector<CBlockHeader>(headers.begin() + 31, headers.end() - 1), 0, 32, consensusParams));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
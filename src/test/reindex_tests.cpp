@@ -0,0 +1,102 @@
+// Copyright (c) 2018 The Monacoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <chain.h>
+#include <chainparams.h>
+#include <clientversion.h>
+#include <consensus/validation.h>
+#include <fs.h>
+#include <init.h>
+#include <streams.h>
+#include <txdb.h>
+#include <validation.h>
+#include <test/test_bitcoin.h>
+
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(reindex_tests, TestingSetup)
+
+/** Write blocks the way they are stored in blk?????.dat files. */
+static void WriteBlockFile(const fs::path& path, const std::vector<CBlock>& vBlocks)
+{
+    CAutoFile file(fsbridge::fopen(path, "wb"), SER_DISK, CLIENT_VERSION);
+    BOOST_REQUIRE(!file.IsNull());
+    for (const CBlock& block : vBlocks) {
+        file << FLATDATA(Params().MessageStart()) << (unsigned int)::GetSerializeSize(block, SER_DISK, CLIENT_VERSION) << block;
+    }
+}
+
+/** Start over from empty databases, as -reindex does. */
+static void ResetDatabases()
+{
+    UnloadBlockIndex();
+    pcoinsTip.reset();
+    pcoinsdbview.reset(new CCoinsViewDB(1 << 23, true, true));
+    pcoinsTip.reset(new CCoinsViewCache(pcoinsdbview.get(), true));
+    pblocktree.reset(new CBlockTreeDB(1 << 20, true, true));
+}
+
+BOOST_AUTO_TEST_CASE(import_genesis_block)
+{
+    // BIP34 is active from the genesis block on, whose coinbase does not
+    // start with its height. Importing it still has to give a usable chain.
+    const CChainParams& chainparams = Params();
+    BOOST_CHECK_EQUAL(chainparams.GetConsensus().BIP34Height, 0);
+    const fs::path path = GetDataDir() / "bootstrap.dat";
+    WriteBlockFile(path, {chainparams.GenesisBlock()});
+
+    ResetDatabases();
+    BOOST_CHECK(mapBlockIndex.empty());
+    BOOST_CHECK(LoadExternalBlockFiles(chainparams, {path}, false));
+
+    LOCK(cs_main);
+    BlockMap::const_iterator it = mapBlockIndex.find(chainparams.GetConsensus().hashGenesisBlock);
+    BOOST_REQUIRE(it != mapBlockIndex.end());
+    BOOST_CHECK(it->second->nStatus & BLOCK_HAVE_DATA);
+    BOOST_CHECK(!(it->second->nStatus & BLOCK_FAILED_MASK));
+    BOOST_CHECK(chainActive.Tip() == it->second);
+}
+
+BOOST_AUTO_TEST_CASE(import_several_files)
+{
+    // More files than reader threads, with blocks that are known already
+    // after the first file
+    const CChainParams& chainparams = Params();
+    std::vector<fs::path> vFiles;
+    for (int i = 0; i < 3 * DEFAULT_IMPORT_THREADS; i++) {
+        vFiles.push_back(GetDataDir() / strprintf("bootstrap%d.dat", i));
+        WriteBlockFile(vFiles.back(), std::vector<CBlock>(i + 1, chainparams.GenesisBlock()));
+    }
+    vFiles.push_back(GetDataDir() / "missing.dat");
+
+    ResetDatabases();
+    BOOST_CHECK(LoadExternalBlockFiles(chainparams, vFiles, false));
+    BOOST_CHECK(!ShutdownRequested());
+
+    LOCK(cs_main);
+    BOOST_CHECK_EQUAL(mapBlockIndex.size(), 1U);
+    BOOST_CHECK(chainActive.Tip() && chainActive.Tip()->GetBlockHash() == chainparams.GetConsensus().hashGenesisBlock);
+}
+
+BOOST_AUTO_TEST_CASE(read_raw_block)
+{
+    // The genesis block as written to blk00000.dat by the setup
+    const CChainParams& chainparams = Params();
+    const CBlockIndex* pindex = mapBlockIndex.at(chainparams.GetConsensus().hashGenesisBlock);
+    std::vector<uint8_t> vData;
+    BOOST_REQUIRE(ReadRawBlockFromDisk(vData, pindex, chainparams.MessageStart()));
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << chainparams.GenesisBlock();
+    BOOST_CHECK(vData == std::vector<uint8_t>(ss.begin(), ss.end()));
+
+    // Data at the position of an entry for another block is not served
+    CBlockIndex indexOther(*pindex);
+    const uint256 hashOther = InsecureRand256();
+    indexOther.phashBlock = &hashOther;
+    BOOST_CHECK(!ReadRawBlockFromDisk(vData, &indexOther, chainparams.MessageStart()));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -43,6 +43,35 @@ BOOST_AUTO_TEST_CASE(skiplist_test)
     }
 }
 
+BOOST_AUTO_TEST_CASE(skiplist_from_chain_test)
+{
+    std::vector<CBlockIndex> vIndex(SKIPLIST_LENGTH);
+    std::vector<CBlockIndex> vIndexChain(SKIPLIST_LENGTH);
+
+    for (int i=0; i<SKIPLIST_LENGTH; i++) {
+        vIndex[i].nHeight = vIndexChain[i].nHeight = i;
+        vIndex[i].pprev = (i == 0) ? nullptr : &vIndex[i - 1];
+        vIndexChain[i].pprev = (i == 0) ? nullptr : &vIndexChain[i - 1];
+        vIndex[i].BuildSkip();
+    }
+
+    // Build the skip pointers from the top down, which walking back could not do
+    CChain chain;
+    chain.SetTip(&vIndexChain.back());
+    for (int i=SKIPLIST_LENGTH - 1; i>=0; i--) {
+        vIndexChain[i].BuildSkip(chain);
+    }
+
+    for (int i=0; i<SKIPLIST_LENGTH; i++) {
+        if (i > 0) {
+            BOOST_CHECK_EQUAL(vIndexChain[i].pskip->nHeight, vIndex[i].pskip->nHeight);
+            BOOST_CHECK(vIndexChain[i].pskip == &vIndexChain[vIndexChain[i].pskip->nHeight]);
+        } else {
+            BOOST_CHECK(vIndexChain[i].pskip == nullptr);
+        }
+    }
+}
+
 BOOST_AUTO_TEST_CASE(getlocator_test)
 {
     // Build a main chain 100000 blocks long.
@@ -0,0 +1,69 @@
+// Copyright (c) 2018 The Monacoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <chain.h>
+#include <usercheckpoint.h>
+#include <validation.h>
+#include <test/test_bitcoin.h>
+
+#include <memory>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(usercheckpoint_tests, TestingSetup)
+
+BOOST_AUTO_TEST_CASE(last_checkpoint_follows_index_and_checkpoints)
+{
+    CUserCheckpoint& uc = CUserCheckpoint::GetInstance();
+    std::vector<uint256> hashes;
+    std::vector<std::unique_ptr<CBlockIndex>> vIndex;
+    hashes.reserve(3);
+    for (int i = 0; i < 3; i++) {
+        hashes.push_back(InsecureRand256());
+        vIndex.emplace_back(new CBlockIndex());
+        vIndex.back()->nHeight = (i + 1) * 100;
+        vIndex.back()->phashBlock = &hashes.back();
+    }
+
+    LOCK(cs_main);
+    BOOST_CHECK(uc.GetLastCheckpoint() == nullptr);
+
+    for (int i = 0; i < 3; i++) {
+        BOOST_CHECK(uc.WriteCheckpoint((i + 1) * 100, hashes[i]));
+    }
+    BOOST_CHECK_EQUAL(uc.GetMaxCheckpointHeight(), 300);
+    BOOST_CHECK(uc.GetLastCheckpoint() == nullptr);
+
+    // Blocks entering the index are picked up without a full rescan.
+    for (int i = 0; i < 2; i++) {
+        mapBlockIndex.emplace(hashes[i], vIndex[i].get());
+        uc.BlockIndexAdded(vIndex[i].get());
+    }
+    BOOST_CHECK(uc.GetLastCheckpoint() == vIndex[1].get());
+    mapBlockIndex.emplace(hashes[2], vIndex[2].get());
+    uc.BlockIndexAdded(vIndex[2].get());
+    BOOST_CHECK(uc.GetLastCheckpoint() == vIndex[2].get());
+
+    // Changing the checkpoints invalidates the memoized entry.
+    BOOST_CHECK(uc.DeleteCheckpoint(300, false));
+    BOOST_CHECK(uc.GetLastCheckpoint() == vIndex[1].get());
+    uint256 hash;
+    BOOST_CHECK(!uc.ReadCheckpoint(300, hash));
+    BOOST_CHECK(uc.ReadCheckpoint(200, hash));
+    BOOST_CHECK(hash == hashes[1]);
+    BOOST_CHECK_EQUAL(uc.Dump(10).size(), 2U);
+
+    for (int i = 0; i < 3; i++) {
+        mapBlockIndex.erase(hashes[i]);
+    }
+    uc.BlockIndexReset();
+    BOOST_CHECK(uc.GetLastCheckpoint() == nullptr);
+
+    BOOST_CHECK(uc.DeleteCheckpoint(100, false));
+    BOOST_CHECK(uc.DeleteCheckpoint(200, false));
+    BOOST_CHECK_EQUAL(uc.GetMaxCheckpointHeight(), 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
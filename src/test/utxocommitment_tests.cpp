@@ -0,0 +1,85 @@
+// Copyright (c) 2018 The Monacoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <coins.h>
+#include <script/standard.h>
+#include <streams.h>
+#include <utxocommitment.h>
+#include <version.h>
+#include <test/test_bitcoin.h>
+
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(utxocommitment_tests, BasicTestingSetup)
+
+static std::vector<std::pair<COutPoint, Coin>> RandomCoins(int n)
+{
+    std::vector<std::pair<COutPoint, Coin>> coins;
+    for (int i = 0; i < n; i++) {
+        CTxOut out(InsecureRandRange(1000000), CScript() << ToByteVector(InsecureRand256()));
+        coins.emplace_back(COutPoint(InsecureRand256(), InsecureRandBits(4)), Coin(out, InsecureRandRange(100000), InsecureRandBool()));
+    }
+    return coins;
+}
+
+BOOST_AUTO_TEST_CASE(order_independence)
+{
+    // More coins than are buffered before summing, to exercise both paths.
+    const auto coins = RandomCoins(600);
+    CUTXOCommitment forward, backward, empty;
+    for (const auto& entry : coins) {
+        forward.Add(entry.first, entry.second);
+    }
+    for (auto it = coins.rbegin(); it != coins.rend(); ++it) {
+        backward.Add(it->first, it->second);
+    }
+    BOOST_CHECK(forward.GetHash() == backward.GetHash());
+    BOOST_CHECK(forward.GetHash() != empty.GetHash());
+    BOOST_CHECK_EQUAL(forward.nTransactionOutputs, 600);
+    BOOST_CHECK_EQUAL(forward.nTotalAmount, backward.nTotalAmount);
+
+    // Removing every coin again gives back the empty set.
+    for (const auto& entry : coins) {
+        forward.Remove(entry.first, entry.second);
+    }
+    BOOST_CHECK(forward.GetHash() == empty.GetHash());
+    BOOST_CHECK_EQUAL(forward.nTransactionOutputs, 0);
+    BOOST_CHECK_EQUAL(forward.nBogoSize, 0);
+    BOOST_CHECK_EQUAL(forward.nTotalAmount, 0);
+}
+
+BOOST_AUTO_TEST_CASE(combine_and_serialize)
+{
+    const auto coins = RandomCoins(20);
+    CUTXOCommitment all, base, delta;
+    for (size_t i = 0; i < coins.size(); i++) {
+        all.Add(coins[i].first, coins[i].second);
+        (i < 15 ? base : delta).Add(coins[i].first, coins[i].second);
+    }
+    // A delta that adds and removes the same coin changes nothing.
+    delta.Add(coins[0].first, coins[0].second);
+    delta.Remove(coins[0].first, coins[0].second);
+    base.Combine(delta);
+    BOOST_CHECK(base.GetHash() == all.GetHash());
+    BOOST_CHECK_EQUAL(base.nBogoSize, all.nBogoSize);
+
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << all;
+    BOOST_CHECK_EQUAL(ss.size(), 1U + 33 + 3 * 8);
+    CUTXOCommitment read;
+    ss >> read;
+    BOOST_CHECK(read.GetHash() == all.GetHash());
+    BOOST_CHECK_EQUAL(read.nTransactionOutputs, all.nTransactionOutputs);
+    BOOST_CHECK_EQUAL(read.nTotalAmount, all.nTotalAmount);
+
+    CUTXOCommitment empty;
+    ss << empty;
+    BOOST_CHECK_EQUAL(ss.size(), 1U + 3 * 8);
+    ss >> read;
+    BOOST_CHECK(read.GetHash() == empty.GetHash());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,228 @@
+// Copyright (c) 2018 The Monacoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <chainparams.h>
+#include <coins.h>
+#include <fs.h>
+#include <hash.h>
+#include <streams.h>
+#include <txdb.h>
+#include <utxocommitment.h>
+#include <utxosnapshot.h>
+#include <validation.h>
+#include <test/test_bitcoin.h>
+
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+namespace {
+/** The parameters of the selected network, with some UTXO snapshots listed. */
+class SnapshotTestParams : public CChainParams
+{
+public:
+    explicit SnapshotTestParams(const CChainParams& params) : CChainParams(params) {}
+
+    void AddSnapshot(const CUTXOSnapshotHeader& header, uint64_t nChainTx)
+    {
+        mapUTXOSnapshots[header.nHeight] = UTXOSnapshotData{header.hashBlock, header.hashCommitment, header.nCoins, nChainTx};
+    }
+};
+
+struct SnapshotTestingSetup : public TestingSetup {
+    std::vector<CBlockHeader> vHeaders;
+    std::vector<std::pair<COutPoint, Coin>> vCoins;
+
+    SnapshotTestingSetup()
+    {
+        // Headers are not checked for proof of work, only for linking up
+        uint256 hashPrev = Params().GenesisBlock().GetHash();
+        for (int i = 0; i < 10; i++) {
+            CBlockHeader block;
+            block.nVersion = 4;
+            block.hashPrevBlock = hashPrev;
+            block.hashMerkleRoot = InsecureRand256();
+            block.nTime = Params().GenesisBlock().nTime + i + 1;
+            block.nBits = Params().GenesisBlock().nBits;
+            vHeaders.push_back(block);
+            hashPrev = block.GetHash();
+        }
+        for (int i = 0; i < 50; i++) {
+            CTxOut out(InsecureRandRange(1000000), CScript() << ToByteVector(InsecureRand256()));
+            vCoins.emplace_back(COutPoint(InsecureRand256(), InsecureRandBits(4)), Coin(out, 1 + InsecureRandRange(10), InsecureRandBool()));
+        }
+    }
+
+    /** Transactions up to the last of vHeaders: the genesis block's, then one per block. */
+    uint64_t ChainTx() const { return 1 + vHeaders.size(); }
+
+    /** The header of a snapshot of vCoins as of the last of vHeaders. */
+    CUTXOSnapshotHeader MakeHeader() const
+    {
+        CUTXOCommitment commitment;
+        for (const auto& entry : vCoins) {
+            commitment.Add(entry.first, entry.second);
+        }
+        CUTXOSnapshotHeader header;
+        memcpy(header.pchMessageStart, Params().MessageStart(), sizeof(header.pchMessageStart));
+        header.hashBlock = vHeaders.back().GetHash();
+        header.nHeight = vHeaders.size();
+        header.nCoins = vCoins.size();
+        header.hashCommitment = commitment.GetHash();
+        return header;
+    }
+
+    void WriteSnapshot(const fs::path& path, const CUTXOSnapshotHeader& header) const
+    {
+        CAutoFile file(fsbridge::fopen(path, "wb"), SER_DISK, CLIENT_VERSION);
+        BOOST_REQUIRE(!file.IsNull());
+        CHashingWriter<CAutoFile> writer(&file);
+        writer << header;
+        for (const CBlockHeader& block : vHeaders) {
+            writer << block << VARINT(1u);
+        }
+        for (const auto& entry : vCoins) {
+            writer << entry.first << entry.second;
+        }
+        file << writer.GetHash();
+    }
+
+    void CheckCoins(const CCoinsView& view) const
+    {
+        for (const auto& entry : vCoins) {
+            Coin coin;
+            BOOST_CHECK(view.GetCoin(entry.first, coin));
+            BOOST_CHECK(coin.out == entry.second.out);
+            BOOST_CHECK_EQUAL(coin.nHeight, entry.second.nHeight);
+        }
+    }
+};
+} // namespace
+
+BOOST_FIXTURE_TEST_SUITE(utxosnapshot_tests, SnapshotTestingSetup)
+
+BOOST_AUTO_TEST_CASE(dump_load_roundtrip)
+{
+    SnapshotTestParams params(Params());
+    const CUTXOSnapshotHeader header = MakeHeader();
+    params.AddSnapshot(header, ChainTx());
+    const fs::path path = GetDataDir() / "snapshot.dat";
+    WriteSnapshot(path, header);
+
+    // Load into the (empty) chain state, so that it can be dumped again
+    BOOST_REQUIRE(pcoinsdbview->InitCommitment());
+    BOOST_REQUIRE(LoadUTXOSnapshot(params, path, pcoinsdbview.get()));
+    BOOST_CHECK(pcoinsdbview->GetBestBlock() == header.hashBlock);
+    BOOST_CHECK_EQUAL(mapBlockIndex.at(header.hashBlock)->nChainTx, ChainTx());
+    pcoinsTip.reset(new CCoinsViewCache(pcoinsdbview.get(), true));
+    CheckCoins(*pcoinsTip);
+
+    const fs::path pathDumped = GetDataDir() / "dumped.dat";
+    CUTXOSnapshotHeader headerDumped;
+    BOOST_REQUIRE(DumpUTXOSnapshot(pathDumped, headerDumped));
+    BOOST_CHECK(headerDumped.hashBlock == header.hashBlock);
+    BOOST_CHECK_EQUAL(headerDumped.nHeight, header.nHeight);
+    BOOST_CHECK_EQUAL(headerDumped.nCoins, header.nCoins);
+    BOOST_CHECK(headerDumped.hashCommitment == header.hashCommitment);
+
+    // Which loads into another chain state with the same result
+    CCoinsViewDB view(1 << 20, true, true);
+    BOOST_REQUIRE(view.InitCommitment());
+    BOOST_REQUIRE(LoadUTXOSnapshot(params, pathDumped, &view));
+    BOOST_CHECK(view.GetBestBlock() == header.hashBlock);
+    CUTXOCommitment commitment;
+    BOOST_CHECK(view.GetCommitment(commitment));
+    BOOST_CHECK(commitment.GetHash() == header.hashCommitment);
+    CheckCoins(view);
+}
+
+BOOST_AUTO_TEST_CASE(tampered_coin)
+{
+    SnapshotTestParams params(Params());
+    const CUTXOSnapshotHeader header = MakeHeader();
+    params.AddSnapshot(header, ChainTx());
+
+    // Valid checksum, but a coin that the listed commitment does not cover
+    vCoins[InsecureRandRange(vCoins.size())].second.out.nValue += 1;
+    const fs::path path = GetDataDir() / "snapshot.dat";
+    WriteSnapshot(path, header);
+
+    CCoinsViewDB view(1 << 20, true, true);
+    BOOST_REQUIRE(view.InitCommitment());
+    BOOST_CHECK(!LoadUTXOSnapshot(params, path, &view));
+}
+
+BOOST_AUTO_TEST_CASE(wrong_commitment)
+{
+    SnapshotTestParams params(Params());
+    params.AddSnapshot(MakeHeader(), ChainTx());
+
+    // A snapshot of the same block whose coins match its own commitment,
+    // which is not the listed one
+    vCoins.pop_back();
+    const CUTXOSnapshotHeader header = MakeHeader();
+    const fs::path path = GetDataDir() / "snapshot.dat";
+    WriteSnapshot(path, header);
+
+    CCoinsViewDB view(1 << 20, true, true);
+    BOOST_REQUIRE(view.InitCommitment());
+    BOOST_CHECK(!LoadUTXOSnapshot(params, path, &view));
+    BOOST_CHECK(view.GetBestBlock().IsNull());
+    BOOST_CHECK(mapBlockIndex.count(header.hashBlock) == 0);
+
+    // Nor is a matching commitment enough for another coin count
+    SnapshotTestParams paramsCount(Params());
+    CUTXOSnapshotHeader headerCount = header;
+    headerCount.nCoins++;
+    paramsCount.AddSnapshot(headerCount, ChainTx());
+    BOOST_CHECK(!LoadUTXOSnapshot(paramsCount, path, &view));
+    BOOST_CHECK(view.GetBestBlock().IsNull());
+}
+
+BOOST_AUTO_TEST_CASE(wrong_chain_tx)
+{
+    // The coins match, but the blocks carry more transactions than listed
+    SnapshotTestParams params(Params());
+    const CUTXOSnapshotHeader header = MakeHeader();
+    params.AddSnapshot(header, ChainTx() - 1);
+    const fs::path path = GetDataDir() / "snapshot.dat";
+    WriteSnapshot(path, header);
+
+    CCoinsViewDB view(1 << 20, true, true);
+    BOOST_REQUIRE(view.InitCommitment());
+    BOOST_CHECK(!LoadUTXOSnapshot(params, path, &view));
+    BOOST_CHECK(view.GetBestBlock().IsNull());
+    BOOST_CHECK(mapBlockIndex.count(header.hashBlock) == 0);
+}
+
+BOOST_AUTO_TEST_CASE(unanchored_base)
+{
+    const CUTXOSnapshotHeader header = MakeHeader();
+    const fs::path path = GetDataDir() / "snapshot.dat";
+    WriteSnapshot(path, header);
+
+    // Nothing listed
+    CCoinsViewDB view(1 << 20, true, true);
+    BOOST_REQUIRE(view.InitCommitment());
+    BOOST_CHECK(!LoadUTXOSnapshot(Params(), path, &view));
+    BOOST_CHECK(view.GetBestBlock().IsNull());
+
+    // Listed at another height
+    SnapshotTestParams params(Params());
+    CUTXOSnapshotHeader headerOther = header;
+    headerOther.nHeight--;
+    params.AddSnapshot(headerOther, ChainTx());
+    BOOST_CHECK(!LoadUTXOSnapshot(params, path, &view));
+
+    // Listed for another block at that height
+    SnapshotTestParams paramsFork(Params());
+    headerOther = header;
+    headerOther.hashBlock = vHeaders[vHeaders.size() - 2].GetHash();
+    paramsFork.AddSnapshot(headerOther, ChainTx());
+    BOOST_CHECK(!LoadUTXOSnapshot(paramsFork, path, &view));
+    BOOST_CHECK(view.GetBestBlock().IsNull());
+    BOOST_CHECK(mapBlockIndex.count(header.hashBlock) == 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
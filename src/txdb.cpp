@@ -16,6 +16,9 @@
 
 #include <stdint.h>
 
+#include <functional>
+#include <thread>
+
 #include <boost/thread.hpp>
 
 static const char DB_COIN = 'C';
@@ -26,6 +29,8 @@ static const char DB_BLOCK_INDEX = 'b';
 
 static const char DB_BEST_BLOCK = 'B';
 static const char DB_HEAD_BLOCKS = 'H';
+static const char DB_UTXO_COMMITMENT = 'U';
+static const char DB_BLOCK_UTXO_COMMITMENT = 'u';
 static const char DB_FLAG = 'F';
 static const char DB_REINDEX_FLAG = 'R';
 static const char DB_LAST_BLOCK = 'l';
@@ -56,6 +61,15 @@ struct CoinEntry {
 
 CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe, true) 
 {
+    fHaveCommitment = db.Read(DB_UTXO_COMMITMENT, commitment);
+    if (fHaveCommitment && !GetHeadBlocks().empty()) {
+        // A flush was interrupted, so the coins no longer match the stored
+        // commitment. Replaying the blocks only restores the coins; the
+        // commitment is recomputed afterwards by InitCommitment().
+        LogPrintf("Dropping UTXO set commitment after an interrupted flush\n");
+        db.Erase(DB_UTXO_COMMITMENT, true);
+        fHaveCommitment = false;
+    }
 }
 
 bool CCoinsViewDB::GetCoin(const COutPoint &outpoint, Coin &coin) const {
@@ -81,7 +95,70 @@ std::vector<uint256> CCoinsViewDB::GetHeadBlocks() const {
     return vhashHeadBlocks;
 }
 
-bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
+bool CCoinsViewDB::GetCommitment(CUTXOCommitment &commitmentOut) const {
+    if (!fHaveCommitment)
+        return false;
+    commitmentOut = commitment;
+    return true;
+}
+
+bool CCoinsViewDB::InitCommitment() {
+    if (fHaveCommitment)
+        return true;
+
+    LogPrintf("Computing UTXO set commitment...\n");
+    CUTXOCommitment computed;
+    std::unique_ptr<CCoinsViewCursor> pcursor(Cursor());
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        COutPoint key;
+        Coin coin;
+        if (!pcursor->GetKey(key) || !pcursor->GetValue(coin))
+            return error("%s: unable to read value", __func__);
+        computed.Add(key, coin);
+        pcursor->Next();
+    }
+    if (!db.Write(DB_UTXO_COMMITMENT, computed, true))
+        return false;
+    commitment = computed;
+    fHaveCommitment = true;
+    LogPrintf("UTXO set commitment covers %d outputs\n", commitment.nTransactionOutputs);
+    return true;
+}
+
+bool CCoinsViewDB::WriteBlockCommitment(const uint256 &hashBlock, const CUTXOCommitment &blockCommitment) {
+    return db.Write(std::make_pair(DB_BLOCK_UTXO_COMMITMENT, hashBlock), blockCommitment);
+}
+
+bool CCoinsViewDB::ReadBlockCommitment(const uint256 &hashBlock, CUTXOCommitment &blockCommitment) const {
+    {
+        std::lock_guard<std::mutex> lock(csBlockCommitments);
+        auto it = mapBlockCommitmentsPending.find(hashBlock);
+        if (it != mapBlockCommitmentsPending.end()) {
+            if (!it->second)
+                return false;
+            blockCommitment = *it->second;
+            return true;
+        }
+    }
+    return db.Read(std::make_pair(DB_BLOCK_UTXO_COMMITMENT, hashBlock), blockCommitment);
+}
+
+void CCoinsViewDB::QueueBlockCommitment(const uint256 &hashBlock, const CUTXOCommitment &blockCommitment) {
+    std::lock_guard<std::mutex> lock(csBlockCommitments);
+    mapBlockCommitmentsPending[hashBlock] = blockCommitment;
+}
+
+void CCoinsViewDB::QueueEraseBlockCommitment(const uint256 &hashBlock) {
+    std::lock_guard<std::mutex> lock(csBlockCommitments);
+    mapBlockCommitmentsPending[hashBlock] = boost::none;
+}
+
+bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, const CUTXOCommitment &commitmentDelta) {
+    return WriteCoins(mapCoins, hashBlock, commitmentDelta, true);
+}
+
+bool CCoinsViewDB::WriteCoins(CCoinsMap &mapCoins, const uint256 &hashBlock, const CUTXOCommitment &commitmentDelta, bool fErase) {
     CDBBatch batch(db);
     size_t count = 0;
     size_t changed = 0;
@@ -116,8 +193,12 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
             changed++;
         }
         count++;
-        CCoinsMap::iterator itOld = it++;
-        mapCoins.erase(itOld);
+        if (fErase) {
+            CCoinsMap::iterator itOld = it++;
+            mapCoins.erase(itOld);
+        } else {
+            ++it;
+        }
         if (batch.SizeEstimate() > batch_size) {
             LogPrint(BCLog::COINDB, "Writing partial batch of %.2f MiB\n", batch.SizeEstimate() * (1.0 / 1048576.0));
             db.WriteBatch(batch);
@@ -135,9 +216,38 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
     // In the last batch, mark the database as consistent with hashBlock again.
     batch.Erase(DB_HEAD_BLOCKS);
     batch.Write(DB_BEST_BLOCK, hashBlock);
+    CUTXOCommitment newCommitment = commitment;
+    if (fHaveCommitment) {
+        newCommitment.Combine(commitmentDelta);
+        batch.Write(DB_UTXO_COMMITMENT, newCommitment);
+    }
+    // Block commitments queued until now. They stay readable from memory
+    // until written, and may be queued again (e.g. by a background write
+    // racing with a reorganization) in the meantime.
+    std::map<uint256, boost::optional<CUTXOCommitment>> mapBlockCommitments;
+    {
+        std::lock_guard<std::mutex> lock(csBlockCommitments);
+        mapBlockCommitments = mapBlockCommitmentsPending;
+    }
+    for (const auto& entry : mapBlockCommitments) {
+        if (entry.second)
+            batch.Write(std::make_pair(DB_BLOCK_UTXO_COMMITMENT, entry.first), *entry.second);
+        else
+            batch.Erase(std::make_pair(DB_BLOCK_UTXO_COMMITMENT, entry.first));
+    }
 
     LogPrint(BCLog::COINDB, "Writing final batch of %.2f MiB\n", batch.SizeEstimate() * (1.0 / 1048576.0));
     bool ret = db.WriteBatch(batch);
+    if (ret) {
+        commitment = newCommitment;
+        std::lock_guard<std::mutex> lock(csBlockCommitments);
+        for (const auto& entry : mapBlockCommitments) {
+            auto it = mapBlockCommitmentsPending.find(entry.first);
+            // The commitment as of a block never changes, only whether it is kept
+            if (it != mapBlockCommitmentsPending.end() && bool(it->second) == bool(entry.second))
+                mapBlockCommitmentsPending.erase(it);
+        }
+    }
     LogPrint(BCLog::COINDB, "Committed %u changed transaction outputs (out of %u) to coin database...\n", (unsigned int)changed, (unsigned int)count);
     return ret;
 }
@@ -147,6 +257,143 @@ size_t CCoinsViewDB::EstimateSize() const
     return db.EstimateSize(DB_COIN, (char)(DB_COIN+1));
 }
 
+CCoinsViewDBFlusher::CCoinsViewDBFlusher(CCoinsViewDB *dbIn, bool fBackground) :
+    CCoinsViewBacked(dbIn), db(dbIn), fHaveCommitmentWriting(false), fWriteFailed(false), fStop(false)
+{
+    if (fBackground) {
+        writer = std::thread(&TraceThread<std::function<void()>>, "coinsflush", std::function<void()>(std::bind(&CCoinsViewDBFlusher::ThreadWrite, this)));
+    }
+}
+
+CCoinsViewDBFlusher::~CCoinsViewDBFlusher()
+{
+    {
+        std::lock_guard<std::mutex> lock(cs);
+        fStop = true;
+        cond.notify_all();
+    }
+    if (writer.joinable()) {
+        writer.join();
+    }
+}
+
+void CCoinsViewDBFlusher::ThreadWrite()
+{
+    std::unique_lock<std::mutex> lock(cs);
+    while (true) {
+        cond.wait(lock, [this]{ return fStop || !hashWriting.IsNull(); });
+        // Finish the write in progress before stopping
+        if (hashWriting.IsNull()) {
+            return;
+        }
+
+        // Nothing else touches the coins being written until hashWriting is
+        // cleared, and reads only look them up.
+        lock.unlock();
+        const int64_t nStart = GetTimeMicros();
+        bool fOk = false;
+        try {
+            fOk = db->WriteCoins(*pmapWriting, hashWriting, commitmentDeltaWriting, false);
+        } catch (const std::runtime_error& e) {
+            LogPrintf("Error writing to coin database: %s\n", e.what());
+        }
+        LogPrint(BCLog::COINDB, "Background flush of %u coins up to %s took %.2fms\n", (unsigned int)pmapWriting->size(), hashWriting.ToString(), (GetTimeMicros() - nStart) * 0.001);
+        lock.lock();
+
+        if (!fOk) {
+            // Keep serving the coins from memory, as the database is inconsistent
+            fWriteFailed = true;
+            cond.notify_all();
+            uiInterface.ThreadSafeMessageBox(_("Error writing to coin database, shutting down."), "", CClientUIInterface::MSG_ERROR);
+            StartShutdown();
+            return;
+        }
+        std::unique_ptr<CCoinsMap> pmapWritten = std::move(pmapWriting);
+        hashWriting.SetNull();
+        cond.notify_all();
+        // Free the written coins without holding up readers
+        lock.unlock();
+        pmapWritten.reset();
+        lock.lock();
+    }
+}
+
+bool CCoinsViewDBFlusher::GetCoin(const COutPoint &outpoint, Coin &coin) const
+{
+    std::lock_guard<std::mutex> lock(cs);
+    if (!hashWriting.IsNull()) {
+        CCoinsMap::const_iterator it = pmapWriting->find(outpoint);
+        if (it != pmapWriting->end()) {
+            coin = it->second.coin;
+            return !coin.IsSpent();
+        }
+    }
+    return base->GetCoin(outpoint, coin);
+}
+
+bool CCoinsViewDBFlusher::HaveCoin(const COutPoint &outpoint) const
+{
+    Coin coin;
+    return GetCoin(outpoint, coin);
+}
+
+uint256 CCoinsViewDBFlusher::GetBestBlock() const
+{
+    std::lock_guard<std::mutex> lock(cs);
+    if (!hashWriting.IsNull()) {
+        return hashWriting;
+    }
+    return base->GetBestBlock();
+}
+
+bool CCoinsViewDBFlusher::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, const CUTXOCommitment &commitmentDelta)
+{
+    if (!writer.joinable()) {
+        return base->BatchWrite(mapCoins, hashBlock, commitmentDelta);
+    }
+
+    std::unique_lock<std::mutex> lock(cs);
+    cond.wait(lock, [this]{ return hashWriting.IsNull() || fWriteFailed; });
+    if (fWriteFailed) {
+        return false;
+    }
+    fHaveCommitmentWriting = base->GetCommitment(commitmentWriting);
+    if (fHaveCommitmentWriting) {
+        commitmentWriting.Combine(commitmentDelta);
+    }
+    commitmentDeltaWriting = commitmentDelta;
+    pmapWriting.reset(new CCoinsMap(std::move(mapCoins)));
+    mapCoins.clear();
+    hashWriting = hashBlock;
+    cond.notify_all();
+    return true;
+}
+
+bool CCoinsViewDBFlusher::GetCommitment(CUTXOCommitment &commitment) const
+{
+    std::lock_guard<std::mutex> lock(cs);
+    if (!hashWriting.IsNull()) {
+        if (fHaveCommitmentWriting) {
+            commitment = commitmentWriting;
+        }
+        return fHaveCommitmentWriting;
+    }
+    return base->GetCommitment(commitment);
+}
+
+CCoinsViewCursor *CCoinsViewDBFlusher::Cursor() const
+{
+    Sync();
+    return base->Cursor();
+}
+
+bool CCoinsViewDBFlusher::Sync() const
+{
+    std::unique_lock<std::mutex> lock(cs);
+    cond.wait(lock, [this]{ return hashWriting.IsNull() || fWriteFailed; });
+    return !fWriteFailed;
+}
+
 CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe) {
 }
 
@@ -259,49 +506,125 @@ bool CBlockTreeDB::ReadFlag(const std::string &name, bool &fValue) {
     return true;
 }
 
-bool CBlockTreeDB::LoadBlockIndexGuts(const Consensus::Params& consensusParams, std::function<CBlockIndex*(const uint256&)> insertBlockIndex)
+bool CBlockTreeDB::LoadBlockIndexGuts(const Consensus::Params& consensusParams, std::function<CBlockIndex*(const uint256&)> insertBlockIndex, int nThreads)
 {
-    std::unique_ptr<CDBIterator> pcursor(NewIterator());
-
-    pcursor->Seek(std::make_pair(DB_BLOCK_INDEX, uint256()));
+    // The entries are split by the first byte of their hash into shards,
+    // which are read and deserialized (including the hashing of each header)
+    // by nThreads reader threads, each with its own iterator. The entries
+    // are then inserted shard by shard on this thread, as insertBlockIndex
+    // is not thread safe. Readers stay at most nThreads shards ahead, which
+    // bounds the memory used.
+    static const int NUM_SHARDS = 256;
+    nThreads = std::max(nThreads, 1);
+    struct Shard {
+        bool fRead = false;
+        bool fFailed = false;
+        std::vector<std::pair<uint256, CDiskBlockIndex>> vEntries;
+    };
+    std::vector<Shard> vShards(NUM_SHARDS);
+    CWaitableCriticalSection cs;
+    CConditionVariable cond;
+    int nNextRead = 0;
+    int nNextInsert = 0;
+    bool fStop = false;
+
+    auto read = [&]() {
+        std::unique_ptr<CDBIterator> pcursor(NewIterator());
+        while (true) {
+            int nShard;
+            {
+                WaitableLock lock(cs);
+                cond.wait(lock, [&] { return fStop || nNextRead >= NUM_SHARDS || nNextRead < nNextInsert + nThreads; });
+                if (fStop || nNextRead >= NUM_SHARDS)
+                    return;
+                nShard = nNextRead++;
+            }
+            Shard shard;
+            uint256 hashStart;
+            *hashStart.begin() = nShard;
+            pcursor->Seek(std::make_pair(DB_BLOCK_INDEX, hashStart));
+            while (pcursor->Valid()) {
+                std::pair<char, uint256> key;
+                if (!pcursor->GetKey(key) || key.first != DB_BLOCK_INDEX || *key.second.begin() != nShard)
+                    break;
+                CDiskBlockIndex diskindex;
+                if (!pcursor->GetValue(diskindex)) {
+                    shard.fFailed = true;
+                    break;
+                }
+                shard.vEntries.emplace_back(diskindex.GetBlockHash(), diskindex);
+                pcursor->Next();
+            }
+            shard.fRead = true;
+            WaitableLock lock(cs);
+            vShards[nShard] = std::move(shard);
+            cond.notify_all();
+        }
+    };
+
+    std::vector<std::thread> threads;
+    auto stopReaders = [&]() {
+        {
+            WaitableLock lock(cs);
+            fStop = true;
+            cond.notify_all();
+        }
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+        threads.clear();
+    };
+    struct ReaderGuard {
+        const std::function<void()> stop;
+        ~ReaderGuard() { stop(); }
+    } guard{stopReaders};
+    for (int i = 0; i < nThreads; i++) {
+        threads.emplace_back(&TraceThread<decltype(read)>, "loadblkindex", read);
+    }
 
     // Load mapBlockIndex
-    while (pcursor->Valid()) {
-        boost::this_thread::interruption_point();
-        std::pair<char, uint256> key;
-        if (pcursor->GetKey(key) && key.first == DB_BLOCK_INDEX) {
-            CDiskBlockIndex diskindex;
-            if (pcursor->GetValue(diskindex)) {
-                // Construct block index object
-                CBlockIndex* pindexNew = insertBlockIndex(diskindex.GetBlockHash());
-                pindexNew->pprev          = insertBlockIndex(diskindex.hashPrev);
-                pindexNew->nHeight        = diskindex.nHeight;
-                pindexNew->nFile          = diskindex.nFile;
-                pindexNew->nDataPos       = diskindex.nDataPos;
-                pindexNew->nUndoPos       = diskindex.nUndoPos;
-                pindexNew->nVersion       = diskindex.nVersion;
-                pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
-                pindexNew->nTime          = diskindex.nTime;
-                pindexNew->nBits          = diskindex.nBits;
-                pindexNew->nNonce         = diskindex.nNonce;
-                pindexNew->nStatus        = diskindex.nStatus;
-                pindexNew->nTx            = diskindex.nTx;
-
-                // NobleGasCoin: Disable PoW Sanity check while loading block index from disk.
-                // We use the sha256 hash for the block index for performance reasons, which is recorded for later use.
-                // CheckProofOfWork() uses the scrypt hash which is discarded after a block is accepted.
-                // While it is technically feasible to verify the PoW, doing so takes several minutes as it
-                // requires recomputing every PoW hash during every NobleGasCoin startup.
-                // We opt instead to simply trust the data that is on your local disk.
-                //if (!CheckProofOfWork(pindexNew->GetBlockHash(), pindexNew->nBits, consensusParams))
-                //    return error("%s: CheckProofOfWork failed: %s", __func__, pindexNew->ToString());
-
-                pcursor->Next();
-            } else {
-                return error("%s: failed to read value", __func__);
+    for (int nShard = 0; nShard < NUM_SHARDS; nShard++) {
+        Shard shard;
+        {
+            WaitableLock lock(cs);
+            while (!vShards[nShard].fRead) {
+                cond.wait_for(lock, std::chrono::milliseconds(100));
+                lock.unlock();
+                boost::this_thread::interruption_point();
+                lock.lock();
             }
-        } else {
-            break;
+            shard = std::move(vShards[nShard]);
+            nNextInsert = nShard + 1;
+            cond.notify_all();
+        }
+        if (shard.fFailed) {
+            return error("%s: failed to read value", __func__);
+        }
+        for (const std::pair<uint256, CDiskBlockIndex>& entry : shard.vEntries) {
+            const CDiskBlockIndex& diskindex = entry.second;
+            // Construct block index object
+            CBlockIndex* pindexNew = insertBlockIndex(entry.first);
+            pindexNew->pprev          = insertBlockIndex(diskindex.hashPrev);
+            pindexNew->nHeight        = diskindex.nHeight;
+            pindexNew->nFile          = diskindex.nFile;
+            pindexNew->nDataPos       = diskindex.nDataPos;
+            pindexNew->nUndoPos       = diskindex.nUndoPos;
+            pindexNew->nVersion       = diskindex.nVersion;
+            pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
+            pindexNew->nTime          = diskindex.nTime;
+            pindexNew->nBits          = diskindex.nBits;
+            pindexNew->nNonce         = diskindex.nNonce;
+            pindexNew->nStatus        = diskindex.nStatus;
+            pindexNew->nTx            = diskindex.nTx;
+
+            // NobleGasCoin: Disable PoW Sanity check while loading block index from disk.
+            // We use the sha256 hash for the block index for performance reasons, which is recorded for later use.
+            // CheckProofOfWork() uses the scrypt hash which is discarded after a block is accepted.
+            // While it is technically feasible to verify the PoW, doing so takes several minutes as it
+            // requires recomputing every PoW hash during every NobleGasCoin startup.
+            // We opt instead to simply trust the data that is on your local disk.
+            //if (!CheckProofOfWork(pindexNew->GetBlockHash(), pindexNew->nBits, consensusParams))
+            //    return error("%s: CheckProofOfWork failed: %s", __func__, pindexNew->ToString());
         }
     }
 
@@ -10,12 +10,17 @@
 #include <dbwrapper.h>
 #include <chain.h>
 
+#include <condition_variable>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <utility>
 #include <vector>
 
+#include <boost/optional.hpp>
+
 class CBlockIndex;
 class CCoinsViewDBCursor;
 class uint256;
@@ -26,6 +31,8 @@ static constexpr int MAX_BLOCK_COINSDB_USAGE = 10;
 static const int64_t nDefaultDbCache = 450;
 //! -dbbatchsize default (bytes)
 static const int64_t nDefaultDbBatchSize = 16 << 20;
+//! -backgroundflush default
+static const bool DEFAULT_BACKGROUND_FLUSH = false;
 //! max. -dbcache (MiB)
 static const int64_t nMaxDbCache = sizeof(void*) > 4 ? 16384 : 1024;
 //! min. -dbcache (MiB)
@@ -69,6 +76,12 @@ class CCoinsViewDB final : public CCoinsView
 {
 protected:
     CDBWrapper db;
+    //! Commitment to the coins as of the best block, if known
+    CUTXOCommitment commitment;
+    bool fHaveCommitment;
+    //! Block commitments to write (or, if none, erase) with the next coins write
+    mutable std::mutex csBlockCommitments;
+    std::map<uint256, boost::optional<CUTXOCommitment>> mapBlockCommitmentsPending;
 public:
     explicit CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
 
@@ -76,14 +89,72 @@ public:
     bool HaveCoin(const COutPoint &outpoint) const override;
     uint256 GetBestBlock() const override;
     std::vector<uint256> GetHeadBlocks() const override;
-    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) override;
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, const CUTXOCommitment &commitmentDelta) override;
+    bool GetCommitment(CUTXOCommitment &commitment) const override;
     CCoinsViewCursor *Cursor() const override;
 
+    //! BatchWrite, but if !fErase leaving mapCoins intact so that it can be read from while it is written.
+    bool WriteCoins(CCoinsMap &mapCoins, const uint256 &hashBlock, const CUTXOCommitment &commitmentDelta, bool fErase);
     //! Attempt to update from an older database format. Returns whether an error occurred.
     bool Upgrade();
+    //! Compute the UTXO set commitment with a full scan if the database has none.
+    bool InitCommitment();
+    //! Record/look up the UTXO set commitment as of a given block.
+    bool WriteBlockCommitment(const uint256 &hashBlock, const CUTXOCommitment &blockCommitment);
+    bool ReadBlockCommitment(const uint256 &hashBlock, CUTXOCommitment &blockCommitment) const;
+    //! Record/forget the UTXO set commitment as of a given block in the final batch of the next coins write.
+    void QueueBlockCommitment(const uint256 &hashBlock, const CUTXOCommitment &blockCommitment);
+    void QueueEraseBlockCommitment(const uint256 &hashBlock);
     size_t EstimateSize() const override;
 };
 
+/**
+ * CCoinsView between the coins cache and the coin database. With
+ * -backgroundflush, a flush of the cache hands its coins to a thread that
+ * writes them to the database, so that the (now empty) cache can take new
+ * blocks in the meantime; until the write is done, reads of those coins are
+ * served from memory. The write marks the database with the head blocks like
+ * any other, so an interrupted one is replayed on startup. Only one write is
+ * in progress at a time: a flush waits for the previous one to finish.
+ */
+class CCoinsViewDBFlusher final : public CCoinsViewBacked
+{
+private:
+    CCoinsViewDB *db;
+
+    mutable std::mutex cs;
+    mutable std::condition_variable cond;
+    //! The coins being written, the block they bring the database to (null
+    //! while no write is in progress) and the commitment they amount to
+    std::unique_ptr<CCoinsMap> pmapWriting;
+    uint256 hashWriting;
+    CUTXOCommitment commitmentDeltaWriting;
+    //! The commitment as of hashWriting, if the database has one
+    CUTXOCommitment commitmentWriting;
+    bool fHaveCommitmentWriting;
+    //! A background write failed; the database is left as it was partially
+    //! written and every later flush fails
+    bool fWriteFailed;
+    bool fStop;
+    std::thread writer;
+
+    void ThreadWrite();
+
+public:
+    CCoinsViewDBFlusher(CCoinsViewDB *dbIn, bool fBackground);
+    ~CCoinsViewDBFlusher();
+
+    bool GetCoin(const COutPoint &outpoint, Coin &coin) const override;
+    bool HaveCoin(const COutPoint &outpoint) const override;
+    uint256 GetBestBlock() const override;
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock, const CUTXOCommitment &commitmentDelta) override;
+    bool GetCommitment(CUTXOCommitment &commitment) const override;
+    CCoinsViewCursor *Cursor() const override;
+
+    //! Wait until the coins handed over so far are on disk. Returns false if writing them failed.
+    bool Sync() const;
+};
+
 /** Specialization of CCoinsViewCursor to iterate over a CCoinsViewDB */
 class CCoinsViewDBCursor: public CCoinsViewCursor
 {
@@ -124,7 +195,8 @@ public:
     bool WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> > &vect);
     bool WriteFlag(const std::string &name, bool fValue);
     bool ReadFlag(const std::string &name, bool &fValue);
-    bool LoadBlockIndexGuts(const Consensus::Params& consensusParams, std::function<CBlockIndex*(const uint256&)> insertBlockIndex);
+    /** Read all block index entries, on nThreads threads, and insert them with insertBlockIndex on this one */
+    bool LoadBlockIndexGuts(const Consensus::Params& consensusParams, std::function<CBlockIndex*(const uint256&)> insertBlockIndex, int nThreads = 1);
 };
 
 #endif // BITCOIN_TXDB_H
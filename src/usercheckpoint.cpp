@@ -27,8 +27,20 @@ CUserCheckpoint &CUserCheckpoint::GetInstance()
 
 
 CUserCheckpoint::CUserCheckpoint(size_t nCacheSize)
- : CDBWrapper(GetDataDir() / "checkpoint", nCacheSize, false, false, false, &*globalComparator)
+ : CDBWrapper(GetDataDir() / "checkpoint", nCacheSize, false, false, false, &*globalComparator),
+   fLastCheckpointValid(false), pindexLastCheckpoint(nullptr), nLastCheckpointHeight(-1)
 {
+    int height;
+    uint256 hash;
+
+    std::unique_ptr<CDBIterator> it(NewIterator());
+    it->SeekToFirst();
+    while(it->Valid())
+    {
+        if (it->GetKey(height) && it->GetValue(hash))
+            mapCheckpoints[height] = hash;
+        it->Next();
+    }
 }
 
 bool CUserCheckpoint::WriteCheckpoint(const int nHeight, const uint256 &nHash, bool fSync)
@@ -36,61 +48,107 @@ bool CUserCheckpoint::WriteCheckpoint(const int nHeight, const uint256 &nHash, b
     CDBBatch batch(*this);
     batch.Erase(nHeight);
     batch.Write(nHeight, nHash);
-    return WriteBatch(batch, fSync);
+    if (!WriteBatch(batch, fSync))
+        return false;
+
+    LOCK(cs_checkpoints);
+    mapCheckpoints[nHeight] = nHash;
+    fLastCheckpointValid = false;
+    return true;
 }
 
 bool CUserCheckpoint::ReadCheckpoint(const int nHeight, uint256 &nHash)
 {
-    return Read(nHeight, nHash);
+    LOCK(cs_checkpoints);
+    std::map<int, uint256, std::greater<int>>::const_iterator it = mapCheckpoints.find(nHeight);
+    if (it == mapCheckpoints.end())
+        return false;
+    nHash = it->second;
+    return true;
 }
 
 bool CUserCheckpoint::DeleteCheckpoint(const int nHeight, bool fSync)
 {
-    return Erase(nHeight, fSync);
+    if (!Erase(nHeight, fSync))
+        return false;
+
+    LOCK(cs_checkpoints);
+    mapCheckpoints.erase(nHeight);
+    fLastCheckpointValid = false;
+    return true;
 }
 
 CBlockIndex* CUserCheckpoint::GetLastCheckpoint()
 {
-    uint256 hash;
+    AssertLockHeld(cs_main);
+    LOCK(cs_checkpoints);
 
-    std::unique_ptr<CDBIterator> it(NewIterator());
-    it->SeekToFirst();
-    while(it->Valid())
+    if (!fLastCheckpointValid)
     {
-       it->GetValue(hash);
+        pindexLastCheckpoint = nullptr;
+        nLastCheckpointHeight = -1;
+        for (const auto& checkpoint : mapCheckpoints)
+        {
+            BlockMap::const_iterator t = mapBlockIndex.find(checkpoint.second);
+            if (t != mapBlockIndex.end())
+            {
+                pindexLastCheckpoint = t->second;
+                nLastCheckpointHeight = checkpoint.first;
+                break;
+            }
+        }
+        fLastCheckpointValid = true;
+    }
 
-        BlockMap::const_iterator t = mapBlockIndex.find(hash);
-        if (t != mapBlockIndex.end())
-            return t->second;
+    return pindexLastCheckpoint;
+}
 
-        it->Next();
-    }
+void CUserCheckpoint::BlockIndexAdded(CBlockIndex* pindex)
+{
+    AssertLockHeld(cs_main);
+    LOCK(cs_checkpoints);
 
-    return nullptr;
+    if (!fLastCheckpointValid)
+        return;
 
+    // Only a checkpoint above the memoized one can take its place.
+    const uint256 hash = pindex->GetBlockHash();
+    for (const auto& checkpoint : mapCheckpoints)
+    {
+        if (checkpoint.first <= nLastCheckpointHeight)
+            break;
+        if (checkpoint.second == hash)
+        {
+            pindexLastCheckpoint = pindex;
+            nLastCheckpointHeight = checkpoint.first;
+            break;
+        }
+    }
+}
+
+void CUserCheckpoint::BlockIndexReset()
+{
+    LOCK(cs_checkpoints);
+    fLastCheckpointValid = false;
+    pindexLastCheckpoint = nullptr;
+    nLastCheckpointHeight = -1;
 }
 
 UniValue CUserCheckpoint::Dump(int nMax)
 {
-    int height;
-    uint256 hash;
+    LOCK(cs_checkpoints);
 
     UniValue o(UniValue::VARR);
 
-    std::unique_ptr<CDBIterator> it(NewIterator());
-    it->SeekToFirst();
-    while(it->Valid() && nMax-- > 0)
+    for (const auto& checkpoint : mapCheckpoints)
     {
-        UniValue checkpoint(UniValue::VOBJ);
-
-       it->GetKey(height);
-       it->GetValue(hash);
+        if (nMax-- <= 0)
+            break;
 
-        checkpoint.push_back(Pair("height", height));
-        checkpoint.push_back(Pair("hash",  hash.ToString()));
-        o.push_back(checkpoint);
-
-        it->Next();
+        UniValue entry(UniValue::VOBJ);
+        entry.push_back(Pair("height", checkpoint.first));
+        entry.push_back(Pair("hash", checkpoint.second.ToString()));
+        o.push_back(entry);
     }
 
     return o;
@@ -98,15 +156,6 @@ UniValue CUserCheckpoint::Dump(int nMax)
 
 int CUserCheckpoint::GetMaxCheckpointHeight()
 {
-    int height = 0;
-
-    std::unique_ptr<CDBIterator> it(NewIterator());
-    it->SeekToFirst();
-    if(it->Valid())
-    {
-        it->GetKey(height);
-    }
-
-    return height;
+    LOCK(cs_checkpoints);
+    return mapCheckpoints.empty() ? 0 : mapCheckpoints.begin()->first;
 }
-
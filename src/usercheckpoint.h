@@ -8,10 +8,13 @@
 #include "chain.h"
 #include "dbwrapper.h"
 #include "streams.h"
+#include "sync.h"
 
 #include <leveldb/comparator.h>
 
 #include <univalue.h>
+#include <functional>
+#include <map>
 #include <string>
 
 
@@ -43,11 +46,27 @@ public:
 };
 
 
+/**
+ * User checkpoints, persisted in LevelDB and mirrored in memory so that
+ * header validation never has to touch the database. The block index entry
+ * of the last known checkpoint is memoized and only re-resolved after the
+ * checkpoints or the block index change.
+ */
 class CUserCheckpoint : public CDBWrapper
 {
 private:
     CUserCheckpoint(size_t nCacheSize);
 
+    CCriticalSection cs_checkpoints;
+    //! All checkpoints, highest first (the database order)
+    std::map<int, uint256, std::greater<int>> mapCheckpoints;
+    //! Whether pindexLastCheckpoint/nLastCheckpointHeight are up to date
+    bool fLastCheckpointValid;
+    //! Memoized result of GetLastCheckpoint()
+    CBlockIndex* pindexLastCheckpoint;
+    //! Height key of the memoized checkpoint, or -1 if there is none
+    int nLastCheckpointHeight;
+
 public:
     static CUserCheckpoint &GetInstance();
 
@@ -55,9 +74,15 @@ public:
     bool ReadCheckpoint(const int nHeight, uint256 &nHash);
     bool DeleteCheckpoint(const int nHeight, bool fSync);
 
+    /** Highest checkpoint whose block is in mapBlockIndex. Requires cs_main. */
     CBlockIndex* GetLastCheckpoint();
     int GetMaxCheckpointHeight();
 
+    /** Called for every entry added to mapBlockIndex. Requires cs_main. */
+    void BlockIndexAdded(CBlockIndex* pindex);
+    /** Forget the memoized checkpoint after mapBlockIndex was rebuilt. */
+    void BlockIndexReset();
+
     UniValue Dump(int nMax);
 };
 
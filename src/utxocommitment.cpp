@@ -0,0 +1,155 @@
+// Copyright (c) 2018 The Monacoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <utxocommitment.h>
+
+#include <coins.h>
+#include <crypto/common.h>
+#include <crypto/sha256.h>
+#include <hash.h>
+#include <version.h>
+
+#include <secp256k1.h>
+
+#include <ios>
+#include <string.h>
+
+//! Number of points buffered before they are summed
+static const size_t MAX_PENDING_POINTS = 256;
+
+static const secp256k1_context* GetCommitmentContext()
+{
+    static const secp256k1_context* ctx = secp256k1_context_create(SECP256K1_CONTEXT_NONE);
+    return ctx;
+}
+
+static_assert(sizeof(secp256k1_pubkey) == 64, "secp256k1_pubkey has an unexpected size");
+
+static const secp256k1_pubkey* AsPubKey(const std::array<unsigned char, 64>& point)
+{
+    return reinterpret_cast<const secp256k1_pubkey*>(point.data());
+}
+
+static secp256k1_pubkey* AsPubKey(std::array<unsigned char, 64>& point)
+{
+    return reinterpret_cast<secp256k1_pubkey*>(point.data());
+}
+
+/**
+ * Map a coin to a curve point: the point with even y and the first
+ * x = SHA256(H(outpoint, coin) || counter) that lies on the curve.
+ */
+static std::array<unsigned char, 64> CoinPoint(const COutPoint& outpoint, const Coin& coin)
+{
+    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+    ss << outpoint << coin;
+    const uint256 hash = ss.GetHash();
+
+    std::array<unsigned char, 64> point;
+    unsigned char vch[33];
+    unsigned char counter[4];
+    vch[0] = 0x02;
+    for (uint32_t i = 0; ; i++) {
+        WriteLE32(counter, i);
+        CSHA256().Write(hash.begin(), 32).Write(counter, 4).Finalize(vch + 1);
+        if (secp256k1_ec_pubkey_parse(GetCommitmentContext(), AsPubKey(point), vch, sizeof(vch))) {
+            return point;
+        }
+    }
+}
+
+static int64_t BogoSize(const Coin& coin)
+{
+    return 32 /* txid */ + 4 /* vout index */ + 4 /* height + coinbase */ + 8 /* amount */ +
+           2 /* scriptPubKey len */ + coin.out.scriptPubKey.size() /* scriptPubKey */;
+}
+
+void CUTXOCommitment::AddPoint(const Point& point)
+{
+    vPending.push_back(point);
+    if (vPending.size() >= MAX_PENDING_POINTS) {
+        Collapse();
+    }
+}
+
+void CUTXOCommitment::Add(const COutPoint& outpoint, const Coin& coin)
+{
+    AddPoint(CoinPoint(outpoint, coin));
+    nTransactionOutputs++;
+    nBogoSize += BogoSize(coin);
+    nTotalAmount += coin.out.nValue;
+}
+
+void CUTXOCommitment::Remove(const COutPoint& outpoint, const Coin& coin)
+{
+    Point point = CoinPoint(outpoint, coin);
+    int ret = secp256k1_ec_pubkey_negate(GetCommitmentContext(), AsPubKey(point));
+    assert(ret);
+    AddPoint(point);
+    nTransactionOutputs--;
+    nBogoSize -= BogoSize(coin);
+    nTotalAmount -= coin.out.nValue;
+}
+
+void CUTXOCommitment::Combine(const CUTXOCommitment& other)
+{
+    other.Collapse();
+    if (!other.fEmpty) {
+        AddPoint(other.sum);
+    }
+    nTransactionOutputs += other.nTransactionOutputs;
+    nBogoSize += other.nBogoSize;
+    nTotalAmount += other.nTotalAmount;
+}
+
+void CUTXOCommitment::Collapse() const
+{
+    if (vPending.empty()) {
+        return;
+    }
+    std::vector<const secp256k1_pubkey*> points;
+    points.reserve(vPending.size() + 1);
+    if (!fEmpty) {
+        points.push_back(AsPubKey(sum));
+    }
+    for (const Point& point : vPending) {
+        points.push_back(AsPubKey(point));
+    }
+    Point result;
+    // Fails only if the points add up to infinity, i.e. the set is empty.
+    fEmpty = !secp256k1_ec_pubkey_combine(GetCommitmentContext(), AsPubKey(result), points.data(), points.size());
+    if (!fEmpty) {
+        sum = result;
+    }
+    vPending.clear();
+}
+
+std::vector<unsigned char> CUTXOCommitment::GetCompressedSum() const
+{
+    Collapse();
+    if (fEmpty) {
+        return std::vector<unsigned char>();
+    }
+    std::vector<unsigned char> vch(33);
+    size_t len = vch.size();
+    int ret = secp256k1_ec_pubkey_serialize(GetCommitmentContext(), vch.data(), &len, AsPubKey(sum), SECP256K1_EC_COMPRESSED);
+    assert(ret && len == vch.size());
+    return vch;
+}
+
+void CUTXOCommitment::SetCompressedSum(const std::vector<unsigned char>& vch)
+{
+    vPending.clear();
+    fEmpty = vch.empty();
+    if (!fEmpty && !secp256k1_ec_pubkey_parse(GetCommitmentContext(), AsPubKey(sum), vch.data(), vch.size())) {
+        throw std::ios_base::failure("Invalid UTXO set commitment");
+    }
+}
+
+uint256 CUTXOCommitment::GetHash() const
+{
+    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+    ss << GetCompressedSum();
+    return ss.GetHash();
+}
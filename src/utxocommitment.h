@@ -0,0 +1,74 @@
+// Copyright (c) 2018 The Monacoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_UTXOCOMMITMENT_H
+#define BITCOIN_UTXOCOMMITMENT_H
+
+#include <amount.h>
+#include <serialize.h>
+#include <uint256.h>
+
+#include <array>
+#include <stdint.h>
+#include <vector>
+
+class COutPoint;
+class Coin;
+
+/**
+ * Order-independent commitment to a set of unspent transaction outputs: an
+ * elliptic curve multiset hash. Every coin is mapped to a point on the
+ * secp256k1 curve and the set to the sum of the points of its coins, so coins
+ * can be added and removed in any order and two commitments can be combined.
+ * The number of outputs, their bogosize and their total amount are tracked
+ * alongside; for a commitment to a change of the set these can be negative.
+ */
+class CUTXOCommitment
+{
+public:
+    int64_t nTransactionOutputs;
+    int64_t nBogoSize;
+    CAmount nTotalAmount;
+
+    CUTXOCommitment() : nTransactionOutputs(0), nBogoSize(0), nTotalAmount(0), fEmpty(true) {}
+
+    void Add(const COutPoint& outpoint, const Coin& coin);
+    void Remove(const COutPoint& outpoint, const Coin& coin);
+    /** Add all coins of another commitment (and remove the ones it removes). */
+    void Combine(const CUTXOCommitment& other);
+
+    /** Hash of the sum of the points, identifying the set. */
+    uint256 GetHash() const;
+
+    template <typename Stream>
+    void Serialize(Stream& s) const
+    {
+        s << GetCompressedSum() << nTransactionOutputs << nBogoSize << nTotalAmount;
+    }
+
+    template <typename Stream>
+    void Unserialize(Stream& s)
+    {
+        std::vector<unsigned char> vchSum;
+        s >> vchSum >> nTransactionOutputs >> nBogoSize >> nTotalAmount;
+        SetCompressedSum(vchSum);
+    }
+
+private:
+    //! A secp256k1_pubkey in the library's internal representation
+    typedef std::array<unsigned char, 64> Point;
+
+    //! Sum of the points folded in so far, unless fEmpty (the point at infinity)
+    mutable Point sum;
+    mutable bool fEmpty;
+    //! Points added since the last Collapse(), summed in one go to share the field inversion
+    mutable std::vector<Point> vPending;
+
+    void AddPoint(const Point& point);
+    void Collapse() const;
+    std::vector<unsigned char> GetCompressedSum() const;
+    void SetCompressedSum(const std::vector<unsigned char>& vch);
+};
+
+#endif // BITCOIN_UTXOCOMMITMENT_H
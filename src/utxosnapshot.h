@@ -0,0 +1,69 @@
+// Copyright (c) 2018 The Monacoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_UTXOSNAPSHOT_H
+#define BITCOIN_UTXOSNAPSHOT_H
+
+#include <protocol.h> // For CMessageHeader::MessageStartChars
+#include <serialize.h>
+#include <uint256.h>
+
+#include <stdint.h>
+#include <string.h>
+
+static const unsigned char UTXO_SNAPSHOT_MAGIC[4] = {'u', 't', 'x', 'o'};
+
+/**
+ * Header of a UTXO snapshot file, as written by dumptxoutset and read by
+ * -loadutxosnapshot. It is followed by the header of every block from height 1
+ * up to the base block, each with its VARINT transaction count, then by nCoins
+ * (COutPoint, Coin) pairs in database order, and finally by the double SHA256
+ * of everything before it.
+ */
+class CUTXOSnapshotHeader
+{
+public:
+    static const uint16_t CURRENT_VERSION = 1;
+
+    unsigned char pchMagic[4];
+    uint16_t nVersion;
+    CMessageHeader::MessageStartChars pchMessageStart;
+    //! Block the coins are the unspent outputs as of
+    uint256 hashBlock;
+    int32_t nHeight;
+    uint64_t nCoins;
+    //! CUTXOCommitment::GetHash() of the coins
+    uint256 hashCommitment;
+
+    CUTXOSnapshotHeader()
+    {
+        memcpy(pchMagic, UTXO_SNAPSHOT_MAGIC, sizeof(pchMagic));
+        nVersion = CURRENT_VERSION;
+        memset(pchMessageStart, 0, sizeof(pchMessageStart));
+        nHeight = 0;
+        nCoins = 0;
+    }
+
+    bool IsValid(const CMessageHeader::MessageStartChars& messageStart) const
+    {
+        return memcmp(pchMagic, UTXO_SNAPSHOT_MAGIC, sizeof(pchMagic)) == 0 && nVersion == CURRENT_VERSION &&
+               memcmp(pchMessageStart, messageStart, sizeof(pchMessageStart)) == 0 && nHeight > 0;
+    }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action)
+    {
+        READWRITE(FLATDATA(pchMagic));
+        READWRITE(nVersion);
+        READWRITE(FLATDATA(pchMessageStart));
+        READWRITE(hashBlock);
+        READWRITE(nHeight);
+        READWRITE(nCoins);
+        READWRITE(hashCommitment);
+    }
+};
+
+#endif // BITCOIN_UTXOSNAPSHOT_H
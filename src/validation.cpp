@@ -15,6 +15,8 @@
 #include <consensus/merkle.h>
 #include <consensus/tx_verify.h>
 #include <consensus/validation.h>
+#include <core_memusage.h>
+#include <crypto/Lyra2RE/Lyra2RE.h>
 #include <cuckoocache.h>
 #include <hash.h>
 #include <init.h>
@@ -37,14 +39,18 @@
 #include <undo.h>
 #include <usercheckpoint.h>
 #include <util.h>
+#include <utxosnapshot.h>
 #include <utilmoneystr.h>
 #include <utilstrencodings.h>
 #include <validationinterface.h>
 #include <volatilecheckpoint.h>
 #include <warnings.h>
 
+#include <chrono>
+#include <functional>
 #include <future>
 #include <sstream>
+#include <thread>
 
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/algorithm/string/join.hpp>
@@ -156,6 +162,8 @@ private:
 public:
     CChain chainActive;
     BlockMap mapBlockIndex;
+    //! Owns the entries of mapBlockIndex
+    CBlockIndexArena blockIndexArena;
     std::multimap<CBlockIndex*, CBlockIndex*> mapBlocksUnlinked;
     CBlockIndex *pindexBestInvalid = nullptr;
 
@@ -163,7 +171,7 @@ public:
 
     bool ActivateBestChain(CValidationState &state, const CChainParams& chainparams, std::shared_ptr<const CBlock> pblock);
 
-    bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex);
+    bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex, bool fCheckPOW = true);
     bool AcceptBlock(const std::shared_ptr<const CBlock>& pblock, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex, bool fRequested, const CDiskBlockPos* dbp, bool* fNewBlock);
 
     // Block (dis)connection on a given view:
@@ -181,7 +189,9 @@ public:
 
     bool ReplayBlocks(const CChainParams& params, CCoinsView* view);
     bool RewindBlockIndex(const CChainParams& params);
-    bool LoadGenesisBlock(const CChainParams& chainparams);
+    /** Add the genesis block to the block tree, where it is stored at dbp if not null */
+    bool LoadGenesisBlock(const CChainParams& chainparams, const CDiskBlockPos* dbp = nullptr);
+    bool LoadUTXOSnapshot(const CChainParams& chainparams, const fs::path& path, CCoinsViewDB* view);
 
     void PruneBlockIndexCandidates();
 
@@ -224,6 +234,7 @@ bool fIsBareMultisigStd = DEFAULT_PERMIT_BAREMULTISIG;
 bool fRequireStandard = true;
 bool fCheckBlockIndex = false;
 bool fCheckpointsEnabled = DEFAULT_CHECKPOINTS_ENABLED;
+bool fCheckBlockPoW = DEFAULT_CHECK_BLOCK_POW;
 size_t nCoinCacheUsage = 5000 * 300;
 uint64_t nPruneTarget = 0;
 bool fAlerts = DEFAULT_ALERTS;
@@ -288,6 +299,7 @@ CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& loc
 }
 
 std::unique_ptr<CCoinsViewDB> pcoinsdbview;
+std::unique_ptr<CCoinsViewDBFlusher> pcoinsflusher;
 std::unique_ptr<CCoinsViewCache> pcoinsTip;
 std::unique_ptr<CBlockTreeDB> pblocktree;
 
@@ -1106,7 +1118,7 @@ static bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMes
     return true;
 }
 
-bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, int nHeight, const Consensus::Params& consensusParams)
+static bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, int nHeight, const Consensus::Params& consensusParams, bool fCheckPOW)
 {
     block.SetNull();
 
@@ -1124,21 +1136,31 @@ bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, int nHeight, con
     }
 
     // Check the header
-    if (!CheckProofOfWork(block.GetPoWHash(nHeight >= Params().SwitchLyra2REv2_DGWblock()), block.nBits, nHeight, consensusParams))
+    if (fCheckPOW && !CheckProofOfWork(block.GetPoWHash(nHeight >= Params().SwitchLyra2REv2_DGWblock()), block.nBits, nHeight, consensusParams))
         return error("ReadBlockFromDisk: Errors in block header at %s", pos.ToString());
 
     return true;
 }
 
+bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, int nHeight, const Consensus::Params& consensusParams)
+{
+    return ReadBlockFromDisk(block, pos, nHeight, consensusParams, true);
+}
+
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams)
 {
     CDiskBlockPos blockPos;
+    bool fCheckPOW;
     {
         LOCK(cs_main);
         blockPos = pindex->GetBlockPos();
+        // An index entry only exists for headers that already passed CheckProofOfWork()
+        // (BLOCK_VALID_HEADER), and the sha256d block hash comparison below ties the data
+        // on disk to that header. Re-hashing the Lyra2REv2 PoW is then only done on request.
+        fCheckPOW = fCheckBlockPoW || (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_HEADER;
     }
 
-    if (!ReadBlockFromDisk(block, blockPos, pindex->nHeight, consensusParams))
+    if (!ReadBlockFromDisk(block, blockPos, pindex->nHeight, consensusParams, fCheckPOW))
         return false;
     if (block.GetHash() != pindex->GetBlockHash())
         return error("ReadBlockFromDisk(CBlock&, CBlockIndex*): GetHash() doesn't match index for %s at %s",
@@ -1146,6 +1168,53 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus
     return true;
 }
 
+bool ReadRawBlockFromDisk(std::vector<uint8_t>& block, const CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart)
+{
+    CDiskBlockPos hpos = pos;
+    hpos.nPos -= 8; // Seek back 8 bytes for the message start and size written before the block
+
+    // Open history file to read
+    CAutoFile filein(OpenBlockFile(hpos, true), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull())
+        return error("ReadRawBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
+
+    try {
+        CMessageHeader::MessageStartChars blkStart;
+        unsigned int nSize;
+        filein >> FLATDATA(blkStart) >> nSize;
+        if (memcmp(blkStart, messageStart, CMessageHeader::MESSAGE_START_SIZE))
+            return error("%s: Block magic mismatch for %s", __func__, pos.ToString());
+        if (nSize > MAX_BLOCK_SERIALIZED_SIZE)
+            return error("%s: Block data is larger than the maximum block size for %s", __func__, pos.ToString());
+        // Reuses the capacity of a buffer passed in again
+        block.resize(nSize);
+        filein.read((char*)block.data(), nSize);
+    }
+    catch (const std::exception& e) {
+        return error("%s: Read from block file failed: %s for %s", __func__, e.what(), pos.ToString());
+    }
+
+    return true;
+}
+
+bool ReadRawBlockFromDisk(std::vector<uint8_t>& block, const CBlockIndex* pindex, const CMessageHeader::MessageStartChars& messageStart)
+{
+    CDiskBlockPos blockPos;
+    {
+        LOCK(cs_main);
+        blockPos = pindex->GetBlockPos();
+    }
+
+    if (!ReadRawBlockFromDisk(block, blockPos, messageStart))
+        return false;
+    // Check that the data belongs to the index entry, as ReadBlockFromDisk()
+    // does, but by hashing only the 80 byte header in front of it
+    if (block.size() < 80 || Hash(block.begin(), block.begin() + 80) != pindex->GetBlockHash())
+        return error("ReadRawBlockFromDisk(CBlockIndex*): header hash doesn't match index for %s at %s",
+                pindex->ToString(), blockPos.ToString());
+    return true;
+}
+
 CAmount GetBlockSubsidy(int nHeight, const Consensus::Params& consensusParams)
 {
     int halvings = nHeight / consensusParams.nSubsidyHalvingInterval;
@@ -1677,6 +1746,83 @@ void ThreadScriptCheck() {
     scriptcheckqueue.Thread();
 }
 
+/** Headers whose proof of work one check covers, hashed together by lyra2re2_hash_batch() */
+static const size_t HEADERS_PER_POW_CHECK = 4;
+
+/**
+ * Closure representing the proof-of-work check of a few consecutive headers.
+ * Note that this stores a reference to the headers.
+ */
+class CHeaderPoWCheck
+{
+private:
+    const CBlockHeader *pheaders;
+    size_t nCount;
+    int nHeight;
+    const Consensus::Params *pconsensusParams;
+
+public:
+    CHeaderPoWCheck(): pheaders(nullptr), nCount(0), nHeight(0), pconsensusParams(nullptr) {}
+    CHeaderPoWCheck(const CBlockHeader* pheadersIn, size_t nCountIn, int nHeightIn, const Consensus::Params& consensusParamsIn) :
+        pheaders(pheadersIn), nCount(nCountIn), nHeight(nHeightIn), pconsensusParams(&consensusParamsIn) { }
+
+    bool operator()() {
+        assert(nCount <= HEADERS_PER_POW_CHECK);
+        uint256 hashes[HEADERS_PER_POW_CHECK];
+        if (nHeight >= Params().SwitchLyra2REv2_DGWblock()) {
+            // Hash the headers in the vector lanes of the Lyra2REv2 batch
+            char input[80 * HEADERS_PER_POW_CHECK];
+            unsigned char output[32 * HEADERS_PER_POW_CHECK];
+            for (size_t i = 0; i < nCount; i++)
+                memcpy(input + 80 * i, BEGIN(pheaders[i].nVersion), 80);
+            lyra2re2_hash_batch(input, (char*)output, nCount);
+            for (size_t i = 0; i < nCount; i++)
+                memcpy(hashes[i].begin(), output + 32 * i, 32);
+        } else {
+            for (size_t i = 0; i < nCount; i++)
+                hashes[i] = pheaders[i].GetPoWHash(nHeight + (int)i >= Params().SwitchLyra2REv2_DGWblock());
+        }
+        for (size_t i = 0; i < nCount; i++) {
+            if (!CheckProofOfWork(hashes[i], pheaders[i].nBits, nHeight + (int)i, *pconsensusParams))
+                return false;
+        }
+        return true;
+    }
+
+    void swap(CHeaderPoWCheck &check) {
+        std::swap(pheaders, check.pheaders);
+        std::swap(nCount, check.nCount);
+        std::swap(nHeight, check.nHeight);
+        std::swap(pconsensusParams, check.pconsensusParams);
+    }
+};
+
+static CCheckQueue<CHeaderPoWCheck> headerpowcheckqueue(16);
+
+void ThreadHeaderPoWCheck() {
+    RenameThread("noblegascoin-powch");
+    headerpowcheckqueue.Thread();
+}
+
+bool CheckBlockHeadersPoW(const std::vector<CBlockHeader>& headers, size_t nStart, int nStartHeight, const Consensus::Params& consensusParams)
+{
+    CCheckQueueControl<CHeaderPoWCheck> control(nScriptCheckThreads ? &headerpowcheckqueue : nullptr);
+    std::vector<CHeaderPoWCheck> vChecks;
+    vChecks.reserve((headers.size() - std::min(nStart, headers.size()) + HEADERS_PER_POW_CHECK - 1) / HEADERS_PER_POW_CHECK);
+    for (size_t i = nStart; i < headers.size(); i += HEADERS_PER_POW_CHECK) {
+        CHeaderPoWCheck check(&headers[i], std::min(HEADERS_PER_POW_CHECK, headers.size() - i), nStartHeight + (int)(i - nStart), consensusParams);
+        if (!nScriptCheckThreads) {
+            if (!check())
+                return false;
+            continue;
+        }
+        vChecks.push_back(CHeaderPoWCheck());
+        check.swap(vChecks.back());
+    }
+    control.Add(vChecks);
+    return control.Wait();
+}
+
 // Protected by cs_main
 VersionBitsCache versionbitscache;
 
@@ -2084,9 +2230,13 @@ bool static FlushStateToDisk(const CChainParams& chainparams, CValidationState &
                     return AbortNode(state, "Failed to write to block index database");
                 }
             }
-            // Finally remove any pruned files
-            if (fFlushForPrune)
+            // Finally remove any pruned files, once no coins are still being
+            // written that a replay would need them for
+            if (fFlushForPrune) {
+                if (pcoinsflusher && !pcoinsflusher->Sync())
+                    return AbortNode(state, "Failed to write to coin database");
                 UnlinkPrunedFiles(setFilesToPrune);
+            }
             nLastWrite = nNow;
         }
         // Flush best chain related state. This can only be done if the blocks / block index write was also done.
@@ -2101,6 +2251,9 @@ bool static FlushStateToDisk(const CChainParams& chainparams, CValidationState &
             // Flush the chainstate (which may refer to block index entries).
             if (!pcoinsTip->Flush())
                 return AbortNode(state, "Failed to write to coin database");
+            // With -backgroundflush the coins may still be being written.
+            if (mode == FLUSH_STATE_ALWAYS && pcoinsflusher && !pcoinsflusher->Sync())
+                return AbortNode(state, "Failed to write to coin database");
             nLastFlush = nNow;
         }
     }
@@ -2218,13 +2371,14 @@ bool CChainState::DisconnectTip(CValidationState& state, const CChainParams& cha
     // Apply the block atomically to the chain state.
     int64_t nStart = GetTimeMicros();
     {
-        CCoinsViewCache view(pcoinsTip.get());
+        CCoinsViewCache view(pcoinsTip.get(), true);
         assert(view.GetBestBlock() == pindexDelete->GetBlockHash());
         if (DisconnectBlock(block, pindexDelete, view) != DISCONNECT_OK)
             return error("DisconnectTip(): DisconnectBlock %s failed", pindexDelete->GetBlockHash().ToString());
         bool flushed = view.Flush();
         assert(flushed);
     }
+    pcoinsdbview->QueueEraseBlockCommitment(pindexDelete->GetBlockHash());
     LogPrint(BCLog::BENCH, "- Disconnect block: %.2fms\n", (GetTimeMicros() - nStart) * MILLI);
     // Write the chain state to disk, if necessary.
     if (!FlushStateToDisk(chainparams, state, FLUSH_STATE_IF_NEEDED))
@@ -2349,7 +2503,7 @@ bool CChainState::ConnectTip(CValidationState& state, const CChainParams& chainp
     int64_t nTime3;
     LogPrint(BCLog::BENCH, "  - Load block from disk: %.2fms [%.2fs]\n", (nTime2 - nTime1) * MILLI, nTimeReadFromDisk * MICRO);
     {
-        CCoinsViewCache view(pcoinsTip.get());
+        CCoinsViewCache view(pcoinsTip.get(), true);
         bool rv = ConnectBlock(blockConnecting, state, pindexNew, view, chainparams);
         GetMainSignals().BlockChecked(blockConnecting, state);
         if (!rv) {
@@ -2362,6 +2516,15 @@ bool CChainState::ConnectTip(CValidationState& state, const CChainParams& chainp
         bool flushed = view.Flush();
         assert(flushed);
     }
+    // Keep the UTXO set commitment of recent blocks for gettxoutsetinfo,
+    // written along with the coins
+    CUTXOCommitment commitment;
+    if (pcoinsTip->GetCommitment(commitment))
+        pcoinsdbview->QueueBlockCommitment(pindexNew->GetBlockHash(), commitment);
+    const int nHeightExpired = pindexNew->nHeight - UTXO_COMMITMENT_BLOCKS_TO_KEEP;
+    if (nHeightExpired >= 0 && !chainparams.Checkpoints().mapCheckpoints.count(nHeightExpired) &&
+        !chainparams.UTXOSnapshots().count(nHeightExpired))
+        pcoinsdbview->QueueEraseBlockCommitment(pindexNew->GetAncestor(nHeightExpired)->GetBlockHash());
     int64_t nTime4 = GetTimeMicros(); nTimeFlush += nTime4 - nTime3;
     LogPrint(BCLog::BENCH, "  - Flush: %.2fms [%.2fs (%.2fms/blk)]\n", (nTime4 - nTime3) * MILLI, nTimeFlush * MICRO, nTimeFlush * MILLI / nBlocksTotal);
     // Write the chain state to disk, if necessary.
@@ -2809,7 +2972,8 @@ CBlockIndex* CChainState::AddToBlockIndex(const CBlockHeader& block)
         return it->second;
 
     // Construct new block index object
-    CBlockIndex* pindexNew = new CBlockIndex(block);
+    CBlockIndex* pindexNew = blockIndexArena.Allocate();
+    *pindexNew = CBlockIndex(block);
     // We assign the sequence id to blocks only when the full data is available,
     // to avoid miners withholding blocks but broadcasting headers, to get a
     // competitive advantage.
@@ -2830,6 +2994,7 @@ CBlockIndex* CChainState::AddToBlockIndex(const CBlockHeader& block)
         pindexBestHeader = pindexNew;
 
     setDirtyBlockIndex.insert(pindexNew);
+    CUserCheckpoint::GetInstance().BlockIndexAdded(pindexNew);
 
     return pindexNew;
 }
@@ -2973,6 +3138,9 @@ static bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos,
 
 static bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW = true)
 {
+    if (!fCheckPOW)
+        return true;
+
     // Get prev block index
     CBlockIndex* pindexPrev = NULL;
     int nHeight = 0;
@@ -2983,7 +3151,7 @@ static bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state,
     }
 
     // Check proof of work matches claimed amount
-    if (fCheckPOW && !CheckProofOfWork(block.GetPoWHash(nHeight >= Params().SwitchLyra2REv2_DGWblock()), block.nBits, nHeight, consensusParams))
+    if (!CheckProofOfWork(block.GetPoWHash(nHeight >= Params().SwitchLyra2REv2_DGWblock()), block.nBits, nHeight, consensusParams))
         return state.DoS(50, false, REJECT_INVALID, "high-hash", false, "proof of work failed");
 
     return true;
@@ -3267,7 +3435,7 @@ static bool ContextualCheckBlock(const CBlock& block, CValidationState& state, c
     return true;
 }
 
-bool CChainState::AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex)
+bool CChainState::AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex, bool fCheckPOW)
 {
     AssertLockHeld(cs_main);
     // Check for duplicate
@@ -3286,7 +3454,7 @@ bool CChainState::AcceptBlockHeader(const CBlockHeader& block, CValidationState&
             return true;
         }
 
-        if (!CheckBlockHeader(block, state, chainparams.GetConsensus()))
+        if (!CheckBlockHeader(block, state, chainparams.GetConsensus(), fCheckPOW))
             return error("%s: Consensus::CheckBlockHeader: %s, %s", __func__, hash.ToString(), FormatStateMessage(state));
 
         // Get prev block index
@@ -3327,14 +3495,14 @@ bool CChainState::AcceptBlockHeader(const CBlockHeader& block, CValidationState&
 }
 
 // Exposed wrapper for AcceptBlockHeader
-bool ProcessNewBlockHeaders(const std::vector<CBlockHeader>& headers, CValidationState& state, const CChainParams& chainparams, const CBlockIndex** ppindex, CBlockHeader *first_invalid)
+bool ProcessNewBlockHeaders(const std::vector<CBlockHeader>& headers, CValidationState& state, const CChainParams& chainparams, const CBlockIndex** ppindex, CBlockHeader *first_invalid, bool fCheckPOW)
 {
     if (first_invalid != nullptr) first_invalid->SetNull();
     {
         LOCK(cs_main);
         for (const CBlockHeader& header : headers) {
             CBlockIndex *pindex = nullptr; // Use a temp pindex instead of ppindex to avoid a const_cast
-            if (!g_chainstate.AcceptBlockHeader(header, state, chainparams, &pindex)) {
+            if (!g_chainstate.AcceptBlockHeader(header, state, chainparams, &pindex, fCheckPOW)) {
                 if (first_invalid) *first_invalid = header;
                 return false;
             }
@@ -3377,7 +3545,7 @@ bool CChainState::AcceptBlock(const std::shared_ptr<const CBlock>& pblock, CVali
     CBlockIndex *pindexDummy = nullptr;
     CBlockIndex *&pindex = ppindex ? *ppindex : pindexDummy;
 
-    if (!AcceptBlockHeader(block, state, chainparams, &pindex))
+    if (!AcceptBlockHeader(block, state, chainparams, &pindex, !block.fCheckedPoW))
         return false;
 
     // Try to process all requested blocks that we don't have, but only
@@ -3716,17 +3884,35 @@ CBlockIndex * CChainState::InsertBlockIndex(const uint256& hash)
         return (*mi).second;
 
     // Create new
-    CBlockIndex* pindexNew = new CBlockIndex();
+    CBlockIndex* pindexNew = blockIndexArena.Allocate();
     mi = mapBlockIndex.insert(std::make_pair(hash, pindexNew)).first;
     pindexNew->phashBlock = &((*mi).first);
 
     return pindexNew;
 }
 
+/** Call func(nBegin, nEnd) on nThreads threads (this one included), for consecutive ranges covering [0, nItems) */
+static void ForEachRangeInParallel(size_t nItems, int nThreads, const std::function<void(size_t, size_t)>& func)
+{
+    const size_t nPerThread = (nItems + nThreads - 1) / std::max(nThreads, 1);
+    std::vector<std::thread> threads;
+    for (size_t nBegin = nPerThread; nBegin < nItems; nBegin += nPerThread) {
+        threads.emplace_back(func, nBegin, std::min(nItems, nBegin + nPerThread));
+    }
+    func(0, std::min(nItems, nPerThread));
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+}
+
 bool CChainState::LoadBlockIndex(const Consensus::Params& consensus_params, CBlockTreeDB& blocktree)
 {
-    if (!blocktree.LoadBlockIndexGuts(consensus_params, [this](const uint256& hash){ return this->InsertBlockIndex(hash); }))
+    const int nThreads = std::max(1, std::min(GetNumCores(), MAX_BLOCK_INDEX_LOAD_THREADS));
+    int64_t nTimeStart = GetTimeMicros();
+    if (!blocktree.LoadBlockIndexGuts(consensus_params, [this](const uint256& hash){ return this->InsertBlockIndex(hash); }, nThreads))
         return false;
+    LogPrintf("%s: read %u block index entries in %.2fms, using %.1fMiB\n", __func__, mapBlockIndex.size(), MILLI * (GetTimeMicros() - nTimeStart),
+        (memusage::DynamicUsage(mapBlockIndex) + blockIndexArena.DynamicMemoryUsage()) / (1024.0 * 1024.0));
 
     boost::this_thread::interruption_point();
 
@@ -3739,10 +3925,22 @@ bool CChainState::LoadBlockIndex(const Consensus::Params& consensus_params, CBlo
         vSortedByHeight.push_back(std::make_pair(pindex->nHeight, pindex));
     }
     sort(vSortedByHeight.begin(), vSortedByHeight.end());
+    // The proof of each block does not depend on any other, so compute them
+    // all in parallel first and only add them up along the chains below.
+    ForEachRangeInParallel(vSortedByHeight.size(), nThreads, [&vSortedByHeight](size_t nBegin, size_t nEnd) {
+        for (size_t i = nBegin; i < nEnd; i++) {
+            vSortedByHeight[i].second->nChainWork = GetBlockProof(*vSortedByHeight[i].second);
+        }
+    });
     for (const std::pair<int, CBlockIndex*>& item : vSortedByHeight)
     {
         CBlockIndex* pindex = item.second;
-        pindex->nChainWork = (pindex->pprev ? pindex->pprev->nChainWork : 0) + GetBlockProof(*pindex);
+        // Only the genesis block has no predecessor; anything else means
+        // the index is corrupt, and chains would not start at height 0.
+        if (!pindex->pprev && pindex->nHeight != 0)
+            return error("%s: block %s at height %d has no predecessor", __func__, pindex->GetBlockHash().ToString(), pindex->nHeight);
+        if (pindex->pprev)
+            pindex->nChainWork += pindex->pprev->nChainWork;
         pindex->nTimeMax = (pindex->pprev ? std::max(pindex->pprev->nTimeMax, pindex->nTime) : pindex->nTime);
         // We can link the chain of blocks for which we've received transactions at some point.
         // Pruned nodes may have deleted the block.
@@ -3766,12 +3964,42 @@ bool CChainState::LoadBlockIndex(const Consensus::Params& consensus_params, CBlo
             setBlockIndexCandidates.insert(pindex);
         if (pindex->nStatus & BLOCK_FAILED_MASK && (!pindexBestInvalid || pindex->nChainWork > pindexBestInvalid->nChainWork))
             pindexBestInvalid = pindex;
-        if (pindex->pprev)
-            pindex->BuildSkip();
         if (pindex->IsValid(BLOCK_VALID_TREE) && (pindexBestHeader == nullptr || CBlockIndexWorkComparator()(pindexBestHeader, pindex)))
             pindexBestHeader = pindex;
     }
 
+    // Build the skip pointers. Along the longest chain in the index the
+    // ancestors of a block can be looked up by height, so those entries are
+    // done in parallel. The few entries off that chain are done afterwards
+    // in height order, by walking back from their predecessors.
+    CChain chainLongest;
+    if (!vSortedByHeight.empty()) {
+        CBlockIndex* pindexLongest = vSortedByHeight.back().second;
+        bool fHeightsConsistent = true;
+        for (const CBlockIndex* pindex = pindexLongest; pindex && pindex->pprev; pindex = pindex->pprev) {
+            if (pindex->pprev->nHeight != pindex->nHeight - 1) {
+                fHeightsConsistent = false;
+                break;
+            }
+        }
+        if (fHeightsConsistent)
+            chainLongest.SetTip(pindexLongest);
+    }
+    ForEachRangeInParallel(chainLongest.Height() + 1, nThreads, [&chainLongest](size_t nBegin, size_t nEnd) {
+        for (size_t nHeight = nBegin; nHeight < nEnd; nHeight++) {
+            chainLongest[nHeight]->BuildSkip(chainLongest);
+        }
+    });
+    for (const std::pair<int, CBlockIndex*>& item : vSortedByHeight)
+    {
+        CBlockIndex* pindex = item.second;
+        if (pindex->pprev && !chainLongest.Contains(pindex))
+            pindex->BuildSkip();
+    }
+    LogPrintf("%s: loaded %u block index entries in %.2fms\n", __func__, mapBlockIndex.size(), MILLI * (GetTimeMicros() - nTimeStart));
+
+    CUserCheckpoint::GetInstance().BlockIndexReset();
+
     return true;
 }
 
@@ -3877,17 +4105,112 @@ bool CVerifyDB::VerifyDB(const CChainParams& chainparams, CCoinsView *coinsview,
     if (chainActive.Tip() == nullptr || chainActive.Tip()->pprev == nullptr)
         return true;
 
+    const Consensus::Params& consensusParams = chainparams.GetConsensus();
+    int nThreads = gArgs.GetArg("-checkthreads", DEFAULT_CHECK_THREADS);
+    if (nThreads <= 0)
+        nThreads = GetNumCores();
+    nThreads = std::max(1, std::min(nThreads, MAX_CHECK_THREADS));
+
     // Verify blocks in the best chain
     if (nCheckDepth <= 0 || nCheckDepth > chainActive.Height())
         nCheckDepth = chainActive.Height();
     nCheckLevel = std::max(0, std::min(4, nCheckLevel));
-    LogPrintf("Verifying last %i blocks at level %i\n", nCheckDepth, nCheckLevel);
+    LogPrintf("Verifying last %i blocks at level %i on %i threads\n", nCheckDepth, nCheckLevel, nThreads);
+    const int nMinHeight = chainActive.Height() - nCheckDepth;
+    auto isChecked = [nMinHeight](const CBlockIndex* pindex) {
+        // If pruning, only go back as far as we have data.
+        return pindex && pindex->pprev && pindex->nHeight >= nMinHeight &&
+               (!fPruneMode || (pindex->nStatus & BLOCK_HAVE_DATA));
+    };
+
+    // Checks up to level 2 don't depend on each other, so the checkers do
+    // them for the blocks at most nWindow blocks ahead of the one this thread
+    // is at, going down from the tip. This thread, which holds cs_main for
+    // all of them, only disconnects blocks from the coins cache in order.
+    struct CheckedBlock {
+        bool fDone = false;
+        std::string strError;
+        std::shared_ptr<const CBlock> pblock;
+    };
+    const size_t nWindow = 4 * nThreads;
+    std::vector<CheckedBlock> vChecked(nWindow);
+    CWaitableCriticalSection cs;
+    CConditionVariable cond;
+    CBlockIndex* pindexNextCheck = chainActive.Tip();
+    size_t nNextCheck = 0;
+    size_t nNextVerify = 0;
+    bool fStop = false;
+
+    auto check = [&]() {
+        while (true) {
+            CBlockIndex* pindex;
+            size_t nSlot;
+            {
+                WaitableLock lock(cs);
+                cond.wait(lock, [&] { return fStop || !isChecked(pindexNextCheck) || nNextCheck < nNextVerify + nWindow; });
+                if (fStop || !isChecked(pindexNextCheck))
+                    return;
+                pindex = pindexNextCheck;
+                pindexNextCheck = pindex->pprev;
+                nSlot = nNextCheck++ % nWindow;
+            }
+            // As in ReadBlockFromDisk(CBlock&, const CBlockIndex*), which
+            // would take cs_main
+            bool fCheckPOW = fCheckBlockPoW || (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_HEADER;
+            std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
+            CValidationState state;
+            CheckedBlock result;
+            // check level 0: read from disk
+            if (!ReadBlockFromDisk(*pblock, pindex->GetBlockPos(), pindex->nHeight, consensusParams, fCheckPOW) ||
+                pblock->GetHash() != pindex->GetBlockHash()) {
+                result.strError = strprintf("VerifyDB(): *** ReadBlockFromDisk failed at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
+            // check level 1: verify block validity
+            } else if (nCheckLevel >= 1 && !CheckBlock(*pblock, state, consensusParams)) {
+                result.strError = strprintf("VerifyDB(): *** found bad block at %d, hash=%s (%s)", pindex->nHeight, pindex->GetBlockHash().ToString(), FormatStateMessage(state));
+            // check level 2: verify undo validity
+            } else if (nCheckLevel >= 2 && !pindex->GetUndoPos().IsNull()) {
+                CBlockUndo undo;
+                if (!UndoReadFromDisk(undo, pindex))
+                    result.strError = strprintf("VerifyDB(): *** found bad undo data at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
+            }
+            if (nCheckLevel >= 3)
+                result.pblock = std::move(pblock);
+            result.fDone = true;
+            WaitableLock lock(cs);
+            vChecked[nSlot] = std::move(result);
+            cond.notify_all();
+        }
+    };
+
+    std::vector<std::thread> threads;
+    // Stop and join the checkers however this function is left, including
+    // by an interruption of the RPC thread.
+    auto stopCheckers = [&]() {
+        {
+            WaitableLock lock(cs);
+            fStop = true;
+            cond.notify_all();
+        }
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+        threads.clear();
+    };
+    struct CheckerGuard {
+        const std::function<void()> stop;
+        ~CheckerGuard() { stop(); }
+    } guard{stopCheckers};
+    for (int i = 0; i < nThreads; i++) {
+        threads.emplace_back(&TraceThread<decltype(check)>, "verifyblk", check);
+    }
+
     CCoinsViewCache coins(coinsview);
     CBlockIndex* pindexState = chainActive.Tip();
     CBlockIndex* pindexFailure = nullptr;
     int nGoodTransactions = 0;
-    CValidationState state;
     int reportDone = 0;
+    int nReportedProgress = 0;
+    int64_t nStart = GetTimeMillis();
     LogPrintf("[0%%]...");
     for (CBlockIndex* pindex = chainActive.Tip(); pindex && pindex->pprev; pindex = pindex->pprev)
     {
@@ -3898,35 +4221,37 @@ bool CVerifyDB::VerifyDB(const CChainParams& chainparams, CCoinsView *coinsview,
             LogPrintf("[%d%%]...", percentageDone);
             reportDone = percentageDone/10;
         }
-        uiInterface.ShowProgress(_("Verifying blocks..."), percentageDone, false);
-        if (pindex->nHeight < chainActive.Height()-nCheckDepth)
-            break;
-        if (fPruneMode && !(pindex->nStatus & BLOCK_HAVE_DATA)) {
-            // If pruning, only go back as far as we have data.
-            LogPrintf("VerifyDB(): block verification stopping at height %d (pruning, no data)\n", pindex->nHeight);
+        if (nReportedProgress < percentageDone) {
+            int64_t nElapsed = std::max<int64_t>(1, GetTimeMillis() - nStart);
+            uiInterface.ShowProgress(strprintf(_("Verifying blocks (%d/s)..."), nNextVerify * 1000 / nElapsed), percentageDone, false);
+            nReportedProgress = percentageDone;
+        }
+        if (!isChecked(pindex)) {
+            if (pindex->nHeight >= nMinHeight)
+                LogPrintf("VerifyDB(): block verification stopping at height %d (pruning, no data)\n", pindex->nHeight);
             break;
         }
-        CBlock block;
-        // check level 0: read from disk
-        if (!ReadBlockFromDisk(block, pindex, chainparams.GetConsensus()))
-            return error("VerifyDB(): *** ReadBlockFromDisk failed at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
-        // check level 1: verify block validity
-        if (nCheckLevel >= 1 && !CheckBlock(block, state, chainparams.GetConsensus()))
-            return error("%s: *** found bad block at %d, hash=%s (%s)\n", __func__,
-                         pindex->nHeight, pindex->GetBlockHash().ToString(), FormatStateMessage(state));
-        // check level 2: verify undo validity
-        if (nCheckLevel >= 2 && pindex) {
-            CBlockUndo undo;
-            if (!pindex->GetUndoPos().IsNull()) {
-                if (!UndoReadFromDisk(undo, pindex)) {
-                    return error("VerifyDB(): *** found bad undo data at %d, hash=%s\n", pindex->nHeight, pindex->GetBlockHash().ToString());
-                }
+        CheckedBlock checked;
+        {
+            WaitableLock lock(cs);
+            CheckedBlock& slot = vChecked[nNextVerify % nWindow];
+            while (!slot.fDone) {
+                cond.wait_for(lock, std::chrono::milliseconds(100));
+                lock.unlock();
+                boost::this_thread::interruption_point();
+                lock.lock();
             }
+            checked = std::move(slot);
+            slot.fDone = false;
+            nNextVerify++;
+            cond.notify_all();
         }
+        if (!checked.strError.empty())
+            return error("%s", checked.strError);
         // check level 3: check for inconsistencies during memory-only disconnect of tip blocks
         if (nCheckLevel >= 3 && pindex == pindexState && (coins.DynamicMemoryUsage() + pcoinsTip->DynamicMemoryUsage()) <= nCoinCacheUsage) {
             assert(coins.GetBestBlock() == pindex->GetBlockHash());
-            DisconnectResult res = g_chainstate.DisconnectBlock(block, pindex, coins);
+            DisconnectResult res = g_chainstate.DisconnectBlock(*checked.pblock, pindex, coins);
             if (res == DISCONNECT_FAILED) {
                 return error("VerifyDB(): *** irrecoverable inconsistency in block data at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
             }
@@ -3935,15 +4260,19 @@ bool CVerifyDB::VerifyDB(const CChainParams& chainparams, CCoinsView *coinsview,
                 nGoodTransactions = 0;
                 pindexFailure = pindex;
             } else {
-                nGoodTransactions += block.vtx.size();
+                nGoodTransactions += checked.pblock->vtx.size();
             }
         }
         if (ShutdownRequested())
             return true;
     }
+    stopCheckers();
+    int64_t nCheckTime = GetTimeMillis() - nStart;
     if (pindexFailure)
         return error("VerifyDB(): *** coin database inconsistencies found (last %i blocks, %i good transactions before that)\n", chainActive.Height() - pindexFailure->nHeight + 1, nGoodTransactions);
 
+    CValidationState state;
+
     // check level 4: try reconnecting blocks
     if (nCheckLevel >= 4) {
         CBlockIndex *pindex = pindexState;
@@ -3960,6 +4289,7 @@ bool CVerifyDB::VerifyDB(const CChainParams& chainparams, CCoinsView *coinsview,
     }
 
     LogPrintf("[DONE].\n");
+    LogPrintf("Checked %u blocks in %dms\n", nNextVerify, nCheckTime);
     LogPrintf("No coin database inconsistencies in last %i blocks (%i transactions)\n", chainActive.Height() - pindexState->nHeight, nGoodTransactions);
 
     return true;
@@ -4163,6 +4493,7 @@ void CChainState::UnloadBlockIndex() {
     nBlockSequenceId = 1;
     g_failed_blocks.clear();
     setBlockIndexCandidates.clear();
+    blockIndexArena.Clear();
 }
 
 // May NOT be used after any connections are up as much
@@ -4185,10 +4516,8 @@ void UnloadBlockIndex()
         warningcache[b].clear();
     }
 
-    for (BlockMap::value_type& entry : mapBlockIndex) {
-        delete entry.second;
-    }
     mapBlockIndex.clear();
+    CUserCheckpoint::GetInstance().BlockIndexReset();
     fHavePruned = false;
 
     g_chainstate.UnloadBlockIndex();
@@ -4219,7 +4548,7 @@ bool LoadBlockIndex(const CChainParams& chainparams)
     return true;
 }
 
-bool CChainState::LoadGenesisBlock(const CChainParams& chainparams)
+bool CChainState::LoadGenesisBlock(const CChainParams& chainparams, const CDiskBlockPos* dbp)
 {
     LOCK(cs_main);
 
@@ -4232,7 +4561,7 @@ bool CChainState::LoadGenesisBlock(const CChainParams& chainparams)
 
     try {
         CBlock &block = const_cast<CBlock&>(chainparams.GenesisBlock());
-        CDiskBlockPos blockPos = SaveBlockToDisk(block, 0, chainparams, nullptr);
+        CDiskBlockPos blockPos = SaveBlockToDisk(block, 0, chainparams, dbp);
         if (blockPos.IsNull())
             return error("%s: writing genesis block to disk failed", __func__);
         CBlockIndex *pindex = AddToBlockIndex(block);
@@ -4251,123 +4580,366 @@ bool LoadGenesisBlock(const CChainParams& chainparams)
     return g_chainstate.LoadGenesisBlock(chainparams);
 }
 
+// Map of disk positions for blocks with unknown parent (only used for reindex)
+static std::multimap<uint256, CDiskBlockPos> mapBlocksUnknownParent;
+
+/**
+ * Scan a block file for blocks, calling fn with every block found and its
+ * position in the file. Stops at the end of the file, or when fn returns false.
+ */
+static void ScanBlockFile(const CChainParams& chainparams, FILE* fileIn, const std::function<bool(const std::shared_ptr<CBlock>&, uint64_t)>& fn)
+{
+    // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
+    CBufferedFile blkdat(fileIn, 2*MAX_BLOCK_SERIALIZED_SIZE, MAX_BLOCK_SERIALIZED_SIZE+8, SER_DISK, CLIENT_VERSION);
+    uint64_t nRewind = blkdat.GetPos();
+    while (!blkdat.eof()) {
+        boost::this_thread::interruption_point();
+
+        blkdat.SetPos(nRewind);
+        nRewind++; // start one byte further next time, in case of failure
+        blkdat.SetLimit(); // remove former limit
+        unsigned int nSize = 0;
+        try {
+            // locate a header
+            unsigned char buf[CMessageHeader::MESSAGE_START_SIZE];
+            blkdat.FindByte(chainparams.MessageStart()[0]);
+            nRewind = blkdat.GetPos()+1;
+            blkdat >> FLATDATA(buf);
+            if (memcmp(buf, chainparams.MessageStart(), CMessageHeader::MESSAGE_START_SIZE))
+                continue;
+            // read size
+            blkdat >> nSize;
+            if (nSize < 80 || nSize > MAX_BLOCK_SERIALIZED_SIZE)
+                continue;
+        } catch (const std::exception&) {
+            // no valid block header found; don't complain
+            break;
+        }
+        try {
+            // read block
+            uint64_t nBlockPos = blkdat.GetPos();
+            blkdat.SetLimit(nBlockPos + nSize);
+            blkdat.SetPos(nBlockPos);
+            std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
+            blkdat >> *pblock;
+            nRewind = blkdat.GetPos();
+            if (!fn(pblock, nBlockPos))
+                break;
+        } catch (const std::exception& e) {
+            LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
+        }
+    }
+}
+
+/**
+ * Accept a block read from a block file, followed by any earlier read
+ * blocks waiting for it. Returns false if importing should stop.
+ */
+static bool AcceptExternalBlock(const CChainParams& chainparams, const std::shared_ptr<CBlock>& pblock, CDiskBlockPos* dbp, int& nLoaded)
+{
+    const CBlock& block = *pblock;
+
+    // detect out of order blocks, and store them for later
+    uint256 hash = block.GetHash();
+    if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex.find(block.hashPrevBlock) == mapBlockIndex.end()) {
+        LogPrint(BCLog::REINDEX, "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
+                block.hashPrevBlock.ToString());
+        if (dbp)
+            mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, *dbp));
+        return true;
+    }
+
+    // process in case the block isn't known yet
+    if (mapBlockIndex.count(hash) == 0 || (mapBlockIndex[hash]->nStatus & BLOCK_HAVE_DATA) == 0) {
+        LOCK(cs_main);
+        CValidationState state;
+        if (hash == chainparams.GetConsensus().hashGenesisBlock) {
+            // The genesis block is part of the chain parameters, and is not
+            // validated, as at startup: its coinbase predates BIP34, which
+            // is active from height 0 on the main and test networks
+            if (!g_chainstate.LoadGenesisBlock(chainparams, dbp))
+                return false;
+            nLoaded++;
+        } else if (g_chainstate.AcceptBlock(pblock, state, chainparams, nullptr, true, dbp, nullptr)) {
+            nLoaded++;
+        }
+        if (state.IsError())
+            return false;
+    } else if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex[hash]->nHeight % 1000 == 0) {
+        LogPrint(BCLog::REINDEX, "Block Import: already had block %s at height %d\n", hash.ToString(), mapBlockIndex[hash]->nHeight);
+    }
+
+    // Activate the genesis block so normal node progress can continue
+    if (hash == chainparams.GetConsensus().hashGenesisBlock) {
+        CValidationState state;
+        if (!ActivateBestChain(state, chainparams)) {
+            return false;
+        }
+    }
+
+    NotifyHeaderTip();
+
+    // Recursively process earlier encountered successors of this block
+    std::deque<uint256> queue;
+    queue.push_back(hash);
+    while (!queue.empty()) {
+        uint256 head = queue.front();
+        queue.pop_front();
+        std::pair<std::multimap<uint256, CDiskBlockPos>::iterator, std::multimap<uint256, CDiskBlockPos>::iterator> range = mapBlocksUnknownParent.equal_range(head);
+        while (range.first != range.second) {
+            std::multimap<uint256, CDiskBlockPos>::iterator it = range.first;
+            std::shared_ptr<CBlock> pblockrecursive = std::make_shared<CBlock>();
+            uint256 hash = block.GetHash();
+            int nHeight = mapBlockIndex[hash]->nHeight;
+            if (ReadBlockFromDisk(*pblockrecursive, it->second, nHeight, chainparams.GetConsensus()))
+            {
+                LogPrint(BCLog::REINDEX, "%s: Processing out of order child %s of %s\n", __func__, pblockrecursive->GetHash().ToString(),
+                        head.ToString());
+                LOCK(cs_main);
+                CValidationState dummy;
+                if (g_chainstate.AcceptBlock(pblockrecursive, dummy, chainparams, nullptr, true, &it->second, nullptr))
+                {
+                    nLoaded++;
+                    queue.push_back(pblockrecursive->GetHash());
+                }
+            }
+            range.first++;
+            mapBlocksUnknownParent.erase(it);
+            NotifyHeaderTip();
+        }
+    }
+    return true;
+}
+
 bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskBlockPos *dbp)
 {
-    // Map of disk positions for blocks with unknown parent (only used for reindex)
-    static std::multimap<uint256, CDiskBlockPos> mapBlocksUnknownParent;
     int64_t nStart = GetTimeMillis();
 
     int nLoaded = 0;
     try {
-        // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
-        CBufferedFile blkdat(fileIn, 2*MAX_BLOCK_SERIALIZED_SIZE, MAX_BLOCK_SERIALIZED_SIZE+8, SER_DISK, CLIENT_VERSION);
-        uint64_t nRewind = blkdat.GetPos();
-        while (!blkdat.eof()) {
-            boost::this_thread::interruption_point();
+        ScanBlockFile(chainparams, fileIn, [&](const std::shared_ptr<CBlock>& pblock, uint64_t nBlockPos) {
+            if (dbp)
+                dbp->nPos = nBlockPos;
+            return AcceptExternalBlock(chainparams, pblock, dbp, nLoaded);
+        });
+    } catch (const std::runtime_error& e) {
+        AbortNode(std::string("System error: ") + e.what());
+    }
+    if (nLoaded > 0)
+        LogPrintf("Loaded %i blocks from external file in %dms\n", nLoaded, GetTimeMillis() - nStart);
+    return nLoaded > 0;
+}
 
-            blkdat.SetPos(nRewind);
-            nRewind++; // start one byte further next time, in case of failure
-            blkdat.SetLimit(); // remove former limit
-            unsigned int nSize = 0;
-            try {
-                // locate a header
-                unsigned char buf[CMessageHeader::MESSAGE_START_SIZE];
-                blkdat.FindByte(chainparams.MessageStart()[0]);
-                nRewind = blkdat.GetPos()+1;
-                blkdat >> FLATDATA(buf);
-                if (memcmp(buf, chainparams.MessageStart(), CMessageHeader::MESSAGE_START_SIZE))
-                    continue;
-                // read size
-                blkdat >> nSize;
-                if (nSize < 80 || nSize > MAX_BLOCK_SERIALIZED_SIZE)
-                    continue;
-            } catch (const std::exception&) {
-                // no valid block header found; don't complain
-                break;
+/**
+ * Run the context-free block checks that do not need the block index, so
+ * that they can be done ahead of time on any thread. Sets fCheckedPoW (and
+ * fChecked) only when the result is the same as the checks AcceptBlock()
+ * would do: that is the case when every block above the genesis block
+ * uses Lyra2REv2, as on the main and test networks.
+ */
+static void PreCheckBlock(const CBlock& block, const CChainParams& chainparams)
+{
+    const Consensus::Params& consensusParams = chainparams.GetConsensus();
+    if (block.GetHash() == consensusParams.hashGenesisBlock || chainparams.SwitchLyra2REv2_DGWblock() > 1)
+        return;
+    // Any height a block can be accepted at is at least 1
+    if (!CheckProofOfWork(block.GetPoWHash(true), block.nBits, 1, consensusParams))
+        return;
+    block.fCheckedPoW = true;
+    CValidationState state;
+    if (CheckBlock(block, state, consensusParams, false, true))
+        block.fChecked = true;
+}
+
+bool LoadExternalBlockFiles(const CChainParams& chainparams, const std::vector<fs::path>& vFiles, bool fBlockFiles)
+{
+    int nThreads = gArgs.GetArg("-importthreads", DEFAULT_IMPORT_THREADS);
+    if (nThreads <= 0)
+        nThreads = GetNumCores();
+    nThreads = std::max(1, std::min(nThreads, MAX_IMPORT_THREADS));
+
+    struct ReadBlock {
+        std::shared_ptr<CBlock> pblock;
+        uint64_t nPos;
+        size_t nUsage;
+    };
+    struct FileBlocks {
+        bool fStarted = false;
+        bool fOpened = false;
+        bool fDone = false;
+        bool fFailed = false;
+        std::string strError;
+        std::deque<ReadBlock> vBlocks;
+    };
+    std::vector<FileBlocks> vRead(vFiles.size());
+    CWaitableCriticalSection cs;
+    CConditionVariable cond;
+    size_t nNextRead = 0;
+    size_t nNextAccept = 0;
+    //! Memory used by the blocks read and not accepted yet
+    size_t nReadAhead = 0;
+    bool fStop = false;
+
+    // Each reader takes the next file that is at most nThreads files ahead of
+    // the one being accepted, then reads and checks its blocks, as long as
+    // the blocks read ahead fit in MAX_IMPORT_READ_AHEAD. The reader of the
+    // file being accepted can always hand over one block, so that the import
+    // goes on however large the files are.
+    auto read = [&]() {
+        while (true) {
+            size_t nFile;
+            {
+                WaitableLock lock(cs);
+                cond.wait(lock, [&] { return fStop || nNextRead >= vFiles.size() || nNextRead < nNextAccept + nThreads; });
+                if (fStop || nNextRead >= vFiles.size())
+                    return;
+                nFile = nNextRead++;
             }
-            try {
-                // read block
-                uint64_t nBlockPos = blkdat.GetPos();
-                if (dbp)
-                    dbp->nPos = nBlockPos;
-                blkdat.SetLimit(nBlockPos + nSize);
-                blkdat.SetPos(nBlockPos);
-                std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
-                CBlock& block = *pblock;
-                blkdat >> block;
-                nRewind = blkdat.GetPos();
-
-                // detect out of order blocks, and store them for later
-                uint256 hash = block.GetHash();
-                if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex.find(block.hashPrevBlock) == mapBlockIndex.end()) {
-                    LogPrint(BCLog::REINDEX, "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
-                            block.hashPrevBlock.ToString());
-                    if (dbp)
-                        mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, *dbp));
-                    continue;
+            FILE* file = fBlockFiles ? OpenBlockFile(CDiskBlockPos(nFile, 0), true) : fsbridge::fopen(vFiles[nFile], "rb");
+            {
+                WaitableLock lock(cs);
+                vRead[nFile].fStarted = true;
+                vRead[nFile].fOpened = file != nullptr;
+                cond.notify_all();
+            }
+            bool fFailed = false;
+            std::string strError;
+            if (file) {
+                try {
+                    ScanBlockFile(chainparams, file, [&](const std::shared_ptr<CBlock>& pblock, uint64_t nBlockPos) {
+                        PreCheckBlock(*pblock, chainparams);
+                        size_t nUsage = RecursiveDynamicUsage(*pblock);
+                        WaitableLock lock(cs);
+                        cond.wait(lock, [&] {
+                            return fStop || nReadAhead < MAX_IMPORT_READ_AHEAD || (nFile + 1 == nNextAccept && vRead[nFile].vBlocks.empty());
+                        });
+                        if (fStop)
+                            return false;
+                        vRead[nFile].vBlocks.push_back(ReadBlock{pblock, nBlockPos, nUsage});
+                        nReadAhead += nUsage;
+                        cond.notify_all();
+                        return true;
+                    });
+                } catch (const std::exception& e) {
+                    // A reader thread must not throw: TraceThread would only
+                    // pass the exception on and end the process
+                    fFailed = true;
+                    strError = e.what();
+                } catch (...) {
+                    fFailed = true;
+                    strError = "unknown exception";
                 }
+            }
+            WaitableLock lock(cs);
+            vRead[nFile].fDone = true;
+            vRead[nFile].fFailed = fFailed;
+            vRead[nFile].strError = strError;
+            cond.notify_all();
+        }
+    };
 
-                // process in case the block isn't known yet
-                if (mapBlockIndex.count(hash) == 0 || (mapBlockIndex[hash]->nStatus & BLOCK_HAVE_DATA) == 0) {
-                    LOCK(cs_main);
-                    CValidationState state;
-                    if (g_chainstate.AcceptBlock(pblock, state, chainparams, nullptr, true, dbp, nullptr))
-                        nLoaded++;
-                    if (state.IsError())
-                        break;
-                } else if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex[hash]->nHeight % 1000 == 0) {
-                    LogPrint(BCLog::REINDEX, "Block Import: already had block %s at height %d\n", hash.ToString(), mapBlockIndex[hash]->nHeight);
-                }
+    std::vector<std::thread> threads;
+    // Stop and join the readers however this function is left, including
+    // by an interruption of the import thread.
+    auto stopReaders = [&]() {
+        {
+            WaitableLock lock(cs);
+            fStop = true;
+            cond.notify_all();
+        }
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+        threads.clear();
+    };
+    struct ReaderGuard {
+        const std::function<void()> stop;
+        ~ReaderGuard() { stop(); }
+    } guard{stopReaders};
+    for (int i = 0; i < nThreads; i++) {
+        threads.emplace_back(&TraceThread<decltype(read)>, "loadblkread", read);
+    }
+
+    // Wait for the readers, without missing an interruption of this thread
+    auto wait = [&](WaitableLock& lock) {
+        cond.wait_for(lock, std::chrono::milliseconds(100));
+        lock.unlock();
+        boost::this_thread::interruption_point();
+        lock.lock();
+    };
 
-                // Activate the genesis block so normal node progress can continue
-                if (hash == chainparams.GetConsensus().hashGenesisBlock) {
-                    CValidationState state;
-                    if (!ActivateBestChain(state, chainparams)) {
-                        break;
-                    }
-                }
+    int nLoadedTotal = 0;
+    for (size_t nFile = 0; nFile < vFiles.size(); nFile++) {
+        bool fOpened;
+        {
+            WaitableLock lock(cs);
+            nNextAccept = nFile + 1;
+            cond.notify_all();
+            while (!vRead[nFile].fStarted)
+                wait(lock);
+            fOpened = vRead[nFile].fOpened;
+        }
+        if (!fOpened) {
+            // OpenBlockFile logs its own errors
+            if (fBlockFiles)
+                break;
+            LogPrintf("Warning: Could not open blocks file %s\n", vFiles[nFile].string());
+            continue;
+        }
+        if (fBlockFiles) {
+            LogPrintf("Reindexing block file blk%05u.dat...\n", (unsigned int)nFile);
+        } else {
+            LogPrintf("Importing blocks file %s...\n", vFiles[nFile].string());
+        }
 
-                NotifyHeaderTip();
-
-                // Recursively process earlier encountered successors of this block
-                std::deque<uint256> queue;
-                queue.push_back(hash);
-                while (!queue.empty()) {
-                    uint256 head = queue.front();
-                    queue.pop_front();
-                    std::pair<std::multimap<uint256, CDiskBlockPos>::iterator, std::multimap<uint256, CDiskBlockPos>::iterator> range = mapBlocksUnknownParent.equal_range(head);
-                    while (range.first != range.second) {
-                        std::multimap<uint256, CDiskBlockPos>::iterator it = range.first;
-                        std::shared_ptr<CBlock> pblockrecursive = std::make_shared<CBlock>();
-                        uint256 hash = block.GetHash();
-                        int nHeight = mapBlockIndex[hash]->nHeight;
-                        if (ReadBlockFromDisk(*pblockrecursive, it->second, nHeight, chainparams.GetConsensus()))
-                        {
-                            LogPrint(BCLog::REINDEX, "%s: Processing out of order child %s of %s\n", __func__, pblockrecursive->GetHash().ToString(),
-                                    head.ToString());
-                            LOCK(cs_main);
-                            CValidationState dummy;
-                            if (g_chainstate.AcceptBlock(pblockrecursive, dummy, chainparams, nullptr, true, &it->second, nullptr))
-                            {
-                                nLoaded++;
-                                queue.push_back(pblockrecursive->GetHash());
-                            }
-                        }
-                        range.first++;
-                        mapBlocksUnknownParent.erase(it);
-                        NotifyHeaderTip();
-                    }
-                }
+        int64_t nStart = GetTimeMillis();
+        int nLoaded = 0;
+        bool fAccepting = true;
+        while (true) {
+            ReadBlock entry;
+            {
+                WaitableLock lock(cs);
+                FileBlocks& file = vRead[nFile];
+                while (file.vBlocks.empty() && !file.fDone)
+                    wait(lock);
+                if (file.vBlocks.empty())
+                    break;
+                entry = std::move(file.vBlocks.front());
+                file.vBlocks.pop_front();
+                nReadAhead -= entry.nUsage;
+                cond.notify_all();
+            }
+            // The rest of the file is still taken, to keep the read-ahead going
+            if (!fAccepting)
+                continue;
+            boost::this_thread::interruption_point();
+            CDiskBlockPos pos(nFile, entry.nPos);
+            try {
+                if (!AcceptExternalBlock(chainparams, entry.pblock, fBlockFiles ? &pos : nullptr, nLoaded))
+                    fAccepting = false;
             } catch (const std::exception& e) {
                 LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
             }
         }
-    } catch (const std::runtime_error& e) {
-        AbortNode(std::string("System error: ") + e.what());
+        if (nLoaded > 0)
+            LogPrintf("Loaded %i blocks from external file in %dms\n", nLoaded, GetTimeMillis() - nStart);
+        nLoadedTotal += nLoaded;
+
+        bool fFailed;
+        std::string strError;
+        {
+            WaitableLock lock(cs);
+            fFailed = vRead[nFile].fFailed;
+            strError = vRead[nFile].strError;
+        }
+        if (fFailed) {
+            // Stop importing: the blocks after the failure can't be accepted
+            // without the ones that were not read
+            AbortNode(std::string("System error: ") + strError);
+            break;
+        }
     }
-    if (nLoaded > 0)
-        LogPrintf("Loaded %i blocks from external file in %dms\n", nLoaded, GetTimeMillis() - nStart);
-    return nLoaded > 0;
+    return nLoadedTotal > 0;
 }
 
 void CChainState::CheckBlockIndex(const Consensus::Params& consensusParams)
@@ -4711,6 +5283,265 @@ bool DumpMempool(void)
     return true;
 }
 
+bool DumpUTXOSnapshot(const fs::path& path, CUTXOSnapshotHeader& header)
+{
+    int64_t nStart = GetTimeMillis();
+
+    std::unique_ptr<CCoinsViewCursor> pcursor;
+    std::vector<const CBlockIndex*> vChain;
+    {
+        LOCK(cs_main);
+        // Get the coins as of the tip into the database, and take the cursor
+        // (which reads from a snapshot of it) before another block can be
+        // connected and written
+        FlushStateToDisk();
+        pcursor.reset(pcoinsdbview->Cursor());
+        CUTXOCommitment commitment;
+        if (!pcoinsdbview->GetCommitment(commitment))
+            return error("%s: the coins database has no UTXO set commitment", __func__);
+        BlockMap::const_iterator it = mapBlockIndex.find(pcursor->GetBestBlock());
+        if (it == mapBlockIndex.end() || it->second->nHeight == 0)
+            return error("%s: no blocks have been connected yet", __func__);
+        header.hashBlock = it->first;
+        header.nHeight = it->second->nHeight;
+        header.nCoins = commitment.nTransactionOutputs;
+        header.hashCommitment = commitment.GetHash();
+        memcpy(header.pchMessageStart, Params().MessageStart(), sizeof(header.pchMessageStart));
+        // Entries of mapBlockIndex stay in place until shutdown
+        vChain.reserve(header.nHeight);
+        for (const CBlockIndex* pindex = it->second; pindex->pprev; pindex = pindex->pprev)
+            vChain.push_back(pindex);
+    }
+
+    fs::path pathTmp = path;
+    pathTmp += ".incomplete";
+    try {
+        CAutoFile file(fsbridge::fopen(pathTmp, "wb"), SER_DISK, CLIENT_VERSION);
+        if (file.IsNull())
+            return error("%s: unable to open %s", __func__, pathTmp.string());
+
+        CHashingWriter<CAutoFile> writer(&file);
+        writer << header;
+        for (auto it = vChain.rbegin(); it != vChain.rend(); ++it)
+            writer << (*it)->GetBlockHeader() << VARINT((*it)->nTx);
+
+        uint64_t nCoins = 0;
+        while (pcursor->Valid()) {
+            boost::this_thread::interruption_point();
+            COutPoint key;
+            Coin coin;
+            if (!pcursor->GetKey(key) || !pcursor->GetValue(coin))
+                return error("%s: unable to read value", __func__);
+            writer << key << coin;
+            nCoins++;
+            pcursor->Next();
+        }
+        if (nCoins != header.nCoins)
+            return error("%s: wrote %u coins, but the UTXO set commitment covers %u", __func__, nCoins, header.nCoins);
+
+        file << writer.GetHash();
+        FileCommit(file.Get());
+        file.fclose();
+    } catch (const std::exception& e) {
+        return error("%s: %s", __func__, e.what());
+    }
+    if (!RenameOver(pathTmp, path))
+        return error("%s: unable to rename %s", __func__, pathTmp.string());
+
+    LogPrintf("Dumped UTXO snapshot of %u coins as of block %s (height %d) to %s in %dms\n",
+        header.nCoins, header.hashBlock.ToString(), header.nHeight, path.string(), GetTimeMillis() - nStart);
+    return true;
+}
+
+/**
+ * Read a UTXO snapshot, passing its header, every block header and every coin
+ * to the callbacks, any of which can stop reading by returning false. Fails
+ * if the snapshot is for another network or its checksum does not match.
+ */
+template <typename BaseFunc, typename HeaderFunc, typename CoinFunc>
+static bool ReadUTXOSnapshot(const CChainParams& chainparams, const fs::path& path, CUTXOSnapshotHeader& header,
+                             BaseFunc baseFunc, HeaderFunc headerFunc, CoinFunc coinFunc)
+{
+    CAutoFile file(fsbridge::fopen(path, "rb"), SER_DISK, CLIENT_VERSION);
+    if (file.IsNull())
+        return error("%s: unable to open %s", __func__, path.string());
+
+    try {
+        CHashVerifier<CAutoFile> verifier(&file);
+        verifier >> header;
+        if (!header.IsValid(chainparams.MessageStart()))
+            return error("%s: %s is not a UTXO snapshot for this network", __func__, path.string());
+        if (!baseFunc(header))
+            return false;
+
+        CBlockHeader block;
+        unsigned int nTx;
+        for (int nHeight = 1; nHeight <= header.nHeight; nHeight++) {
+            verifier >> block >> VARINT(nTx);
+            if (!headerFunc(block, nTx))
+                return false;
+        }
+
+        for (uint64_t i = 0; i < header.nCoins; i++) {
+            COutPoint outpoint;
+            Coin coin;
+            verifier >> outpoint >> coin;
+            if (!coinFunc(outpoint, std::move(coin)))
+                return false;
+        }
+
+        uint256 hashChecksum;
+        file >> hashChecksum;
+        if (hashChecksum != verifier.GetHash())
+            return error("%s: checksum mismatch in %s", __func__, path.string());
+    } catch (const std::exception& e) {
+        return error("%s: deserialize or I/O error reading %s: %s", __func__, path.string(), e.what());
+    }
+    return true;
+}
+
+/**
+ * Whether the snapshot is one listed in the chain parameters: its base block,
+ * commitment and coin count all have to match, as nothing else vouches for the
+ * coins.
+ */
+static bool IsUTXOSnapshotAnchored(const CChainParams& chainparams, const CUTXOSnapshotHeader& header)
+{
+    const MapUTXOSnapshots& snapshots = chainparams.UTXOSnapshots();
+    MapUTXOSnapshots::const_iterator it = snapshots.find(header.nHeight);
+    return it != snapshots.end() && it->second.hashBlock == header.hashBlock &&
+           it->second.hashCommitment == header.hashCommitment && it->second.nCoins == header.nCoins;
+}
+
+bool CChainState::LoadUTXOSnapshot(const CChainParams& chainparams, const fs::path& path, CCoinsViewDB* view)
+{
+    AssertLockHeld(cs_main);
+    const Consensus::Params& consensusParams = chainparams.GetConsensus();
+    int64_t nStart = GetTimeMillis();
+
+    // Check the whole file before changing anything: the headers have to
+    // lead from the genesis block to the base block of a snapshot listed in
+    // the chain parameters, whose commitment the coins are checked against.
+    // The transaction counts of the blocks are only known from the headers,
+    // so they have to add up to the listed count for the chain.
+    BlockMap::iterator itGenesis = mapBlockIndex.find(consensusParams.hashGenesisBlock);
+    if (itGenesis == mapBlockIndex.end())
+        return error("%s: genesis block not loaded", __func__);
+
+    LogPrintf("Checking UTXO snapshot %s...\n", path.string());
+    CUTXOSnapshotHeader header;
+    uint256 hashPrev = consensusParams.hashGenesisBlock;
+    uint64_t nChainTx = itGenesis->second->nChainTx;
+    bool fLinked = true;
+    auto checkBase = [&chainparams](const CUTXOSnapshotHeader& base) {
+        if (!IsUTXOSnapshotAnchored(chainparams, base))
+            return error("LoadUTXOSnapshot: snapshot of block %s at height %d with commitment %s is not a known snapshot",
+                base.hashBlock.ToString(), base.nHeight, base.hashCommitment.ToString());
+        return true;
+    };
+    auto checkHeader = [&hashPrev, &nChainTx, &fLinked](const CBlockHeader& block, unsigned int nTx) {
+        fLinked = block.hashPrevBlock == hashPrev && nTx > 0;
+        hashPrev = block.GetHash();
+        nChainTx += nTx;
+        return fLinked;
+    };
+    auto skipCoin = [](const COutPoint& outpoint, Coin&& coin) { return true; };
+    if (!ReadUTXOSnapshot(chainparams, path, header, checkBase, checkHeader, skipCoin))
+        return fLinked ? false : error("%s: block headers in the snapshot do not form a chain", __func__);
+    if (hashPrev != header.hashBlock)
+        return error("%s: block headers in the snapshot do not lead to its base block", __func__);
+    if (nChainTx != chainparams.UTXOSnapshots().at(header.nHeight).nChainTx)
+        return error("%s: transaction counts in the snapshot add up to %u, not to the listed %u", __func__,
+            nChainTx, chainparams.UTXOSnapshots().at(header.nHeight).nChainTx);
+
+    // Until the flag is cleared the chainstate is incomplete, and has to be
+    // wiped on the next start
+    if (!pblocktree->WriteFlag("utxosnapshotloading", true))
+        return error("%s: failed to write to block index database", __func__);
+
+    LogPrintf("Loading %u coins as of block %s (height %d)...\n", header.nCoins, header.hashBlock.ToString(), header.nHeight);
+    uiInterface.ShowProgress(_("Loading UTXO snapshot..."), 0, false);
+    CCoinsViewCache cache(view, true);
+    cache.SetBestBlock(header.hashBlock);
+    CBlockIndex* pindexPrev = itGenesis->second;
+    uint64_t nLoaded = 0;
+    int nReportedProgress = 0;
+    bool fInterrupted = false;
+    auto addHeader = [&](const CBlockHeader& block, unsigned int nTx) {
+        // The blocks themselves are never downloaded, as if pruned
+        CBlockIndex* pindex = AddToBlockIndex(block);
+        if (pindex->pprev != pindexPrev)
+            return error("LoadUTXOSnapshot: snapshot changed while loading");
+        if (!(pindex->nStatus & BLOCK_HAVE_DATA))
+            pindex->nTx = nTx;
+        pindex->nChainTx = pindexPrev->nChainTx + pindex->nTx;
+        if (IsWitnessEnabled(pindexPrev, consensusParams))
+            pindex->nStatus |= BLOCK_OPT_WITNESS;
+        pindex->RaiseValidity(BLOCK_VALID_SCRIPTS);
+        setDirtyBlockIndex.insert(pindex);
+        pindexPrev = pindex;
+        return true;
+    };
+    auto addCoin = [&](const COutPoint& outpoint, Coin&& coin) {
+        cache.AddCoin(outpoint, std::move(coin), false);
+        if (++nLoaded % 100000 != 0)
+            return true;
+        if (ShutdownRequested()) {
+            fInterrupted = true;
+            return false;
+        }
+        int nProgress = (int)(nLoaded * 100 / header.nCoins);
+        if (nProgress > nReportedProgress) {
+            nReportedProgress = nProgress;
+            uiInterface.ShowProgress(_("Loading UTXO snapshot..."), nProgress, false);
+            LogPrintf("[%d%%]...", nProgress); /* Continued */
+        }
+        // Write in batches as large as the coins cache allows
+        if (cache.DynamicMemoryUsage() > nCoinCacheUsage && !cache.Flush())
+            return error("LoadUTXOSnapshot: failed to write to coin database");
+        return true;
+    };
+    bool fLoaded = ReadUTXOSnapshot(chainparams, path, header, [](const CUTXOSnapshotHeader& base) { return true; }, addHeader, addCoin);
+    LogPrintf("\n");
+    uiInterface.ShowProgress("", 100, false);
+    if (fInterrupted)
+        return error("%s: interrupted", __func__);
+    if (!fLoaded)
+        return false;
+    if (pindexPrev->GetBlockHash() != header.hashBlock)
+        return error("%s: snapshot changed while loading", __func__);
+    if (!cache.Flush())
+        return error("%s: failed to write to coin database", __func__);
+
+    CUTXOCommitment commitment;
+    if (!view->GetCommitment(commitment) || commitment.GetHash() != header.hashCommitment ||
+        commitment.nTransactionOutputs != (int64_t)header.nCoins)
+        return error("%s: coins do not match the UTXO set commitment of the snapshot", __func__);
+    if (!view->WriteBlockCommitment(header.hashBlock, commitment))
+        return error("%s: failed to write to coin database", __func__);
+
+    // Record the headers, and that the blocks before the base are missing
+    fHavePruned = true;
+    pblocktree->WriteFlag("prunedblockfiles", true);
+    std::vector<const CBlockIndex*> vBlocks(setDirtyBlockIndex.begin(), setDirtyBlockIndex.end());
+    setDirtyBlockIndex.clear();
+    if (!pblocktree->WriteBatchSync({}, nLastBlockFile, vBlocks))
+        return error("%s: failed to write to block index database", __func__);
+    setBlockIndexCandidates.insert(pindexPrev);
+
+    if (!pblocktree->WriteFlag("utxosnapshotloading", false))
+        return error("%s: failed to write to block index database", __func__);
+    LogPrintf("Loaded UTXO snapshot of %u coins as of block %s in %dms\n",
+        header.nCoins, header.hashBlock.ToString(), GetTimeMillis() - nStart);
+    return true;
+}
+
+bool LoadUTXOSnapshot(const CChainParams& chainparams, const fs::path& path, CCoinsViewDB* view)
+{
+    LOCK(cs_main);
+    return g_chainstate.LoadUTXOSnapshot(chainparams, path, view);
+}
+
 //! Guess how far we are in the verification process at the given block index
 double GuessVerificationProgress(const ChainTxData& data, const CBlockIndex *pindex) {
     if (pindex == nullptr)
@@ -4734,10 +5565,7 @@ class CMainCleanup
 public:
     CMainCleanup() {}
     ~CMainCleanup() {
-        // block headers
-        BlockMap::iterator it1 = mapBlockIndex.begin();
-        for (; it1 != mapBlockIndex.end(); it1++)
-            delete (*it1).second;
+        // block headers, owned by g_chainstate's arena
         mapBlockIndex.clear();
     }
 } instance_of_cmaincleanup;
@@ -35,11 +35,13 @@ class CBlockIndex;
 class CBlockTreeDB;
 class CChainParams;
 class CCoinsViewDB;
+class CCoinsViewDBFlusher;
 class CInv;
 class CConnman;
 class CScriptCheck;
 class CBlockPolicyEstimator;
 class CTxMemPool;
+class CUTXOSnapshotHeader;
 class CValidationState;
 struct ChainTxData;
 
@@ -83,8 +85,24 @@ static const unsigned int UNDOFILE_CHUNK_SIZE = 0x100000; // 1 MiB
 static const int MAX_SCRIPTCHECK_THREADS = 16;
 /** -par default (number of script-checking threads, 0 = auto) */
 static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
-/** Number of blocks that can be requested at any given time from a single peer. */
+/** Maximum number of threads reading block files ahead during -reindex and -loadblock */
+static const int MAX_IMPORT_THREADS = 16;
+/** -importthreads default */
+static const int DEFAULT_IMPORT_THREADS = 4;
+/** Maximum memory used by the blocks read ahead during -reindex and -loadblock */
+static const size_t MAX_IMPORT_READ_AHEAD = 256 * 1024 * 1024;
+/** Maximum number of threads reading and checking blocks ahead in CVerifyDB */
+static const int MAX_CHECK_THREADS = 16;
+/** -checkthreads default */
+static const int DEFAULT_CHECK_THREADS = 4;
+/** Maximum number of threads loading the block index at startup */
+static const int MAX_BLOCK_INDEX_LOAD_THREADS = 16;
+/** Number of blocks that can be requested at any given time from a single peer, until we know its speed. */
 static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 16;
+/** Bounds of the number of blocks in transit from a single peer, once its speed
+ *  is known and the window is sized to cover its round trip time. */
+static const int MIN_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER = 4;
+static const int MAX_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER = 64;
 /** Timeout in seconds during which a peer must stall block download progress before being disconnected. */
 static const unsigned int BLOCK_STALLING_TIMEOUT = 2;
 /** Number of headers sent in one getheaders result. We rely on the assumption that if a peer sends
@@ -132,6 +150,8 @@ static const int64_t MAX_FEE_ESTIMATION_TIP_AGE = 3 * 60 * 60;
 /** Default for -permitbaremultisig */
 static const bool DEFAULT_PERMIT_BAREMULTISIG = true;
 static const bool DEFAULT_CHECKPOINTS_ENABLED = true;
+/** Default for -checkblockpow */
+static const bool DEFAULT_CHECK_BLOCK_POW = false;
 static const bool DEFAULT_TXINDEX = false;
 static const unsigned int DEFAULT_BANSCORE_THRESHOLD = 100;
 /** Default for -persistmempool */
@@ -177,6 +197,8 @@ extern bool fIsBareMultisigStd;
 extern bool fRequireStandard;
 extern bool fCheckBlockIndex;
 extern bool fCheckpointsEnabled;
+/** Whether to recompute the PoW hash of indexed blocks every time they are read from disk */
+extern bool fCheckBlockPoW;
 extern size_t nCoinCacheUsage;
 /** A fee rate smaller than this is considered zero fee (for relaying, mining and transaction creation) */
 extern CFeeRate minRelayTxFee;
@@ -209,6 +231,8 @@ extern bool fPruneMode;
 extern uint64_t nPruneTarget;
 /** Block files containing a block-height within MIN_BLOCKS_TO_KEEP of chainActive.Tip() will not be pruned. */
 static const unsigned int MIN_BLOCKS_TO_KEEP = 288;
+/** The UTXO set commitment of blocks within UTXO_COMMITMENT_BLOCKS_TO_KEEP of chainActive.Tip() (and of checkpoints and UTXO snapshots) is kept. */
+static const int UTXO_COMMITMENT_BLOCKS_TO_KEEP = 1440;
 /** Minimum blocks required to signal NODE_NETWORK_LIMITED */
 static const unsigned int NODE_NETWORK_LIMITED_MIN_BLOCKS = 288;
 
@@ -256,8 +280,24 @@ bool ProcessNewBlock(const CChainParams& chainparams, const std::shared_ptr<cons
  * @param[in]  chainparams The params for the chain we want to connect to
  * @param[out] ppindex If set, the pointer will be set to point to the last new block index object for the given headers
  * @param[out] first_invalid First header that fails validation, if one exists
+ * @param[in]  fCheckPOW Whether to check proof of work; pass false only if CheckBlockHeadersPoW() already succeeded for these headers
  */
-bool ProcessNewBlockHeaders(const std::vector<CBlockHeader>& block, CValidationState& state, const CChainParams& chainparams, const CBlockIndex** ppindex=nullptr, CBlockHeader *first_invalid=nullptr);
+bool ProcessNewBlockHeaders(const std::vector<CBlockHeader>& block, CValidationState& state, const CChainParams& chainparams, const CBlockIndex** ppindex=nullptr, CBlockHeader *first_invalid=nullptr, bool fCheckPOW=true);
+
+/**
+ * Check the proof of work of a continuous sequence of headers in parallel on
+ * the header check threads, so that ProcessNewBlockHeaders() can skip it
+ * while holding cs_main.
+ *
+ * Call without cs_main held.
+ *
+ * @param[in]  headers The block headers, each one building on the previous
+ * @param[in]  nStart Index of the first header to check
+ * @param[in]  nStartHeight Height of headers[nStart]
+ * @param[in]  consensusParams Consensus parameters
+ * @return True if all headers from nStart on have valid proof of work
+ */
+bool CheckBlockHeadersPoW(const std::vector<CBlockHeader>& headers, size_t nStart, int nStartHeight, const Consensus::Params& consensusParams);
 
 /** Check whether enough disk space is available for an incoming block */
 bool CheckDiskSpace(uint64_t nAdditionalBytes = 0);
@@ -267,6 +307,14 @@ FILE* OpenBlockFile(const CDiskBlockPos &pos, bool fReadOnly = false);
 fs::path GetBlockPosFilename(const CDiskBlockPos &pos, const char *prefix);
 /** Import blocks from an external file */
 bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskBlockPos *dbp = nullptr);
+/**
+ * Import blocks from several files. -importthreads reader threads read and
+ * check the blocks of upcoming files, up to MAX_IMPORT_READ_AHEAD of them,
+ * while the calling thread accepts them in file order. If fBlockFiles, vFiles
+ * are our own blk?????.dat files, numbered from 0, which are reindexed in
+ * place. An error reading a file aborts the import and shuts the node down.
+ */
+bool LoadExternalBlockFiles(const CChainParams& chainparams, const std::vector<fs::path>& vFiles, bool fBlockFiles);
 /** Ensures we have a genesis block in the block tree, possibly writing one to disk. */
 bool LoadGenesisBlock(const CChainParams& chainparams);
 /** Load the block tree and coins database from disk,
@@ -278,6 +326,8 @@ bool LoadChainTip(const CChainParams& chainparams);
 void UnloadBlockIndex();
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the header proof-of-work checking thread */
+void ThreadHeaderPoWCheck();
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
 bool IsInitialBlockDownload();
 /** Retrieve a transaction (from memory pool, or from disk, if possible) */
@@ -402,6 +452,9 @@ void InitScriptExecutionCache();
 /** Functions for disk access for blocks */
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, int nHeight, const Consensus::Params& consensusParams);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams);
+/** Read a block's serialized bytes as stored on disk, which is its network serialization with witness data */
+bool ReadRawBlockFromDisk(std::vector<uint8_t>& block, const CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart);
+bool ReadRawBlockFromDisk(std::vector<uint8_t>& block, const CBlockIndex* pindex, const CMessageHeader::MessageStartChars& messageStart);
 
 /** Functions for validating blocks and updating the block tree */
 
@@ -452,6 +505,9 @@ extern CChain& chainActive;
 /** Global variable that points to the coins database (protected by cs_main) */
 extern std::unique_ptr<CCoinsViewDB> pcoinsdbview;
 
+/** Global variable that points to the view writing to the coins database (protected by cs_main) */
+extern std::unique_ptr<CCoinsViewDBFlusher> pcoinsflusher;
+
 /** Global variable that points to the active CCoinsView (protected by cs_main) */
 extern std::unique_ptr<CCoinsViewCache> pcoinsTip;
 
@@ -489,4 +545,10 @@ bool DumpMempool();
 /** Load the mempool from disk. */
 bool LoadMempool();
 
+/** Write the coins database, and the headers of the chain up to its best block, to a snapshot file. */
+bool DumpUTXOSnapshot(const fs::path& path, CUTXOSnapshotHeader& header);
+
+/** Fill an empty coins database, and the block index up to its best block, from a snapshot file. */
+bool LoadUTXOSnapshot(const CChainParams& chainparams, const fs::path& path, CCoinsViewDB* view);
+
 #endif // BITCOIN_VALIDATION_H
@@ -542,7 +542,10 @@ static int64_t AddTx(CWallet& wallet, uint32_t lockTime, int64_t mockTime, int64
     CBlockIndex* block = nullptr;
     if (blockTime > 0) {
         LOCK(cs_main);
-        auto inserted = mapBlockIndex.emplace(GetRandHash(), new CBlockIndex);
+        // Block index entries are not owned by mapBlockIndex
+        static std::vector<std::unique_ptr<CBlockIndex>> vBlocks;
+        vBlocks.emplace_back(new CBlockIndex);
+        auto inserted = mapBlockIndex.emplace(GetRandHash(), vBlocks.back().get());
         assert(inserted.second);
         const uint256& hash = inserted.first->first;
         block = inserted.first->second;
@@ -171,20 +171,29 @@ bool CZMQPublishRawBlockNotifier::NotifyBlock(const CBlockIndex *pindex)
     LogPrint(BCLog::ZMQ, "zmq: Publish rawblock %s\n", pindex->GetBlockHash().GetHex());
 
     const Consensus::Params& consensusParams = Params().GetConsensus();
-    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION | RPCSerializationFlags());
+    std::vector<uint8_t> blockData;
     {
         LOCK(cs_main);
-        CBlock block;
-        if(!ReadBlockFromDisk(block, pindex, consensusParams))
-        {
-            zmqError("Can't read block from disk");
-            return false;
+        if (RPCSerializationFlags() == 0) {
+            // Serialized with witness data, the block is the same as on disk
+            if (!ReadRawBlockFromDisk(blockData, pindex, Params().MessageStart()))
+            {
+                zmqError("Can't read block from disk");
+                return false;
+            }
+        } else {
+            CBlock block;
+            if(!ReadBlockFromDisk(block, pindex, consensusParams))
+            {
+                zmqError("Can't read block from disk");
+                return false;
+            }
+
+            CVectorWriter(SER_NETWORK, PROTOCOL_VERSION | RPCSerializationFlags(), blockData, 0, block);
         }
-
-        ss << block;
     }
 
-    return SendMessage(MSG_RAWBLOCK, &(*ss.begin()), ss.size());
+    return SendMessage(MSG_RAWBLOCK, blockData.data(), blockData.size());
 }
 
 bool CZMQPublishRawTransactionNotifier::NotifyTransaction(const CTransaction &transaction)